@@ -0,0 +1,103 @@
+#include "bench.h"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+bench_state::bench_state(std::size_t iterations)
+    :
+    remaining {iterations}
+    ,items {1}
+    ,started {false}
+{
+};
+
+double bench_state::seconds() const
+{
+    return std::chrono::duration<double>(stop - start).count();
+}
+
+std::vector<bench_case>& bench_registry()
+{
+    static std::vector<bench_case> registry;
+    return registry;
+}
+
+int register_bench(const char* group, const char* name, bench_function f)
+{
+    bench_registry().push_back(bench_case {group, name, f});
+    return bench_registry().size();
+}
+
+namespace {
+
+struct bench_result
+{
+    double ns_per_item;
+    double items_per_sec;
+    std::size_t iterations;
+};
+
+// Grows the iteration count until a run takes min_time, then times the
+// repetitions
+bench_result run_case(const bench_case& c, double min_time, int repetitions)
+{
+    std::size_t iterations {1};
+    while (true) {
+	bench_state state(iterations);
+	c.function(state);
+	double seconds = state.seconds();
+	if (seconds >= min_time || iterations >= (std::size_t(1) << 30))
+	    break;
+	double grow = (seconds > 0) ? 1.4*min_time/seconds : 10;
+	grow = std::min(grow, 10.0);
+	iterations = std::max(iterations + 1,
+			      static_cast<std::size_t>(iterations*grow));
+    }
+
+    std::vector<double> per_item;
+    for (int r=0; r<std::max(1, repetitions); ++r) {
+	bench_state state(iterations);
+	c.function(state);
+	double items = double(iterations)*state.items_per_iteration();
+	per_item.push_back(state.seconds()/items);
+    }
+    std::sort(per_item.begin(), per_item.end());
+    double median = per_item[per_item.size()/2];
+
+    bench_result result {median*1e9, (median > 0) ? 1/median : 0,
+			 iterations};
+    return result;
+}
+
+} // namespace
+
+void run_benchmarks(const std::string& filter, double min_time,
+		    int repetitions)
+{
+    // Groups in the order first registered, cases in registration order
+    std::vector<std::string> groups;
+    for (auto& c : bench_registry()) {
+	if (std::find(groups.begin(), groups.end(), c.group) == groups.end())
+	    groups.push_back(c.group);
+    }
+
+    std::printf("%-36s %12s %14s %10s %8s\n", "Benchmark", "ns/item",
+		"items/s", "iterations", "relative");
+    for (auto& group : groups) {
+	double first {0};
+	for (auto& c : bench_registry()) {
+	    std::string full_name = c.group + "/" + c.name;
+	    if (c.group != group ||
+		full_name.find(filter) == std::string::npos)
+		continue;
+
+	    bench_result r = run_case(c, min_time, repetitions);
+	    if (first == 0)
+		first = r.ns_per_item;
+	    std::printf("%-36s %12.2f %14.4g %10zu %8.2f\n", full_name.c_str(),
+			r.ns_per_item, r.items_per_sec, r.iterations,
+			(first > 0) ? r.ns_per_item/first : 1.0);
+	    std::fflush(stdout);
+	}
+    }
+}
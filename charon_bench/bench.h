@@ -0,0 +1,85 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Minimal microbenchmark registry
+//
+// A benchmark is a function that does its setup, then times a loop:
+//     CHARON_BENCH(fill_1d, th1d_fill)
+//     {
+//         TH1D h(...);                    // not timed
+//         while (state.keep_running())    // timed
+//             for (double E : energy) h.Fill(E);
+//         state.set_items(energy.size()); // per iteration
+//     }
+// Benchmarks of the same group measure the same work, so alternative
+// implementations are added to a group and reported next to each other,
+// relative to the first one registered.
+
+class bench_state
+{
+public:
+    bench_state(std::size_t iterations);
+
+    // True while iterations remain; timing starts with the first call
+    bool keep_running()
+    {
+	if (!started) {
+	    started = true;
+	    start = std::chrono::steady_clock::now();
+	}
+	if (remaining == 0) {
+	    stop = std::chrono::steady_clock::now();
+	    return false;
+	}
+	--remaining;
+	return true;
+    }
+
+    void set_items(std::size_t n) { items = n; }
+    std::size_t items_per_iteration() const { return items; }
+    double seconds() const;
+
+private:
+    std::size_t remaining;
+    std::size_t items;
+    bool started;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point stop;
+};
+
+typedef void (*bench_function)(bench_state&);
+
+struct bench_case
+{
+    std::string group;
+    std::string name;
+    bench_function function;
+};
+
+std::vector<bench_case>& bench_registry();
+int register_bench(const char* group, const char* name, bench_function f);
+
+// Runs the benchmarks whose "group/name" contains filter and prints ns per
+// item and items per second (median of the repetitions)
+void run_benchmarks(const std::string& filter, double min_time,
+		    int repetitions);
+
+// Keeps the compiler from dropping a result that is never used
+template<class T>
+inline void keep(T const& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#define CHARON_BENCH(group, name)					\
+    static void bench_##group##_##name(bench_state& state);		\
+    static int bench_id_##group##_##name					\
+	= register_bench(#group, #name, bench_##group##_##name);	\
+    static void bench_##group##_##name(bench_state& state)
+
+#endif
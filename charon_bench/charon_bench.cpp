@@ -0,0 +1,81 @@
+#include "bench.h"
+#include "TH1.h"
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <getopt.h>
+
+static void show_usage(std::string name)
+{
+    std::cerr << "Times the processing kernels one by one (ns per item and "
+	      << "items per second;\nalternatives are shown relative to the "
+	      << "first of their group).\n\n"
+	      << "Usage: " << name << " [OPTION]...\n\n"
+	      << "Options:\n"
+	      << "-f, --filter <text>  \t run the benchmarks whose "
+	      <<                            "group/name contains <text>\n"
+	      << "-t, --min-time <s>   \t shortest timed run "
+	      <<                            "[default: 0.2]\n"
+	      << "-r, --repetitions <int> timed runs, the median is shown "
+	      <<                            "[default: 5]\n"
+	      << "-l, --list           \t list the benchmarks\n"
+	      << "-h,  --help           \t show this help message\n"
+	      << std::endl;
+};
+
+int main(int argc, char **argv)
+{
+    std::string filter;
+    double min_time {0.2};
+    int repetitions {5};
+
+    static const struct option long_options[] = {
+	{"help", no_argument, 0, 'h'},
+	{"filter", required_argument, 0, 'f'},
+	{"min-time", required_argument, 0, 't'},
+	{"repetitions", required_argument, 0, 'r'},
+	{"list", no_argument, 0, 'l'},
+	{} // deals with unknown parameters
+    };
+
+    std::string option_string {"f:t:r:lh"};
+
+    // Parse input
+    int opt;
+    int option_index {0};
+    opt = getopt_long(argc, argv, option_string.c_str(), long_options,
+		      &option_index);
+    while (opt != -1) {
+	switch (opt)
+	{
+	case 'f':
+	    filter = optarg;
+	    break;
+	case 't':
+	    min_time = std::stod(optarg);
+	    break;
+	case 'r':
+	    repetitions = std::atoi(optarg);
+	    break;
+	case 'l':
+	    for (auto& c : bench_registry())
+		std::cout << c.group << "/" << c.name << "\n";
+	    return 0;
+	case 'h':
+	case '?':
+	    show_usage(argv[0]);
+	    return 1;
+	default:
+	    break;
+	}
+
+	opt = getopt_long(argc, argv, option_string.c_str(), long_options,
+			  &option_index);
+    }
+
+    // Histograms of the kernels are owned by them
+    TH1::AddDirectory(false);
+
+    run_benchmarks(filter, min_time, repetitions);
+    return 0;
+};
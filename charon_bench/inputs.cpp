@@ -0,0 +1,171 @@
+#include "inputs.h"
+#include "TRandom3.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+namespace {
+
+const std::size_t num_events {1 << 20};
+const int num_window_events {200000};
+const double gain {3600}; // ADC per MeV, as charon_synth
+const double band_center {0.15};
+const double band_sigma {0.015};
+
+// On-axis energy [MeV]: the carbon lines and 2.2 MeV on a falling continuum
+double onaxis_energy(TRandom3& rng)
+{
+    double u = rng.Uniform();
+    double E {0};
+    if (u < 0.15)
+	E = 4.438;
+    else if (u < 0.23)
+	E = 3.927;
+    else if (u < 0.30)
+	E = 2.2;
+    else
+	return std::min(rng.Exp(1.5) + 0.1, 9.9);
+    return rng.Gaus(E, 0.02*E);
+}
+
+struct event_sample
+{
+    std::vector<double> energy;
+    std::vector<double> ratio;
+
+    event_sample()
+    {
+	TRandom3 rng(12345);
+	for (std::size_t i=0; i<num_events; ++i) {
+	    energy.push_back(onaxis_energy(rng));
+	    ratio.push_back((rng.Uniform() < 0.08) ? rng.Uniform(0.35, 0.9)
+			    : rng.Gaus(band_center, band_sigma));
+	}
+    }
+};
+
+const event_sample& events()
+{
+    static event_sample sample;
+    return sample;
+}
+
+struct band_cut
+{
+    TCutG* cut;
+    std::vector<double> low;
+    std::vector<double> high;
+
+    // Top edge forwards, bottom edge backwards and closed, as make_cut
+    band_cut()
+    {
+	TH2D* psd = bench_psd();
+	const int n = bench_num_xbin;
+	cut = new TCutG("bench_cut", 2*n + 1);
+	for (int i=0; i<n; ++i) {
+	    double x = psd->GetXaxis()->GetBinCenter(i+1);
+	    double sigma = band_sigma*(1 + 0.5/(1 + x)); // wider at low energy
+	    low.push_back(band_center - 2*sigma);
+	    high.push_back(band_center + 2*sigma);
+	    cut->SetPoint(i, x, high.back());
+	}
+	for (int i=0; i<n; ++i) {
+	    double x = psd->GetXaxis()->GetBinCenter(n - i);
+	    cut->SetPoint(n + i, x, low.at(n - 1 - i));
+	}
+	cut->SetPoint(2*n, psd->GetXaxis()->GetBinCenter(1), high.at(0));
+    }
+};
+
+const band_cut& cut()
+{
+    static band_cut c;
+    return c;
+}
+
+} // namespace
+
+const std::vector<double>& bench_energy()
+{
+    return events().energy;
+}
+
+const std::vector<double>& bench_ratio()
+{
+    return events().ratio;
+}
+
+TH2D* bench_psd()
+{
+    static TH2D* psd = 0;
+    if (psd == 0) {
+	psd = new TH2D("bench_psd", "PSD;Energy [MeV];Tail/Total",
+		       bench_num_xbin, 0, 10, bench_num_ybin, 0, 1);
+	psd->SetDirectory(0);
+	const event_sample& e = events();
+	psd->FillN(e.energy.size(), &e.energy[0], &e.ratio[0], 0);
+    }
+    return psd;
+}
+
+TCutG* bench_cut()
+{
+    return cut().cut;
+}
+
+const std::vector<double>& bench_cut_low()
+{
+    return cut().low;
+}
+
+const std::vector<double>& bench_cut_high()
+{
+    return cut().high;
+}
+
+TH1D* bench_window()
+{
+    static TH1D* window = 0;
+    if (window == 0) {
+	window = new TH1D("bench_window", "Spectrum;Energy [ADC];Counts",
+			  1024, 0, 35000);
+	window->SetDirectory(0);
+	TRandom3 rng(54321);
+	for (int i=0; i<num_window_events; ++i)
+	    window->Fill(gain*onaxis_energy(rng));
+    }
+    return window;
+}
+
+const std::vector<int>& bench_peak_bounds()
+{
+    static const std::vector<int> bounds {17000, 15000, 14500, 12000,
+					  9000, 7000};
+    return bounds;
+}
+
+// Written once to a temporary file, removed at exit
+const std::string& bench_rbd_file()
+{
+    static std::string name;
+    if (name.empty()) {
+	char temp[] = "/tmp/charon_bench_rbdXXXXXX";
+	int fd = mkstemp(temp);
+	if (fd >= 0)
+	    close(fd);
+	name = temp;
+
+	FILE* f = std::fopen(name.c_str(), "w");
+	TRandom3 rng(999);
+	const int num_samples {72000}; // an hour at 20 Hz
+	for (int i=0; i<num_samples && f != 0; ++i) {
+	    double current = (i % 12000 < 11000) ? rng.Gaus(2.0e-6, 5e-8) : 0;
+	    std::fprintf(f, "%.2f,%d,%.6e\n", 0.05*i, i, current);
+	}
+	if (f != 0)
+	    std::fclose(f);
+	std::atexit([] { std::remove(bench_rbd_file().c_str()); });
+    }
+    return name;
+}
@@ -0,0 +1,38 @@
+#ifndef INPUTS_H
+#define INPUTS_H
+
+#include "TCutG.h"
+#include "TH1D.h"
+#include "TH2D.h"
+#include <string>
+#include <vector>
+
+// Realistic, fixed inputs for the kernels, made once and shared. The binning
+// matches the on-axis tool: 1024 energy bins over 0-10 MeV and 512
+// tail/total bins over 0-1.
+
+const int bench_num_xbin {1024};
+const int bench_num_ybin {512};
+
+// Calibrated events of the analyzed channel (MeV, tail/total)
+const std::vector<double>& bench_energy();
+const std::vector<double>& bench_ratio();
+
+// Uncut PSD plot filled with the events
+TH2D* bench_psd();
+
+// Pileup cut of 2049 points (a 2 sigma band sampled at every energy bin)
+// and its lower and upper edges per energy bin
+TCutG* bench_cut();
+const std::vector<double>& bench_cut_low();
+const std::vector<double>& bench_cut_high();
+
+// Uncalibrated spectrum of one 60 s window, with the 4.438 MeV, single
+// escape and 2.2 MeV peaks inside default_bounds.txt
+TH1D* bench_window();
+const std::vector<int>& bench_peak_bounds();
+
+// RBD log of an hour of beam (20 Hz samples)
+const std::string& bench_rbd_file();
+
+#endif
@@ -0,0 +1,74 @@
+#include "bench.h"
+#include "inputs.h"
+
+// Pileup cut of the clean pass and of the scale factor (clean_fraction)
+
+CHARON_BENCH(cut_inside, tcutg_is_inside)
+{
+    const std::vector<double>& energy = bench_energy();
+    const std::vector<double>& ratio = bench_ratio();
+    TCutG* cut = bench_cut();
+    std::size_t inside {0};
+    while (state.keep_running()) {
+	for (std::size_t i=0; i<energy.size(); ++i)
+	    inside += cut->IsInside(energy[i], ratio[i]);
+    }
+    keep(inside);
+    state.set_items(energy.size());
+}
+
+// Edges of the band looked up by energy bin (the cut is a band over
+// energy, so this matches IsInside up to the interpolation between points)
+CHARON_BENCH(cut_inside, band_lookup)
+{
+    const std::vector<double>& energy = bench_energy();
+    const std::vector<double>& ratio = bench_ratio();
+    const std::vector<double>& low = bench_cut_low();
+    const std::vector<double>& high = bench_cut_high();
+    const double per_bin = bench_num_xbin/10.0;
+    std::size_t inside {0};
+    while (state.keep_running()) {
+	for (std::size_t i=0; i<energy.size(); ++i) {
+	    int bin = int(energy[i]*per_bin);
+	    if (bin < 0 || bin >= bench_num_xbin)
+		continue;
+	    inside += (ratio[i] >= low[bin] && ratio[i] <= high[bin]);
+	}
+    }
+    keep(inside);
+    state.set_items(energy.size());
+}
+
+// Items are the bins of the PSD plot
+CHARON_BENCH(cut_integral, integral_hist)
+{
+    TH2D* psd = bench_psd();
+    TCutG* cut = bench_cut();
+    double sum {0};
+    while (state.keep_running())
+	sum += cut->IntegralHist(psd);
+    keep(sum);
+    state.set_items(bench_num_xbin*bench_num_ybin);
+}
+
+CHARON_BENCH(cut_integral, band_lookup)
+{
+    TH2D* psd = bench_psd();
+    const std::vector<double>& low = bench_cut_low();
+    const std::vector<double>& high = bench_cut_high();
+    TAxis* y_axis = psd->GetYaxis();
+    double sum {0};
+    while (state.keep_running()) {
+	for (int x=1; x<=bench_num_xbin; ++x) {
+	    int first = y_axis->FindFixBin(low[x-1]);
+	    int last = y_axis->FindFixBin(high[x-1]);
+	    for (int y=first; y<=last; ++y) {
+		double center = y_axis->GetBinCenter(y);
+		if (center >= low[x-1] && center <= high[x-1])
+		    sum += psd->GetBinContent(x, y);
+	    }
+	}
+    }
+    keep(sum);
+    state.set_items(bench_num_xbin*bench_num_ybin);
+}
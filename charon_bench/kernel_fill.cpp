@@ -0,0 +1,93 @@
+#include "bench.h"
+#include "inputs.h"
+#include <algorithm>
+
+// Histogram filling of the uncut and clean passes (fill_events)
+
+CHARON_BENCH(fill_1d, th1d_fill)
+{
+    const std::vector<double>& energy = bench_energy();
+    TH1D h("bench_1d", "", bench_num_xbin, 0, 10);
+    h.SetDirectory(0);
+    while (state.keep_running()) {
+	for (double E : energy)
+	    h.Fill(E);
+    }
+    keep(h.GetEntries());
+    state.set_items(energy.size());
+}
+
+CHARON_BENCH(fill_1d, th1d_fill_n)
+{
+    const std::vector<double>& energy = bench_energy();
+    TH1D h("bench_1d", "", bench_num_xbin, 0, 10);
+    h.SetDirectory(0);
+    while (state.keep_running())
+	h.FillN(energy.size(), &energy[0], 0);
+    keep(h.GetEntries());
+    state.set_items(energy.size());
+}
+
+// Counts in a plain array, copied into a histogram once
+CHARON_BENCH(fill_1d, array_bins)
+{
+    const std::vector<double>& energy = bench_energy();
+    std::vector<double> counts(bench_num_xbin + 2, 0);
+    const double per_bin = bench_num_xbin/10.0;
+    while (state.keep_running()) {
+	for (double E : energy) {
+	    int bin = (E < 0) ? 0 : std::min(int(E*per_bin) + 1,
+					     bench_num_xbin + 1);
+	    counts[bin] += 1;
+	}
+    }
+    keep(counts[1]);
+    state.set_items(energy.size());
+}
+
+CHARON_BENCH(fill_2d, th2d_fill)
+{
+    const std::vector<double>& energy = bench_energy();
+    const std::vector<double>& ratio = bench_ratio();
+    TH2D h("bench_2d", "", bench_num_xbin, 0, 10, bench_num_ybin, 0, 1);
+    h.SetDirectory(0);
+    while (state.keep_running()) {
+	for (std::size_t i=0; i<energy.size(); ++i)
+	    h.Fill(energy[i], ratio[i]);
+    }
+    keep(h.GetEntries());
+    state.set_items(energy.size());
+}
+
+CHARON_BENCH(fill_2d, th2d_fill_n)
+{
+    const std::vector<double>& energy = bench_energy();
+    const std::vector<double>& ratio = bench_ratio();
+    TH2D h("bench_2d", "", bench_num_xbin, 0, 10, bench_num_ybin, 0, 1);
+    h.SetDirectory(0);
+    while (state.keep_running())
+	h.FillN(energy.size(), &energy[0], &ratio[0], 0);
+    keep(h.GetEntries());
+    state.set_items(energy.size());
+}
+
+CHARON_BENCH(fill_2d, array_bins)
+{
+    const std::vector<double>& energy = bench_energy();
+    const std::vector<double>& ratio = bench_ratio();
+    const int nx = bench_num_xbin + 2;
+    const int ny = bench_num_ybin + 2;
+    std::vector<double> counts(nx*ny, 0);
+    const double x_per_bin = bench_num_xbin/10.0;
+    while (state.keep_running()) {
+	for (std::size_t i=0; i<energy.size(); ++i) {
+	    double E = energy[i];
+	    double r = ratio[i];
+	    int x = (E < 0) ? 0 : std::min(int(E*x_per_bin) + 1, nx - 1);
+	    int y = (r < 0) ? 0 : std::min(int(r*bench_num_ybin) + 1, ny - 1);
+	    counts[y*nx + x] += 1;
+	}
+    }
+    keep(counts[nx + 1]);
+    state.set_items(energy.size());
+}
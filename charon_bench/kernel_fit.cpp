@@ -0,0 +1,124 @@
+#include "bench.h"
+#include "inputs.h"
+#include "TF1.h"
+#include "TLinearFitter.h"
+
+// Fits of psd_cut (one energy slice of the band) and time_cut (the
+// calibration of a window)
+
+// One slice of fit_psd_band: projection and gaussian plus offset fit
+CHARON_BENCH(slice_fit, projection_gaus)
+{
+    TH2D* psd = bench_psd();
+    const int xbin = psd->GetXaxis()->FindBin(2.0);
+    double par[] {0, 0, 0.1, 0};
+    while (state.keep_running()) {
+	TH1D* proj = psd->ProjectionY("bench_proj", xbin, xbin);
+	TF1 gaus_fit("bench_fit", "gaus(0)+[3]", 0, 1);
+	par[0] = proj->GetMaximum();
+	par[1] = proj->GetBinCenter(proj->GetMaximumBin());
+	gaus_fit.SetParameters(par);
+	proj->Fit(&gaus_fit, "Q0N");
+	gaus_fit.GetParameters(par);
+	par[2] = 0.1;
+	delete proj;
+    }
+    keep(par[1]);
+}
+
+namespace {
+
+// Peak position in [low, high] as fit_window: the mean of the 11 bins
+// around the highest one
+double peak_mean(TH1D* h, int high, int low)
+{
+    h->GetXaxis()->SetRangeUser(low, high);
+    int bin = h->GetMaximumBin();
+    h->GetXaxis()->SetRange(bin-5, bin+5);
+    return h->GetMean();
+}
+
+// Same peak, scanning the bin contents directly
+double peak_mean_scan(TH1D* h, int high, int low)
+{
+    int first = h->GetXaxis()->FindFixBin(low);
+    int last = h->GetXaxis()->FindFixBin(high);
+    int bin = first;
+    for (int b=first+1; b<=last; ++b) {
+	if (h->GetBinContent(b) > h->GetBinContent(bin))
+	    bin = b;
+    }
+    double sum {0};
+    double weighted {0};
+    for (int b=bin-5; b<=bin+5; ++b) {
+	sum += h->GetBinContent(b);
+	weighted += h->GetBinContent(b)*h->GetBinCenter(b);
+    }
+    return (sum > 0) ? weighted/sum : h->GetBinCenter(bin);
+}
+
+const double peak_energy[] {4.438, 3.927, 2.2};
+
+} // namespace
+
+// Items are peaks
+CHARON_BENCH(peak_search, range_mean)
+{
+    TH1D* window = bench_window();
+    const std::vector<int>& bounds = bench_peak_bounds();
+    double peaks[3];
+    while (state.keep_running()) {
+	for (int p=0; p<3; ++p)
+	    peaks[p] = peak_mean(window, bounds[2*p], bounds[2*p+1]);
+	keep(peaks[0] + peaks[1] + peaks[2]);
+    }
+    window->GetXaxis()->SetRange(0, 0);
+    state.set_items(3);
+}
+
+CHARON_BENCH(peak_search, bin_scan)
+{
+    TH1D* window = bench_window();
+    const std::vector<int>& bounds = bench_peak_bounds();
+    double peaks[3];
+    while (state.keep_running()) {
+	for (int p=0; p<3; ++p)
+	    peaks[p] = peak_mean_scan(window, bounds[2*p], bounds[2*p+1]);
+	keep(peaks[0] + peaks[1] + peaks[2]);
+    }
+    state.set_items(3);
+}
+
+// Calibration line through the three peaks
+CHARON_BENCH(calibration_fit, linear_fitter)
+{
+    double ax[] {15977, 14137, 7920};
+    double ay[] {peak_energy[0], peak_energy[1], peak_energy[2]};
+    double slope {0};
+    while (state.keep_running()) {
+	TLinearFitter fit(1, "pol1");
+	fit.AssignData(3, 1, ax, ay);
+	fit.Eval();
+	slope += fit.GetParameter(1);
+    }
+    keep(slope);
+}
+
+CHARON_BENCH(calibration_fit, least_squares)
+{
+    double ax[] {15977, 14137, 7920};
+    double ay[] {peak_energy[0], peak_energy[1], peak_energy[2]};
+    double slope {0};
+    while (state.keep_running()) {
+	double sx {0}, sy {0}, sxx {0}, sxy {0};
+	for (int i=0; i<3; ++i) {
+	    sx += ax[i];
+	    sy += ay[i];
+	    sxx += ax[i]*ax[i];
+	    sxy += ax[i]*ay[i];
+	}
+	slope += (3*sxy - sx*sy)/(3*sxx - sx*sx);
+	keep(&ax[0]); // recomputed every iteration
+    }
+    keep(slope);
+}
@@ -0,0 +1,49 @@
+#include "bench.h"
+#include "inputs.h"
+#include "rbd.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// RBD log reading of apply_scaling (items are samples)
+
+CHARON_BENCH(rbd_parse, read_rbd)
+{
+    std::string name = bench_rbd_file();
+    std::size_t num_samples {0};
+    while (state.keep_running()) {
+	std::vector<double> time;
+	std::vector<double> current;
+	read_rbd(name, time, current);
+	num_samples = current.size();
+    }
+    state.set_items(num_samples);
+}
+
+// Whole lines read with fgets, third column converted with strtod
+CHARON_BENCH(rbd_parse, fgets_strtod)
+{
+    std::string name = bench_rbd_file();
+    std::size_t num_samples {0};
+    while (state.keep_running()) {
+	std::vector<double> time;
+	std::vector<double> current;
+	FILE* f = std::fopen(name.c_str(), "r");
+	char line[256];
+	double t {0};
+	while (f != 0 && std::fgets(line, sizeof(line), f) != 0) {
+	    const char* column = std::strchr(line, ',');
+	    if (column != 0)
+		column = std::strchr(column + 1, ',');
+	    if (column == 0)
+		continue;
+	    current.push_back(std::strtod(column + 1, 0));
+	    time.push_back(t);
+	    t += rbd_sample_rate;
+	}
+	if (f != 0)
+	    std::fclose(f);
+	num_samples = current.size();
+    }
+    state.set_items(num_samples);
+}
@@ -0,0 +1,154 @@
+#include "coincidence.h"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <getopt.h>
+
+static void show_usage(std::string name)
+{
+    std::cerr << "Finds time coincidences between digitizer channels in a "
+	      << "time sorted CHARON\ndata file.\n\n"
+	      << "Usage: " << name << " [OPTION]...\n\n"
+	      << "Options:\n"
+	      << "-i, --input <file>   \t ROOT input file name "
+	      <<                            "[default: default_input.root]\n"
+	      << "-o, --output <file>  \t ROOT output file name "
+	      <<                            "[default: coincidence_output.root]\n"
+	      << "-c, --channels <list>\t comma separated digitizer channels "
+	      <<                            "[default: 0,1]\n"
+	      << "-t, --window <ns>    \t coincidence window "
+	      <<                            "[default: 100]\n"
+	      << "-k, --calibration <file> text file with '<channel> <slope> "
+	      <<                            "<intercept>'\n\t\t\t\tlines "
+	      <<                            "[default: none, ADC]\n"
+	      << "-w, --overwrite      \t enables overwriting the output file "
+	      <<                            "[default: off]\n"
+	      << "-h,  --help           \t show this help message\n"
+	      << std::endl;
+};
+
+void read_channels(std::string list, std::vector<int>& channels)
+{
+    std::stringstream list_stream(list);
+    std::string value;
+    while (std::getline(list_stream, value, ',')) {
+	if (!value.empty())
+	    channels.push_back(std::stoi(value));
+    }
+};
+
+int main(int argc, char **argv)
+{
+    std::cout << "########################################"
+	      << "########################################\n";
+
+    // Set defaults
+    std::string name_input {"default_input.root"};
+    std::string name_output {"coincidence_output.root"};
+    std::vector<int> channels {};
+    std::string channel_string {"0,1"};
+    double window_ns {100};
+    std::string calibration_file; // default is "empty"
+    bool overwrite_param {false};
+
+    static const struct option long_options[] = {
+	{"help", no_argument, 0, 'h'},
+	{"input", required_argument, 0, 'i'},
+	{"output", required_argument, 0, 'o'},
+	{"channels", required_argument, 0, 'c'},
+	{"window", required_argument, 0, 't'},
+	{"calibration", required_argument, 0, 'k'},
+	{"overwrite", no_argument, 0, 'w'},
+	{} // deals with unknown parameters
+    };
+
+    std::string option_string {"i:o:c:t:k:wh"};
+
+    // Parse input
+    int opt;
+    int option_index {0};
+    opt = getopt_long(argc, argv, option_string.c_str(), long_options,
+		      &option_index);
+    while (opt != -1) {
+	switch (opt)
+	{
+	case 'i':
+	    name_input = optarg;
+	    break;
+	case 'o':
+	    name_output = optarg;
+	    break;
+	case 'c':
+	    channel_string = optarg;
+	    break;
+	case 't':
+	    window_ns = std::stod(optarg);
+	    break;
+	case 'k':
+	    calibration_file = optarg;
+	    break;
+	case 'w':
+	    overwrite_param = true;
+	    break;
+	case 'h':
+	    show_usage(argv[0]);
+	    return 1;
+	case '?':
+	    show_usage(argv[0]);
+	    return 1;
+	default:
+	    break;
+	}
+
+	opt = getopt_long(argc, argv, option_string.c_str(), long_options,
+			  &option_index);
+    }
+
+    read_channels(channel_string, channels);
+    if (channels.size() < 2) {
+	std::cerr << "\nAt least two channels are needed for coincidences\n";
+	return 1;
+    }
+
+    // Print out settings for user to see
+    std::cout << "\nInput file:\t\t" << name_input << "\n"
+	      << "\nOutput file:\t\t" << name_output << "\n"
+	      << "\nChannels:\t\t" << channel_string << "\n"
+	      << "\nWindow [ns]:\t\t" << window_ns << "\n"
+	      << "\nCalibration file:\t" << calibration_file << "\n"
+	      << "\nOverwrite output:\t" << std::boolalpha << overwrite_param << "\n"
+	      << std::endl;
+
+    std::cout << "########################################"
+	      << "########################################\n";
+
+    // Ask if the user wants to continue with the default parameters
+    std::cout << "\nWould you like to continue with these parameters? [y/N]\n";
+    char response = gather_input();
+    if (response == 'n' || response == 'N') {
+	std::cerr << "\nExiting.\n";
+	return 1;
+    }
+
+    coincidence C(name_input, name_output, channels, window_ns);
+
+    if (!C.check_ifile()) {
+	std::cerr << "\nWarning! Input file does not exist!\n"
+		  << "Exiting.\n\n";
+	return 1;
+    }
+
+    if (!C.check_ofile_write(overwrite_param)) {
+	std::cerr << "\n\nExiting.\n\n";
+	return 1;
+    }
+
+    if (!calibration_file.empty())
+	C.read_calibration(calibration_file);
+    C.initialize();
+    C.find_coincidences();
+    C.write_out(overwrite_param);
+
+    return 0;
+};
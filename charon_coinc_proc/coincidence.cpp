@@ -0,0 +1,334 @@
+#include "coincidence.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+// Non member functions
+////////////////////////////////////////////////////////////////////////////////
+char gather_input()
+{
+    // Gets input from user (y,Y,n,N) and returns it as a char
+    char check_val;
+    std::cin >> check_val;
+    while (check_val != 'n' && check_val != 'N' &&
+	   check_val != 'y' && check_val != 'Y') {
+	std::cout << "Sorry, I do not understand that response.\n";
+	std::cin >> check_val;
+    }
+    return check_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Ring buffer
+////////////////////////////////////////////////////////////////////////////////
+hit_ring::hit_ring(std::size_t capacity_pow2)
+    :
+    buf(capacity_pow2)
+    ,mask {capacity_pow2 - 1}
+    ,head {0}
+    ,count {0}
+{
+};
+
+void hit_ring::push_back(const hit& h)
+{
+    if (count == buf.size()) {
+	std::vector<hit> grown(2*buf.size());
+	for (std::size_t i=0; i<count; ++i)
+	    grown[i] = at(i);
+	buf.swap(grown);
+	mask = buf.size() - 1;
+	head = 0;
+    }
+    buf[(head + count) & mask] = h;
+    ++count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Member functions
+////////////////////////////////////////////////////////////////////////////////
+
+// Constructor
+coincidence::coincidence(std::string& name_input, std::string& name_output,
+			 std::vector<int>& channels, double window_ns)
+    :
+    name_in {name_input}
+    ,name_out {name_output}
+    ,f_in {0}
+    ,tree {0}
+    ,num_entries {0}
+    ,channel_list {channels}
+    ,window {0}
+    ,calibrated {false}
+    ,slope(channels.size(), 1)
+    ,intercept(channels.size(), 0)
+    ,rings(channels.size())
+    ,cluster_start {0}
+    ,in_cluster(channels.size(), false)
+    ,cluster_channels {0}
+    ,h_multiplicity {0}
+{
+    // Time stamps are in units of 4 ns
+    window = static_cast<ULong64_t>(window_ns/4.0);
+
+    int max_channel = *std::max_element(channels.begin(), channels.end());
+    channel_index.assign(max_channel+1, -1);
+    for (std::size_t i=0; i<channels.size(); ++i)
+	channel_index.at(channels.at(i)) = i;
+};
+
+// Destructor
+coincidence::~coincidence()
+{
+    for (auto h : h_singles)
+	delete h;
+    for (auto h : h_gated)
+	delete h;
+    for (auto h : h_dt)
+	delete h;
+    delete h_multiplicity;
+    delete f_in;
+};
+
+// Checks if the designated input file exists
+bool coincidence::check_ifile()
+{
+    std::ifstream stream(name_in.c_str());
+    return stream.good();
+}
+
+// Checks if the designated output file exists already
+// Want to be careful not to overwrite something by accident
+bool coincidence::check_ofile_write(bool overwrite_param)
+{
+    char delete_check {'n'};
+    std::ifstream stream(name_out.c_str());
+
+    if (!stream.good())
+	return true; // No file exists, so it may be "overwritten"
+
+    if (overwrite_param == false) {
+	std::cout << "\nThe file '" << name_out.c_str()
+		  << "' already exists and you have chosen not to "
+		  << "overwrite it.\n";
+	return false;
+    }
+    std::cout << "\n\nOops!\n\t"
+	      << "The output file '" << name_out.c_str()
+	      << "' already exists.\n\t"
+	      << "Would you like to overwrite it? [y/N]\n\n";
+    delete_check = gather_input();
+
+    return (delete_check == 'y' || delete_check == 'Y');
+}
+
+// Reads per channel linear calibrations
+// One line per channel: <channel> <slope> <intercept>
+void coincidence::read_calibration(std::string& file_name)
+{
+    std::ifstream f_stream(file_name.c_str());
+    if (!f_stream) {
+	std::cerr << "Cannot open calibration file, " << file_name << "\n";
+	return;
+    }
+
+    int channel;
+    double m, b;
+    while (f_stream >> channel >> m >> b) {
+	if (channel < 0 || channel >= static_cast<int>(channel_index.size())
+	    || channel_index.at(channel) < 0)
+	    continue;
+	slope.at(channel_index.at(channel)) = m;
+	intercept.at(channel_index.at(channel)) = b;
+    }
+    calibrated = true;
+}
+
+// Index of the time difference histogram for channels i<j
+int coincidence::pair_index(int i, int j)
+{
+    int n = channel_list.size();
+    return i*n - i*(i+1)/2 + (j-i-1);
+}
+
+// Initial setup (opening the input and defining histograms)
+void coincidence::initialize()
+{
+    f_in = new TFile(name_in.c_str());
+    tree = (TTree*)f_in->Get("WaveformData");
+    num_entries = tree->GetEntries();
+    std::cout << "\n\nTree read with " << num_entries << " events\n\n";
+
+    // Define histogram parameters
+    const int num_xbin = 1024;
+    const double x_min = 0;
+    const double x_max = calibrated ? 10 : 35000; // MeV or ADC
+    std::string x_title = calibrated ? "Energy [MeV]" : "Energy [ADC]";
+
+    // Time differences are histogrammed in 4 ns bins over +/- window
+    const double dt_max = window*4.0;
+    const int num_tbin = std::max(2*static_cast<int>(window)+1, 1);
+
+    int n = channel_list.size();
+    for (int i=0; i<n; ++i) {
+	std::string ch = std::to_string(channel_list.at(i));
+	h_singles.push_back(new TH1D(("Singles_ch" + ch).c_str(),
+				     ("Singles;" + x_title + ";Counts").c_str(),
+				     num_xbin, x_min, x_max));
+	h_gated.push_back(new TH1D(("Coincident_ch" + ch).c_str(),
+				   ("Coincidence gated;" + x_title
+				    + ";Counts").c_str(),
+				   num_xbin, x_min, x_max));
+    }
+    for (int i=0; i<n; ++i) {
+	for (int j=i+1; j<n; ++j) {
+	    std::string name = "dT_ch" + std::to_string(channel_list.at(j))
+		+ "_ch" + std::to_string(channel_list.at(i));
+	    h_dt.push_back(new TH1D(name.c_str(),
+				    "Time difference;#Delta t [ns];Counts",
+				    num_tbin, -dt_max-2, dt_max+2));
+	}
+    }
+    h_multiplicity = new TH1D("Multiplicity",
+			      "Coincidence multiplicity;Channels;Counts",
+			      n-1, 1.5, n+0.5);
+}
+
+// Removes the hits of a channel that can no longer be in coincidence
+// Coincident hits fill their gated spectrum when they leave the window
+void coincidence::expire(int index, ULong64_t time_now)
+{
+    hit_ring& ring = rings.at(index);
+    while (!ring.empty() && ring.front().time_stamp + window < time_now) {
+	if (ring.front().coincident)
+	    h_gated.at(index)->Fill(ring.front().energy);
+	ring.pop_front();
+    }
+}
+
+// Adds a hit to the open cluster, or closes it and opens a new one if the
+// hit is past its window
+void coincidence::add_to_cluster(int index, ULong64_t time_now)
+{
+    if (cluster_channels > 0 && time_now > cluster_start + window)
+	close_cluster();
+    if (cluster_channels == 0)
+	cluster_start = time_now;
+    if (!in_cluster[index]) {
+	in_cluster[index] = true;
+	++cluster_channels;
+    }
+}
+
+// Counts the multiplicity of a cluster once, when it is complete
+void coincidence::close_cluster()
+{
+    if (cluster_channels > 1)
+	h_multiplicity->Fill(cluster_channels);
+    in_cluster.assign(in_cluster.size(), false);
+    cluster_channels = 0;
+}
+
+// Single pass over the time sorted data
+// Each event is compared to the hits still inside the window on the other
+// channels, so the cost is linear in the number of events
+void coincidence::find_coincidences()
+{
+    std::cout << "\n\nFinding coincidences.\n\n";
+
+    ULong64_t time_stamp {0};
+    int channel {0};
+    double energy {0};
+
+    // Only read what we need
+    tree->SetBranchStatus("*", 0);
+    tree->SetBranchStatus("TimeStamp", 1);
+    tree->SetBranchStatus("ChannelID", 1);
+    tree->SetBranchStatus("PSDTotalIntegral", 1);
+    tree->SetBranchAddress("TimeStamp", &time_stamp);
+    tree->SetBranchAddress("ChannelID", &channel);
+    tree->SetBranchAddress("PSDTotalIntegral", &energy);
+
+    const int n = channel_list.size();
+    const int num_index = channel_index.size();
+
+    for (ULong64_t entry=0; entry<num_entries; ++entry) {
+	tree->GetEntry(entry);
+
+	if (entry%1000000 == 0) {
+	    std::cout << "Processing event " << entry << " of "
+		      << num_entries << " ("
+		      << (double)entry/(double)num_entries*100.0 << "%)"
+		      << std::endl;
+	}
+
+	if (channel < 0 || channel >= num_index)
+	    continue;
+	int index = channel_index[channel];
+	if (index < 0)
+	    continue;
+
+	hit current {time_stamp,
+		     slope[index]*energy + intercept[index],
+		     false};
+	h_singles[index]->Fill(current.energy);
+	add_to_cluster(index, time_stamp);
+
+	for (int other=0; other<n; ++other) {
+	    if (other == index)
+		continue;
+	    expire(other, time_stamp);
+
+	    hit_ring& ring = rings[other];
+	    if (ring.empty())
+		continue;
+	    current.coincident = true;
+
+	    int lo = std::min(index, other);
+	    int hi = std::max(index, other);
+	    TH1D* h = h_dt[pair_index(lo, hi)];
+	    for (std::size_t k=0; k<ring.size(); ++k) {
+		hit& prev = ring.at(k);
+		prev.coincident = true;
+		double dt = 4.0*(static_cast<double>(time_stamp)
+				 - static_cast<double>(prev.time_stamp));
+		// Always t(hi) - t(lo)
+		h->Fill(index == hi ? dt : -dt);
+	    }
+	}
+
+	expire(index, time_stamp);
+	rings[index].push_back(current);
+    }
+
+    // Flush the hits still waiting in the window
+    for (int i=0; i<n; ++i)
+	expire(i, std::numeric_limits<ULong64_t>::max());
+    close_cluster();
+
+    tree->SetBranchStatus("*", 1);
+}
+
+// Writes out the coincidence histograms
+void coincidence::write_out(bool overwrite_param)
+{
+    std::cout << "\n\nWriting output file.\n\n";
+    TFile* f_output {0};
+    if (overwrite_param == true)
+	f_output = new TFile(name_out.c_str(),"RECREATE");
+    else
+	f_output = new TFile(name_out.c_str(),"NEW");
+
+    for (auto h : h_singles)
+	h->Write();
+    for (auto h : h_gated)
+	h->Write();
+    for (auto h : h_dt)
+	h->Write();
+    h_multiplicity->Write();
+
+    f_output->Close();
+    delete f_output;
+};
@@ -0,0 +1,93 @@
+#ifndef COINCIDENCE_H
+#define COINCIDENCE_H
+
+#include "TFile.h"
+#include "TH1D.h"
+#include "TH2D.h"
+#include "TTree.h"
+#include <string>
+#include <vector>
+
+// An event waiting in a channel's coincidence window
+struct hit
+{
+    ULong64_t time_stamp;
+    double energy;
+    bool coincident;
+};
+
+// Ring buffer of the recent hits on one channel
+// Capacity is a power of two; a full ring doubles, so no hit is dropped
+class hit_ring
+{
+public:
+    hit_ring(std::size_t capacity_pow2 = 256);
+
+    bool empty() const { return count == 0; }
+    std::size_t size() const { return count; }
+    hit& at(std::size_t i) { return buf[(head + i) & mask]; }
+    hit& front() { return buf[head]; }
+    void pop_front() { head = (head + 1) & mask; --count; }
+    void push_back(const hit& h);
+
+private:
+    std::vector<hit> buf;
+    std::size_t mask;
+    std::size_t head;
+    std::size_t count;
+};
+
+class coincidence
+{
+public:
+    // Constructor/destructor
+    coincidence(std::string& name_input, std::string& name_output,
+		std::vector<int>& channels, double window_ns);
+    ~coincidence();
+
+    // Functions
+    bool check_ifile();
+    bool check_ofile_write(bool overwrite_param);
+    void read_calibration(std::string& file_name);
+    void initialize();
+    void find_coincidences();
+    void write_out(bool overwrite_param);
+
+private:
+    std::string name_in;
+    std::string name_out;
+    TFile* f_in;
+
+    TTree* tree;
+    ULong64_t num_entries;
+    std::vector<int> channel_list;
+    std::vector<int> channel_index; // digitizer channel -> index (or -1)
+    ULong64_t window;               // coincidence window in time stamp ticks
+    bool calibrated;
+    std::vector<double> slope;
+    std::vector<double> intercept;
+
+    std::vector<hit_ring> rings;
+
+    // Events within a window of the first one (its time stamp); its
+    // multiplicity is the number of channels with a hit
+    ULong64_t cluster_start;
+    std::vector<bool> in_cluster;
+    int cluster_channels;
+
+    // Histograms
+    std::vector<TH1D*> h_singles;
+    std::vector<TH1D*> h_gated;
+    std::vector<TH1D*> h_dt;    // one per channel pair (i<j), t_j - t_i
+    TH1D* h_multiplicity;
+
+    int pair_index(int i, int j);
+    void expire(int index, ULong64_t time_now);
+    void add_to_cluster(int index, ULong64_t time_now);
+    void close_cluster();
+};
+
+// Non member function
+char gather_input();
+
+#endif
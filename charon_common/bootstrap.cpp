@@ -0,0 +1,351 @@
+#include "bootstrap.h"
+#include "memory_budget.h"
+#include "psd_pyramid.h"
+#include "replica_seed.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <thread>
+
+namespace {
+
+// Moving average over the last window+1 points, as psd_cut smooths the
+// cut edges
+std::vector<double> smooth(const std::vector<double>& y)
+{
+    const int window {5};
+    std::vector<double> y_new(y.size());
+    for (std::size_t i=0; i<y.size(); ++i) {
+	int start_index = i-window;
+	if (start_index < 0) {
+	    y_new[i] = y[i];
+	    continue;
+	}
+	double sum {0};
+	for (std::size_t j=start_index; j<=i; ++j)
+	    sum += y[j];
+	y_new[i] = sum/(window + 1);
+    }
+    return y_new;
+}
+
+} // namespace
+
+bootstrap::bootstrap(TH2D* h_psd, double num_stddevs_cut, bool pyramid_fit,
+		     bool skip_sparse_slices)
+    :
+    nx {h_psd->GetNbinsX()}
+    ,ny {h_psd->GetNbinsY()}
+    ,y_min {h_psd->GetYaxis()->GetXmin()}
+    ,y_width {(h_psd->GetYaxis()->GetXmax() - y_min)/ny}
+    ,content((nx+2)*(ny+2))
+    ,num_stddevs {num_stddevs_cut}
+    ,pyramid {pyramid_fit}
+    ,skip_sparse {skip_sparse_slices}
+    ,nominal_scale {0}
+{
+    for (int xbin=0; xbin<=nx+1; ++xbin) {
+	x_edges.push_back(h_psd->GetXaxis()->GetBinLowEdge(xbin));
+	for (int ybin=0; ybin<=ny+1; ++ybin)
+	    content[xbin*(ny+2) + ybin] = h_psd->GetBinContent(xbin, ybin);
+    }
+};
+
+// Replicas are spread over num_threads (all cores if 0), fewer if their
+// resampled copies of the PSD plot do not fit the memory budget
+void bootstrap::run(int num_replicas, int num_threads, ULong64_t seed)
+{
+    if (num_threads <= 0)
+	num_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::size_t workspace = content.size()*sizeof(double);
+    if (num_threads*workspace > memory().headroom()) {
+	num_threads = std::max<std::size_t>(1, memory().headroom()/workspace);
+	memory().degraded("fewer bootstrap threads");
+    }
+    memory_charge workspaces(mem_fit_workspaces, num_threads*workspace);
+
+    std::vector<double> nominal_clean;
+    nominal_scale = scale_of(content, nominal_clean);
+
+    scale_factors.assign(num_replicas, 0);
+    corrected.assign(num_replicas, std::vector<double>());
+
+    std::atomic<int> next {0};
+    auto work = [&]() {
+	int index;
+	while ((index = next++) < num_replicas)
+	    replica(index, replica_seed(seed, index));
+    };
+
+    std::vector<std::thread> workers;
+    for (int t=0; t<num_threads; ++t)
+	workers.emplace_back(work);
+    for (auto& worker : workers)
+	worker.join();
+}
+
+double bootstrap::mean() const
+{
+    if (scale_factors.empty())
+	return 0;
+    double sum {0};
+    for (auto s : scale_factors)
+	sum += s;
+    return sum/scale_factors.size();
+}
+
+double bootstrap::rms() const
+{
+    if (scale_factors.size() < 2)
+	return 0;
+    double m = mean();
+    double sum {0};
+    for (auto s : scale_factors)
+	sum += (s - m)*(s - m);
+    return std::sqrt(sum/(scale_factors.size() - 1));
+}
+
+TH1D* bootstrap::make_histogram(const char* name) const
+{
+    double m = mean();
+    double width = std::max(5*rms(), 1e-6*std::fabs(m) + 1e-9);
+    TH1D* h = new TH1D(name, "Pileup scale factor (bootstrap);Scale factor;"
+		       "Replicas", 100, m - width, m + width);
+    h->SetDirectory(0);
+    for (auto s : scale_factors)
+	h->Fill(s);
+    return h;
+}
+
+TH1D* bootstrap::make_band(const char* name) const
+{
+    TH1D* h = new TH1D(name, "Relative uncertainty (bootstrap);"
+		       "Energy [MeV];RMS/mean", nx, &x_edges[1]);
+    h->SetDirectory(0);
+    if (corrected.size() < 2)
+	return h;
+
+    for (int xbin=1; xbin<=nx; ++xbin) {
+	double sum {0};
+	double sum2 {0};
+	for (auto& counts : corrected) {
+	    sum += counts[xbin];
+	    sum2 += counts[xbin]*counts[xbin];
+	}
+	double n = corrected.size();
+	double m = sum/n;
+	double var = std::max(0.0, (sum2 - n*m*m)/(n - 1));
+	if (m > 0)
+	    h->SetBinContent(xbin, std::sqrt(var)/m);
+    }
+    return h;
+}
+
+// Resamples, refits and recomputes the scale factor of one replica
+void bootstrap::replica(int index, ULong64_t seed)
+{
+    std::mt19937_64 engine(seed);
+    std::vector<double> counts(content.size(), 0);
+    for (std::size_t i=0; i<content.size(); ++i) {
+	if (content[i] > 0) {
+	    std::poisson_distribution<long> poisson(content[i]);
+	    counts[i] = poisson(engine);
+	}
+    }
+    scale_factors[index] = scale_of(counts, corrected[index]);
+}
+
+// Refits the band of a PSD plot (counts as in content), builds the cut and
+// returns the scale factor; clean gets the corrected counts of every xbin
+double bootstrap::scale_of(const std::vector<double>& counts,
+			   std::vector<double>& clean) const
+{
+    std::vector<double> center;
+    std::vector<double> std_dev;
+    std::vector<bool> kept;
+    fit_band(counts, center, std_dev, kept);
+
+    // Cut edges through the kept slices with the origin first, as the
+    // caller builds them
+    std::vector<double> x {0};
+    std::vector<double> y_bottom {0};
+    std::vector<double> y_top {0};
+    std::vector<int> point(nx+1, -1); // of every kept slice
+    for (int xbin=0; xbin<=nx; ++xbin) {
+	if (!kept[xbin])
+	    continue;
+	double cut = std_dev[xbin]*num_stddevs;
+	point[xbin] = x.size();
+	x.push_back(0.5*(x_edges[xbin] + x_edges[xbin+1]));
+	y_bottom.push_back(center[xbin] - cut);
+	y_top.push_back(center[xbin] + cut);
+    }
+    y_bottom = smooth(y_bottom);
+    y_top = smooth(y_top);
+
+    // Next kept slice of every left out one (the cut ends at the last)
+    std::vector<int> next_point(nx+2, -1);
+    for (int xbin=nx; xbin>=0; --xbin)
+	next_point[xbin] = (point[xbin] >= 0) ? point[xbin]
+	    : next_point[xbin+1];
+
+    // Count bins with centers inside the cut, slice by slice; left out
+    // slices are inside the straight edges between their neighbours
+    double num_clean {0};
+    double num_total {0};
+    int last_point {0};
+    clean.assign(nx+1, 0);
+    for (int xbin=1; xbin<=nx; ++xbin) {
+	const double* slice = &counts[xbin*(ny+2)];
+	for (int ybin=0; ybin<=ny+1; ++ybin)
+	    num_total += slice[ybin];
+
+	double bottom;
+	double top;
+	if (point[xbin] >= 0) {
+	    last_point = point[xbin];
+	    bottom = y_bottom[last_point];
+	    top = y_top[last_point];
+	}
+	else if (next_point[xbin] >= 0) {
+	    int a = last_point;
+	    int b = next_point[xbin];
+	    double w = (0.5*(x_edges[xbin] + x_edges[xbin+1]) - x[a])
+		/ (x[b] - x[a]);
+	    bottom = y_bottom[a] + w*(y_bottom[b] - y_bottom[a]);
+	    top = y_top[a] + w*(y_top[b] - y_top[a]);
+	}
+	else
+	    continue;
+
+	for (int ybin=1; ybin<=ny; ++ybin) {
+	    double y = y_min + (ybin - 0.5)*y_width;
+	    if (y > bottom && y < top)
+		clean[xbin] += slice[ybin];
+	}
+	num_clean += clean[xbin];
+    }
+
+    double fraction = (num_total > 0) ? num_clean/num_total : 1;
+    double scale = (fraction > 0) ? (1 - std::log(fraction))/fraction : 0;
+    for (auto& c : clean)
+	c *= scale;
+    return scale;
+}
+
+// Gaussian band of every slice (kept is false for slices left out of the
+// cut); failed fits keep the previous slice's values
+void bootstrap::fit_band(const std::vector<double>& counts,
+			 std::vector<double>& center,
+			 std::vector<double>& std_dev,
+			 std::vector<bool>& kept) const
+{
+    kept.assign(nx+1, true);
+    if (pyramid) {
+	slice_fitter fit =
+	    [this, &counts](int first, int last, double guess, int needed,
+			    double& entries, double& c, double& s) {
+		return fit_slice(counts, first, last, guess, needed, entries,
+				 c, s);
+	    };
+	fit_psd_pyramid(nx, fit, center, std_dev);
+	for (auto& s : std_dev)
+	    s = std::max(s, 0.005);
+	return;
+    }
+
+    center.clear();
+    std_dev.clear();
+    double last_center {0};
+    double last_std_dev {0.1};
+    for (int xbin=0; xbin<=nx; ++xbin) {
+	double entries {0};
+	double c = last_center;
+	double s = last_std_dev;
+	if (!fit_slice(counts, xbin, xbin, last_std_dev, 100, entries, c, s)
+	    && entries < 100 && skip_sparse)
+	    kept[xbin] = false;
+
+	if (s < 0.005)
+	    s = 0.005;
+	center.push_back(c);
+	std_dev.push_back(s);
+	last_center = c;
+	last_std_dev = s;
+    }
+}
+
+// Fits the summed slices [first_bin, last_bin] with a weighted parabola
+// through the log of the counts within about two standard deviations of
+// the peak; center and std_dev are only set by a successful fit
+bool bootstrap::fit_slice(const std::vector<double>& counts, int first_bin,
+			  int last_bin, double guess_sigma, int min_entries,
+			  double& entries, double& center,
+			  double& std_dev) const
+{
+    std::vector<double> slice(ny+2, 0);
+    for (int xbin=first_bin; xbin<=last_bin; ++xbin) {
+	for (int ybin=1; ybin<=ny; ++ybin)
+	    slice[ybin] += counts[xbin*(ny+2) + ybin];
+    }
+
+    entries = 0;
+    int peak_bin {1};
+    for (int ybin=1; ybin<=ny; ++ybin) {
+	entries += slice[ybin];
+	if (slice[ybin] > slice[peak_bin])
+	    peak_bin = ybin;
+    }
+    if (entries < min_entries)
+	return false;
+
+    int half = std::max(3, int(2*guess_sigma/y_width + 0.5));
+    int first = std::max(1, peak_bin - half);
+    int last = std::min(ny, peak_bin + half);
+
+    // Weighted sums for ln(n) = a + b*u + c*u^2, u relative to the peak
+    double S[5] {0,0,0,0,0};
+    double T[3] {0,0,0};
+    int points {0};
+    for (int ybin=first; ybin<=last; ++ybin) {
+	double n = slice[ybin];
+	if (n <= 0)
+	    continue;
+	double u = (ybin - peak_bin)*y_width;
+	double l = std::log(n);
+	double power {1};
+	for (int k=0; k<5; ++k) {
+	    S[k] += n*power;
+	    if (k < 3)
+		T[k] += n*l*power;
+	    power *= u;
+	}
+	++points;
+    }
+
+    // Solve the 3x3 normal equations (Cramer's rule)
+    double det = S[0]*(S[2]*S[4] - S[3]*S[3])
+	- S[1]*(S[1]*S[4] - S[3]*S[2])
+	+ S[2]*(S[1]*S[3] - S[2]*S[2]);
+    if (points < 3 || det == 0)
+	return false;
+    double b = (S[0]*(T[1]*S[4] - S[3]*T[2])
+		- T[0]*(S[1]*S[4] - S[3]*S[2])
+		+ S[2]*(S[1]*T[2] - T[1]*S[2]))/det;
+    double q = (S[0]*(S[2]*T[2] - T[1]*S[3])
+		- S[1]*(S[1]*T[2] - T[1]*S[2])
+		+ T[0]*(S[1]*S[3] - S[2]*S[2]))/det;
+    if (q >= 0)
+	return false;
+
+    double peak = y_min + (peak_bin - 0.5)*y_width;
+    double fit_center = peak - b/(2*q);
+    double fit_std_dev = std::sqrt(-1/(2*q));
+    if (fit_center <= 0 || fit_center >= 1 || fit_std_dev >= 1)
+	return false;
+    center = fit_center;
+    std_dev = fit_std_dev;
+    return true;
+}
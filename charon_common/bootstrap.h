@@ -0,0 +1,72 @@
+#ifndef BOOTSTRAP_H
+#define BOOTSTRAP_H
+
+#include "TH1D.h"
+#include "TH2D.h"
+#include <vector>
+
+// Poisson bootstrap of the pileup correction factor
+//
+// Every replica resamples the bins of the uncut PSD plot, refits the pileup
+// band, rebuilds the cut the way psd_cut does (num_stddevs wide, moving
+// average edges) and recomputes
+//     scale_factor = (1 - log(fraction)) / fraction
+// The band is refitted slice by slice with a weighted parabola through the
+// log of the counts around the peak, so replicas need no Minuit and run in
+// parallel. Each replica has its own seed, so the results do not depend on
+// the number of threads.
+//
+// Slices are handled as the caller's fit handles them: with pyramid through
+// the same coarse-to-fine pyramid, otherwise one by one, where slices with
+// fewer than 100 entries take the previous slice's band or (skip_sparse)
+// are left out of the cut. As the refit only stands in for the caller's
+// fit, it is also run on the plot itself: nominal() should agree with the
+// fitted scale factor within rms().
+class bootstrap
+{
+public:
+    bootstrap(TH2D* h_psd, double num_stddevs, bool pyramid = false,
+	      bool skip_sparse = false);
+
+    void run(int num_replicas, int num_threads = 0,
+	     ULong64_t seed = 20180601);
+
+    double mean() const;
+    double rms() const;
+    double nominal() const { return nominal_scale; } // of the plot itself
+    const std::vector<double>& replicas() const { return scale_factors; }
+
+    // Histogram of the replica scale factors
+    TH1D* make_histogram(const char* name) const;
+
+    // Relative RMS of the corrected counts in every energy bin (same
+    // binning as the x axis of the PSD plot)
+    TH1D* make_band(const char* name) const;
+
+private:
+    int nx;
+    int ny;
+    double y_min;
+    double y_width;
+    std::vector<double> x_edges;
+    std::vector<double> content; // [xbin*(ny+2) + ybin], with under/overflow
+    double num_stddevs;
+    bool pyramid;
+    bool skip_sparse;
+
+    double nominal_scale;
+    std::vector<double> scale_factors;
+    std::vector<std::vector<double>> corrected; // per replica and xbin
+
+    void replica(int index, ULong64_t seed);
+    double scale_of(const std::vector<double>& counts,
+		    std::vector<double>& clean) const;
+    void fit_band(const std::vector<double>& counts,
+		  std::vector<double>& center, std::vector<double>& std_dev,
+		  std::vector<bool>& kept) const;
+    bool fit_slice(const std::vector<double>& counts, int first_bin,
+		   int last_bin, double guess_sigma, int min_entries,
+		   double& entries, double& center, double& std_dev) const;
+};
+
+#endif
@@ -0,0 +1,157 @@
+#include "dieaway.h"
+#include "rbd.h"
+#include <iostream>
+
+// Time stamps are in units of 4 ns
+static const double ticks_per_us {250.0};
+
+dieaway::dieaway()
+    :
+    mode {none}
+    ,period_ticks {0}
+    ,trigger_channel {-1}
+    ,next_gap {0}
+    ,time_initial {0}
+    ,last_ref {0}
+    ,have_ref {false}
+    ,h_time {0}
+    ,h_energy_time {0}
+{
+};
+
+dieaway::~dieaway()
+{
+    delete h_time;
+    delete h_energy_time;
+};
+
+void dieaway::set_period(double period_us)
+{
+    mode = period;
+    period_ticks = static_cast<ULong64_t>(period_us*ticks_per_us);
+    if (period_ticks < 1)
+	period_ticks = 1;
+}
+
+void dieaway::set_trigger(int channel)
+{
+    mode = trigger;
+    trigger_channel = channel;
+}
+
+// The RBD log is assumed to start with the first event of the run
+void dieaway::set_rbd(std::string& file_name, double threshold)
+{
+    std::vector<double> time;
+    std::vector<double> current;
+    if (!read_rbd(file_name, time, current)) {
+	std::cerr << "Cannot open RBD file, " << file_name
+		  << ", die-away histograms disabled\n";
+	return;
+    }
+    mode = rbd;
+    find_beam_gaps(time, current, threshold, gap_start_sec, gap_end_sec);
+    std::cout << "\nFound " << gap_start_sec.size()
+	      << " beam off periods in " << file_name << "\n";
+}
+
+// Creates the histograms; range_us is the longest time since the reference
+void dieaway::initialize(double range_us, ULong64_t time_first)
+{
+    if (mode == none)
+	return;
+
+    time_initial = time_first;
+    for (std::size_t i=0; i<gap_start_sec.size(); ++i) {
+	gap_start.push_back(time_initial + static_cast<ULong64_t>
+			    (gap_start_sec.at(i)*1e6*ticks_per_us));
+	gap_end.push_back(time_initial + static_cast<ULong64_t>
+			  (gap_end_sec.at(i)*1e6*ticks_per_us));
+    }
+    next_gap = 0;
+    have_ref = false;
+
+    // Keep histograms restored from a checkpoint
+    if (h_time != 0)
+	return;
+
+    const int num_tbin = 1000;
+    const int num_xbin = 1024;
+    const int x_min = 0;  // MeV
+    const int x_max = 10; // MeV
+
+    h_time = new TH1D("Die_Away","Die-away;Time since reference [#mus];Counts"
+		      ,num_tbin,0,range_us);
+    h_energy_time = new TH2D("Die_Away_Energy"
+			     ,"Die-away;Energy [MeV];Time since reference "
+			     "[#mus]"
+			     ,num_xbin,x_min,x_max
+			     ,num_tbin,0,range_us);
+    // Owned here, not by the input file
+    h_time->SetDirectory(0);
+    h_energy_time->SetDirectory(0);
+}
+
+void dieaway::fill(ULong64_t time_stamp, double energy)
+{
+    ULong64_t since {0};
+
+    switch (mode)
+    {
+    case period:
+	since = (time_stamp - time_initial) % period_ticks;
+	break;
+    case trigger:
+	if (!have_ref)
+	    return;
+	since = time_stamp - last_ref;
+	break;
+    case rbd:
+	// Merge the (sorted) gaps with the time sorted events
+	while (next_gap < gap_end.size() && gap_end[next_gap] <= time_stamp)
+	    ++next_gap;
+	if (next_gap == gap_end.size() || time_stamp < gap_start[next_gap])
+	    return; // beam is on
+	since = time_stamp - gap_start[next_gap];
+	break;
+    default:
+	return;
+    }
+
+    double since_us = since/ticks_per_us;
+    h_time->Fill(since_us);
+    h_energy_time->Fill(energy, since_us);
+}
+
+// Writes to the current directory
+void dieaway::write()
+{
+    if (h_time == 0)
+	return;
+    h_time->Write();
+    h_energy_time->Write();
+}
+
+// Reads histograms written by write() (e.g. a checkpoint); filling adds to
+// them instead of starting over
+void dieaway::restore(TDirectory* dir)
+{
+    TH1D* stored_time = (TH1D*)dir->Get("Die_Away");
+    TH2D* stored_energy_time = (TH2D*)dir->Get("Die_Away_Energy");
+    if (mode == none || stored_time == 0 || stored_energy_time == 0)
+	return;
+
+    delete h_time;
+    delete h_energy_time;
+    h_time = (TH1D*)stored_time->Clone();
+    h_energy_time = (TH2D*)stored_energy_time->Clone();
+    h_time->SetDirectory(0);
+    h_energy_time->SetDirectory(0);
+}
+
+// The beam gaps stand for the RBD file they were found in
+void dieaway::fingerprint(stage_key& key) const
+{
+    key.add(static_cast<int>(mode)).add(period_ticks).add(trigger_channel)
+	.add(gap_start_sec).add(gap_end_sec);
+}
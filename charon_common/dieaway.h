@@ -0,0 +1,70 @@
+#ifndef DIEAWAY_H
+#define DIEAWAY_H
+
+#include "TDirectory.h"
+#include "TH1D.h"
+#include "TH2D.h"
+#include "stage_cache.h"
+#include <string>
+#include <vector>
+
+// Fills time-since-reference (die-away) histograms while the main event
+// loop runs. The reference is one of:
+//   - a fixed beam period (pulse n starts at n*period after the first event)
+//   - the last event on a trigger channel
+//   - the start of each beam off gap in the RBD current log
+class dieaway
+{
+public:
+    dieaway();
+    ~dieaway();
+
+    void set_period(double period_us);
+    void set_trigger(int channel);
+    void set_rbd(std::string& file_name, double threshold);
+    bool enabled() const { return mode != none; }
+
+    // Whether observe() needs events of this (not analyzed) channel
+    bool observes(int channel) const
+    {
+	return mode == trigger && channel == trigger_channel;
+    }
+
+    void initialize(double range_us, ULong64_t time_first);
+
+    // Called for every event of the time sorted stream (any channel)
+    void observe(ULong64_t time_stamp, int channel)
+    {
+	if (mode == trigger && channel == trigger_channel) {
+	    last_ref = time_stamp;
+	    have_ref = true;
+	}
+    }
+
+    // Called for every event of the analyzed channel
+    void fill(ULong64_t time_stamp, double energy);
+
+    void write();
+    void restore(TDirectory* dir); // continue from histograms in dir
+    void fingerprint(stage_key& key) const; // settings, for result caches
+
+private:
+    enum ref_mode {none, period, trigger, rbd};
+    ref_mode mode;
+    ULong64_t period_ticks;
+    int trigger_channel;
+    std::vector<ULong64_t> gap_start; // time stamps
+    std::vector<ULong64_t> gap_end;
+    std::vector<double> gap_start_sec;
+    std::vector<double> gap_end_sec;
+    std::size_t next_gap;
+
+    ULong64_t time_initial;
+    ULong64_t last_ref;
+    bool have_ref;
+
+    TH1D* h_time;
+    TH2D* h_energy_time;
+};
+
+#endif
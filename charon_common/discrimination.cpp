@@ -0,0 +1,151 @@
+#include "discrimination.h"
+#include "TF1.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace {
+
+const double fwhm_per_sigma {2.35482};
+
+// Highest bin at least min_distance away from bin peak_bin (0 if none)
+int second_peak(TH1D* proj, int peak_bin, double min_distance)
+{
+    int best {0};
+    double peak = proj->GetBinCenter(peak_bin);
+    for (int bin=1; bin<=proj->GetNbinsX(); ++bin) {
+	if (std::fabs(proj->GetBinCenter(bin) - peak) < min_distance)
+	    continue;
+	if (best == 0 || proj->GetBinContent(bin) > proj->GetBinContent(best))
+	    best = bin;
+    }
+    return (best != 0 && proj->GetBinContent(best) > 0) ? best : 0;
+}
+
+} // namespace
+
+discrimination::discrimination(TH2D* h_psd, double region_width,
+			       double num_stddevs_cut, int min_entries)
+    :
+    num_stddevs {num_stddevs_cut}
+{
+    TAxis* x_axis = h_psd->GetXaxis();
+    int bins_per_region = int(region_width/x_axis->GetBinWidth(1) + 0.5);
+    bins_per_region = std::max(1, bins_per_region);
+    TF1* fit = new TF1("ng_fit", "gaus(0)+gaus(3)", 0, 1);
+    double last_sigma {0.02};
+
+    for (int first=1; first<=x_axis->GetNbins(); first+=bins_per_region) {
+	int last = std::min(first + bins_per_region - 1, x_axis->GetNbins());
+	TH1D* proj = h_psd->ProjectionY("ng_proj", first, last);
+	if (proj->Integral(1, proj->GetNbinsX()) < min_entries) {
+	    delete proj;
+	    continue;
+	}
+
+	// Tallest band and the tallest point clear of it
+	int peak_bin = proj->GetMaximumBin();
+	int other_bin = second_peak(proj, peak_bin, 3*last_sigma);
+	if (other_bin == 0) {
+	    delete proj;
+	    continue;
+	}
+	double height = proj->GetBinContent(peak_bin);
+	double par[] {height, proj->GetBinCenter(peak_bin), last_sigma,
+		      proj->GetBinContent(other_bin),
+		      proj->GetBinCenter(other_bin), last_sigma};
+	fit->SetParameters(par);
+	for (int i : {0, 3})
+	    fit->SetParLimits(i, 0, 10*height);
+	for (int i : {1, 4})
+	    fit->SetParLimits(i, 0, 1);
+	for (int i : {2, 5})
+	    fit->SetParLimits(i, 0.002, 0.2);
+	proj->Fit(fit, "Q0");
+	fit->GetParameters(par);
+	const double* err = fit->GetParErrors();
+	delete proj;
+
+	// Gammas have the smaller tail fraction
+	int g = (par[1] < par[4]) ? 0 : 3;
+	int n = 3 - g;
+	if (par[g] <= 0 || par[n] <= 0 || par[n+1] - par[g+1] <= 0)
+	    continue;
+
+	region r;
+	double low = x_axis->GetBinLowEdge(first);
+	double high = x_axis->GetBinUpEdge(last);
+	r.energy = 0.5*(low + high);
+	r.half_width = 0.5*(high - low);
+	r.gamma_center = par[g+1];
+	r.gamma_sigma = par[g+2];
+	r.neutron_center = par[n+1];
+	r.neutron_sigma = par[n+2];
+
+	// Figure of merit and its error from the fit errors
+	double d = r.neutron_center - r.gamma_center;
+	double w = fwhm_per_sigma*(r.gamma_sigma + r.neutron_sigma);
+	r.fom = d/w;
+	double var_d = err[g+1]*err[g+1] + err[n+1]*err[n+1];
+	double var_w = fwhm_per_sigma*fwhm_per_sigma
+	    *(err[g+2]*err[g+2] + err[n+2]*err[n+2]);
+	r.fom_error = std::sqrt(var_d/(w*w) + d*d*var_w/(w*w*w*w));
+
+	regions.push_back(r);
+	last_sigma = r.gamma_sigma;
+    }
+    delete fit;
+
+    std::cout << "\nNeutron/gamma discrimination: " << regions.size()
+	      << " regions fitted\n";
+}
+
+TGraphErrors* discrimination::make_fom(const char* name) const
+{
+    TGraphErrors* g = new TGraphErrors(regions.size());
+    for (std::size_t i=0; i<regions.size(); ++i) {
+	g->SetPoint(i, regions[i].energy, regions[i].fom);
+	g->SetPointError(i, regions[i].half_width, regions[i].fom_error);
+    }
+    g->SetName(name);
+    g->SetTitle("PSD figure of merit;Energy [MeV];FOM");
+    return g;
+}
+
+TCutG* discrimination::make_neutron_cut(const char* name) const
+{
+    std::vector<double> bottom;
+    std::vector<double> top;
+    for (auto& r : regions) {
+	bottom.push_back(r.gamma_center + num_stddevs*r.gamma_sigma);
+	top.push_back(std::max(bottom.back(),
+			       r.neutron_center + num_stddevs*r.neutron_sigma));
+    }
+    return make_cut(name, bottom, top);
+}
+
+TCutG* discrimination::make_gamma_cut(const char* name) const
+{
+    std::vector<double> bottom;
+    std::vector<double> top;
+    for (auto& r : regions) {
+	bottom.push_back(r.gamma_center - num_stddevs*r.gamma_sigma);
+	top.push_back(r.gamma_center + num_stddevs*r.gamma_sigma);
+    }
+    return make_cut(name, bottom, top);
+}
+
+// Closed polygon along the top edge and back along the bottom one
+TCutG* discrimination::make_cut(const char* name, std::vector<double>& bottom,
+				std::vector<double>& top) const
+{
+    const int n = regions.size();
+    TCutG* cut = new TCutG(name, (n > 0) ? 2*n + 1 : 0);
+    for (int i=0; i<n; ++i) {
+	cut->SetPoint(i, regions[i].energy, top[i]);
+	cut->SetPoint(2*n - 1 - i, regions[i].energy, bottom[i]);
+    }
+    if (n > 0)
+	cut->SetPoint(2*n, regions[0].energy, top[0]);
+    return cut;
+}
@@ -0,0 +1,53 @@
+#ifndef DISCRIMINATION_H
+#define DISCRIMINATION_H
+
+#include "TCutG.h"
+#include "TGraphErrors.h"
+#include "TH2D.h"
+#include <vector>
+
+// Neutron/gamma discrimination from the uncut PSD plot
+//
+// The tail/total projection of every energy region is fitted with two
+// gaussians, gammas being the lower band and neutrons the upper one. The
+// separation of a region is the figure of merit
+//     FOM = (neutron center - gamma center) / (FWHM gamma + FWHM neutron)
+// The neutron region runs from num_stddevs gamma widths above the gamma
+// center to num_stddevs neutron widths above the neutron center; the gamma
+// region is num_stddevs gamma widths around the gamma center. Both cuts
+// are drawn through the region centers, so energies outside the fitted
+// regions are not tagged. Regions with few entries or no second band are
+// skipped.
+class discrimination
+{
+public:
+    discrimination(TH2D* h_psd, double region_width, double num_stddevs = 3,
+		   int min_entries = 1000);
+
+    int num_regions() const { return regions.size(); }
+
+    TGraphErrors* make_fom(const char* name) const;
+    TCutG* make_neutron_cut(const char* name) const;
+    TCutG* make_gamma_cut(const char* name) const;
+
+private:
+    struct region
+    {
+	double energy;     // center
+	double half_width;
+	double gamma_center;
+	double gamma_sigma;
+	double neutron_center;
+	double neutron_sigma;
+	double fom;
+	double fom_error;
+    };
+
+    std::vector<region> regions;
+    double num_stddevs;
+
+    TCutG* make_cut(const char* name, std::vector<double>& bottom,
+		    std::vector<double>& top) const;
+};
+
+#endif
@@ -0,0 +1,120 @@
+#include "event_reader.h"
+#include "list_mode.h"
+#include <algorithm>
+#include <cstring>
+
+void event_batch::reserve(std::size_t capacity)
+{
+    time_stamp.resize(capacity);
+    channel.resize(capacity);
+    energy.resize(capacity);
+    tail.resize(capacity);
+    pileup.resize(capacity);
+}
+
+event_reader::event_reader(TTree* input_tree, list_mode* list_input,
+			   std::size_t batch_capacity)
+    :
+    tree {input_tree}
+    ,list {list_input}
+    ,capacity {batch_capacity}
+    ,time_stamp {0}
+    ,channel {0}
+    ,energy {0}
+    ,tail {0}
+    ,wave_channel {-1}
+    ,samples {0}
+    ,wave {0}
+{
+    if (tree == 0)
+	return;
+    tree->SetBranchAddress("TimeStamp", &time_stamp);
+    tree->SetBranchAddress("ChannelID", &channel);
+    tree->SetBranchAddress("PSDTotalIntegral", &energy);
+    tree->SetBranchAddress("PSDTailIntegral", &tail);
+};
+
+event_reader::~event_reader()
+{
+    delete wave;
+    if (tree != 0)
+	tree->ResetBranchAddresses();
+};
+
+// Raw samples are read from a std::vector<UShort_t> branch
+void event_reader::set_waveforms(std::string& branch, gate_params& gates,
+				 int channel_num)
+{
+    wave_channel = channel_num;
+    if (tree != 0)
+	tree->SetBranchAddress(branch.c_str(), &samples);
+    delete wave;
+    wave = new waveform_batch(capacity, gates);
+    wave_index.reserve(capacity);
+}
+
+bool event_reader::read(ULong64_t first, ULong64_t last, event_batch& batch)
+{
+    if (first >= last)
+	return false;
+
+    std::size_t n = std::min<ULong64_t>(capacity, last - first);
+    if (batch.time_stamp.size() < capacity)
+	batch.reserve(capacity);
+    batch.first_entry = first;
+    batch.size = n;
+
+    if (wave != 0) {
+	wave->clear();
+	wave_index.clear();
+    }
+
+    if (tree != 0)
+	read_tree(first, batch);
+    else
+	read_list(first, batch);
+
+    // Replace the digitizer integrals with the recomputed ones
+    if (wave != 0 && wave->size() > 0) {
+	wave->process();
+	for (int k=0; k<wave->size(); ++k) {
+	    std::size_t i = wave_index[k];
+	    batch.energy[i] = wave->total(k);
+	    batch.tail[i] = wave->tail(k);
+	    batch.pileup[i] = wave->pileup(k);
+	}
+    }
+    return batch.size > 0;
+}
+
+void event_reader::read_tree(ULong64_t first, event_batch& batch)
+{
+    for (std::size_t i=0; i<batch.size; ++i) {
+	tree->GetEntry(first + i);
+	batch.time_stamp[i] = time_stamp;
+	batch.channel[i] = channel;
+	batch.energy[i] = energy;
+	batch.tail[i] = tail;
+	batch.pileup[i] = 0;
+
+	if (wave != 0 && channel == wave_channel && samples != 0) {
+	    wave->add(samples->data(), samples->size());
+	    wave_index.push_back(i);
+	}
+    }
+}
+
+// Records are decoded in place; only traces are copied, as the waveform
+// batch takes them aligned
+void event_reader::read_list(ULong64_t first, event_batch& batch)
+{
+    std::vector<list_mode::trace> traces;
+    batch.size = list->read(first, batch.size, batch,
+			    (wave != 0) ? wave_channel : -1, traces);
+    for (auto& t : traces) {
+	trace_copy.resize(t.num_samples);
+	std::memcpy(trace_copy.data(), t.samples, 2*t.num_samples);
+	wave->add(trace_copy.data(), t.num_samples);
+	wave_index.push_back(t.index);
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef EVENT_READER_H
+#define EVENT_READER_H
+
+#include "TTree.h"
+#include "waveform.h"
+#include <string>
+#include <vector>
+
+class list_mode;
+
+// Columns of consecutive WaveformData entries
+struct event_batch
+{
+    ULong64_t first_entry;
+    std::size_t size;
+    std::vector<ULong64_t> time_stamp;
+    std::vector<int> channel;
+    std::vector<double> energy; // PSDTotalIntegral
+    std::vector<double> tail;   // PSDTailIntegral
+    std::vector<char> pileup;   // waveform pileup flag (if reanalysed)
+
+    void reserve(std::size_t capacity);
+};
+
+// Reads the WaveformData tree in batches of entries, or CAEN list-mode
+// files in its place (if the tree is 0)
+//
+// If a waveform branch is set, the total and tail integrals of the events
+// on one channel are recomputed from the raw samples (vectorized over the
+// batch) instead of using the values the digitizer computed. List-mode
+// files have the traces in their records, so the branch name is not used.
+class event_reader
+{
+public:
+    event_reader(TTree* input_tree, list_mode* list_input = 0,
+		 std::size_t batch_capacity = 4096);
+    ~event_reader();
+
+    void set_waveforms(std::string& branch, gate_params& gates,
+		       int channel);
+    bool reanalysing() const { return wave != 0; }
+    std::size_t batch_capacity() const { return capacity; }
+
+    // Reads entries [first, min(first + capacity, last)) into batch
+    // Returns false if there is nothing to read
+    bool read(ULong64_t first, ULong64_t last, event_batch& batch);
+
+private:
+    TTree* tree;
+    list_mode* list;
+    std::size_t capacity;
+
+    ULong64_t time_stamp;
+    int channel;
+    double energy;
+    double tail;
+
+    // Waveform reanalysis
+    int wave_channel;
+    std::vector<UShort_t>* samples;
+    waveform_batch* wave;
+    std::vector<std::size_t> wave_index; // batch index of each trace
+    std::vector<UShort_t> trace_copy;    // aligned list-mode trace
+
+    void read_tree(ULong64_t first, event_batch& batch);
+    void read_list(ULong64_t first, event_batch& batch);
+};
+
+#endif
@@ -0,0 +1,201 @@
+#include "interval_tagger.h"
+#include "TMath.h"
+#include "TParameter.h"
+#include <iostream>
+
+// Time stamps are in units of 4 ns
+static const double ticks_per_us {250.0};
+
+interval_tagger::interval_tagger()
+    :
+    resolving_ticks {0}
+    ,num_events {0}
+    ,num_tagged {0}
+    ,num_gaps {0}
+    ,sum_gaps {0}
+    ,psd_scale {0}
+    ,h_interval {0}
+    ,h_interval_short {0}
+    ,h_tagged {0}
+{
+};
+
+interval_tagger::~interval_tagger()
+{
+    delete h_interval;
+    delete h_interval_short;
+    delete h_tagged;
+};
+
+// tau_ns <= 0 disables the tagging; shorter than a tick is one tick
+void interval_tagger::set_resolving_time(double tau_ns)
+{
+    if (tau_ns <= 0) {
+	resolving_ticks = 0;
+	return;
+    }
+    resolving_ticks = static_cast<ULong64_t>(tau_ns*ticks_per_us/1000);
+    if (resolving_ticks < 1)
+	resolving_ticks = 1;
+}
+
+// Creates the histograms (unless restored from a checkpoint)
+void interval_tagger::initialize()
+{
+    if (!enabled() || h_interval != 0)
+	return;
+
+    h_interval = new TH1D("Interval"
+			  ,"Time to the previous event;Interval [#mus];Counts"
+			  ,10000,0,1000);
+    h_interval_short = new TH1D("Interval_Short"
+				,"Time to the previous event;Interval [#mus];"
+				"Counts"
+				,1000,0,4); // one bin per tick
+    h_tagged = new TH1D("Interval_Tagged"
+			,"Events with a close neighbour;Energy [MeV];Counts"
+			,1024,0,10);
+    // Owned here, not by the input file
+    h_interval->SetDirectory(0);
+    h_interval_short->SetDirectory(0);
+    h_tagged->SetDirectory(0);
+}
+
+void interval_tagger::fill_gap(ULong64_t gap)
+{
+    double gap_us = gap/ticks_per_us;
+    h_interval->Fill(gap_us);
+    h_interval_short->Fill(gap_us);
+    ++num_gaps;
+    sum_gaps += gap;
+}
+
+// Counts an event once both of its neighbours are known
+void interval_tagger::settle(neighbour& event)
+{
+    if (!event.seen)
+	return;
+    ++num_events;
+    if (event.tagged) {
+	++num_tagged;
+	h_tagged->Fill(event.energy);
+    }
+    event.seen = false;
+}
+
+void interval_tagger::finish()
+{
+    for (auto& event : last)
+	settle(event);
+}
+
+double interval_tagger::rate() const
+{
+    if (sum_gaps == 0)
+	return 0;
+    return num_gaps/(sum_gaps/(ticks_per_us*1e6));
+}
+
+double interval_tagger::clean_fraction() const
+{
+    if (num_events == 0)
+	return 1;
+    return 1 - double(num_tagged)/double(num_events);
+}
+
+double interval_tagger::expected_fraction() const
+{
+    double tau_sec = resolving_ticks/(ticks_per_us*1e6);
+    return TMath::Exp(-2*rate()*tau_sec);
+}
+
+double interval_tagger::scale_factor() const
+{
+    double fraction = clean_fraction();
+    if (fraction <= 0)
+	return 1;
+    return (1 - TMath::Log(fraction)) / fraction;
+}
+
+void interval_tagger::compare(double psd_factor)
+{
+    if (!enabled())
+	return;
+    psd_scale = psd_factor;
+
+    std::cout << "\nPileup from event intervals (resolving time "
+	      << resolving_ticks*1000/ticks_per_us << " ns):\n"
+	      << "\tRate:\t\t\t\t" << rate() << " Hz\n"
+	      << "\tTagged events:\t\t\t" << num_tagged << " of "
+	      << num_events << "\n"
+	      << "\tUntagged fraction:\t\t" << clean_fraction() << "\n"
+	      << "\tExpected from the rate:\t\t" << expected_fraction() << "\n"
+	      << "\tScale factor:\t\t\t" << scale_factor() << "\n"
+	      << "\tScale factor of the PSD cut:\t" << psd_scale << "\n";
+}
+
+// Writes to the current directory
+void interval_tagger::write()
+{
+    if (h_interval == 0)
+	return;
+    h_interval->Write();
+    h_interval_short->Write();
+    h_tagged->Write();
+
+    TParameter<double>("Interval_Resolving_Time_ns"
+		       ,resolving_ticks*1000/ticks_per_us).Write();
+    TParameter<double>("Interval_Rate_Hz", rate()).Write();
+    TParameter<double>("Interval_Clean_Fraction", clean_fraction()).Write();
+    TParameter<double>("Interval_Expected_Fraction"
+		       ,expected_fraction()).Write();
+    TParameter<double>("Interval_Scale_Factor", scale_factor()).Write();
+    if (psd_scale > 0)
+	TParameter<double>("PSD_Scale_Factor", psd_scale).Write();
+
+    // Counters, to continue from a checkpoint
+    TParameter<Long64_t>("Interval_Events", num_events).Write();
+    TParameter<Long64_t>("Interval_Tagged_Events", num_tagged).Write();
+    TParameter<Long64_t>("Interval_Gaps", num_gaps).Write();
+    TParameter<Long64_t>("Interval_Gap_Ticks", sum_gaps).Write();
+}
+
+// Reads what write() wrote (e.g. a checkpoint); filling adds to it
+void interval_tagger::restore(TDirectory* dir)
+{
+    TH1D* stored_interval = (TH1D*)dir->Get("Interval");
+    TH1D* stored_short = (TH1D*)dir->Get("Interval_Short");
+    TH1D* stored_tagged = (TH1D*)dir->Get("Interval_Tagged");
+    TParameter<Long64_t>* events
+	= (TParameter<Long64_t>*)dir->Get("Interval_Events");
+    TParameter<Long64_t>* tagged
+	= (TParameter<Long64_t>*)dir->Get("Interval_Tagged_Events");
+    TParameter<Long64_t>* gaps
+	= (TParameter<Long64_t>*)dir->Get("Interval_Gaps");
+    TParameter<Long64_t>* gap_ticks
+	= (TParameter<Long64_t>*)dir->Get("Interval_Gap_Ticks");
+    if (!enabled() || stored_interval == 0 || stored_short == 0 ||
+	stored_tagged == 0 || events == 0 || tagged == 0 || gaps == 0 ||
+	gap_ticks == 0)
+	return;
+
+    delete h_interval;
+    delete h_interval_short;
+    delete h_tagged;
+    h_interval = (TH1D*)stored_interval->Clone();
+    h_interval_short = (TH1D*)stored_short->Clone();
+    h_tagged = (TH1D*)stored_tagged->Clone();
+    h_interval->SetDirectory(0);
+    h_interval_short->SetDirectory(0);
+    h_tagged->SetDirectory(0);
+
+    num_events = events->GetVal();
+    num_tagged = tagged->GetVal();
+    num_gaps = gaps->GetVal();
+    sum_gaps = gap_ticks->GetVal();
+}
+
+void interval_tagger::fingerprint(stage_key& key) const
+{
+    key.add(resolving_ticks);
+}
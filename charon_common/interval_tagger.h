@@ -0,0 +1,96 @@
+#ifndef INTERVAL_TAGGER_H
+#define INTERVAL_TAGGER_H
+
+#include "TDirectory.h"
+#include "TH1D.h"
+#include "stage_cache.h"
+#include <vector>
+
+// Tags pileup from the time to the neighbouring events of the same channel
+//
+// The stream is time sorted, so the gap to the previous event is known when
+// an event arrives and the gap to the next one when the next arrives. An
+// event with a neighbour closer than the resolving time is tagged, so every
+// event is counted one event late. For a Poisson source of rate r (from the
+// mean gap) a fraction exp(-2 r tau) of the events has no such neighbour.
+// The untagged fraction f gives a correction factor (1 - ln f)/f, like the
+// one of the PSD cut, without any fit. Pileup within the trigger hold-off of
+// the digitizer is a single event, which only the PSD cut sees.
+class interval_tagger
+{
+public:
+    interval_tagger();
+    ~interval_tagger();
+
+    void set_resolving_time(double tau_ns);
+    bool enabled() const { return resolving_ticks > 0; }
+
+    void initialize();
+
+    // Called for every event of a channel (time sorted)
+    void fill(ULong64_t time_stamp, int channel, double energy)
+    {
+	if (channel < 0)
+	    return;
+	if (static_cast<std::size_t>(channel) >= last.size())
+	    last.resize(channel + 1);
+	neighbour& previous = last[channel];
+	bool tagged {false};
+	if (previous.seen && time_stamp >= previous.time_stamp) {
+	    ULong64_t gap = time_stamp - previous.time_stamp;
+	    fill_gap(gap);
+	    if (gap < resolving_ticks) {
+		previous.tagged = true;
+		tagged = true;
+	    }
+	}
+	settle(previous); // also if the time stamps start over (segments)
+	previous.seen = true;
+	previous.tagged = tagged;
+	previous.time_stamp = time_stamp;
+	previous.energy = energy;
+    }
+
+    // Counts the last event of every channel; the next fill starts a new
+    // stream
+    void finish();
+
+    // Prints the estimates next to the scale factor of the PSD cut
+    void compare(double psd_factor);
+
+    double rate() const;           // Hz
+    double clean_fraction() const; // untagged
+    double expected_fraction() const;
+    double scale_factor() const;
+
+    void write();
+    void restore(TDirectory* dir); // continue from a checkpoint in dir
+    void fingerprint(stage_key& key) const; // settings, for result caches
+
+private:
+    struct neighbour
+    {
+	bool seen {false};
+	bool tagged {false};
+	ULong64_t time_stamp {0};
+	double energy {0};
+    };
+
+    ULong64_t resolving_ticks;
+    std::vector<neighbour> last; // per channel
+
+    Long64_t num_events;
+    Long64_t num_tagged;
+    Long64_t num_gaps;
+    ULong64_t sum_gaps; // ticks
+    double psd_scale;   // 0 until compared
+
+    TH1D* h_interval;
+    TH1D* h_interval_short;
+    TH1D* h_tagged;
+
+    void fill_gap(ULong64_t gap);
+    void settle(neighbour& event);
+};
+
+#endif
@@ -0,0 +1,283 @@
+#include "list_mode.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Fields are packed (and little endian, as the files are)
+template<class T>
+T load(const char* p)
+{
+    T value;
+    std::memcpy(&value, p, sizeof(T));
+    return value;
+}
+
+const unsigned energy_field {0x1};
+const unsigned calibrated_field {0x2};
+const unsigned short_field {0x4};
+const unsigned trace_field {0x8};
+
+const ULong64_t ps_per_tick {4000}; // 4 ns
+
+typedef std::greater<std::pair<ULong64_t, int>> earliest_first;
+
+} // namespace
+
+list_mode::list_mode(std::vector<std::string>& file_names)
+    :
+    num_entries {0}
+{
+    for (auto& name : file_names) {
+	mapped_file file {name, 0, 0, 0, 0, 0, 0};
+	if (map(file))
+	    files.push_back(file);
+    }
+
+    // One pass over the time stamps numbers the entries, keeping the file
+    // offsets every index_step entries to seek from
+    std::vector<std::size_t> offsets;
+    for (auto& file : files)
+	offsets.push_back(file.start);
+    reset(stream, offsets, 0);
+    while (!stream.heap.empty()) {
+	if (num_entries % index_step == 0)
+	    index.push_back(stream.offset);
+	pop(stream);
+	++num_entries;
+    }
+
+    seek(stream, 0);
+    std::cout << "\n" << files.size() << " list-mode files mapped\n";
+};
+
+list_mode::~list_mode()
+{
+    for (auto& file : files) {
+	if (file.size > 0)
+	    munmap(const_cast<char*>(file.data), file.size);
+    }
+};
+
+bool list_mode::is_list_mode(const std::string& file_name)
+{
+    if (file_name.size() < 4)
+	return false;
+    std::string suffix = file_name.substr(file_name.size() - 4);
+    for (auto& c : suffix)
+	c = std::tolower(c);
+    return suffix == ".bin";
+}
+
+ULong64_t list_mode::time_stamp(ULong64_t entry)
+{
+    seek(lookup, entry);
+    if (lookup.heap.empty())
+	return 0;
+    return lookup.heap.front().first/ps_per_tick;
+}
+
+std::size_t list_mode::read(ULong64_t first, std::size_t n,
+			    event_batch& batch, int trace_channel,
+			    std::vector<trace>& traces)
+{
+    if (first >= num_entries)
+	return 0;
+    n = std::min<ULong64_t>(n, num_entries - first);
+    seek(stream, first);
+    for (std::size_t i=0; i<n; ++i) {
+	std::pair<int, std::size_t> record = pop(stream);
+	const mapped_file& file = files[record.first];
+	const char* p = file.data + record.second;
+
+	int channel = 16*load<UShort_t>(p) + load<UShort_t>(p + 2);
+	ULong64_t time_ps = load<ULong64_t>(p + 4);
+	p += 12;
+
+	double energy {0};
+	double energy_short {0};
+	if (file.fields & energy_field) {
+	    energy = load<UShort_t>(p);
+	    p += 2;
+	}
+	if (file.fields & calibrated_field)
+	    p += 8;
+	if (file.fields & short_field) {
+	    energy_short = load<UShort_t>(p);
+	    p += 2;
+	}
+	p += 4; // flags
+
+	batch.time_stamp[i] = time_ps/ps_per_tick;
+	batch.channel[i] = channel;
+	batch.energy[i] = energy;
+	batch.tail[i] = energy - energy_short;
+	batch.pileup[i] = 0;
+
+	// Records without samples (common in CoMPASS 1) keep the digitizer's
+	// integrals
+	if ((file.fields & trace_field) && channel == trace_channel) {
+	    p += file.trace_code;
+	    trace t {i, p + 4, load<UInt_t>(p)};
+	    if (t.num_samples > 0)
+		traces.push_back(t);
+	}
+    }
+    return n;
+}
+
+bool list_mode::map(mapped_file& file)
+{
+    int fd = open(file.name.c_str(), O_RDONLY);
+    if (fd < 0) {
+	std::cerr << "Cannot open list-mode file, " << file.name << "\n";
+	return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size == 0) {
+	close(fd);
+	return false;
+    }
+
+    void* data = mmap(0, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+	std::cerr << "Cannot map list-mode file, " << file.name << "\n";
+	return false;
+    }
+    madvise(data, status.st_size, MADV_SEQUENTIAL);
+    file.data = static_cast<const char*>(data);
+    file.size = status.st_size;
+
+    // CoMPASS 2 header, or the records of CoMPASS 1 (with a trace that
+    // is often empty, and no waveform code)
+    UShort_t header = (file.size >= 2) ? load<UShort_t>(file.data) : 0;
+    if ((header & 0xFFF0) == 0xCAE0) {
+	file.fields = header & 0xF;
+	file.start = 2;
+	file.trace_code = 1;
+    }
+    else {
+	file.fields = energy_field | short_field | trace_field;
+	file.start = 0;
+	file.trace_code = 0;
+    }
+    file.fixed_size = 16;
+    if (file.fields & energy_field)
+	file.fixed_size += 2;
+    if (file.fields & calibrated_field)
+	file.fixed_size += 8;
+    if (file.fields & short_field)
+	file.fixed_size += 2;
+
+    if (!is_valid(file)) {
+	std::cerr << "Not a CoMPASS list-mode file (or an unknown version), "
+		  << file.name << "\n";
+	munmap(const_cast<char*>(file.data), file.size);
+	file.size = 0;
+	return false;
+    }
+    return true;
+}
+
+// Whether the first records decode sensibly: a file holds one board and
+// channel, in time order
+bool list_mode::is_valid(const mapped_file& file) const
+{
+    std::size_t first = file.start;
+    std::size_t size = record_size(file, first);
+    if (size == 0) // too short to tell, or a trace past the end
+	return file.size - first <= file.fixed_size + file.trace_code + 4;
+    const char* a = file.data + first;
+    if (load<UShort_t>(a + 2) >= 64) // channels of a board
+	return false;
+
+    std::size_t second = first + size;
+    if (record_size(file, second) == 0)
+	return true;
+    const char* b = file.data + second;
+    return load<UShort_t>(b) == load<UShort_t>(a) &&
+	load<UShort_t>(b + 2) == load<UShort_t>(a + 2) &&
+	load<ULong64_t>(b + 4) >= load<ULong64_t>(a + 4);
+}
+
+// Size of the record at offset, 0 if it is cut off by the end of the file
+std::size_t list_mode::record_size(const mapped_file& file,
+				   std::size_t offset) const
+{
+    std::size_t size = file.fixed_size;
+    if (file.fields & trace_field) {
+	std::size_t count = size + file.trace_code; // of the samples
+	if (offset + count + 4 > file.size)
+	    return 0;
+	std::size_t num_samples = load<UInt_t>(file.data + offset + count);
+	size = count + 4 + 2*num_samples;
+    }
+    return (offset + size <= file.size) ? size : 0;
+}
+
+void list_mode::reset(cursor& c, std::vector<std::size_t>& offsets,
+		      ULong64_t entry)
+{
+    c.entry = entry;
+    c.offset = offsets;
+    c.heap.clear();
+    for (std::size_t f=0; f<files.size(); ++f)
+	push(c, f);
+}
+
+// Adds the next record of a file (if complete) to the merge
+void list_mode::push(cursor& c, int file_index)
+{
+    const mapped_file& file = files[file_index];
+    std::size_t offset = c.offset[file_index];
+    if (record_size(file, offset) == 0)
+	return;
+    c.heap.push_back(std::make_pair(load<ULong64_t>(file.data + offset + 4),
+				    file_index));
+    std::push_heap(c.heap.begin(), c.heap.end(), earliest_first());
+}
+
+// Takes the earliest record: (file, offset)
+std::pair<int, std::size_t> list_mode::pop(cursor& c)
+{
+    std::pop_heap(c.heap.begin(), c.heap.end(), earliest_first());
+    int f = c.heap.back().second;
+    c.heap.pop_back();
+
+    std::size_t offset = c.offset[f];
+    c.offset[f] += record_size(files[f], offset);
+    push(c, f);
+    ++c.entry;
+    return std::make_pair(f, offset);
+}
+
+// Moves to entry, from the closest index point unless it is just ahead
+void list_mode::seek(cursor& c, ULong64_t entry)
+{
+    if (entry > num_entries)
+	entry = num_entries;
+    if (c.offset.empty() || c.entry > entry ||
+	entry - c.entry >= index_step) {
+	if (index.empty()) {
+	    std::vector<std::size_t> offsets;
+	    for (auto& file : files)
+		offsets.push_back(file.start);
+	    reset(c, offsets, 0);
+	}
+	else {
+	    ULong64_t k = std::min<ULong64_t>(entry/index_step,
+					      index.size() - 1);
+	    reset(c, index[k], k*index_step);
+	}
+    }
+    while (c.entry < entry && !c.heap.empty())
+	pop(c);
+}
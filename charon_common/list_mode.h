@@ -0,0 +1,88 @@
+#ifndef LIST_MODE_H
+#define LIST_MODE_H
+
+#include "event_reader.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+// CAEN CoMPASS binary list-mode files (DPP-PSD), read in place
+//
+// The files are memory mapped and their records decoded straight into
+// event batches, merged by time stamp over all files (one per board and
+// channel, and the numbered continuations of a file). CoMPASS 2 files start
+// with a 16 bit header, 0xCAE0 | the fields present, and have records
+//     board (u16), channel (u16), time stamp (u64, ps),
+//     [energy (u16)], [calibrated energy (f64)], [short energy (u16)],
+//     flags (u32), [waveform code (u8), samples (u32), samples (u16 each)]
+// CoMPASS 1 files have no header and records with all of
+//     board, channel, time stamp, energy, short energy, flags,
+//     samples (u32), samples (u16 each)
+// Files whose first records do not look like either are not read.
+// and becomes an entry of the WaveformData tree:
+//     TimeStamp = time stamp in 4 ns ticks
+//     ChannelID = 16*board + channel
+//     PSDTotalIntegral = energy (long gate)
+//     PSDTailIntegral = energy - short energy
+// Entries are numbered in merged order, like the entries of a chain.
+class list_mode
+{
+public:
+    list_mode(std::vector<std::string>& file_names);
+    ~list_mode();
+
+    static bool is_list_mode(const std::string& file_name); // *.bin
+    ULong64_t entries() const { return num_entries; }
+    ULong64_t time_stamp(ULong64_t entry);
+
+    // A trace of a decoded record (samples are not aligned)
+    struct trace
+    {
+	std::size_t index; // in the batch
+	const char* samples;
+	std::size_t num_samples;
+    };
+
+    // Decodes entries [first, first + n) into batch, and lists the traces
+    // of the entries on trace_channel (none if -1); returns the number read
+    std::size_t read(ULong64_t first, std::size_t n, event_batch& batch,
+		     int trace_channel, std::vector<trace>& traces);
+
+private:
+    struct mapped_file
+    {
+	std::string name;
+	const char* data;
+	std::size_t size;
+	std::size_t start;      // first record
+	unsigned fields;        // header bits
+	std::size_t fixed_size; // record without the trace
+	std::size_t trace_code; // bytes before the number of samples
+    };
+
+    // Next record of every file, merged by time stamp
+    struct cursor
+    {
+	ULong64_t entry;
+	std::vector<std::size_t> offset;
+	std::vector<std::pair<ULong64_t, int>> heap; // (time stamp, file)
+    };
+
+    static const ULong64_t index_step {4096};
+
+    std::vector<mapped_file> files;
+    ULong64_t num_entries;
+    std::vector<std::vector<std::size_t>> index; // offsets every index_step
+    cursor stream; // read
+    cursor lookup; // time_stamp
+
+    bool map(mapped_file& file);
+    bool is_valid(const mapped_file& file) const;
+    std::size_t record_size(const mapped_file& file, std::size_t offset) const;
+    void reset(cursor& c, std::vector<std::size_t>& offsets, ULong64_t entry);
+    void push(cursor& c, int file_index);
+    std::pair<int, std::size_t> pop(cursor& c);
+    void seek(cursor& c, ULong64_t entry);
+};
+
+#endif
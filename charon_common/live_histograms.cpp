@@ -0,0 +1,302 @@
+#include "live_histograms.h"
+#include "TArrayD.h"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <thread>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::string live_shm_name(const std::string& name)
+{
+    return "/charon_" + name;
+}
+
+// Whether the segment shm_name was left behind by a writer that is gone
+static bool is_stale(const std::string& shm_name)
+{
+    int fd = shm_open(shm_name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+	return errno == ENOENT; // removed in the meantime
+    pid_t pid {0};
+    struct stat status;
+    if (fstat(fd, &status) == 0 &&
+	status.st_size >= static_cast<off_t>(sizeof(live_header))) {
+	void* address = mmap(0, sizeof(live_header), PROT_READ, MAP_SHARED,
+			     fd, 0);
+	if (address != MAP_FAILED) {
+	    pid = static_cast<live_header*>(address)->pid;
+	    munmap(address, sizeof(live_header));
+	}
+    }
+    close(fd);
+    return pid > 0 && kill(pid, 0) != 0 && errno == ESRCH;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Writer
+////////////////////////////////////////////////////////////////////////////////
+live_publisher::live_publisher()
+    :
+    segment {0}
+    ,header {0}
+    ,interval {std::chrono::seconds(1)}
+    ,pass {0}
+    ,span_first {0}
+    ,span_last {0}
+    ,last_time {0}
+    ,events {0}
+    ,window {0}
+    ,window_slope {1}
+    ,window_intercept {0}
+    ,done {false}
+{
+};
+
+live_publisher::~live_publisher()
+{
+    if (segment == 0)
+	return;
+    munmap(segment, header->size);
+    shm_unlink(shm_name.c_str());
+};
+
+// Creates the segment for histograms that keep their binning (TH1D, TH2D)
+bool live_publisher::open(const std::string& name,
+			  const std::vector<TH1*>& histograms,
+			  double interval_sec)
+{
+    std::vector<live_histogram> descriptors;
+    for (TH1* h : histograms) {
+	TArrayD* bins = dynamic_cast<TArrayD*>(h);
+	if (h == 0 || bins == 0)
+	    continue;
+	live_histogram d {};
+	std::strncpy(d.name, h->GetName(), sizeof(d.name) - 1);
+	d.nx = h->GetNbinsX();
+	d.x_min = h->GetXaxis()->GetXmin();
+	d.x_max = h->GetXaxis()->GetXmax();
+	if (h->GetDimension() == 2) {
+	    d.ny = h->GetNbinsY();
+	    d.y_min = h->GetYaxis()->GetXmin();
+	    d.y_max = h->GetYaxis()->GetXmax();
+	}
+	d.num_cells = h->GetNcells();
+	descriptors.push_back(d);
+	sources.push_back(h);
+    }
+
+    // Bins follow the descriptors
+    std::size_t bytes = sizeof(live_header)
+	+ descriptors.size()*sizeof(live_histogram);
+    for (auto& d : descriptors) {
+	d.offset = bytes;
+	bytes += d.num_cells*sizeof(double);
+    }
+
+    // The segment is only ever created here, so two jobs publishing under
+    // one name cannot truncate each other's; a writer that died leaves
+    // its segment behind, which is replaced
+    shm_name = live_shm_name(name);
+    int fd = shm_open(shm_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0 && errno == EEXIST && is_stale(shm_name)) {
+	shm_unlink(shm_name.c_str());
+	fd = shm_open(shm_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    }
+    if (fd < 0) {
+	if (errno == EEXIST) {
+	    std::cerr << "Live histograms " << shm_name << " are published "
+		      << "by another job, not publishing\n";
+	}
+	else {
+	    std::cerr << "Cannot create live histograms " << shm_name << ", "
+		      << std::strerror(errno) << "\n";
+	}
+	return false;
+    }
+    void* address {MAP_FAILED};
+    if (ftruncate(fd, bytes) == 0)
+	address = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+	std::cerr << "Cannot map live histograms " << shm_name << ", "
+		  << std::strerror(errno) << "\n";
+	shm_unlink(shm_name.c_str());
+	return false;
+    }
+
+    segment = static_cast<char*>(address);
+    header = new (segment) live_header; // the segment starts zeroed
+    header->size = bytes;
+    header->num_histograms = descriptors.size();
+    header->pid = getpid();
+    std::memcpy(segment + sizeof(live_header), descriptors.data(),
+		descriptors.size()*sizeof(live_histogram));
+    for (auto& d : descriptors)
+	targets.push_back(reinterpret_cast<double*>(segment + d.offset));
+
+    interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>
+	(std::chrono::duration<double>(interval_sec));
+    next_publish = std::chrono::steady_clock::now();
+
+    // Readers take the layout as valid once they see the magic number
+    header->version = live_version;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = live_magic;
+
+    std::cout << "\nLive histograms in " << shm_name << "\n";
+    return true;
+}
+
+// Called before the filling thread starts on the pass
+void live_publisher::set_pass(int pass_num, ULong64_t time_first,
+			      ULong64_t time_last)
+{
+    pass = pass_num;
+    span_first = time_first;
+    span_last = time_last;
+    last_time = time_first;
+    events = 0;
+}
+
+void live_publisher::set_window(double window_sec, double slope,
+				double intercept)
+{
+    window = window_sec;
+    window_slope = slope;
+    window_intercept = intercept;
+}
+
+void live_publisher::publish()
+{
+    if (header == 0)
+	return;
+
+    std::uint64_t sequence = header->sequence.load(std::memory_order_relaxed);
+    header->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    live_status& status = header->status;
+    status.pass = pass;
+    status.finished = done;
+    status.progress = 0;
+    if (span_last > span_first && last_time > span_first) {
+	status.progress = double(last_time - span_first)
+	    / double(span_last - span_first);
+	if (status.progress > 1)
+	    status.progress = 1;
+    }
+    status.window_sec = window;
+    status.slope = window_slope;
+    status.intercept = window_intercept;
+    status.num_events = events;
+    ++status.num_updates;
+    for (std::size_t i=0; i<sources.size(); ++i) {
+	const TArrayD* bins = dynamic_cast<const TArrayD*>(sources[i]);
+	std::memcpy(targets[i], bins->GetArray(),
+		    sources[i]->GetNcells()*sizeof(double));
+    }
+
+    header->sequence.store(sequence + 2, std::memory_order_release);
+    next_publish = std::chrono::steady_clock::now() + interval;
+}
+
+void live_publisher::finish()
+{
+    done = true;
+    publish();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Reader
+////////////////////////////////////////////////////////////////////////////////
+live_reader::live_reader()
+    :
+    segment {0}
+    ,size {0}
+    ,header {0}
+{
+};
+
+live_reader::~live_reader()
+{
+    if (segment != 0)
+	munmap(const_cast<char*>(segment), size);
+};
+
+bool live_reader::attach(const std::string& name)
+{
+    std::string shm_name = live_shm_name(name);
+    int fd = shm_open(shm_name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+	std::cerr << "No live histograms " << shm_name << "\n";
+	return false;
+    }
+    struct stat info;
+    void* address {MAP_FAILED};
+    if (fstat(fd, &info) == 0 &&
+	static_cast<std::size_t>(info.st_size) >= sizeof(live_header))
+	address = mmap(0, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+	std::cerr << "Cannot map live histograms " << shm_name << "\n";
+	return false;
+    }
+    segment = static_cast<const char*>(address);
+    size = info.st_size;
+    header = reinterpret_cast<const live_header*>(segment);
+
+    // A job that just started may not have set it up yet
+    for (int i=0; i<100 && header->magic != live_magic; ++i)
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header->magic != live_magic || header->version != live_version ||
+	header->size > size) {
+	std::cerr << shm_name << " is not a version " << live_version
+		  << " live histogram segment\n";
+	return false;
+    }
+
+    const live_histogram* descriptors
+	= reinterpret_cast<const live_histogram*>(segment
+						   + sizeof(live_header));
+    histograms.assign(descriptors, descriptors + header->num_histograms);
+    return true;
+}
+
+int live_reader::writer_pid() const
+{
+    return (header != 0) ? header->pid : 0;
+}
+
+bool live_reader::snapshot(live_snapshot& copy, int max_tries) const
+{
+    if (header == 0)
+	return false;
+
+    copy.histograms = histograms;
+    copy.bins.resize(histograms.size());
+    for (std::size_t i=0; i<histograms.size(); ++i)
+	copy.bins[i].resize(histograms[i].num_cells);
+
+    for (int t=0; t<max_tries; ++t) {
+	std::uint64_t before = header->sequence.load(std::memory_order_acquire);
+	if (before % 2 == 1) {
+	    std::this_thread::yield();
+	    continue;
+	}
+	std::memcpy(&copy.status, &header->status, sizeof(live_status));
+	for (std::size_t i=0; i<histograms.size(); ++i) {
+	    std::memcpy(copy.bins[i].data(), segment + histograms[i].offset,
+			histograms[i].num_cells*sizeof(double));
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (header->sequence.load(std::memory_order_relaxed) == before)
+	    return true;
+    }
+    return false;
+}
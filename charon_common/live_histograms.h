@@ -0,0 +1,145 @@
+#ifndef LIVE_HISTOGRAMS_H
+#define LIVE_HISTOGRAMS_H
+
+#include "TH1.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Histograms of a running job, published in POSIX shared memory
+//
+// The segment (/dev/shm/charon_<name>) holds a header, one descriptor per
+// histogram and the bin contents (doubles, under/overflow included, x
+// fastest). Descriptors do not change once the magic number is set. The
+// status and the bins are written under a sequence number that is odd
+// while the writer updates them. A reader copies them and keeps the copy
+// only if the number was even and unchanged around the copy, so the writer
+// never waits and any number of readers can attach.
+const std::uint32_t live_magic {0x4e524843}; // "CHRN"
+const std::uint32_t live_version {1};
+
+struct live_status
+{
+    std::int32_t pass;     // 0 uncut (calibration), 1 clean
+    std::int32_t finished; // the histograms are final
+    double progress;       // fraction of the time span of the pass
+    double window_sec;     // start of the current calibration window
+    double slope;          // its calibration, MeV/ADC
+    double intercept;
+    std::uint64_t num_events;  // histogrammed in this pass
+    std::uint64_t num_updates;
+};
+
+struct live_histogram
+{
+    char name[32];
+    std::uint32_t nx;
+    std::uint32_t ny; // 0 for a TH1
+    double x_min;
+    double x_max;
+    double y_min;
+    double y_max;
+    std::uint64_t offset;    // of the bins, bytes from the segment start
+    std::uint64_t num_cells; // with under/overflow
+};
+
+struct live_header
+{
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint64_t size; // bytes of the segment
+    std::uint32_t num_histograms;
+    std::int32_t pid;   // of the writer
+    std::atomic<std::uint64_t> sequence;
+    live_status status;
+};
+
+// Publishes histograms while they are filled
+//
+// publish() copies them, so it is called by the thread that fills them, at
+// most every interval. The calibration may be set from another thread.
+class live_publisher
+{
+public:
+    live_publisher();
+    ~live_publisher(); // removes the segment (attached readers keep it)
+    live_publisher(const live_publisher&) = delete;
+    live_publisher& operator=(const live_publisher&) = delete;
+
+    bool open(const std::string& name, const std::vector<TH1*>& histograms,
+	      double interval_sec = 1);
+    bool enabled() const { return header != 0; }
+
+    void set_pass(int pass, ULong64_t time_first, ULong64_t time_last);
+    void set_window(double window_sec, double slope, double intercept);
+
+    // Called after every batch of the filling thread
+    void update(ULong64_t time_stamp, std::size_t num_events)
+    {
+	if (header == 0)
+	    return;
+	last_time = time_stamp;
+	events += num_events;
+	if (std::chrono::steady_clock::now() >= next_publish)
+	    publish();
+    }
+
+    void publish();
+    void finish(); // marks the histograms final and publishes them
+
+private:
+    std::string shm_name;
+    char* segment;
+    live_header* header;
+    std::vector<TH1*> sources;
+    std::vector<double*> targets;
+
+    std::chrono::steady_clock::duration interval;
+    std::chrono::steady_clock::time_point next_publish;
+    int pass;
+    ULong64_t span_first;
+    ULong64_t span_last;
+    ULong64_t last_time;
+    std::uint64_t events;
+    std::atomic<double> window;
+    std::atomic<double> window_slope;
+    std::atomic<double> window_intercept;
+    bool done;
+};
+
+// Consistent copy of a segment
+struct live_snapshot
+{
+    live_status status;
+    std::vector<live_histogram> histograms;
+    std::vector<std::vector<double>> bins; // per histogram
+};
+
+// Attaches to the segment of a job and copies it without blocking the job
+class live_reader
+{
+public:
+    live_reader();
+    ~live_reader();
+    live_reader(const live_reader&) = delete;
+    live_reader& operator=(const live_reader&) = delete;
+
+    bool attach(const std::string& name);
+    int writer_pid() const;
+
+    // False if the writer kept changing the segment over max_tries copies
+    bool snapshot(live_snapshot& copy, int max_tries = 1000) const;
+
+private:
+    const char* segment;
+    std::size_t size;
+    const live_header* header;
+    std::vector<live_histogram> histograms;
+};
+
+// Shared memory name of a live name ("run17" is "/charon_run17")
+std::string live_shm_name(const std::string& name);
+
+#endif
@@ -0,0 +1,248 @@
+#include "memory_budget.h"
+#include <cctype>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+const char* subsystem_names[num_memory_subsystems] {
+    "event_buffers", "histograms", "fit_workspaces", "io_caches"
+};
+
+// Raises peak to value if it is higher
+void raise(std::atomic<std::size_t>& peak, std::size_t value)
+{
+    std::size_t old = peak.load();
+    while (value > old && !peak.compare_exchange_weak(old, value)) {}
+}
+
+// Peak resident set size of the process (VmHWM), 0 if unknown
+std::size_t peak_rss()
+{
+    std::ifstream f_stream("/proc/self/status");
+    std::string line;
+    while (std::getline(f_stream, line)) {
+	if (line.compare(0, 6, "VmHWM:") == 0)
+	    return std::stoul(line.substr(6))*1024;
+    }
+    return 0;
+}
+
+double megabytes(std::size_t bytes)
+{
+    return bytes/1048576.0;
+}
+
+} // namespace
+
+memory_budget::memory_budget()
+    :
+    budget {0}
+    ,total {0}
+    ,total_peak {0}
+    ,breakdown_total {0}
+{
+    for (int s=0; s<num_memory_subsystems; ++s) {
+	current[s] = 0;
+	peak[s] = 0;
+	breakdown[s] = 0;
+    }
+};
+
+void memory_budget::set_limit(std::size_t bytes)
+{
+    budget = bytes;
+}
+
+void memory_budget::charge(memory_subsystem subsystem, std::size_t bytes)
+{
+    if (bytes == 0)
+	return;
+    std::size_t now = total += bytes;
+    if (budget > 0 && now > budget) {
+	total -= bytes;
+	std::stringstream message;
+	message << "Memory budget of " << megabytes(budget)
+		<< " MB exceeded: " << megabytes(bytes) << " MB more for "
+		<< subsystem_names[subsystem] << " with "
+		<< megabytes(now - bytes) << " MB in use";
+	throw std::runtime_error(message.str());
+    }
+    raise(peak[subsystem], current[subsystem] += bytes);
+
+    std::size_t old = total_peak.load();
+    if (now <= old)
+	return;
+    raise(total_peak, now);
+
+    // Breakdown of the new high-water mark
+    std::lock_guard<std::mutex> lock(mutex);
+    if (now < breakdown_total)
+	return;
+    breakdown_total = now;
+    for (int s=0; s<num_memory_subsystems; ++s)
+	breakdown[s] = current[s].load();
+}
+
+void memory_budget::release(memory_subsystem subsystem, std::size_t bytes)
+{
+    current[subsystem] -= bytes;
+    total -= bytes;
+}
+
+bool memory_budget::fits(std::size_t bytes) const
+{
+    return budget == 0 || in_use() + bytes <= budget;
+}
+
+bool memory_budget::pressure() const
+{
+    return budget > 0 && in_use() > budget/4*3;
+}
+
+std::size_t memory_budget::headroom() const
+{
+    if (budget == 0)
+	return std::numeric_limits<std::size_t>::max();
+    std::size_t used = in_use();
+    return (used < budget) ? budget - used : 0;
+}
+
+void memory_budget::degraded(const std::string& action)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (degradations[action]++ == 0)
+	std::cout << "\nMemory budget: " << action << "\n";
+}
+
+// Table of the high-water marks
+void memory_budget::print() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::cout << "\n\nMemory [MB] (budget "
+	      << (budget > 0 ? megabytes(budget) : 0) << "):\n\n"
+	      << std::left << std::setw(24) << "Subsystem" << std::right
+	      << std::setw(12) << "In use" << std::setw(12) << "Peak"
+	      << std::setw(12) << "At peak" << "\n"
+	      << std::fixed << std::setprecision(1);
+    for (int s=0; s<num_memory_subsystems; ++s) {
+	std::cout << std::left << std::setw(24) << subsystem_names[s]
+		  << std::right << std::setw(12) << megabytes(current[s])
+		  << std::setw(12) << megabytes(peak[s])
+		  << std::setw(12) << megabytes(breakdown[s]) << "\n";
+    }
+    std::cout << std::left << std::setw(24) << "total" << std::right
+	      << std::setw(12) << megabytes(total)
+	      << std::setw(12) << megabytes(total_peak)
+	      << std::setw(12) << megabytes(breakdown_total) << "\n"
+	      << std::left << std::setw(24) << "peak RSS" << std::right
+	      << std::setw(24) << megabytes(peak_rss()) << "\n"
+	      << std::defaultfloat;
+    for (auto& d : degradations)
+	std::cout << "Degraded " << d.second << "x: " << d.first << "\n";
+    std::cout << std::endl;
+}
+
+// Bytes, with the breakdown at the peak of the total and the peak RSS of
+// the process for comparison
+bool memory_budget::write_report(const std::string& file_name) const
+{
+    std::ofstream f_stream(file_name.c_str());
+    if (!f_stream) {
+	std::cerr << "Cannot write memory report, " << file_name << "\n";
+	return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    f_stream << "{\n"
+	     << "  \"limit_bytes\": " << budget << ",\n"
+	     << "  \"in_use_bytes\": " << total << ",\n"
+	     << "  \"high_water_bytes\": " << total_peak << ",\n"
+	     << "  \"peak_rss_bytes\": " << peak_rss() << ",\n"
+	     << "  \"subsystems\": {\n";
+    for (int s=0; s<num_memory_subsystems; ++s) {
+	f_stream << "    \"" << subsystem_names[s] << "\": {"
+		 << "\"in_use_bytes\": " << current[s] << ", "
+		 << "\"high_water_bytes\": " << peak[s] << ", "
+		 << "\"at_total_high_water_bytes\": " << breakdown[s] << "}"
+		 << (s+1 < num_memory_subsystems ? ",\n" : "\n");
+    }
+    f_stream << "  },\n"
+	     << "  \"degradations\": {";
+    std::size_t n {0};
+    for (auto& d : degradations) {
+	f_stream << (n++ == 0 ? "\n" : ",\n")
+		 << "    \"" << d.first << "\": " << d.second;
+    }
+    f_stream << (n > 0 ? "\n  }\n" : "}\n")
+	     << "}\n";
+    return true;
+}
+
+memory_budget& memory()
+{
+    static memory_budget budget;
+    return budget;
+}
+
+std::size_t parse_bytes(const std::string& text)
+{
+    std::stringstream stream(text);
+    double value {0};
+    char unit {0};
+    stream >> value >> unit;
+    switch (std::toupper(unit)) {
+    case 'T':
+	value *= 1024;
+	// fall through
+    case 'G':
+	value *= 1024;
+	// fall through
+    case 'M':
+	value *= 1024;
+	// fall through
+    case 'K':
+	value *= 1024;
+	break;
+    default:
+	break;
+    }
+    return (value > 0) ? static_cast<std::size_t>(value) : 0;
+}
+
+std::size_t histogram_bytes(const TH1* h)
+{
+    if (h == 0)
+	return 0;
+    std::size_t cells = h->GetNcells();
+    return cells*sizeof(double) + h->GetSumw2N()*sizeof(double);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Charges
+////////////////////////////////////////////////////////////////////////////////
+memory_charge::memory_charge(memory_subsystem charged, std::size_t num_bytes)
+    :
+    subsystem {charged}
+    ,bytes {num_bytes}
+{
+    memory().charge(subsystem, bytes);
+};
+
+memory_charge::~memory_charge()
+{
+    memory().release(subsystem, bytes);
+};
+
+void memory_charge::resize(std::size_t num_bytes)
+{
+    if (num_bytes > bytes)
+	memory().charge(subsystem, num_bytes - bytes);
+    else
+	memory().release(subsystem, bytes - num_bytes);
+    bytes = num_bytes;
+}
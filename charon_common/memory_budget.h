@@ -0,0 +1,92 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include "TH1.h"
+#include <atomic>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+
+// Accounted parts of a job
+enum memory_subsystem
+{
+    mem_event_buffers,  // pipeline batches, kept events
+    mem_histograms,
+    mem_fit_workspaces, // bootstrap replicas, response matrix
+    mem_io_caches,      // tree cache
+    num_memory_subsystems
+};
+
+// Bytes in use per subsystem, against an optional budget
+//
+// Only the large allocations are charged, so the budget should leave room
+// for ROOT itself. The accounting is per process: concurrent daemon jobs
+// share one budget. Code that can make do with less asks first and
+// degrades: smaller batches, a smaller tree cache, fewer bootstrap
+// threads, fewer concurrent daemon jobs. Each degradation is counted. A
+// charge that still does not fit throws std::runtime_error, which fails
+// the job.
+//
+// Every subsystem keeps its high-water mark. The high-water mark of the
+// total keeps the breakdown at that moment.
+class memory_budget
+{
+public:
+    memory_budget();
+
+    void set_limit(std::size_t bytes); // 0: no limit
+    std::size_t limit() const { return budget; }
+
+    void charge(memory_subsystem subsystem, std::size_t bytes); // throws
+    void release(memory_subsystem subsystem, std::size_t bytes);
+
+    std::size_t in_use() const { return total.load(); }
+    bool fits(std::size_t bytes) const; // still within the budget
+    bool pressure() const;              // above 3/4 of the budget
+    std::size_t headroom() const;       // unlimited without a budget
+    void degraded(const std::string& action);
+
+    void print() const;
+    bool write_report(const std::string& file_name) const; // JSON
+
+private:
+    std::size_t budget;
+    std::atomic<std::size_t> current[num_memory_subsystems];
+    std::atomic<std::size_t> peak[num_memory_subsystems];
+    std::atomic<std::size_t> total;
+    std::atomic<std::size_t> total_peak;
+
+    mutable std::mutex mutex; // guards the rest
+    std::size_t breakdown_total;
+    std::size_t breakdown[num_memory_subsystems]; // at the total peak
+    std::map<std::string, unsigned long> degradations;
+};
+
+// The budget of this process
+memory_budget& memory();
+
+// Sizes such as "512M" or "4G" (K, M, G, T; plain bytes without a suffix)
+std::size_t parse_bytes(const std::string& text);
+
+// Bytes of the bin contents (and errors) of h, 0 if there is no h
+std::size_t histogram_bytes(const TH1* h);
+
+// Charge that follows an allocation and is released with it
+class memory_charge
+{
+public:
+    memory_charge(memory_subsystem charged, std::size_t num_bytes = 0);
+    ~memory_charge();
+    memory_charge(const memory_charge&) = delete;
+    memory_charge& operator=(const memory_charge&) = delete;
+
+    void resize(std::size_t num_bytes);
+    std::size_t size() const { return bytes; }
+
+private:
+    memory_subsystem subsystem;
+    std::size_t bytes;
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include "peak_search.h"
+#include "TMath.h"
+#include <algorithm>
+#include <cmath>
+
+std::vector<double> find_peaks(TH1D* h, double sigma,
+			       double min_significance)
+{
+    int num_bins = h->GetNbinsX();
+    int half = static_cast<int>(std::ceil(3*sigma));
+
+    // Second derivative of a gaussian, shifted to sum to 0 so that a
+    // constant background gives nothing
+    std::vector<double> kernel(2*half + 1);
+    double sum {0};
+    for (int k=-half; k<=half; ++k) {
+	double u = k/sigma;
+	kernel[k + half] = (u*u - 1)*TMath::Exp(-u*u/2);
+	sum += kernel[k + half];
+    }
+    for (auto& w : kernel)
+	w -= sum/kernel.size();
+
+    // Depth (positive at a peak) and its significance, away from the ends
+    std::vector<double> significance(num_bins + 2, 0);
+    for (int bin=1+half; bin<=num_bins-half; ++bin) {
+	double depth {0};
+	double variance {0};
+	for (int k=-half; k<=half; ++k) {
+	    double counts = h->GetBinContent(bin + k);
+	    depth -= kernel[k + half]*counts;
+	    variance += kernel[k + half]*kernel[k + half]*counts;
+	}
+	if (variance > 0)
+	    significance[bin] = depth/TMath::Sqrt(variance);
+    }
+
+    std::vector<std::pair<double, int>> found;
+    for (int bin=2; bin<num_bins; ++bin) {
+	double s = significance[bin];
+	if (s >= min_significance && s > significance[bin-1] &&
+	    s >= significance[bin+1])
+	    found.push_back(std::make_pair(s, bin));
+    }
+    std::sort(found.rbegin(), found.rend());
+
+    std::vector<double> peaks;
+    for (auto& peak : found)
+	peaks.push_back(h->GetBinCenter(peak.second));
+    return peaks;
+}
+
+bool find_peak_bounds(TH1D* h, std::vector<int>& bounds)
+{
+    const double e_photo {4.438};
+    const double e_escape {3.927};
+    const double e_low {2.2};
+    const double ratio = (e_photo - e_escape)/(e_photo - e_low);
+    const double tolerance {0.1}; // relative, of the ratio
+    const double half_width {0.2}; // MeV
+
+    // The strongest few are enough, and keep the search small
+    std::vector<double> peaks = find_peaks(h);
+    if (peaks.size() > 12)
+	peaks.resize(12);
+
+    double best_score {-1};
+    double best[3] {0, 0, 0};
+    for (double p : peaks) {
+	for (double s : peaks) {
+	    if (s >= p)
+		continue;
+	    for (double l : peaks) {
+		if (l >= s)
+		    continue;
+		double error = TMath::Abs((p - s)/(p - l) - ratio)/ratio;
+		if (error > tolerance)
+		    continue;
+
+		// Line through the photopeak and the 2.2 MeV peak
+		double gain = (e_photo - e_low)/(p - l);
+		double offset = e_photo - gain*p;
+		double score = error + TMath::Abs(offset)/e_photo;
+		if (best_score < 0 || score < best_score) {
+		    best_score = score;
+		    best[0] = p;
+		    best[1] = s;
+		    best[2] = l;
+		}
+	    }
+	}
+    }
+    if (best_score < 0)
+	return false;
+
+    double width = half_width*(best[0] - best[2])/(e_photo - e_low);
+    bounds.clear();
+    for (double peak : best) {
+	bounds.push_back(static_cast<int>(peak + width));
+	bounds.push_back(static_cast<int>(peak - width));
+    }
+    return true;
+}
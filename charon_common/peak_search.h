@@ -0,0 +1,28 @@
+#ifndef PEAK_SEARCH_H
+#define PEAK_SEARCH_H
+
+#include "TH1D.h"
+#include <vector>
+
+// Peaks of a spectrum from its smoothed second derivative
+//
+// The spectrum is convolved with the second derivative of a gaussian
+// (sigma in bins), which is flat on a smooth background and strongly
+// negative at a peak. Local minima whose depth is at least min_significance
+// times its statistical error are peaks. Returns the bin centers, largest
+// significance first.
+std::vector<double> find_peaks(TH1D* h, double sigma = 4,
+			       double min_significance = 5);
+
+// Calibration peak bounds from an uncalibrated (ADC) spectrum
+//
+// The 4.438 MeV photopeak, its single escape peak (3.927 MeV) and the
+// 2.2 MeV peak are picked out of the found peaks by their spacing. For
+// any gain and offset, (P - S)/(P - H) = 0.511/2.238. The triple with that
+// ratio and the smallest implied offset wins. The bounds reach 0.2 MeV to
+// either side of each peak, less than half the 0.511 MeV between the two
+// close peaks. bounds gets upper, lower ADC pairs in the order of a bound
+// file. Returns false if no triple fits.
+bool find_peak_bounds(TH1D* h, std::vector<int>& bounds);
+
+#endif
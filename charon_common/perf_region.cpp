@@ -0,0 +1,175 @@
+#include "perf_region.h"
+
+#ifdef CHARON_PERF
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace {
+
+const int num_counters {4};
+const char* counter_names[num_counters] {"cycles", "instructions",
+					  "LLC misses", "branch misses"};
+
+struct region_totals
+{
+    unsigned long long calls;
+    unsigned long long count[num_counters];
+};
+
+// Counter groups that could not be opened (reported once)
+std::once_flag open_failed;
+
+// One counter group per thread, opened on its first region
+struct counter_group
+{
+    int fd[num_counters];
+    bool available;
+
+    counter_group()
+	:
+	available {false}
+    {
+	const unsigned long long config[num_counters] {
+	    PERF_COUNT_HW_CPU_CYCLES,
+	    PERF_COUNT_HW_INSTRUCTIONS,
+	    PERF_COUNT_HW_CACHE_MISSES,
+	    PERF_COUNT_HW_BRANCH_MISSES
+	};
+
+	int leader {-1};
+	for (int i=0; i<num_counters; ++i) {
+	    perf_event_attr attr;
+	    std::memset(&attr, 0, sizeof(attr));
+	    attr.type = PERF_TYPE_HARDWARE;
+	    attr.size = sizeof(attr);
+	    attr.config = config[i];
+	    attr.disabled = (i == 0);
+	    attr.exclude_kernel = 1;
+	    attr.exclude_hv = 1;
+	    attr.read_format = PERF_FORMAT_GROUP;
+	    fd[i] = syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+	    if (fd[i] < 0) {
+		int error = errno;
+		std::call_once(open_failed, [i, error] {
+		    std::cerr << "perf_event_open failed for "
+			      << counter_names[i] << " ("
+			      << std::strerror(error) << "), "
+			      << "performance counters disabled\n";
+		});
+		for (int j=0; j<i; ++j)
+		    close(fd[j]);
+		return;
+	    }
+	    if (i == 0)
+		leader = fd[0];
+	}
+	ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	available = true;
+    }
+
+    ~counter_group()
+    {
+	if (!available)
+	    return;
+	for (int i=0; i<num_counters; ++i)
+	    close(fd[i]);
+    }
+
+    void read_all(unsigned long long* values)
+    {
+	// PERF_FORMAT_GROUP layout: nr, then one value per counter
+	unsigned long long buf[1 + num_counters] {};
+	if (available &&
+	    read(fd[0], buf, sizeof(buf)) == static_cast<ssize_t>(sizeof(buf))) {
+	    for (int i=0; i<num_counters; ++i)
+		values[i] = buf[1 + i];
+	}
+	else {
+	    for (int i=0; i<num_counters; ++i)
+		values[i] = 0;
+	}
+    }
+};
+
+counter_group& counters()
+{
+    thread_local counter_group group;
+    return group;
+}
+
+// Totals of every thread, merged as each region ends
+std::mutex regions_mutex;
+
+std::map<std::string, region_totals>& regions()
+{
+    static std::map<std::string, region_totals> totals;
+    return totals;
+}
+
+} // namespace
+
+perf_region::perf_region(const char* name)
+    :
+    region_name {name}
+{
+    counters().read_all(start);
+}
+
+perf_region::~perf_region()
+{
+    unsigned long long stop[num_counters];
+    counters().read_all(stop);
+    if (!counters().available)
+	return;
+
+    std::lock_guard<std::mutex> lock(regions_mutex);
+    region_totals& totals = regions()[region_name];
+    ++totals.calls;
+    for (int i=0; i<num_counters; ++i)
+	totals.count[i] += stop[i] - start[i];
+}
+
+void perf_report()
+{
+    std::lock_guard<std::mutex> lock(regions_mutex);
+    if (regions().empty())
+	return;
+
+    std::cout << "\n\nPerformance counters per region:\n\n"
+	      << std::left << std::setw(24) << "Region"
+	      << std::right << std::setw(8) << "Calls";
+    for (int i=0; i<num_counters; ++i)
+	std::cout << std::setw(16) << counter_names[i];
+    std::cout << std::setw(8) << "IPC"
+	      << std::setw(12) << "LLC/kinst"
+	      << std::setw(12) << "br/kinst" << "\n";
+
+    for (auto& region : regions()) {
+	region_totals& t = region.second;
+	double kinst = t.count[1] > 0 ? t.count[1]/1000.0 : 1;
+	std::cout << std::left << std::setw(24) << region.first
+		  << std::right << std::setw(8) << t.calls;
+	for (int i=0; i<num_counters; ++i)
+	    std::cout << std::setw(16) << t.count[i];
+	std::cout << std::fixed << std::setprecision(2)
+		  << std::setw(8)
+		  << (t.count[0] > 0 ? double(t.count[1])/t.count[0] : 0.0)
+		  << std::setw(12) << t.count[2]/kinst
+		  << std::setw(12) << t.count[3]/kinst << "\n"
+		  << std::defaultfloat;
+    }
+    std::cout << std::endl;
+}
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef PERF_REGION_H
+#define PERF_REGION_H
+
+// Hardware performance counters per named code region (Linux only)
+//
+// Build with "make PERF=1" to enable. Otherwise PERF_REGION expands to
+// nothing and perf_report does nothing, so there is no cost.
+//
+// Usage:
+//     {
+//         PERF_REGION("time_cut events");
+//         ... hot loop ...
+//     }
+//     perf_report(); // prints one row per region
+//
+// Each thread counts with its own counters, and the totals of a region
+// are summed over the threads that ran it. Regions are inclusive (a
+// nested region is also counted in its parent).
+
+#ifdef CHARON_PERF
+
+class perf_region
+{
+public:
+    perf_region(const char* name);
+    ~perf_region();
+
+private:
+    const char* region_name;
+    unsigned long long start[4];
+};
+
+#define PERF_CONCAT_(a, b) a##b
+#define PERF_CONCAT(a, b) PERF_CONCAT_(a, b)
+#define PERF_REGION(name) perf_region PERF_CONCAT(perf_scope_, __LINE__)(name)
+
+void perf_report();
+
+#else
+
+#define PERF_REGION(name)
+inline void perf_report() {}
+
+#endif
+
+#endif
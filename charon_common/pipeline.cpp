@@ -0,0 +1,316 @@
+#include "pipeline.h"
+#include "perf_region.h"
+#include <stdexcept>
+
+namespace {
+
+// Bytes of the columns of a batch (the same for both kinds)
+std::size_t batch_bytes(std::size_t capacity)
+{
+    return capacity*(sizeof(ULong64_t) + sizeof(int) + 2*sizeof(double)
+		     + sizeof(char));
+}
+
+} // namespace
+
+std::size_t budget_batch_capacity()
+{
+    if (!memory().pressure())
+	return 4096;
+    memory().degraded("smaller event batches");
+    return 1024;
+}
+
+calibrated_batch::calibrated_batch(std::size_t capacity)
+    :
+    size {0}
+    ,time_stamp(capacity)
+    ,channel(capacity)
+    ,energy(capacity)
+    ,ratio(capacity)
+    ,pileup(capacity)
+{
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Reader stage
+////////////////////////////////////////////////////////////////////////////////
+reader_stage::reader_stage(event_reader& event_source, ULong64_t first,
+			   ULong64_t last, int num_batches)
+    :
+    reader (event_source)
+    ,batches(num_batches)
+    ,full_queue(num_batches + 1)
+    ,free_queue(num_batches)
+    ,buffer_memory(mem_event_buffers,
+		   num_batches*batch_bytes(event_source.batch_capacity()))
+    ,done {false}
+{
+    for (auto& batch : batches)
+	free_queue.push(&batch);
+    worker = std::thread(&reader_stage::run, this, first, last);
+};
+
+reader_stage::~reader_stage()
+{
+    // Drain so the reader can finish if we stopped early
+    while (!done) {
+	event_batch* batch = next();
+	if (batch != 0)
+	    recycle(batch);
+    }
+    worker.join();
+};
+
+void reader_stage::run(ULong64_t first, ULong64_t last)
+{
+    ULong64_t entry {first};
+    while (true) {
+	event_batch* batch = free_queue.pop();
+	bool more;
+	{
+	    PERF_REGION("reader stage");
+	    more = reader.read(entry, last, *batch);
+	}
+	if (!more)
+	    break;
+	entry += batch->size;
+	full_queue.push(batch);
+    }
+    full_queue.push(0); // end of data
+}
+
+event_batch* reader_stage::next()
+{
+    if (done)
+	return 0;
+    event_batch* batch = full_queue.pop();
+    if (batch == 0)
+	done = true;
+    return batch;
+}
+
+void reader_stage::recycle(event_batch* batch)
+{
+    free_queue.push(batch);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Filler stage
+////////////////////////////////////////////////////////////////////////////////
+filler_stage::filler_stage(std::function<void(calibrated_batch&)> fill_function,
+			   std::size_t batch_capacity, int num_batches)
+    :
+    fill_fn {fill_function}
+    ,capacity {batch_capacity}
+    ,full_queue(max_batches)
+    ,free_queue(max_batches)
+    ,buffer_memory(mem_event_buffers, num_batches*batch_bytes(batch_capacity))
+    ,finished {false}
+    ,num_pushed {0}
+    ,num_filled {0}
+{
+    for (int i=0; i<num_batches; ++i)
+	batches.push_back(new calibrated_batch(capacity));
+    for (auto batch : batches)
+	free_queue.push(batch);
+    worker = std::thread(&filler_stage::run, this);
+};
+
+filler_stage::~filler_stage()
+{
+    finish();
+    for (auto batch : batches)
+	delete batch;
+};
+
+// A free batch, or a new one if all of them are in use (a time window
+// may hold more batches than the pool) and both the pool limit and the
+// memory budget allow it; otherwise waits for the filler to free one
+calibrated_batch* filler_stage::get_free()
+{
+    calibrated_batch* batch {0};
+    if (!spare.empty()) {
+	batch = spare.back();
+	spare.pop_back();
+    }
+    else if (!free_queue.try_pop(batch)) {
+	if (batches.size() < max_batches &&
+	    memory().fits(batch_bytes(capacity))) {
+	    batch = new calibrated_batch(capacity);
+	    batches.push_back(batch);
+	    buffer_memory.resize(batches.size()*batch_bytes(capacity));
+	}
+	else {
+	    batch = free_queue.pop();
+	}
+    }
+    batch->size = 0;
+    return batch;
+}
+
+// False if the caller holds num_held batches back and they are the whole
+// pool, which cannot grow; get_free() would then wait forever. Otherwise
+// the filler frees one in time, so the answer does not depend on how far
+// the filler got.
+bool filler_stage::can_hold(std::size_t num_held) const
+{
+    return num_held < batches.size() ||
+	(batches.size() < max_batches && memory().fits(batch_bytes(capacity)));
+}
+
+void filler_stage::push(calibrated_batch* batch)
+{
+    ++num_pushed;
+    full_queue.push(batch);
+}
+
+// Afterwards everything pushed so far is in the histograms
+void filler_stage::drain()
+{
+    while (num_filled.load(std::memory_order_acquire) != num_pushed)
+	std::this_thread::yield();
+}
+
+// Only the filler thread pushes to free_queue, so batches given back by
+// the caller are kept aside
+void filler_stage::recycle(calibrated_batch* batch)
+{
+    batch->size = 0;
+    spare.push_back(batch);
+}
+
+void filler_stage::run()
+{
+    while (true) {
+	calibrated_batch* batch = full_queue.pop();
+	if (batch == 0)
+	    break;
+	{
+	    PERF_REGION("filler stage");
+	    fill_fn(*batch);
+	}
+	batch->size = 0;
+	free_queue.push(batch);
+	num_filled.fetch_add(1, std::memory_order_release);
+    }
+}
+
+void filler_stage::finish()
+{
+    if (finished)
+	return;
+    full_queue.push(0);
+    worker.join();
+    finished = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Window events
+////////////////////////////////////////////////////////////////////////////////
+window_events::window_events(filler_stage& filler_stage)
+    :
+    filler (filler_stage)
+    ,spill_file {0}
+    ,spilled {0}
+{
+};
+
+window_events::~window_events()
+{
+    if (spill_file != 0)
+	std::fclose(spill_file);
+};
+
+calibrated_batch* window_events::add(calibrated_batch* batch)
+{
+    // Once spilling, the rest of the window follows in the file
+    if (spilled == 0 && filler.can_hold(held.size() + 1)) {
+	held.push_back(batch);
+	return filler.get_free();
+    }
+    spill(*batch);
+    batch->size = 0;
+    return batch;
+}
+
+void window_events::close(calibrated_batch* batch)
+{
+    if (spilled == 0) {
+	held.push_back(batch);
+	return;
+    }
+    spill(*batch);
+    filler.recycle(batch);
+}
+
+// The spilled batches are read into batches of the pool, freed by fn
+// handing on the held ones
+void window_events::take(std::function<void(calibrated_batch*)> fn)
+{
+    for (auto batch : held)
+	fn(batch);
+    held.clear();
+    if (spilled == 0)
+	return;
+
+    std::rewind(spill_file);
+    for (std::size_t k=0; k<spilled; ++k) {
+	calibrated_batch* batch = filler.get_free();
+	unspill(*batch);
+	fn(batch);
+    }
+    spilled = 0;
+    std::rewind(spill_file);
+}
+
+void window_events::discard()
+{
+    for (auto batch : held)
+	filler.recycle(batch);
+    held.clear();
+    spilled = 0;
+    if (spill_file != 0)
+	std::rewind(spill_file);
+}
+
+void window_events::spill(const calibrated_batch& batch)
+{
+    if (spill_file == 0) {
+	spill_file = std::tmpfile();
+	if (spill_file == 0)
+	    throw std::runtime_error("Cannot create a file for the events of "
+				     "a calibration window");
+    }
+    std::size_t n = batch.size;
+    bool ok =
+	std::fwrite(&n, sizeof(n), 1, spill_file) == 1 &&
+	std::fwrite(batch.time_stamp.data(), sizeof(ULong64_t), n,
+		    spill_file) == n &&
+	std::fwrite(batch.channel.data(), sizeof(int), n, spill_file) == n &&
+	std::fwrite(batch.energy.data(), sizeof(double), n, spill_file) == n &&
+	std::fwrite(batch.ratio.data(), sizeof(double), n, spill_file) == n &&
+	std::fwrite(batch.pileup.data(), sizeof(char), n, spill_file) == n;
+    if (!ok)
+	throw std::runtime_error("Cannot write the events of a calibration "
+				 "window to a temporary file");
+    ++spilled;
+}
+
+void window_events::unspill(calibrated_batch& batch)
+{
+    std::size_t n {0};
+    bool ok =
+	std::fread(&n, sizeof(n), 1, spill_file) == 1 &&
+	n <= batch.time_stamp.size() &&
+	std::fread(batch.time_stamp.data(), sizeof(ULong64_t), n,
+		   spill_file) == n &&
+	std::fread(batch.channel.data(), sizeof(int), n, spill_file) == n &&
+	std::fread(batch.energy.data(), sizeof(double), n, spill_file) == n &&
+	std::fread(batch.ratio.data(), sizeof(double), n, spill_file) == n &&
+	std::fread(batch.pileup.data(), sizeof(char), n, spill_file) == n;
+    if (!ok)
+	throw std::runtime_error("Cannot read the events of a calibration "
+				 "window back from a temporary file");
+    batch.size = n;
+}
@@ -0,0 +1,143 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "event_reader.h"
+#include "memory_budget.h"
+#include "spsc_queue.h"
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// Stages of the threaded event loop:
+//
+//   reader thread  --event_batch-->  calibration (caller)
+//                  --calibrated_batch-->  filler thread
+//
+// Batches are preallocated and recycled through a second queue going the
+// other way, so decoding of the next batch overlaps with the processing of
+// the current one and no allocation happens in steady state.
+
+// Calibrated events of the analyzed channel, ready to be histogrammed
+struct calibrated_batch
+{
+    std::size_t size;
+    std::vector<ULong64_t> time_stamp;
+    std::vector<int> channel;
+    std::vector<double> energy; // raw until calibrated
+    std::vector<double> ratio;  // tail/total
+    std::vector<char> pileup;
+
+    calibrated_batch(std::size_t capacity);
+    bool full() const { return size == time_stamp.size(); }
+    void add(ULong64_t t, int ch, double e, double r, char p)
+    {
+	time_stamp[size] = t;
+	channel[size] = ch;
+	energy[size] = e;
+	ratio[size] = r;
+	pileup[size] = p;
+	++size;
+    }
+};
+
+// Reads entries [first, last) on its own thread
+class reader_stage
+{
+public:
+    reader_stage(event_reader& event_source, ULong64_t first, ULong64_t last,
+		 int num_batches = 8);
+    ~reader_stage();
+
+    event_batch* next();             // 0 once all entries were read
+    void recycle(event_batch* batch);
+
+private:
+    event_reader& reader;
+    std::vector<event_batch> batches;
+    spsc_queue<event_batch*> full_queue;
+    spsc_queue<event_batch*> free_queue;
+    memory_charge buffer_memory;
+    std::thread worker;
+    bool done;
+
+    void run(ULong64_t first, ULong64_t last);
+};
+
+// Histograms calibrated batches on its own thread with fill_fn
+//
+// The pool starts with num_batches and grows on demand up to max_batches
+// (2M events, about 60 MB), never further. A caller that holds batches
+// back (a time window waiting for its calibration) must check can_hold()
+// before get_free(); window_events does.
+class filler_stage
+{
+public:
+    filler_stage(std::function<void(calibrated_batch&)> fill_function,
+		 std::size_t batch_capacity = 4096, int num_batches = 8);
+    ~filler_stage();
+
+    calibrated_batch* get_free();
+    bool can_hold(std::size_t num_held) const;
+    void push(calibrated_batch* batch);
+    void recycle(calibrated_batch* batch); // give back without filling
+    void drain();                          // waits for the pushed batches
+    void finish();                         // waits for all fills
+
+    static const std::size_t max_batches {512};
+
+private:
+    std::function<void(calibrated_batch&)> fill_fn;
+    std::size_t capacity;
+    std::vector<calibrated_batch*> batches; // owned
+    std::vector<calibrated_batch*> spare;   // recycled by the caller
+    spsc_queue<calibrated_batch*> full_queue;
+    spsc_queue<calibrated_batch*> free_queue;
+    memory_charge buffer_memory;
+    std::thread worker;
+    bool finished;
+    std::size_t num_pushed;
+    std::atomic<std::size_t> num_filled;
+
+    void run();
+};
+
+// Events of one time window waiting for its calibration
+//
+// Full batches are held back from the filler's pool while it can hold
+// them. Past that (a window of more than about 2M events, or a memory
+// budget that is used up) the rest of the window is written to a
+// temporary file and read back when the window is taken, so a window is
+// never cut short.
+class window_events
+{
+public:
+    window_events(filler_stage& filler_stage);
+    ~window_events();
+
+    // Adds a full batch and returns the (empty) batch to continue with
+    calibrated_batch* add(calibrated_batch* batch);
+    void close(calibrated_batch* batch); // adds the last batch
+
+    // Hands every batch to fn once, in time order; fn pushes or recycles it
+    void take(std::function<void(calibrated_batch*)> fn);
+    void discard(); // recycles every batch
+
+    std::size_t num_spilled() const { return spilled; }
+
+private:
+    filler_stage& filler;
+    std::vector<calibrated_batch*> held;
+    std::FILE* spill_file;
+    std::size_t spilled; // batches in spill_file
+
+    void spill(const calibrated_batch& batch);
+    void unspill(calibrated_batch& batch);
+};
+
+// Events per batch: 4096, or fewer while the memory budget is under
+// pressure
+std::size_t budget_batch_capacity();
+
+#endif
@@ -0,0 +1,226 @@
+#include "psd_pyramid.h"
+#include "TF1.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace {
+
+// One energy slice at some level of the pyramid
+struct slice
+{
+    int first_bin;
+    int last_bin;
+    double x;       // slice center in bins
+    double entries;
+    bool valid;     // fitted with enough statistics
+    bool refined;   // replaced by its children
+    double center;
+    double sigma;
+};
+
+// Fits one slice of h_psd with a gaussian + offset
+bool fit_slice(TH2D* h_psd, TF1* gaus_fit, int first_bin, int last_bin,
+	       double guess_sigma, int min_entries, double& entries,
+	       double& center, double& sigma)
+{
+    TH1D* proj = h_psd->ProjectionY("pyramid_proj", first_bin, last_bin);
+    entries = proj->Integral(1, proj->GetNbinsX());
+    bool valid {false};
+    if (entries >= min_entries) {
+	double peak = proj->GetBinCenter(proj->GetMaximumBin());
+	double par[] {proj->GetMaximum(), peak, guess_sigma, 0};
+	gaus_fit->SetParameters(par);
+	proj->Fit(gaus_fit, "Q");
+	gaus_fit->GetParameters(par);
+	if (par[1] > 0 && par[1] < 1 && std::fabs(par[2]) < 1) {
+	    center = par[1];
+	    sigma = std::fabs(par[2]);
+	    valid = true;
+	}
+    }
+    delete proj;
+    return valid;
+}
+
+// Fits slice s; guess_sigma comes from the parent (or neighbour)
+void fit_slice(slice_fitter& fit, slice& s, double guess_sigma,
+	       int min_entries)
+{
+    s.valid = fit(s.first_bin, s.last_bin, guess_sigma, min_entries,
+		  s.entries, s.center, s.sigma);
+}
+
+// Linear interpolation of the fitted band at position x (in bins) from
+// valid nodes sorted by x; constant beyond the first/last node
+void interpolate(std::vector<slice*>& nodes, double x,
+		 double& center, double& sigma)
+{
+    if (x <= nodes.front()->x) {
+	center = nodes.front()->center;
+	sigma = nodes.front()->sigma;
+	return;
+    }
+    if (x >= nodes.back()->x) {
+	center = nodes.back()->center;
+	sigma = nodes.back()->sigma;
+	return;
+    }
+    std::size_t i = 1;
+    while (nodes.at(i)->x < x)
+	++i;
+    slice* a = nodes.at(i-1);
+    slice* b = nodes.at(i);
+    double w = (x - a->x) / (b->x - a->x);
+    center = a->center + w*(b->center - a->center);
+    sigma = a->sigma + w*(b->sigma - a->sigma);
+}
+
+// Band at the neighbour of a slice that lies at x (in bins): the fit of
+// the neighbour n if it is at the same level, otherwise interpolated
+// through the parent level, whose slices are sorted. False at the edge of
+// the valid region.
+bool neighbour_band(slice* n, std::vector<slice>& parents, double x,
+		    double& center, double& sigma)
+{
+    if (n != 0) {
+	center = n->center;
+	sigma = n->sigma;
+	return n->valid;
+    }
+
+    std::vector<slice*> nodes;
+    bool covered {false};
+    for (auto& p : parents) {
+	if (p.valid)
+	    nodes.push_back(&p);
+	if (p.first_bin <= x && x <= p.last_bin)
+	    covered = p.valid;
+    }
+    if (!covered)
+	return false;
+    interpolate(nodes, x, center, sigma);
+    return true;
+}
+
+} // namespace
+
+int fit_psd_pyramid(TH2D* h_psd, std::vector<double>& center,
+		    std::vector<double>& sigma, int min_entries,
+		    double center_tol, double sigma_tol)
+{
+    TF1* gaus_fit = new TF1("pyramid_fit","gaus(0)+[3]",0,1);
+    slice_fitter fit =
+	[h_psd, gaus_fit](int first, int last, double guess, int needed,
+			  double& entries, double& c, double& s) {
+	    return fit_slice(h_psd, gaus_fit, first, last, guess, needed,
+			     entries, c, s);
+	};
+    int num_fits = fit_psd_pyramid(h_psd->GetNbinsX(), fit, center, sigma,
+				   min_entries, center_tol, sigma_tol);
+    std::cout << "Pyramid fit: " << num_fits << " fits\n";
+
+    delete gaus_fit;
+    return num_fits;
+}
+
+int fit_psd_pyramid(int num_xbin, slice_fitter fit,
+		    std::vector<double>& center, std::vector<double>& sigma,
+		    int min_entries, double center_tol, double sigma_tol)
+{
+    const int factors[] {64, 16, 4, 1};
+    const int num_levels = sizeof(factors)/sizeof(factors[0]);
+    int num_fits {0};
+
+    // levels[l] holds the slices fitted at level l
+    std::vector<std::vector<slice>> levels(num_levels);
+
+    // Coarsest level covers everything
+    for (int first=1; first<=num_xbin; first+=factors[0]) {
+	slice s {};
+	s.first_bin = first;
+	s.last_bin = std::min(first + factors[0] - 1, num_xbin);
+	s.x = 0.5*(s.first_bin + s.last_bin);
+	fit_slice(fit, s, 0.1, min_entries);
+	++num_fits;
+	levels[0].push_back(s);
+    }
+
+    for (int l=0; l+1<num_levels; ++l) {
+	// Children of refined parents only, so neighbours in the vector are
+	// not always neighbours in energy
+	std::vector<slice>& current = levels[l];
+	std::sort(current.begin(), current.end(),
+		  [](const slice& a, const slice& b) {
+		      return a.first_bin < b.first_bin;
+		  });
+	std::vector<slice> no_parents;
+	std::vector<slice>& parents = (l > 0) ? levels[l-1] : no_parents;
+	int split = factors[l] / factors[l+1];
+
+	for (std::size_t k=0; k<current.size(); ++k) {
+	    slice& s = current[k];
+	    // Children need about min_entries each
+	    if (!s.valid || s.entries < split*min_entries)
+		continue;
+
+	    // Refine where the band is not linear over this slice
+	    // (or at the edge of the valid region)
+	    bool refine {false};
+	    slice* prev = (k > 0 && current[k-1].last_bin + 1 == s.first_bin)
+		? &current[k-1] : 0;
+	    slice* next = (k+1 < current.size() &&
+			   current[k+1].first_bin == s.last_bin + 1)
+		? &current[k+1] : 0;
+	    double c_prev, s_prev, c_next, s_next;
+	    if (!neighbour_band(prev, parents, s.x - factors[l], c_prev,
+				s_prev) ||
+		!neighbour_band(next, parents, s.x + factors[l], c_next,
+				s_next)) {
+		refine = true;
+	    }
+	    else {
+		double c_lin = 0.5*(c_prev + c_next);
+		double s_lin = 0.5*(s_prev + s_next);
+		refine = std::fabs(s.center - c_lin) > center_tol ||
+		    std::fabs(s.sigma - s_lin) > sigma_tol*s.sigma;
+	    }
+	    if (!refine)
+		continue;
+
+	    int width = factors[l+1];
+	    for (int first=s.first_bin; first<=s.last_bin; first+=width) {
+		slice child {};
+		child.first_bin = first;
+		child.last_bin = std::min(first + width - 1, s.last_bin);
+		child.x = 0.5*(child.first_bin + child.last_bin);
+		fit_slice(fit, child, s.sigma, min_entries);
+		++num_fits;
+		// Keep the parent if none of its children could be fitted
+		s.refined = s.refined || child.valid;
+		levels[l+1].push_back(child);
+	    }
+	}
+    }
+
+    // The band is interpolated through the finest fitted slices
+    // (refined slices are replaced by their children, except where a child
+    // could not be fitted)
+    std::vector<slice*> nodes;
+    for (int l=0; l<num_levels; ++l) {
+	for (auto& s : levels[l]) {
+	    if (s.valid && !s.refined)
+		nodes.push_back(&s);
+	}
+    }
+    std::sort(nodes.begin(), nodes.end(),
+	      [](const slice* a, const slice* b) { return a->x < b->x; });
+
+    center.assign(num_xbin+1, 0);
+    sigma.assign(num_xbin+1, 0.1);
+    if (!nodes.empty()) {
+	for (int xbin=0; xbin<=num_xbin; ++xbin)
+	    interpolate(nodes, xbin, center[xbin], sigma[xbin]);
+    }
+    return num_fits;
+}
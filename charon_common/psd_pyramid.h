@@ -0,0 +1,37 @@
+#ifndef PSD_PYRAMID_H
+#define PSD_PYRAMID_H
+
+#include "TH2D.h"
+#include <functional>
+#include <vector>
+
+// Coarse-to-fine fit of the main PSD band (gaussian + offset in tail/total)
+//
+// The energy axis is fitted first in wide slices (64 bins), and a slice is
+// only split (into 4) and refitted when it has the statistics for it and
+// the band bends there, i.e. the fitted center or width disagrees with the
+// interpolation from its neighbours. Everywhere else the band is linearly
+// interpolated between the fitted slices, so low statistics regions get a
+// stable band and most of the 1024 full resolution fits are skipped.
+//
+// center and sigma are filled for xbin = 0..GetNbinsX() (like the full
+// resolution loop in psd_cut). Returns the number of fits performed.
+int fit_psd_pyramid(TH2D* h_psd, std::vector<double>& center,
+		    std::vector<double>& sigma, int min_entries = 100,
+		    double center_tol = 0.005, double sigma_tol = 0.1);
+
+// Fits the band in energy bins [first_bin, last_bin] if they hold at least
+// min_entries (set in entries), starting from guess_sigma; false if there
+// are too few entries or the fit failed
+typedef std::function<bool(int first_bin, int last_bin, double guess_sigma,
+			   int min_entries, double& entries, double& center,
+			   double& sigma)> slice_fitter;
+
+// The same pyramid over num_xbin energy bins with any slice fit (the
+// bootstrap refits its replicas without Minuit)
+int fit_psd_pyramid(int num_xbin, slice_fitter fit,
+		    std::vector<double>& center, std::vector<double>& sigma,
+		    int min_entries = 100, double center_tol = 0.005,
+		    double sigma_tol = 0.1);
+
+#endif
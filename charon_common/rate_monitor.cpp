@@ -0,0 +1,169 @@
+#include "rate_monitor.h"
+#include "rbd.h"
+#include <iostream>
+#include <sstream>
+
+// Time stamps are in units of 4 ns
+static const double ticks_per_sec {250.0e6};
+
+rate_monitor::rate_monitor()
+    :
+    bin_width {1}
+    ,bin_ticks {0}
+    ,next_sample {0}
+    ,last_current {0}
+    ,time_initial {0}
+    ,bin_end {0}
+{
+};
+
+void rate_monitor::add_roi(double low, double high)
+{
+    roi_low.push_back(low);
+    roi_high.push_back(high);
+    bin_rate.push_back(std::vector<double>());
+}
+
+void rate_monitor::set_bin(double bin_sec)
+{
+    if (bin_sec > 0)
+	bin_width = bin_sec;
+}
+
+// The RBD log is assumed to start with the first event of the run
+void rate_monitor::set_rbd(std::string& file_name)
+{
+    if (!read_rbd(file_name, rbd_time, rbd_current))
+	std::cerr << "Cannot open RBD file, " << file_name
+		  << ", ROI rates are not joined with the beam current\n";
+}
+
+// Starts binning at time_first, after any bins restored from a checkpoint
+void rate_monitor::initialize(ULong64_t time_first)
+{
+    if (!enabled())
+	return;
+
+    bin_ticks = static_cast<ULong64_t>(bin_width*ticks_per_sec);
+    if (bin_ticks < 1)
+	bin_ticks = 1;
+    time_initial = time_first;
+    bin_end = time_initial + (bin_time.size() + 1)*bin_ticks;
+    counts.assign(roi_low.size(), 0);
+
+    double start_sec = bin_time.size()*bin_width;
+    next_sample = 0;
+    while (next_sample < rbd_time.size() &&
+	   rbd_time[next_sample] < start_sec)
+	last_current = rbd_current[next_sample++];
+}
+
+void rate_monitor::flush(ULong64_t time_stamp)
+{
+    if (!enabled() || bin_ticks == 0)
+	return;
+    while (bin_end <= time_stamp) {
+	close_bin();
+	bin_end += bin_ticks;
+    }
+}
+
+// Stores the open bin and joins it with its RBD samples (the last current
+// is carried over a bin without samples)
+void rate_monitor::close_bin()
+{
+    double end_sec = (bin_end - time_initial)/ticks_per_sec;
+    double sum {0};
+    int num_samples {0};
+    while (next_sample < rbd_time.size() && rbd_time[next_sample] < end_sec) {
+	sum += rbd_current[next_sample++];
+	++num_samples;
+    }
+    if (num_samples > 0)
+	last_current = sum/num_samples;
+
+    bin_time.push_back(end_sec - 0.5*bin_width);
+    bin_current.push_back(last_current);
+    for (std::size_t r=0; r<roi_low.size(); ++r) {
+	bin_rate[r].push_back(counts[r]/bin_width);
+	counts[r] = 0;
+    }
+}
+
+std::string rate_monitor::roi_name(const char* base, std::size_t r) const
+{
+    std::stringstream name;
+    name << base << "_" << r;
+    return name.str();
+}
+
+// Writes to the current directory
+void rate_monitor::write()
+{
+    if (!enabled() || bin_time.empty())
+	return;
+
+    const int n = bin_time.size();
+    for (std::size_t r=0; r<roi_low.size(); ++r) {
+	std::stringstream roi;
+	roi << roi_low[r] << "-" << roi_high[r] << " MeV";
+
+	TGraph rate(n, &bin_time[0], &bin_rate[r][0]);
+	rate.SetTitle(("ROI rate, " + roi.str()
+		       + ";Time [s];Rate [counts/s]").c_str());
+	rate.Write(roi_name("ROI_Rate", r).c_str());
+
+	if (rbd_time.empty())
+	    continue;
+	// Beam off bins are left out
+	TGraph per_current;
+	per_current.SetTitle(("ROI rate per beam current, " + roi.str()
+			      + ";Time [s];Rate/current [counts/s/A]").c_str());
+	for (int i=0; i<n; ++i) {
+	    if (bin_current[i] > 0)
+		per_current.SetPoint(per_current.GetN(), bin_time[i],
+				     bin_rate[r][i]/bin_current[i]);
+	}
+	per_current.Write(roi_name("ROI_Rate_Per_Current", r).c_str());
+    }
+
+    if (!rbd_time.empty()) {
+	TGraph current(n, &bin_time[0], &bin_current[0]);
+	current.SetTitle("Beam current;Time [s];Current [A]");
+	current.Write("ROI_Beam_Current");
+    }
+}
+
+// Reads graphs written by write() (e.g. a checkpoint); binning continues
+// after the last stored bin. Counts of a bin left open by the checkpoint
+// are lost, which a bin width dividing the 60 s time windows avoids.
+void rate_monitor::restore(TDirectory* dir)
+{
+    if (!enabled())
+	return;
+
+    std::vector<TGraph*> stored;
+    for (std::size_t r=0; r<roi_low.size(); ++r) {
+	TGraph* g = (TGraph*)dir->Get(roi_name("ROI_Rate", r).c_str());
+	if (g == 0 || (r > 0 && g->GetN() != stored[0]->GetN()))
+	    return;
+	stored.push_back(g);
+    }
+    TGraph* current = (TGraph*)dir->Get("ROI_Beam_Current");
+
+    bin_time.assign(stored[0]->GetX(), stored[0]->GetX() + stored[0]->GetN());
+    bin_current.assign(bin_time.size(), 0);
+    if (current != 0 && current->GetN() == stored[0]->GetN())
+	bin_current.assign(current->GetY(), current->GetY() + current->GetN());
+    if (!bin_current.empty())
+	last_current = bin_current.back();
+    for (std::size_t r=0; r<roi_low.size(); ++r)
+	bin_rate[r].assign(stored[r]->GetY(),
+			   stored[r]->GetY() + stored[r]->GetN());
+}
+
+void rate_monitor::fingerprint(stage_key& key) const
+{
+    key.add(roi_low).add(roi_high).add(bin_width).add(rbd_time)
+	.add(rbd_current);
+}
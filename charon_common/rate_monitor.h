@@ -0,0 +1,74 @@
+#ifndef RATE_MONITOR_H
+#define RATE_MONITOR_H
+
+#include "TDirectory.h"
+#include "TGraph.h"
+#include "stage_cache.h"
+#include <string>
+#include <vector>
+
+// Count rates in calibrated energy regions of interest (ROIs) over the run,
+// next to the beam current
+//
+// Counts are binned in time while the main event loop runs. A bin is closed
+// once an event past its end arrives, and is then joined with the RBD
+// samples that fall inside it, so beam trips and detector rate problems show
+// up side by side without a second pass. For every ROI the rate (counts/s)
+// and the rate per beam current are written; the mean current of each bin
+// is written once.
+class rate_monitor
+{
+public:
+    rate_monitor();
+
+    void add_roi(double low, double high); // MeV
+    void set_bin(double bin_sec);
+    void set_rbd(std::string& file_name);
+    bool enabled() const { return !roi_low.empty(); }
+
+    void initialize(ULong64_t time_first);
+
+    // Called for every event of the analyzed channel (time sorted)
+    void fill(ULong64_t time_stamp, double energy)
+    {
+	if (time_stamp >= bin_end)
+	    flush(time_stamp);
+	for (std::size_t r=0; r<roi_low.size(); ++r) {
+	    if (energy >= roi_low[r] && energy < roi_high[r])
+		++counts[r];
+	}
+    }
+
+    // Closes the bins that end at or before time_stamp
+    void flush(ULong64_t time_stamp);
+
+    void write();
+    void restore(TDirectory* dir); // continue from graphs in dir
+    void fingerprint(stage_key& key) const; // settings, for result caches
+
+private:
+    std::vector<double> roi_low;
+    std::vector<double> roi_high;
+    double bin_width; // seconds
+    ULong64_t bin_ticks;
+
+    // RBD log, seconds from the start of the run
+    std::vector<double> rbd_time;
+    std::vector<double> rbd_current;
+    std::size_t next_sample;
+    double last_current;
+
+    ULong64_t time_initial;
+    ULong64_t bin_end;
+    std::vector<ULong64_t> counts; // of the open bin, per ROI
+
+    // Closed bins
+    std::vector<double> bin_time; // center, seconds
+    std::vector<double> bin_current;
+    std::vector<std::vector<double>> bin_rate; // per ROI
+
+    void close_bin();
+    std::string roi_name(const char* base, std::size_t r) const;
+};
+
+#endif
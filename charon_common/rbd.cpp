@@ -0,0 +1,54 @@
+#include "rbd.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+bool read_rbd(std::string& file_name, std::vector<double>& time,
+	      std::vector<double>& current)
+{
+    std::ifstream infile(file_name);
+    if (!infile)
+	return false;
+
+    std::string line;
+    int counter {1};
+    double t {0.00};
+    while (std::getline(infile, line))
+    {
+	std::stringstream line_stream(line);
+	std::string value;
+	while (std::getline(line_stream, value, ','))
+	{
+	    if (counter % 3 == 0) {
+		current.push_back(std::stod(value));
+		time.push_back(t);
+		t += rbd_sample_rate;
+	    }
+	    ++counter;
+	}
+    }
+    return true;
+}
+
+void find_beam_gaps(std::vector<double>& time, std::vector<double>& current,
+		    double threshold, std::vector<double>& gap_start,
+		    std::vector<double>& gap_end)
+{
+    if (current.empty())
+	return;
+
+    double level = threshold * (*std::max_element(current.begin(),
+						  current.end()));
+    bool beam_on = current.at(0) > level;
+    for (std::size_t i=1; i<current.size(); ++i) {
+	bool on = current.at(i) > level;
+	if (beam_on && !on)
+	    gap_start.push_back(time.at(i));
+	else if (!beam_on && on && !gap_start.empty())
+	    gap_end.push_back(time.at(i));
+	beam_on = on;
+    }
+    // A gap still open at the end of the log lasts until the end of the run
+    if (gap_end.size() < gap_start.size())
+	gap_end.push_back(time.back() + rbd_sample_rate);
+}
@@ -0,0 +1,22 @@
+#ifndef RBD_H
+#define RBD_H
+
+#include <string>
+#include <vector>
+
+// Sample period of the RBD (beam current) log in seconds
+const double rbd_sample_rate {0.05};
+
+// Reads an RBD output file (three column csv, current in the third column)
+// Returns false if the file could not be opened
+bool read_rbd(std::string& file_name, std::vector<double>& time,
+	      std::vector<double>& current);
+
+// Finds the beam off periods in an RBD log
+// A gap starts when the current drops below threshold*max and ends when it
+// rises above it again; times are in seconds from the start of the log
+void find_beam_gaps(std::vector<double>& time, std::vector<double>& current,
+		    double threshold, std::vector<double>& gap_start,
+		    std::vector<double>& gap_end);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef REPLICA_SEED_H
+#define REPLICA_SEED_H
+
+#include "RtypesCore.h"
+
+// Well mixed seed of one replica (splitmix64), so that every replica of a
+// bootstrap draws the same numbers whichever thread runs it
+inline ULong64_t replica_seed(ULong64_t seed, int index)
+{
+    ULong64_t z = seed + 0x9E3779B97F4A7C15ULL*(index + 1);
+    z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27))*0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+#endif
@@ -0,0 +1,234 @@
+#include "spool.h"
+#include "memory_budget.h"
+#include "TF1.h"
+#include "TH1.h"
+#include "TH1D.h"
+#include "TMath.h"
+#include "TROOT.h"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+volatile std::sig_atomic_t signalled {0};
+
+void handle_signal(int)
+{
+    signalled = 1;
+}
+
+bool ends_with(const std::string& s, const std::string& suffix)
+{
+    return s.size() >= suffix.size() &&
+	s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+} // namespace
+
+spool_daemon::spool_daemon(std::string& spool_dir, int num_workers,
+			   job_function job)
+    :
+    dir {spool_dir}
+    ,workers {num_workers}
+    ,run_job {job}
+    ,stopping {false}
+    ,num_running {0}
+{
+    if (workers <= 0)
+	workers = std::max(1u, std::thread::hardware_concurrency()/2);
+};
+
+// Pays the one-time costs (thread safety, fitter plugins) before any job
+void spool_daemon::warm_up()
+{
+    ROOT::EnableThreadSafety();
+
+    // Jobs create histograms with the same names at the same time, so
+    // none of them are registered in a directory
+    TH1::AddDirectory(false);
+
+    TH1D h("warm_up", "", 100, -5, 5);
+    for (int bin=1; bin<=100; ++bin)
+	h.SetBinContent(bin, 1000*TMath::Gaus(h.GetBinCenter(bin)));
+    h.Fit("gaus", "Q0");
+}
+
+int spool_daemon::run()
+{
+    std::signal(SIGINT, handle_signal);
+    std::signal(SIGTERM, handle_signal);
+
+    warm_up();
+    std::cout << "\nWatching " << dir << " with " << workers
+	      << " workers (touch " << dir << "/stop to quit)\n";
+
+    std::vector<std::thread> pool;
+    for (int i=0; i<workers; ++i)
+	pool.emplace_back(&spool_daemon::work, this);
+
+    while (scan() && !signalled)
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    {
+	std::lock_guard<std::mutex> lock(queue_mutex);
+	stopping = true;
+    }
+    queue_ready.notify_all();
+    for (auto& worker : pool)
+	worker.join();
+
+    std::cout << "\nSpool daemon stopped\n";
+    return 0;
+}
+
+// Claims new jobs; returns false once asked to stop
+bool spool_daemon::scan()
+{
+    DIR* d = opendir(dir.c_str());
+    if (d == 0) {
+	std::cerr << "Cannot open spool directory, " << dir << "\n";
+	return false;
+    }
+
+    bool keep_going {true};
+    std::vector<std::string> names;
+    while (dirent* entry = readdir(d)) {
+	std::string file = entry->d_name;
+	if (file == "stop")
+	    keep_going = false;
+	else if (ends_with(file, ".job"))
+	    names.push_back(file.substr(0, file.size() - 4));
+    }
+    closedir(d);
+
+    // Oldest first is not known from the name; sorted is reproducible
+    std::sort(names.begin(), names.end());
+    for (auto& name : names) {
+	std::string job = dir + "/" + name + ".job";
+	std::string running = dir + "/" + name + ".running";
+	if (std::rename(job.c_str(), running.c_str()) != 0)
+	    continue; // taken by someone else
+	{
+	    std::lock_guard<std::mutex> lock(queue_mutex);
+	    queue.push_back(name);
+	}
+	queue_ready.notify_one();
+    }
+    return keep_going;
+}
+
+void spool_daemon::work()
+{
+    while (true) {
+	std::string name;
+	{
+	    std::unique_lock<std::mutex> lock(queue_mutex);
+	    queue_ready.wait(lock, [this]() {
+		    return stopping || !queue.empty(); });
+	    if (queue.empty())
+		return;
+	    name = queue.front();
+	    queue.pop_front();
+	}
+
+	admit();
+	std::string running = dir + "/" + name + ".running";
+	std::vector<std::string> args;
+	std::string message;
+	bool ok {false};
+	auto start = std::chrono::steady_clock::now();
+
+	if (read_job(running, args, message)) {
+	    std::cout << "\nStarting job " << name << "\n";
+	    try {
+		int status = run_job(args);
+		ok = (status == 0);
+		if (!ok)
+		    message = "exit status " + std::to_string(status);
+	    }
+	    catch (std::exception& e) {
+		message = e.what();
+	    }
+	}
+
+	std::chrono::duration<double> elapsed
+	    = std::chrono::steady_clock::now() - start;
+	if (ok)
+	    message = "wall time " + std::to_string(elapsed.count()) + " s";
+	finish(name, ok, message);
+
+	{
+	    std::lock_guard<std::mutex> lock(queue_mutex);
+	    --num_running;
+	}
+	job_done.notify_all();
+    }
+}
+
+// Waits while other jobs run and the memory budget is under pressure
+// (jobs release their charges as they finish)
+void spool_daemon::admit()
+{
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    if (num_running > 0 && memory().pressure()) {
+	memory().degraded("fewer concurrent daemon jobs");
+	while (num_running > 0 && memory().pressure())
+	    job_done.wait_for(lock, std::chrono::milliseconds(200));
+    }
+    ++num_running;
+}
+
+bool spool_daemon::read_job(std::string& file_name,
+			    std::vector<std::string>& args,
+			    std::string& message)
+{
+    std::ifstream f_stream(file_name.c_str());
+    if (!f_stream) {
+	message = "cannot read " + file_name;
+	return false;
+    }
+
+    std::vector<std::string> flags; // options without a value go last
+    std::string line;
+    while (std::getline(f_stream, line)) {
+	line.erase(0, line.find_first_not_of(" \t"));
+	line.erase(line.find_last_not_of(" \t\r") + 1);
+	if (line.empty() || line[0] == '#')
+	    continue;
+
+	std::size_t equals = line.find('=');
+	std::string key = line.substr(0, equals);
+	std::string value = (equals == std::string::npos) ?
+	    "" : line.substr(equals + 1);
+	if (value.empty() || value == "true") {
+	    flags.push_back("--" + key);
+	}
+	else {
+	    args.push_back("--" + key);
+	    args.push_back(value);
+	}
+    }
+    args.insert(args.end(), flags.begin(), flags.end());
+    return true;
+}
+
+// Replaces <name>.running by the status file
+void spool_daemon::finish(std::string& name, bool ok, std::string& message)
+{
+    std::string status = dir + "/" + name + (ok ? ".done" : ".failed");
+    std::ofstream f_stream(status.c_str());
+    f_stream << message << "\n";
+    f_stream.close();
+
+    std::string running = dir + "/" + name + ".running";
+    std::remove(running.c_str());
+
+    std::cout << "\nJob " << name << (ok ? " done: " : " failed: ")
+	      << message << "\n";
+}
@@ -0,0 +1,60 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Resident processing service fed through a spool directory
+//
+// Every <name>.job file in the directory is one run, given as key=value
+// lines that map to the tool's long options ("input=run.root" becomes
+// "--input run.root", a key without a value or with "true" is a flag):
+//
+//     input=run_017.root
+//     output=run_017_out.root
+//     stddevs=2.5
+//     overwrite
+//
+// A job is claimed by renaming it to <name>.running, then run on one of
+// the worker threads. It is replaced by <name>.done or <name>.failed, which
+// holds the wall time or the reason. The daemon stops after the running
+// jobs once a file named "stop" appears in the directory (or on
+// SIGINT/SIGTERM).
+//
+// While the memory budget is under pressure, a claimed job waits for the
+// running ones to finish (one job always runs).
+class spool_daemon
+{
+public:
+    typedef std::function<int(std::vector<std::string>& args)> job_function;
+
+    spool_daemon(std::string& spool_dir, int num_workers, job_function job);
+    int run();
+
+private:
+    std::string dir;
+    int workers;
+    job_function run_job;
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_ready;
+    std::deque<std::string> queue; // claimed job names (without suffix)
+    bool stopping;
+    int num_running;
+    std::condition_variable job_done;
+
+    void warm_up();
+    bool scan();
+    void work();
+    void admit();
+    bool read_job(std::string& file_name, std::vector<std::string>& args,
+		  std::string& message);
+    void finish(std::string& name, bool ok, std::string& message);
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Bounded lock-free queue for exactly one producer and one consumer thread
+// The capacity is rounded up to a power of two.
+template <class T>
+class spsc_queue
+{
+public:
+    explicit spsc_queue(std::size_t capacity)
+	:
+	head {0}
+	,tail {0}
+    {
+	std::size_t size {1};
+	while (size < capacity)
+	    size *= 2;
+	buf.resize(size);
+	mask = size - 1;
+    }
+
+    // Producer side
+    bool try_push(const T& item)
+    {
+	std::size_t t = tail.load(std::memory_order_relaxed);
+	if (t - head.load(std::memory_order_acquire) == buf.size())
+	    return false; // full
+	buf[t & mask] = item;
+	tail.store(t + 1, std::memory_order_release);
+	return true;
+    }
+
+    void push(const T& item)
+    {
+	while (!try_push(item))
+	    std::this_thread::yield();
+    }
+
+    // Consumer side
+    bool try_pop(T& item)
+    {
+	std::size_t h = head.load(std::memory_order_relaxed);
+	if (h == tail.load(std::memory_order_acquire))
+	    return false; // empty
+	item = buf[h & mask];
+	head.store(h + 1, std::memory_order_release);
+	return true;
+    }
+
+    T pop()
+    {
+	T item;
+	while (!try_pop(item))
+	    std::this_thread::yield();
+	return item;
+    }
+
+private:
+    std::vector<T> buf;
+    std::size_t mask;
+    alignas(64) std::atomic<std::size_t> head; // next slot to pop
+    alignas(64) std::atomic<std::size_t> tail; // next slot to push
+};
+
+#endif
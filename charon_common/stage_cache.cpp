@@ -0,0 +1,130 @@
+#include "stage_cache.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+stage_key::stage_key()
+    :
+    hash {14695981039346656037ull} // FNV offset basis
+{
+};
+
+stage_key& stage_key::add_bytes(const void* data, std::size_t num_bytes)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t i=0; i<num_bytes; ++i) {
+	hash ^= bytes[i];
+	hash *= 1099511628211ull; // FNV prime
+    }
+    return *this;
+}
+
+stage_key& stage_key::add(const std::string& text)
+{
+    add(static_cast<std::uint64_t>(text.size()));
+    return add_bytes(text.data(), text.size());
+}
+
+bool stage_key::add_file(const std::string& file_name)
+{
+    std::ifstream f_stream(file_name.c_str(), std::ios::binary);
+    if (!f_stream) {
+	add(file_name);
+	return false;
+    }
+    f_stream.seekg(0, std::ios::end);
+    std::uint64_t size = f_stream.tellg();
+    add(size);
+
+    const std::uint64_t sample {1048576};
+    std::vector<char> buffer(std::min(size, sample));
+    f_stream.seekg(0);
+    f_stream.read(buffer.data(), buffer.size());
+    add_bytes(buffer.data(), buffer.size());
+    if (size > sample) {
+	buffer.resize(std::min(size - sample, sample));
+	f_stream.seekg(size - buffer.size());
+	f_stream.read(buffer.data(), buffer.size());
+	add_bytes(buffer.data(), buffer.size());
+    }
+    return f_stream.good();
+}
+
+std::string stage_key::hex() const
+{
+    std::stringstream stream;
+    stream << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return stream.str();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Store
+////////////////////////////////////////////////////////////////////////////////
+void stage_cache::set_dir(const std::string& dir)
+{
+    directory = dir;
+    if (!directory.empty())
+	mkdir(directory.c_str(), 0755); // may exist already
+}
+
+std::string stage_cache::path(const char* stage, const stage_key& key) const
+{
+    return directory + "/" + stage + "_" + key.hex() + ".root";
+}
+
+TFile* stage_cache::open(const char* stage, const stage_key& key) const
+{
+    if (!enabled())
+	return 0;
+    std::string file_name = path(stage, key);
+    std::ifstream f_stream(file_name.c_str());
+    if (!f_stream.good())
+	return 0;
+    TFile* f_result = new TFile(file_name.c_str());
+    if (f_result->IsZombie()) {
+	delete f_result;
+	return 0;
+    }
+    std::cout << "\nReusing " << stage << " from " << file_name << "\n";
+    return f_result;
+}
+
+// Named <result>.<pid>.<n>.tmp until it is stored, n counting the results
+// of the process (daemon jobs may write the same result at once)
+TFile* stage_cache::create(const char* stage, const stage_key& key) const
+{
+    if (!enabled())
+	return 0;
+    static std::atomic<unsigned> num_created {0};
+    std::stringstream name_temp;
+    name_temp << path(stage, key) << "." << getpid() << "."
+	      << num_created++ << ".tmp";
+    TFile* f_result = new TFile(name_temp.str().c_str(), "RECREATE");
+    if (f_result->IsZombie()) {
+	std::cerr << "Cannot write to the result cache, " << directory
+		  << "\n";
+	delete f_result;
+	return 0;
+    }
+    return f_result;
+}
+
+void stage_cache::store(TFile* f_result) const
+{
+    if (f_result == 0)
+	return;
+    std::string name_temp = f_result->GetName();
+    f_result->Write();
+    f_result->Close();
+    delete f_result;
+
+    // Drop the ".<pid>.<n>.tmp"
+    std::string file_name = name_temp.substr(0, name_temp.rfind(".root") + 5);
+    std::rename(name_temp.c_str(), file_name.c_str());
+}
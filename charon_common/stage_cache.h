@@ -0,0 +1,71 @@
+#ifndef STAGE_CACHE_H
+#define STAGE_CACHE_H
+
+#include "TFile.h"
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// 64 bit FNV-1a hash of everything a processing stage depends on
+//
+// Values are hashed as their bytes; strings and vectors with their length
+// first, so that neighbouring values cannot run into each other.
+class stage_key
+{
+public:
+    stage_key();
+
+    stage_key& add_bytes(const void* data, std::size_t num_bytes);
+    stage_key& add(const std::string& text);
+    stage_key& add(const char* text) { return add(std::string(text)); }
+
+    template<typename T>
+    stage_key& add(T value)
+    {
+	static_assert(std::is_arithmetic<T>::value, "numbers only");
+	return add_bytes(&value, sizeof(value));
+    }
+
+    template<typename T>
+    stage_key& add(const std::vector<T>& values)
+    {
+	static_assert(std::is_arithmetic<T>::value, "numbers only");
+	add(static_cast<std::uint64_t>(values.size()));
+	return add_bytes(values.data(), values.size()*sizeof(T));
+    }
+
+    // Content of a file: its size and the first and last MB, which is
+    // enough to tell runs apart without reading GBs
+    bool add_file(const std::string& file_name);
+
+    std::string hex() const;
+
+private:
+    std::uint64_t hash;
+};
+
+// Results of processing stages, stored by key in a local directory
+//
+// A stage whose key matches a stored result loads it instead of running.
+// Results are written aside and renamed into place, so concurrent jobs
+// and killed runs never leave half a result under a key.
+class stage_cache
+{
+public:
+    void set_dir(const std::string& dir);
+    bool enabled() const { return !directory.empty(); }
+
+    // The stored result, 0 if there is none (or no cache)
+    TFile* open(const char* stage, const stage_key& key) const;
+
+    // A new result to fill and pass to store()
+    TFile* create(const char* stage, const stage_key& key) const;
+    void store(TFile* f_result) const;
+
+private:
+    std::string directory;
+    std::string path(const char* stage, const stage_key& key) const;
+};
+
+#endif
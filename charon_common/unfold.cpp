@@ -0,0 +1,290 @@
+#include "unfold.h"
+#include "replica_seed.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+
+namespace {
+
+inline double dot(const double* a, const double* x, int n)
+{
+    double sum {0};
+    #pragma omp simd reduction(+:sum)
+    for (int k=0; k<n; ++k)
+	sum += a[k]*x[k];
+    return sum;
+}
+
+// Threads for the matrix-vector products of one unfolding, started once
+// and woken for every product; the caller computes the first share of the
+// rows and each thread one of the others
+class row_workers
+{
+public:
+    row_workers(int num_threads)
+	:
+	generation {0}
+	,pending {0}
+	,stopping {false}
+	,shares {std::max(1, num_threads)}
+	,A {0}
+	,rows {0}
+	,cols {0}
+	,x {0}
+	,y {0}
+    {
+	for (int s=1; s<shares; ++s)
+	    threads.emplace_back(&row_workers::work, this, s);
+    }
+
+    ~row_workers()
+    {
+	{
+	    std::lock_guard<std::mutex> lock(mutex);
+	    stopping = true;
+	}
+	start.notify_all();
+	for (auto& t : threads)
+	    t.join();
+    }
+
+    // y = A x, A being rows x cols (row major)
+    void product(const double* A_in, int rows_in, int cols_in,
+		 const double* x_in, double* y_in)
+    {
+	{
+	    std::lock_guard<std::mutex> lock(mutex);
+	    A = A_in;
+	    rows = rows_in;
+	    cols = cols_in;
+	    x = x_in;
+	    y = y_in;
+	    pending = threads.size();
+	    ++generation;
+	}
+	start.notify_all();
+	share(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this] { return pending == 0; });
+    }
+
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    long generation;
+    int pending;
+    bool stopping;
+    int shares;
+
+    const double* A;
+    int rows;
+    int cols;
+    const double* x;
+    double* y;
+
+    void share(int s)
+    {
+	int first = static_cast<long>(rows)*s/shares;
+	int last = static_cast<long>(rows)*(s + 1)/shares;
+	for (int r=first; r<last; ++r)
+	    y[r] = dot(A + static_cast<std::size_t>(r)*cols, x, cols);
+    }
+
+    void work(int s)
+    {
+	long seen {0};
+	while (true) {
+	    {
+		std::unique_lock<std::mutex> lock(mutex);
+		start.wait(lock,
+			   [&] { return stopping || generation != seen; });
+		if (stopping)
+		    return;
+		seen = generation;
+	    }
+	    share(s);
+	    std::lock_guard<std::mutex> lock(mutex);
+	    if (--pending == 0)
+		done.notify_one();
+	}
+    }
+};
+
+} // namespace
+
+unfold::unfold(TH2D* response)
+    :
+    nt {response->GetNbinsX()}
+    ,nm {response->GetNbinsY()}
+    ,by_measured(static_cast<std::size_t>(nt)*nm)
+    ,by_true(static_cast<std::size_t>(nt)*nm)
+    ,efficiency(nt, 0)
+    ,matrix_memory(mem_fit_workspaces, 2*by_true.size()*sizeof(double))
+    ,max_iterations {100}
+    ,tolerance {1e-4}
+    ,iterations {0}
+{
+    for (int i=0; i<=nt; ++i)
+	true_edges.push_back(response->GetXaxis()->GetBinLowEdge(i+1));
+    for (int i=0; i<nt; ++i) {
+	for (int j=0; j<nm; ++j) {
+	    double p = std::max(0.0, response->GetBinContent(i+1, j+1));
+	    by_measured[static_cast<std::size_t>(j)*nt + i] = p;
+	    by_true[static_cast<std::size_t>(i)*nm + j] = p;
+	    efficiency[i] += p;
+	}
+    }
+};
+
+// Tolerance 0 always runs max_iterations
+void unfold::set_convergence(int max_iterations_in, double tolerance_in)
+{
+    max_iterations = std::max(1, max_iterations_in);
+    tolerance = std::max(0.0, tolerance_in);
+}
+
+int unfold::run(TH1D* h_measured, int num_threads)
+{
+    if (num_threads <= 0)
+	num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // Scaled spectra (e.g. pileup corrected) are resampled in units of
+    // their effective entries
+    measured.assign(nm, 0);
+    measured_weight.assign(nm, 1);
+    for (int j=0; j<nm; ++j) {
+	double content = h_measured->GetBinContent(j+1);
+	double error = h_measured->GetBinError(j+1);
+	measured[j] = std::max(0.0, content);
+	if (content > 0 && error > 0)
+	    measured_weight[j] = error*error/content;
+    }
+
+    iterations = iterate(measured, result, max_iterations, tolerance,
+			 num_threads);
+    std::cout << "Unfolded in " << iterations << " iterations\n";
+    return iterations;
+}
+
+// Replicas are spread over num_threads (all cores if 0)
+void unfold::run_bootstrap(int num_replicas, int num_threads, ULong64_t seed)
+{
+    if (num_threads <= 0)
+	num_threads = std::max(1u, std::thread::hardware_concurrency());
+    if (measured.empty())
+	return;
+    replicas.assign(std::max(0, num_replicas), std::vector<double>());
+
+    std::atomic<int> next {0};
+    auto work = [&]() {
+	int index;
+	while ((index = next++) < num_replicas) {
+	    std::mt19937_64 engine(replica_seed(seed, index));
+	    std::vector<double> m(nm, 0);
+	    for (int j=0; j<nm; ++j) {
+		if (measured[j] > 0) {
+		    double w = measured_weight[j];
+		    std::poisson_distribution<long> poisson(measured[j]/w);
+		    m[j] = w*poisson(engine);
+		}
+	    }
+	    iterate(m, replicas[index], iterations, 0, 1);
+	}
+    };
+
+    std::vector<std::thread> workers;
+    for (int t=0; t<num_threads; ++t)
+	workers.emplace_back(work);
+    for (auto& worker : workers)
+	worker.join();
+}
+
+TH1D* unfold::make_spectrum(const char* name) const
+{
+    TH1D* h = new TH1D(name, "Unfolded spectrum;Incident energy [MeV];"
+		       "Counts", nt, &true_edges[0]);
+    h->SetDirectory(0);
+    for (std::size_t i=0; i<result.size(); ++i)
+	h->SetBinContent(i+1, result[i]);
+    return h;
+}
+
+TH1D* unfold::make_band(const char* name) const
+{
+    TH1D* h = new TH1D(name, "Relative uncertainty (bootstrap);"
+		       "Incident energy [MeV];RMS/mean", nt, &true_edges[0]);
+    h->SetDirectory(0);
+    if (replicas.size() < 2)
+	return h;
+
+    for (int i=0; i<nt; ++i) {
+	double sum {0};
+	double sum2 {0};
+	for (auto& t : replicas) {
+	    sum += t[i];
+	    sum2 += t[i]*t[i];
+	}
+	double n = replicas.size();
+	double mean = sum/n;
+	double var = std::max(0.0, (sum2 - n*mean*mean)/(n - 1));
+	if (mean > 0)
+	    h->SetBinContent(i+1, std::sqrt(var)/mean);
+    }
+    return h;
+}
+
+// MLEM iterations from a flat start with the measured number of counts;
+// stops early once the relative change is below stop_change (if > 0)
+int unfold::iterate(const std::vector<double>& m, std::vector<double>& t,
+		    int num_iterations, double stop_change,
+		    int num_threads) const
+{
+    double total_measured {0};
+    for (auto c : m)
+	total_measured += c;
+    double total_efficiency {0};
+    for (auto e : efficiency)
+	total_efficiency += e;
+
+    t.assign(nt, 0);
+    if (total_efficiency <= 0)
+	return 0;
+    for (int i=0; i<nt; ++i) {
+	if (efficiency[i] > 0)
+	    t[i] = total_measured/total_efficiency;
+    }
+
+    row_workers workers(num_threads);
+    std::vector<double> folded(nm);
+    std::vector<double> ratio(nm);
+    std::vector<double> back(nt);
+    int k {0};
+    while (k < num_iterations) {
+	++k;
+	workers.product(&by_measured[0], nm, nt, &t[0], &folded[0]);
+	for (int j=0; j<nm; ++j)
+	    ratio[j] = (folded[j] > 0) ? m[j]/folded[j] : 0;
+	workers.product(&by_true[0], nt, nm, &ratio[0], &back[0]);
+
+	double change {0};
+	double total {0};
+	for (int i=0; i<nt; ++i) {
+	    double updated = (efficiency[i] > 0) ?
+		t[i]*back[i]/efficiency[i] : 0;
+	    change += std::fabs(updated - t[i]);
+	    total += updated;
+	    t[i] = updated;
+	}
+	if (stop_change > 0 && total > 0 && change/total < stop_change)
+	    break;
+    }
+    return k;
+}
@@ -0,0 +1,65 @@
+#ifndef UNFOLD_H
+#define UNFOLD_H
+
+#include "TH1D.h"
+#include "TH2D.h"
+#include "memory_budget.h"
+#include <vector>
+
+// MLEM unfolding of a measured spectrum with a detector response matrix
+//
+// Bin (i, j) of the response is the probability that a photon in true
+// energy bin i (x axis) is measured in pulse height bin j (y axis), so the
+// column sums are the efficiencies. Every iteration updates the true
+// spectrum t from the measured one m as
+//     t_i <- t_i / eff_i * sum_j R_ji m_j / (sum_k R_jk t_k)
+// which is also the iterative Bayesian (D'Agostini) update with the
+// previous estimate as the prior. Both matrix-vector products are row dot
+// products over contiguous copies of the matrix, vectorized and split over
+// threads. Iterations stop when the relative change of the spectrum drops
+// below the tolerance, or after max_iterations.
+//
+// The error band comes from unfolding Poisson replicas of the measured
+// spectrum, in parallel, with the same number of iterations as the central
+// result. Each replica has its own seed, as in the pileup bootstrap.
+class unfold
+{
+public:
+    unfold(TH2D* response);
+
+    int num_true() const { return nt; }
+    int num_measured() const { return nm; }
+    void set_convergence(int max_iterations, double tolerance);
+
+    // Unfolds the measured bins (1..nm of h) on num_threads (all cores if
+    // 0); returns the number of iterations
+    int run(TH1D* h_measured, int num_threads = 0);
+    void run_bootstrap(int num_replicas, int num_threads = 0,
+		       ULong64_t seed = 20180601);
+
+    TH1D* make_spectrum(const char* name) const;
+    TH1D* make_band(const char* name) const; // relative RMS per true bin
+
+private:
+    int nt;
+    int nm;
+    std::vector<double> true_edges;
+    std::vector<double> by_measured; // [j*nt + i]
+    std::vector<double> by_true;     // [i*nm + j]
+    std::vector<double> efficiency;
+    memory_charge matrix_memory; // both copies
+
+    int max_iterations;
+    double tolerance;
+
+    std::vector<double> measured;
+    std::vector<double> measured_weight; // counts per entry (scaled input)
+    std::vector<double> result;
+    int iterations;
+    std::vector<std::vector<double>> replicas;
+
+    int iterate(const std::vector<double>& m, std::vector<double>& t,
+		int num_iterations, double stop_change, int num_threads) const;
+};
+
+#endif
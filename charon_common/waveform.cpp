@@ -0,0 +1,126 @@
+#include "waveform.h"
+#include <algorithm>
+
+gate_params default_gates()
+{
+    gate_params gates;
+    gates.baseline_samples = 16;
+    gates.gate_start = 20;
+    gates.short_gate = 12;
+    gates.long_gate = 60;
+    gates.polarity = -1;
+    gates.pileup_low = 0.3;
+    gates.pileup_high = 0.5;
+    return gates;
+}
+
+waveform_batch::waveform_batch(int batch_capacity, gate_params& gate_settings)
+    :
+    capacity {batch_capacity}
+    ,count {0}
+    ,trace_length {0}
+    ,gates (gate_settings)
+    ,baseline(batch_capacity)
+    ,peak(batch_capacity)
+    ,total_v(batch_capacity)
+    ,tail_v(batch_capacity)
+    ,armed(batch_capacity)
+    ,pileup_v(batch_capacity)
+{
+};
+
+// Adds a trace to the batch, returns its index
+// The first trace sets the trace length of the batch
+int waveform_batch::add(const unsigned short* samples, int num_samples)
+{
+    if (trace_length == 0) {
+	trace_length = std::max(num_samples,
+				gates.gate_start + gates.long_gate);
+	data.assign(static_cast<std::size_t>(trace_length)*capacity, 0);
+    }
+
+    int n = std::min(num_samples, trace_length);
+    for (int s=0; s<n; ++s)
+	data[static_cast<std::size_t>(s)*capacity + count] = samples[s];
+    for (int s=n; s<trace_length; ++s)
+	data[static_cast<std::size_t>(s)*capacity + count] = 0;
+    return count++;
+}
+
+// Computes baseline, total and tail integrals and the pileup flag for every
+// trace in the batch
+void waveform_batch::process()
+{
+    const int n = count;
+    const int cap = capacity;
+    const float pol = gates.polarity < 0 ? -1 : 1;
+    const float* x = data.data();
+    float* b = baseline.data();
+    float* pk = peak.data();
+    float* tot = total_v.data();
+    float* tl = tail_v.data();
+    int* arm = armed.data();
+    int* pile = pileup_v.data();
+
+    const int gate_short_end = gates.gate_start + gates.short_gate;
+    const int gate_long_end = std::min(gates.gate_start + gates.long_gate,
+				       trace_length);
+    const float lo = gates.pileup_low;
+    const float hi = gates.pileup_high;
+
+    #pragma omp simd
+    for (int w=0; w<n; ++w) {
+	b[w] = 0;
+	pk[w] = 0;
+	tot[w] = 0;
+	tl[w] = 0;
+	arm[w] = 0;
+	pile[w] = 0;
+    }
+
+    // Baseline
+    for (int s=0; s<gates.baseline_samples; ++s) {
+	const float* xs = x + static_cast<std::size_t>(s)*cap;
+	#pragma omp simd
+	for (int w=0; w<n; ++w)
+	    b[w] += xs[w];
+    }
+    const float norm = 1.0f/std::max(gates.baseline_samples, 1);
+    #pragma omp simd
+    for (int w=0; w<n; ++w)
+	b[w] *= norm;
+
+    // Prompt part of the pulse (short gate)
+    for (int s=gates.gate_start; s<gate_short_end; ++s) {
+	const float* xs = x + static_cast<std::size_t>(s)*cap;
+	#pragma omp simd
+	for (int w=0; w<n; ++w) {
+	    float v = pol*(xs[w] - b[w]);
+	    tot[w] += v;
+	    pk[w] = std::max(pk[w], v);
+	}
+    }
+
+    // Tail (rest of the long gate)
+    for (int s=gate_short_end; s<gate_long_end; ++s) {
+	const float* xs = x + static_cast<std::size_t>(s)*cap;
+	#pragma omp simd
+	for (int w=0; w<n; ++w) {
+	    float v = pol*(xs[w] - b[w]);
+	    tot[w] += v;
+	    tl[w] += v;
+	}
+    }
+
+    // Second pulse: after the prompt gate the signal has to drop below
+    // lo*peak and then rise above hi*peak again
+    for (int s=gate_short_end; s<trace_length; ++s) {
+	const float* xs = x + static_cast<std::size_t>(s)*cap;
+	#pragma omp simd
+	for (int w=0; w<n; ++w) {
+	    float v = pol*(xs[w] - b[w]);
+	    pile[w] |= arm[w] & (v > hi*pk[w]);
+	    arm[w] |= (v < lo*pk[w]);
+	}
+    }
+}
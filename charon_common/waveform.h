@@ -0,0 +1,55 @@
+#ifndef WAVEFORM_H
+#define WAVEFORM_H
+
+#include <vector>
+
+// Integration gates for recomputing the PSD integrals from raw samples
+// All positions are sample indices from the start of the trace
+struct gate_params
+{
+    int baseline_samples; // baseline is the mean of the first samples
+    int gate_start;       // start of both gates
+    int short_gate;       // length of the short (prompt) gate
+    int long_gate;        // length of the long (total) gate
+    int polarity;         // -1 for negative pulses
+    float pileup_low;     // fraction of the peak the pulse must fall below
+    float pileup_high;    // fraction of the peak a second pulse must reach
+};
+
+gate_params default_gates();
+
+// A batch of digitizer traces, stored sample-major (sample s of trace w is
+// at data[s*capacity + w]) so every kernel is a loop over the batch that the
+// compiler can vectorize. Traces are cut or zero padded to one length.
+class waveform_batch
+{
+public:
+    waveform_batch(int batch_capacity, gate_params& gate_settings);
+
+    void clear() { count = 0; }
+    bool full() const { return count == capacity; }
+    int size() const { return count; }
+    int add(const unsigned short* samples, int num_samples);
+    void process();
+
+    // Results of process() for trace i
+    double total(int i) const { return total_v[i]; }
+    double tail(int i) const { return tail_v[i]; }
+    bool pileup(int i) const { return pileup_v[i] != 0; }
+
+private:
+    int capacity;
+    int count;
+    int trace_length;
+    gate_params gates;
+
+    std::vector<float> data;
+    std::vector<float> baseline;
+    std::vector<float> peak;
+    std::vector<float> total_v;
+    std::vector<float> tail_v;
+    std::vector<int> armed;
+    std::vector<int> pileup_v;
+};
+
+#endif
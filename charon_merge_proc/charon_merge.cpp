@@ -0,0 +1,126 @@
+#include "merge.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <getopt.h>
+
+static void show_usage(std::string name)
+{
+    std::cerr << "Merges digitizer data files (e.g. one per board or "
+	      << "channel) into a single\ntime sorted ROOT file for the "
+	      << "processing tools.\n\n"
+	      << "Usage: " << name << " [OPTION]...\n\n"
+	      << "Options:\n"
+	      << "-i, --input <file>   \t ROOT input file name, may be "
+	      <<                            "repeated\n"
+	      << "-o, --output <file>  \t ROOT output file name "
+	      <<                            "[default: sorted_output.root]\n"
+	      << "-m, --memory <MB>    \t memory budget for sorting "
+	      <<                            "[default: 1024]\n"
+	      << "-d, --spool <dir>    \t directory for spilled runs "
+	      <<                            "[default: .]\n"
+	      << "-w, --overwrite      \t enables overwriting the output file "
+	      <<                            "[default: off]\n"
+	      << "-h,  --help           \t show this help message\n"
+	      << std::endl;
+};
+
+int main(int argc, char **argv)
+{
+    std::cout << "########################################"
+	      << "########################################\n";
+
+    // Set defaults
+    std::vector<std::string> names_input {};
+    std::string name_output {"sorted_output.root"};
+    double memory_mb {1024};
+    std::string spool_dir {"."};
+    bool overwrite_param {false};
+
+    static const struct option long_options[] = {
+	{"help", no_argument, 0, 'h'},
+	{"input", required_argument, 0, 'i'},
+	{"output", required_argument, 0, 'o'},
+	{"memory", required_argument, 0, 'm'},
+	{"spool", required_argument, 0, 'd'},
+	{"overwrite", no_argument, 0, 'w'},
+	{} // deals with unknown parameters
+    };
+
+    std::string option_string {"i:o:m:d:wh"};
+
+    // Parse input
+    int opt;
+    int option_index {0};
+    opt = getopt_long(argc, argv, option_string.c_str(), long_options,
+		      &option_index);
+    while (opt != -1) {
+	switch (opt)
+	{
+	case 'i':
+	    names_input.push_back(optarg);
+	    break;
+	case 'o':
+	    name_output = optarg;
+	    break;
+	case 'm':
+	    memory_mb = std::stod(optarg);
+	    break;
+	case 'd':
+	    spool_dir = optarg;
+	    break;
+	case 'w':
+	    overwrite_param = true;
+	    break;
+	case 'h':
+	    show_usage(argv[0]);
+	    return 1;
+	case '?':
+	    show_usage(argv[0]);
+	    return 1;
+	default:
+	    break;
+	}
+
+	opt = getopt_long(argc, argv, option_string.c_str(), long_options,
+			  &option_index);
+    }
+
+    if (names_input.empty()) {
+	show_usage(argv[0]);
+	return 1;
+    }
+
+    // Print out settings for user to see
+    std::cout << "\nInput files:";
+    for (auto& name : names_input)
+	std::cout << "\t\t" << name << "\n";
+    std::cout << "\nOutput file:\t\t" << name_output << "\n"
+	      << "\nMemory budget [MB]:\t" << memory_mb << "\n"
+	      << "\nSpool directory:\t" << spool_dir << "\n"
+	      << "\nOverwrite output:\t" << std::boolalpha << overwrite_param << "\n"
+	      << std::endl;
+
+    std::cout << "########################################"
+	      << "########################################\n";
+
+    merge M(names_input, name_output, memory_mb, spool_dir);
+
+    if (!M.check_ifiles()) {
+	std::cerr << "Exiting.\n\n";
+	return 1;
+    }
+
+    if (!M.check_ofile_write(overwrite_param)) {
+	std::cerr << "\n\nExiting.\n\n";
+	return 1;
+    }
+
+    if (!M.split_runs()) {
+	std::cerr << "Exiting.\n\n";
+	return 1;
+    }
+    M.merge_runs(overwrite_param);
+
+    return 0;
+};
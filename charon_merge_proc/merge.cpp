@@ -0,0 +1,363 @@
+#include "merge.h"
+#include "TObjArray.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <utility>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+// Non member functions
+////////////////////////////////////////////////////////////////////////////////
+char gather_input()
+{
+    // Gets input from user (y,Y,n,N) and returns it as a char
+    char check_val;
+    std::cin >> check_val;
+    while (check_val != 'n' && check_val != 'N' &&
+	   check_val != 'y' && check_val != 'Y') {
+	std::cout << "Sorry, I do not understand that response.\n";
+	std::cin >> check_val;
+    }
+    return check_val;
+}
+
+// Names and titles (leaf lists) of the branches of a tree
+std::vector<std::string> branch_list(TTree* tree)
+{
+    std::vector<std::string> list;
+    TObjArray* branches = tree->GetListOfBranches();
+    for (int i=0; i<branches->GetEntriesFast(); ++i) {
+	TBranch* branch = (TBranch*)branches->At(i);
+	list.push_back(std::string(branch->GetName()) + " "
+		       + branch->GetTitle());
+    }
+    return list;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Member functions
+////////////////////////////////////////////////////////////////////////////////
+
+// Constructor
+merge::merge(std::vector<std::string>& names_input, std::string& name_output,
+	     double memory_mb, std::string& spool_dir)
+    :
+    names_in {names_input}
+    ,name_out {name_output}
+    ,spool {spool_dir}
+    ,max_events {0}
+    ,max_fanin {64}
+    ,num_spilled {0}
+{
+    max_events = static_cast<ULong64_t>(memory_mb*1024*1024
+					/ sizeof(sort_key));
+    if (max_events < 1)
+	max_events = 1;
+};
+
+// Destructor
+merge::~merge()
+{
+    // Remove any spilled runs that were left behind
+    for (std::size_t i=0; i<run_names.size(); ++i) {
+	if (run_temporary.at(i))
+	    std::remove(run_names.at(i).c_str());
+    }
+};
+
+// Checks if all of the designated input files exist
+bool merge::check_ifiles()
+{
+    for (auto& name : names_in) {
+	std::ifstream stream(name.c_str());
+	if (!stream.good()) {
+	    std::cerr << "\nInput file '" << name << "' does not exist.\n";
+	    return false;
+	}
+    }
+    return true;
+}
+
+// Checks if the designated output file exists already
+// Want to be careful not to overwrite something by accident
+bool merge::check_ofile_write(bool overwrite_param)
+{
+    char delete_check {'n'};
+    std::ifstream stream(name_out.c_str());
+
+    if (!stream.good())
+	return true; // No file exists, so it may be "overwritten"
+
+    if (overwrite_param == false) {
+	std::cout << "\nThe file '" << name_out.c_str()
+		  << "' already exists and you have chosen not to "
+		  << "overwrite it.\n";
+	return false;
+    }
+    std::cout << "\n\nOops!\n\t"
+	      << "The output file '" << name_out.c_str()
+	      << "' already exists.\n\t"
+	      << "Would you like to overwrite it? [y/N]\n\n";
+    delete_check = gather_input();
+
+    return (delete_check == 'y' || delete_check == 'Y');
+}
+
+// Reads only the time stamps to see if a tree can be merged as it is
+bool merge::is_sorted(TTree* tree)
+{
+    ULong64_t time_stamp {0};
+    ULong64_t time_previous {0};
+    ULong64_t num_entries = tree->GetEntries();
+
+    tree->SetBranchStatus("*", 0);
+    tree->SetBranchStatus("TimeStamp", 1);
+    tree->SetBranchAddress("TimeStamp", &time_stamp);
+
+    bool sorted {true};
+    for (ULong64_t entry=0; entry<num_entries; ++entry) {
+	tree->GetEntry(entry);
+	if (time_stamp < time_previous) {
+	    sorted = false;
+	    break;
+	}
+	time_previous = time_stamp;
+    }
+
+    tree->SetBranchStatus("*", 1);
+    tree->ResetBranchAddresses();
+    return sorted;
+}
+
+// Sorts a full buffer of keys and writes their events (every branch of
+// tree) to the spool directory as a run
+void merge::spill(TTree* tree, std::vector<sort_key>& buffer)
+{
+    std::stable_sort(buffer.begin(), buffer.end(),
+		     [](const sort_key& a, const sort_key& b) {
+			 return a.time_stamp < b.time_stamp;
+		     });
+
+    std::string name = spool + "/charon_merge_run"
+	+ std::to_string(num_spilled++) + ".root";
+    std::cout << "\tSpilling " << buffer.size() << " events to "
+	      << name << "\n";
+
+    TFile* f_run = new TFile(name.c_str(), "RECREATE");
+    TTree* run_tree = tree->CloneTree(0);
+    run_tree->SetTitle("Sorted run");
+    for (auto& key : buffer) {
+	tree->GetEntry(key.entry);
+	run_tree->Fill();
+    }
+    f_run->Write();
+    f_run->Close();
+    delete f_run;
+
+    run_names.push_back(name);
+    run_temporary.push_back(true);
+    buffer.clear();
+}
+
+// Phase 1: turn every input into one or more time sorted runs
+// Locally sorted inputs (one file per board or channel) are used directly,
+// anything else is sorted in memory sized chunks and spilled to disk
+// Returns false if an input has other branches than the first one
+bool merge::split_runs()
+{
+    std::cout << "\n\nSplitting inputs into sorted runs.\n\n";
+
+    std::vector<sort_key> buffer;
+    for (auto& name : names_in) {
+	TFile* f_in = new TFile(name.c_str());
+	TTree* tree = (TTree*)f_in->Get("WaveformData");
+	if (tree == 0) {
+	    std::cerr << "\nWarning! " << name
+		      << " has no WaveformData tree, skipping.\n";
+	    delete f_in;
+	    continue;
+	}
+
+	// Events are copied with every branch, none may be lost
+	if (branches.empty())
+	    branches = branch_list(tree);
+	else if (branch_list(tree) != branches) {
+	    std::cerr << "\n" << name << " has other WaveformData branches "
+		      << "than " << names_in.front()
+		      << ", cannot merge them.\n";
+	    delete f_in;
+	    return false;
+	}
+
+	ULong64_t num_entries = tree->GetEntries();
+	if (is_sorted(tree)) {
+	    std::cout << name << ": " << num_entries
+		      << " events, already sorted\n";
+	    run_names.push_back(name);
+	    run_temporary.push_back(false);
+	    delete f_in;
+	    continue;
+	}
+
+	std::cout << name << ": " << num_entries
+		  << " events, not sorted\n";
+	buffer.reserve(std::min(num_entries, max_events));
+
+	// Only the time stamps are read for the sort; the whole events are
+	// read when the chunk is spilled
+	ULong64_t time_stamp {0};
+	tree->SetBranchAddress("TimeStamp", &time_stamp);
+	tree->SetBranchStatus("*", 0);
+	tree->SetBranchStatus("TimeStamp", 1);
+	for (ULong64_t entry=0; entry<num_entries; ++entry) {
+	    tree->GetEntry(entry);
+	    buffer.push_back(sort_key {time_stamp, Long64_t(entry)});
+	    if (buffer.size() >= max_events || entry + 1 == num_entries) {
+		tree->SetBranchStatus("*", 1);
+		spill(tree, buffer);
+		tree->SetBranchStatus("*", 0);
+		tree->SetBranchStatus("TimeStamp", 1);
+	    }
+	}
+
+	delete f_in;
+    }
+
+    std::cout << "\n" << run_names.size() << " sorted runs ("
+	      << num_spilled << " spilled)\n";
+    return true;
+}
+
+// Opens a run and loads its first event
+bool merge::open_run(sorted_run& run)
+{
+    run.file = new TFile(run.name.c_str());
+    run.tree = (TTree*)run.file->Get("WaveformData");
+    if (run.tree == 0)
+	return false;
+    run.num_entries = run.tree->GetEntries();
+    run.next_entry = 0;
+    run.tree->SetBranchAddress("TimeStamp", &run.time_stamp);
+    return advance(run);
+}
+
+// Loads the next event of a run, returns false once it is exhausted
+bool merge::advance(sorted_run& run)
+{
+    if (run.next_entry >= run.num_entries)
+	return false;
+    run.tree->GetEntry(run.next_entry++);
+    return true;
+}
+
+// k-way merge of a group of runs into a new WaveformData tree in out_dir
+// using a min-heap on TimeStamp
+// Ties are broken by run order so the merge is stable
+void merge::merge_group(std::vector<std::string>& names,
+			std::vector<bool>& temporary,
+			TDirectory* out_dir, const char* title)
+{
+    std::vector<sorted_run> runs(names.size());
+    typedef std::pair<ULong64_t, std::size_t> heap_item;
+    std::priority_queue<heap_item, std::vector<heap_item>,
+			std::greater<heap_item>> heap;
+
+    for (std::size_t i=0; i<runs.size(); ++i) {
+	runs.at(i).name = names.at(i);
+	runs.at(i).temporary = temporary.at(i);
+	if (open_run(runs.at(i)))
+	    heap.push(heap_item(runs.at(i).time_stamp, i));
+    }
+
+    // The output has the branches of the runs; its branch addresses are
+    // those of the run whose event is copied
+    TTree* out_tree {0};
+    std::size_t source {0};
+    out_dir->cd();
+    while (source < runs.size() && runs.at(source).tree == 0)
+	++source;
+    if (source < runs.size())
+	out_tree = runs.at(source).tree->CloneTree(0);
+    else
+	out_tree = new TTree("WaveformData", title);
+    out_tree->SetTitle(title);
+
+    ULong64_t num_written {0};
+    while (!heap.empty()) {
+	std::size_t i = heap.top().second;
+	heap.pop();
+
+	if (i != source) {
+	    runs.at(i).tree->CopyAddresses(out_tree);
+	    source = i;
+	}
+	out_tree->Fill();
+	++num_written;
+
+	if (num_written % 10000000 == 0)
+	    std::cout << "\tMerged " << num_written << " events\n"
+		      << std::flush;
+
+	if (advance(runs.at(i)))
+	    heap.push(heap_item(runs.at(i).time_stamp, i));
+    }
+    out_tree->ResetBranchAddresses();
+
+    for (auto& run : runs) {
+	delete run.file;
+	if (run.temporary)
+	    std::remove(run.name.c_str());
+    }
+}
+
+// Phase 2: merge all runs into a single time sorted WaveformData tree
+// If there are more runs than can be opened at once, groups of runs are
+// merged into larger (spilled) runs first
+void merge::merge_runs(bool overwrite_param)
+{
+    std::cout << "\n\nMerging sorted runs.\n\n";
+
+    while (static_cast<int>(run_names.size()) > max_fanin) {
+	std::vector<std::string> names(run_names.begin(),
+				       run_names.begin() + max_fanin);
+	std::vector<bool> temporary(run_temporary.begin(),
+				    run_temporary.begin() + max_fanin);
+	run_names.erase(run_names.begin(), run_names.begin() + max_fanin);
+	run_temporary.erase(run_temporary.begin(),
+			    run_temporary.begin() + max_fanin);
+
+	std::string name = spool + "/charon_merge_run"
+	    + std::to_string(num_spilled++) + ".root";
+	TFile* f_run = new TFile(name.c_str(), "RECREATE");
+	merge_group(names, temporary, f_run, "Sorted run");
+	f_run->cd();
+	f_run->Write();
+	f_run->Close();
+	delete f_run;
+
+	run_names.push_back(name);
+	run_temporary.push_back(true);
+    }
+
+    TFile* f_output {0};
+    if (overwrite_param == true)
+	f_output = new TFile(name_out.c_str(), "RECREATE");
+    else
+	f_output = new TFile(name_out.c_str(), "NEW");
+
+    merge_group(run_names, run_temporary, f_output,
+		"Time sorted digitizer data");
+
+    std::cout << "\n\nWriting output file.\n\n";
+    f_output->cd();
+    f_output->Write();
+    f_output->Close();
+    delete f_output;
+
+    // Everything has been merged (and spilled runs removed)
+    run_names.clear();
+    run_temporary.clear();
+}
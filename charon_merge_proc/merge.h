@@ -0,0 +1,70 @@
+#ifndef MERGE_H
+#define MERGE_H
+
+#include "TFile.h"
+#include "TTree.h"
+#include <string>
+#include <vector>
+
+// Time stamp and entry of an event of an unsorted input
+struct sort_key
+{
+    ULong64_t time_stamp;
+    Long64_t entry;
+};
+
+// A time sorted source of events (an input file or a spilled run)
+struct sorted_run
+{
+    std::string name;
+    TFile* file;
+    TTree* tree;
+    ULong64_t next_entry;
+    ULong64_t num_entries;
+    bool temporary; // spilled by us, removed after merging
+    ULong64_t time_stamp; // of the loaded event
+};
+
+class merge
+{
+public:
+    // Constructor/destructor
+    merge(std::vector<std::string>& names_input, std::string& name_output,
+	  double memory_mb, std::string& spool_dir);
+    ~merge();
+
+    // Functions
+    bool check_ifiles();
+    bool check_ofile_write(bool overwrite_param);
+    bool split_runs();
+    void merge_runs(bool overwrite_param);
+
+private:
+    std::vector<std::string> names_in;
+    std::string name_out;
+    std::string spool;
+    ULong64_t max_events; // events held in memory at once
+    int max_fanin;        // runs merged at once
+    int num_spilled;
+
+    std::vector<std::string> run_names;
+    std::vector<bool> run_temporary;
+
+    // Branches (name and leaf list) of the first input; every event is
+    // copied with all of them, so every input must have the same ones
+    std::vector<std::string> branches;
+
+    bool is_sorted(TTree* tree);
+    void spill(TTree* tree, std::vector<sort_key>& buffer);
+    void merge_group(std::vector<std::string>& names,
+		     std::vector<bool>& temporary,
+		     TDirectory* out_dir, const char* title);
+    bool open_run(sorted_run& run);
+    bool advance(sorted_run& run);
+};
+
+// Non member functions
+char gather_input();
+std::vector<std::string> branch_list(TTree* tree);
+
+#endif
@@ -0,0 +1,168 @@
+#include "live_histograms.h"
+#include "TFile.h"
+#include "TH1D.h"
+#include "TH2D.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <getopt.h>
+#include <signal.h>
+
+static void show_usage(std::string name)
+{
+    std::cerr << "Shows the live histograms of a charon_onaxis or "
+	      << "charon_offaxis job run\nwith --live <name>, without "
+	      << "slowing it down.\n\n"
+	      << "Usage: " << name << " -n <name> [OPTION]...\n\n"
+	      << "Options:\n"
+	      << "-n, --name <name>    \t live name of the job\n"
+	      << "-i, --interval <s>   \t seconds between snapshots "
+	      <<                            "[default: 2]\n"
+	      << "-c, --count <int>    \t snapshots to take (0: until the "
+	      <<                            "job is done)\n"
+	      <<                       "\t\t\t\t[default: 0]\n"
+	      << "-o, --output <file>  \t write every snapshot to this ROOT "
+	      <<                            "file\n"
+	      << "-h,  --help           \t show this help message\n"
+	      << std::endl;
+};
+
+// Writes the histograms of a snapshot, aside first so that a viewer of the
+// file never sees it half written
+static void write_snapshot(live_snapshot& copy, std::string& file_name)
+{
+    std::string name_temp = file_name + ".tmp";
+    TFile* f_snapshot = new TFile(name_temp.c_str(), "RECREATE");
+    for (std::size_t i=0; i<copy.histograms.size(); ++i) {
+	live_histogram& d = copy.histograms[i];
+	TH1* h {0};
+	if (d.ny == 0) {
+	    h = new TH1D(d.name, d.name, d.nx, d.x_min, d.x_max);
+	    std::copy(copy.bins[i].begin(), copy.bins[i].end(),
+		      static_cast<TH1D*>(h)->GetArray());
+	}
+	else {
+	    h = new TH2D(d.name, d.name, d.nx, d.x_min, d.x_max,
+			 d.ny, d.y_min, d.y_max);
+	    std::copy(copy.bins[i].begin(), copy.bins[i].end(),
+		      static_cast<TH2D*>(h)->GetArray());
+	}
+	h->SetEntries(h->GetSumOfWeights());
+	h->Write();
+	delete h;
+    }
+    f_snapshot->Close();
+    delete f_snapshot;
+    std::rename(name_temp.c_str(), file_name.c_str());
+}
+
+static void print_snapshot(live_snapshot& copy)
+{
+    live_status& s = copy.status;
+    std::cout << "Pass " << s.pass << "  " << std::fixed
+	      << std::setprecision(1) << s.progress*100 << "%  "
+	      << std::defaultfloat << s.num_events << " events  window "
+	      << s.window_sec << " s: " << s.slope << " MeV/ADC, "
+	      << s.intercept << " MeV";
+    for (std::size_t i=0; i<copy.histograms.size(); ++i) {
+	double sum {0};
+	for (double content : copy.bins[i])
+	    sum += content;
+	std::cout << "  " << copy.histograms[i].name << " " << sum;
+    }
+    std::cout << (s.finished ? "  (final)\n" : "\n") << std::flush;
+}
+
+int main(int argc, char **argv)
+{
+    // Set defaults
+    std::string live_name; // default is "empty" (must be given)
+    double interval_sec {2};
+    int count {0};
+    std::string output_file; // default is "empty" (no file)
+
+    static const struct option long_options[] = {
+	{"help", no_argument, 0, 'h'},
+	{"name", required_argument, 0, 'n'},
+	{"interval", required_argument, 0, 'i'},
+	{"count", required_argument, 0, 'c'},
+	{"output", required_argument, 0, 'o'},
+	{} // deals with unknown parameters
+    };
+
+    std::string option_string {"n:i:c:o:h"};
+
+    // Parse input
+    int opt;
+    int option_index {0};
+    opt = getopt_long(argc, argv, option_string.c_str(), long_options,
+		      &option_index);
+    while (opt != -1) {
+	switch (opt)
+	{
+	case 'n':
+	    live_name = optarg;
+	    break;
+	case 'i':
+	    interval_sec = std::atof(optarg);
+	    break;
+	case 'c':
+	    count = std::atoi(optarg);
+	    break;
+	case 'o':
+	    output_file = optarg;
+	    break;
+	case 'h':
+	    show_usage(argv[0]);
+	    return 1;
+	case '?':
+	    show_usage(argv[0]);
+	    return 1;
+	default:
+	    break;
+	}
+
+	opt = getopt_long(argc, argv, option_string.c_str(), long_options,
+			  &option_index);
+    }
+
+    if (live_name.empty()) {
+	show_usage(argv[0]);
+	return 1;
+    }
+
+    live_reader reader;
+    if (!reader.attach(live_name))
+	return 1;
+
+    live_snapshot copy;
+    for (int n=0; count == 0 || n < count; ++n) {
+	if (n > 0) {
+	    std::this_thread::sleep_for
+		(std::chrono::duration<double>(interval_sec));
+	}
+	if (!reader.snapshot(copy)) {
+	    std::cout << "Job is updating, skipping this snapshot\n";
+	    continue;
+	}
+	print_snapshot(copy);
+	if (!output_file.empty())
+	    write_snapshot(copy, output_file);
+	if (copy.status.finished)
+	    break;
+
+	// A job that was killed never marks its histograms final
+	if (kill(reader.writer_pid(), 0) != 0 && errno == ESRCH) {
+	    std::cout << "Job " << reader.writer_pid() << " is gone\n";
+	    break;
+	}
+    }
+
+    return 0;
+};
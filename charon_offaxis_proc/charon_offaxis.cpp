@@ -1,7 +1,12 @@
 #include "process.h"
+#include "memory_budget.h"
+#include "perf_region.h"
+#include "spool.h"
 #include "TFile.h"
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <memory>
 #include <vector>
 #include <string>
 
@@ -9,13 +14,17 @@ static void show_usage(std::string name)
 {
     std::cerr << "Takes on-axis data from CHARON and processes it into "
 	      << "useful histograms.\n\n"
-	      << "Usage: " << name << " [OPTION]...\n\n"
+	      << "Usage: " << name << " [OPTION]...\n"
+	      << "       " << name << " --daemon <dir> [workers] [budget]\n\n"
               << "Options:\n"
               << "-h,  --help           \t show this help message\n"
 	      << "--intercept <dble>    \t y-intercept for calibration [default: 0]\n "
 	      << "--slope <dble>        \t slope for calibration [default: 1]\n"
-              << "-if, --input <file>   \t ROOT input file name "
-	      <<                            "[default: default_input.root]\n"
+	      << "-if, --input <file>   \t ROOT or list-mode (*.bin) input file "
+	      <<                            "name\n\t\t\t\t[default: "
+	      <<                            "default_input.root]\n"
+	      <<                       "\t\t\t\trepeat for the segments of a "
+	      <<                            "run, in order\n"
 	      << "-of, --output <file>  \t ROOT output file name "
 	      <<                            "[default: default_output.root]\n"
 	      << "-ch, --channel <int>  \t digitizer channel "
@@ -24,8 +33,55 @@ static void show_usage(std::string name)
 	      <<                          " [default: 0]\n"
 	      << "-sd, --stddevs <dble> \t number of standard deviations for "
 	      <<                          "pileup cut\n\t\t\t\t[default: 2.0]\n"
+	      << "--dieaway-period <us>\t fill die-away histograms relative to "
+	      <<                            "a beam period\n"
+	      << "--dieaway-trigger <int> fill die-away histograms relative to "
+	      <<                            "a trigger\n\t\t\t\tchannel\n"
+	      << "--dieaway-rbd        \t fill die-away histograms relative to "
+	      <<                            "beam off gaps\n\t\t\t\tin the "
+	      <<                            "scale (RBD) file\n"
+	      << "--dieaway-range <us> \t die-away histogram range "
+	      <<                            "[default: 1000]\n"
+	      << "--roi <lo:hi>        \t count rate in this energy range "
+	      <<                            "[MeV] over time,\n\t\t\t\twith "
+	      <<                            "the beam current of the scale "
+	      <<                            "file\n\t\t\t\t(repeat for more "
+	      <<                            "ROIs)\n"
+	      << "--roi-bin <s>        \t ROI rate time bin [default: 1]\n"
+	      << "--resolving-time <ns>  tag events with a neighbour closer "
+	      <<                            "than <ns>\n\t\t\t\tand compare "
+	      <<                            "with the PSD pileup\n\t\t\t\t"
+	      <<                            "correction [default: 0, off]\n"
+	      << "--waveforms <branch> \t recompute the PSD integrals from the "
+	      <<                            "raw samples\n\t\t\t\tin this branch\n"
+	      << "--gates <list>       \t waveform gates in samples: baseline,"
+	      <<                            "start,short,long[,polarity]\n"
+	      <<                       "\t\t\t\t[default: 16,20,12,60,-1]\n"
+	      << "--pyramid            \t fit the pileup band coarse-to-fine "
+	      <<                            "(fewer fits)\n"
+	      << "--discriminate <MeV> \t fit neutron and gamma bands in "
+	      <<                            "regions this wide\n\t\t\t\tand "
+	      <<                            "fill tagged spectra (0: off) "
+	      <<                            "[default: 0]\n"
+	      << "--bootstrap <int>    \t bootstrap replicas for the pileup "
+	      <<                            "correction\n\t\t\t\terror "
+	      <<                            "(0: off) [default: 200]\n"
+	      << "--memory-budget <size> memory budget, e.g. 4G (smaller "
+	      <<                            "batches and\n\t\t\t\tcaches "
+	      <<                            "past it) [default: none]\n"
+	      << "--memory-report <file> JSON report of the memory use "
+	      <<                            "per subsystem\n"
+	      << "--live <name>        \t publish the spectra and progress in "
+	      <<                            "shared memory\n\t\t\t\t"
+	      <<                            "/dev/shm/charon_<name> (see "
+	      <<                            "charon_monitor)\n"
 	      << "-ow, --overwrite      \t enables overwriting the output file "
 	      <<                            "[default: off]\n"
+	      << "--daemon <dir> [int] \t stay resident and run the *.job files"
+	      <<                            " put in <dir>\n\t\t\t\t(must be "
+	      <<                            "the first option), with\n\t\t\t\t"
+	      <<                            "<int> workers and a shared memory "
+	      <<                            "budget\n"
               << std::endl;
 };
 
@@ -46,7 +102,28 @@ void read_bounds(std::string& file_name, std::vector<int>& bounds)
     f_stream.close();
 };
 
-int main(int argc, const char* argv[])
+// Reads a comma separated list of integers (e.g. waveform gates)
+void read_list(std::string list, std::vector<int>& values)
+{
+    std::stringstream list_stream(list);
+    std::string value;
+    while (std::getline(list_stream, value, ',')) {
+	if (!value.empty())
+	    values.push_back(std::stoi(value));
+    }
+};
+
+// Whether a valued option is followed by its value
+static bool has_value(int i, int argc, std::string& option)
+{
+    if (i+1 < argc)
+	return true;
+    std::cerr << "Option " << option << " needs a value\n";
+    return false;
+}
+
+// One run of the tool; interactive runs ask before processing
+int run(int argc, const char* argv[], bool interactive)
 {
     // Gather commandline input
     std::cout << "########################################"
@@ -56,10 +133,32 @@ int main(int argc, const char* argv[])
     double intercept {0};
     double slope {1};
     std::string name_input {"default_input.root"};
+    std::vector<std::string> segment_names {}; // further input segments
     std::string name_output {"default_output.root"};
     int channel {0};
     std::string scale_file_name; // default is empty string
     double num_stddevs {2};
+    bool pyramid {false}; // coarse-to-fine pileup band fit
+    std::string waveform_branch; // default is empty (use digitizer values)
+    std::vector<int> gate_list {};
+    int bootstrap_replicas {200};
+    double ng_region_width {0}; // neutron/gamma discrimination (0 is off)
+    std::string memory_budget_text; // default is empty (no budget)
+    std::string memory_report_file; // default is empty (no report)
+    std::string live_name; // default is empty (not published)
+
+    // Die-away histograms (off unless a reference is chosen)
+    double dieaway_period {0};
+    int dieaway_trigger {-1};
+    bool dieaway_rbd {false};
+    double dieaway_range {1000};
+
+    // ROI rate monitor (off if no ROI is given); low, high pairs
+    std::vector<double> roi_list {};
+    double roi_bin {1};
+
+    // Interval pileup tagging (off if 0)
+    double resolving_time {0}; // ns
             
     bool overwrite_param {false}; // enforces overwriting output file if it exists
                                   // WARNING. This can be dangerous.
@@ -74,47 +173,179 @@ int main(int argc, const char* argv[])
 	    return 1;
 	}
 	else if (option == "--intercept") {
+	    if (!has_value(i, argc, option))
+		return 1;
 	    intercept = std::stod(argv[i+1]);
 	    ++i;
 	}
 	else if (option == "--slope") {
+	    if (!has_value(i, argc, option))
+		return 1;
 	    slope = std::stod(argv[i+1]);
 	    ++i;
 	}
 	else if (option == "-if" || option == "--input") {
-	    name_input = argv[i+1];
+	    if (!has_value(i, argc, option))
+		return 1;
+	    segment_names.push_back(argv[i+1]);
 	    ++i;
 	}
 	else if (option == "-of" || option == "--output") {
+	    if (!has_value(i, argc, option))
+		return 1;
 	    name_output = argv[i+1];
 	    ++i;
 	}
 	else if (option == "-ch" || option == "--channel") {
+	    if (!has_value(i, argc, option))
+		return 1;
 	    channel = std::atoi(argv[i+1]);
 	    ++i;
 	}
 	else if (option == "-l" || option == "--scale") {
+	    if (!has_value(i, argc, option))
+		return 1;
 	    scale_file_name = argv[i+1];
 	    ++i;
 	}
 	else if (option == "-sd" || option == "--stddevs") {
+	    if (!has_value(i, argc, option))
+		return 1;
 	    num_stddevs = std::stod(argv[i+1]);
 	    ++i;
 	}
+	else if (option == "--dieaway-period") {
+	    if (!has_value(i, argc, option))
+		return 1;
+	    dieaway_period = std::stod(argv[i+1]);
+	    ++i;
+	}
+	else if (option == "--dieaway-trigger") {
+	    if (!has_value(i, argc, option))
+		return 1;
+	    dieaway_trigger = std::atoi(argv[i+1]);
+	    ++i;
+	}
+	else if (option == "--dieaway-rbd") {
+	    dieaway_rbd = true;
+	}
+	else if (option == "--dieaway-range") {
+	    if (!has_value(i, argc, option))
+		return 1;
+	    dieaway_range = std::stod(argv[i+1]);
+	    ++i;
+	}
+	else if (option == "--roi") {
+	    if (!has_value(i, argc, option))
+		return 1;
+	    std::string roi {argv[i+1]};
+	    std::size_t colon = roi.find(':');
+	    if (colon != std::string::npos) {
+		roi_list.push_back(std::stod(roi.substr(0, colon)));
+		roi_list.push_back(std::stod(roi.substr(colon + 1)));
+	    }
+	    else {
+		std::cout << "\nWarning! ROI " << roi
+			  << " is not <lo:hi>, skipping it\n\n";
+	    }
+	    ++i;
+	}
+	else if (option == "--roi-bin") {
+	    if (!has_value(i, argc, option))
+		return 1;
+	    roi_bin = std::stod(argv[i+1]);
+	    ++i;
+	}
+	else if (option == "--live") {
+	    if (!has_value(i, argc, option))
+		return 1;
+	    live_name = argv[i+1];
+	    ++i;
+	}
+	else if (option == "--resolving-time") {
+	    if (!has_value(i, argc, option))
+		return 1;
+	    resolving_time = std::stod(argv[i+1]);
+	    ++i;
+	}
+	else if (option == "--waveforms") {
+	    if (!has_value(i, argc, option))
+		return 1;
+	    waveform_branch = argv[i+1];
+	    ++i;
+	}
+	else if (option == "--gates") {
+	    if (!has_value(i, argc, option))
+		return 1;
+	    gate_list.clear();
+	    read_list(argv[i+1], gate_list);
+	    ++i;
+	}
+	else if (option == "--pyramid") {
+	    pyramid = true;
+	}
+	else if (option == "--bootstrap") {
+	    if (!has_value(i, argc, option))
+		return 1;
+	    bootstrap_replicas = std::atoi(argv[i+1]);
+	    ++i;
+	}
+	else if (option == "--discriminate") {
+	    if (!has_value(i, argc, option))
+		return 1;
+	    ng_region_width = std::stod(argv[i+1]);
+	    ++i;
+	}
+	else if (option == "--memory-budget") {
+	    if (!has_value(i, argc, option))
+		return 1;
+	    memory_budget_text = argv[i+1];
+	    ++i;
+	}
+	else if (option == "--memory-report") {
+	    if (!has_value(i, argc, option))
+		return 1;
+	    memory_report_file = argv[i+1];
+	    ++i;
+	}
 	else if (option == "-ow" || option == "--overwrite") {
 	    overwrite_param = true;
-	    ++i;
 	}
     }
 
+    // The budget is per process, so daemon jobs share the daemon's
+    if (!memory_budget_text.empty()) {
+	if (interactive)
+	    memory().set_limit(parse_bytes(memory_budget_text));
+	else
+	    std::cout << "\nJobs use the memory budget of the daemon\n";
+    }
+
+    if (!segment_names.empty()) {
+	name_input = segment_names.front();
+	segment_names.erase(segment_names.begin());
+    }
+
     // Print out settings for user to see
-    std::cout << "\nInput file:\t\t" << name_input << "\n"
-	      << "\nOutput file:\t\t" << name_output << "\n"
+    std::cout << "\nInput file:\t\t" << name_input << "\n";
+    for (auto& name : segment_names)
+	std::cout << "\t\t\t" << name << "\n";
+    std::cout << "\nOutput file:\t\t" << name_output << "\n"
 	      << "\nChannel number:\t\t" << channel << "\n"
 	      << "\nScaling File:\t\t" << scale_file_name << "\n"
 	      << "\nIntercept:\t\t" << intercept << "\n"
 	      << "\nSlope:\t\t\t" << slope << "\n"
 	      << "\nStandard deviations:\t" << num_stddevs << "\n"
+	      << "\nWaveform branch:\t" << waveform_branch << "\n"
+	      << "\nPyramid band fit:\t" << std::boolalpha << pyramid << "\n"
+	      << "\nBootstrap replicas:\t" << bootstrap_replicas << "\n"
+	      << "\nn/gamma regions [MeV]:\t" << ng_region_width << "\n"
+	      << "\nMemory budget [MB]:\t" << memory().limit()/1048576.0
+	      << "\n"
+	      << "\nROIs (bin [s]):\t\t" << roi_list.size()/2 << " ("
+	      << roi_bin << ")\n"
+	      << "\nResolving time [ns]:\t" << resolving_time << "\n"
+	      << "\nLive name:\t\t" << live_name << "\n"
 	      << "\nOverwrite output:\t" << std::boolalpha << overwrite_param << "\n"
 	      << std::endl;
 
@@ -122,17 +353,23 @@ int main(int argc, const char* argv[])
 	      << "########################################\n";
 
     // Ask if the user wants to continue with the default parameters
-    std::cout << "\nWould you like to continue with these parameters? [y/N]\n";
-    char response = gather_input();
-    if (response == 'n' || response == 'N') {
-	std::cerr << "\nExiting.\n";
-	return 1;
+    if (interactive) {
+	std::cout << "\nWould you like to continue with these parameters? "
+		  << "[y/N]\n";
+	char response = gather_input();
+	if (response == 'n' || response == 'N') {
+	    std::cerr << "\nExiting.\n";
+	    return 1;
+	}
     }
 
     // Perform analysis
     
     // Create object to perform the analysis
-    process* P = new process(name_input, name_output, channel);
+    std::unique_ptr<process> P(new process(name_input, name_output,
+					   channel));
+    for (auto& name : segment_names)
+	P->add_segment(name);
 
     // Check if input file exists (for soft failure)
     bool ifile_exists = P->check_ifile();
@@ -144,19 +381,67 @@ int main(int argc, const char* argv[])
     }
     
     // Check if the output file exists and if it should be overwritten
-    bool ofile_overwrite = P->check_ofile_write(overwrite_param);
+    bool ofile_overwrite = P->check_ofile_write(overwrite_param,
+						   interactive);
     if (ofile_overwrite == false) {
 	std::cerr << "\n\nExiting.\n\n";
 	return 1;
     }
     
     P->initialize();
+    if (!live_name.empty())
+	P->set_live(live_name);
+    P->set_bootstrap(bootstrap_replicas);
+    P->set_discrimination(ng_region_width);
+    if (!waveform_branch.empty())
+	P->set_waveforms(waveform_branch, gate_list);
+    std::string dieaway_file = dieaway_rbd ? scale_file_name : "";
+    P->set_dieaway(dieaway_period, dieaway_trigger, dieaway_file,
+		   dieaway_range);
+    P->set_rate_monitor(roi_list, roi_bin, scale_file_name);
+    P->set_resolving_time(resolving_time);
     P->calibrate(slope, intercept);
     //P->temp_func();
-    P->psd_cut(slope, intercept, num_stddevs);
+    P->psd_cut(slope, intercept, num_stddevs, pyramid);
     if (!scale_file_name.empty())
 	P->apply_scaling(scale_file_name);
     P->write_out(overwrite_param);
+    perf_report();
 
+    // Charges still in use now were never released
+    P.reset();
+    if (memory().limit() > 0)
+	memory().print();
+    if (!memory_report_file.empty())
+	memory().write_report(memory_report_file);
     return 0;
 };
+
+// Runs one job of the daemon, given as long options
+int run_job(std::vector<std::string>& args)
+{
+    std::vector<const char*> argv_job {"charon_offaxis"};
+    for (auto& arg : args)
+	argv_job.push_back(arg.c_str());
+    argv_job.push_back(0);
+    return run(argv_job.size() - 1, argv_job.data(), false);
+};
+
+int main(int argc, const char* argv[])
+{
+    if (argc > 2 && std::string(argv[1]) == "--daemon") {
+	std::string spool_dir {argv[2]};
+	int workers = (argc > 3) ? std::atoi(argv[3]) : 0;
+	if (argc > 4)
+	    memory().set_limit(parse_bytes(argv[4]));
+	spool_daemon daemon(spool_dir, workers, run_job);
+	return daemon.run();
+    }
+    try {
+	return run(argc, argv, true);
+    }
+    catch (std::exception& e) {
+	std::cerr << "\nError: " << e.what() << "\nExiting.\n\n";
+	return 1;
+    }
+};
@@ -1,16 +1,34 @@
 #include "process.h"
+#include "TBranch.h"
+#include "TChain.h"
 #include "TCutG.h"
 #include "TF1.h"
 #include "TLeaf.h"
 #include "TLinearFitter.h"
+#include "TGraphErrors.h"
 #include "TMath.h"
+#include "TParameter.h"
+#include "TROOT.h"
+#include "bootstrap.h"
+#include "discrimination.h"
+#include "event_reader.h"
+#include "list_mode.h"
+#include "perf_region.h"
+#include "psd_pyramid.h"
+#include "rbd.h"
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <mutex>
 #include <vector>
 ////////////////////////////////////////////////////////////////////////////////
 // Non member functions
 ////////////////////////////////////////////////////////////////////////////////
+// TH1::Fit goes through one global TMinuit, so fits in concurrent daemon
+// jobs take turns
+static std::mutex fit_mutex;
+
 char gather_input()
 {
     // Gets input from user (y,Y,n,N) and returns it as a char
@@ -34,7 +52,9 @@ process::process(std::string& name_input, std::string& name_output,
     :
     name_in {name_input}
     ,name_out {name_output}
+    ,f_in {0}
     ,tree {0}
+    ,binary {0}
     ,num_entries {0}
     ,channel_num {channel}
     ,scale_factor {1}
@@ -44,7 +64,23 @@ process::process(std::string& name_input, std::string& name_output,
     ,h_PSD_clean {0} 
     ,pileup_cut {0}
     ,charge_graph {0}
+    ,dieaway_range {1000}
+    ,gates (default_gates())
+    ,h_wave_pileup {0}
+    ,bootstrap_replicas {200}
+    ,h_bootstrap {0}
+    ,h_band {0}
+    ,bootstrap_offset {0}
+    ,ng_region_width {0}
+    ,neutron_cut {0}
+    ,gamma_cut {0}
+    ,fom_graph {0}
+    ,h_neutron {0}
+    ,h_gamma {0}
+    ,histogram_memory(mem_histograms)
+    ,cache_memory(mem_io_caches)
 {
+    segment_names.push_back(name_input);
 };
 
 // Destructor
@@ -52,18 +88,43 @@ process::~process()
 {
     delete f_in;
     delete tree;
+    delete binary;
     delete h_dirty;
     delete h_clean;
     delete h_PSD_dirty;
     delete h_PSD_clean;
+    delete pileup_cut;
+    delete charge_graph;
+    delete h_wave_pileup;
+    delete h_bootstrap;
+    delete h_band;
+    delete neutron_cut;
+    delete gamma_cut;
+    delete fom_graph;
+    delete h_neutron;
+    delete h_gamma;
 };
 
 // Initial setup (defining some private members)
 void process::initialize()
 {
-    f_in = new TFile(name_in.c_str());
-    tree = (TTree*)f_in->Get("WaveformData");
-    num_entries = tree->GetEntries();
+    // The event loops run on several threads
+    ROOT::EnableThreadSafety();
+
+    // All segments of the run, in order (ROOT files or the digitizer's
+    // list-mode files)
+    if (list_mode::is_list_mode(segment_names.front())) {
+	binary = new list_mode(segment_names);
+	num_entries = binary->entries();
+    }
+    else {
+	TChain* chain = new TChain("WaveformData");
+	for (auto& name : segment_names)
+	    chain->Add(name.c_str());
+	tree = chain;
+	num_entries = tree->GetEntries();
+	size_tree_cache();
+    }
     std::cout << "\n\nTree read with " <<num_entries<< " events\n\n";
 
     // Define histogram parameters
@@ -90,6 +151,7 @@ void process::initialize()
     h_PSD_clean = new TH2D("Clean_PSD","PSD;Energy [MeV];Tail/Total"
 			   ,num_xbin,x_min,x_max
 			   ,num_ybin,y_min,y_max);
+    account_histograms();
 };
 
 // Checks if the designated input file exists
@@ -100,17 +162,18 @@ bool process::check_ifile()
     // true --> input file exists
     // false --> input file does not exist
     
-    std::ifstream stream(name_in.c_str());
-    
-    if (stream.good()) 
-	return true;
-    else
-	return false; 
+    for (auto& name : segment_names) {
+	std::ifstream stream(name.c_str());
+	if (!stream.good())
+	    return false;
+    }
+    return true;
 }
 
 // Checks if the designated output file exists already
 // Want to be careful not to overwrite something by accident 
-bool process::check_ofile_write(bool overwrite_param)
+// (without asking if not interactive, e.g. daemon jobs)
+bool process::check_ofile_write(bool overwrite_param, bool interactive)
 {
     // check if output file already exists
     // Returns boolian to main.
@@ -129,6 +192,8 @@ bool process::check_ofile_write(bool overwrite_param)
 		      << "overwrite it.\n";
 	    return false;
 	}
+	if (!interactive)
+	    return true;
 	std::cout << "\n\nOops!\n\t"
 		  << "The output file '" << name_out.c_str()
 	          << "' already exists.\n\t"
@@ -158,7 +223,9 @@ bool process::check_ofile_write(bool overwrite_param)
 // Does some cleaning up of objects still in memory (prevents duplicated writes)
 void process::write_out(bool overwrite_param)
 {
+    PERF_REGION("write_out");
     std::cout << "\n\nWriting output file.\n\n";
+    live.finish();
     TFile* f_output {0};
     // Need to check if we can overwrite an existing output file
     if (overwrite_param == true)
@@ -174,16 +241,52 @@ void process::write_out(bool overwrite_param)
     pileup_cut->Write();
     if (charge_graph != 0)
 	charge_graph->Write();
+    die_away.write();
+    rates.write();
+    intervals.write();
+    if (h_wave_pileup != 0)
+	h_wave_pileup->Write();
+    if (h_bootstrap != 0) {
+	h_bootstrap->Write();
+	h_band->Write();
+
+	// Corrected spectrum with its bootstrap uncertainty
+	TGraphErrors band(h_clean->GetNbinsX());
+	for (int bin=1; bin<=h_clean->GetNbinsX(); ++bin) {
+	    double counts = h_clean->GetBinContent(bin);
+	    band.SetPoint(bin-1, h_clean->GetBinCenter(bin), counts);
+	    band.SetPointError(bin-1, 0, counts*h_band->GetBinContent(bin));
+	}
+	band.Write("Pileup_Corrected_Band");
+	TParameter<double>("Bootstrap_Offset", bootstrap_offset).Write();
+    }
+    if (fom_graph != 0)
+	fom_graph->Write();
+    if (neutron_cut != 0) {
+	neutron_cut->Write();
+	gamma_cut->Write();
+	h_neutron->Write();
+	h_gamma->Write();
+    }
 
+    // Freed here already (the destructor skips them)
     delete h_dirty;
     delete h_clean;
     delete h_PSD_dirty;
     delete h_PSD_clean;
     delete pileup_cut;
     delete charge_graph;
+    h_dirty = 0;
+    h_clean = 0;
+    h_PSD_dirty = 0;
+    h_PSD_clean = 0;
+    pileup_cut = 0;
+    charge_graph = 0;
+    account_histograms();
 
     f_output->Write();
     f_output->Close();
+    delete f_output;
 };
 
 // apply linear calibration
@@ -192,45 +295,143 @@ void process::calibrate(double slope, double intercept)
     std::cout << "\n\nCalibrating\n\n";
 
     // Initialize variables for the while loop
-    int channel {0};
-    double energy {0};
-    double tail {0};
     double E_calibrated {0};
 
-    tree->SetBranchAddress("ChannelID", &channel);
-    tree->SetBranchAddress("PSDTotalIntegral", &energy);
-    tree->SetBranchAddress("PSDTailIntegral", &tail);
-
-    for (ULong64_t entry = 0; entry<num_entries; ++entry) {
-	tree->GetEntry(entry);
+    // Entries are read in batches (optionally recomputing the integrals
+    // from the raw waveforms)
+    size_tree_cache();
+    event_reader reader(tree, binary, budget_batch_capacity());
+    if (!waveform_branch.empty()) {
+	reader.set_waveforms(waveform_branch, gates, channel_num);
+	if (h_wave_pileup == 0) {
+	    h_wave_pileup = new TH1D("Waveform_Pileup"
+				     ,"Waveform pileup;Energy [MeV];Counts"
+				     ,1024,0,10);
+	}
+    }
 
-	if (entry%1000000 == 0) {
-	    std::cout << "Processing event " << entry << " of "
-		      << num_entries << " ("
-		      << (double)entry/(double)num_entries*100.0<<"%)"
-		      << std::endl;
+    // Die-away histograms and ROI rates are filled with the uncut pass
+    if (pileup_cut == 0 && (die_away.enabled() || rates.enabled())) {
+	ULong64_t time_initial = time_stamp_at(0);
+	die_away.initialize(dieaway_range, time_initial);
+	rates.initialize(time_initial);
+    }
+    if (pileup_cut == 0)
+	intervals.initialize();
+    if (live.enabled())
+	live.set_pass((pileup_cut == 0) ? 0 : 1, time_stamp_at(0),
+		      time_stamp_at(num_entries - 1));
+    live.set_window(0, slope, intercept);
+
+    // Entries are decoded on a reader thread, calibrated here and
+    // histogrammed on a filler thread
+    filler_stage filler([this](calibrated_batch& b) { fill_events(b); },
+			reader.batch_capacity());
+    ULong64_t time_last {0};
+    {
+	reader_stage events(reader, 0, num_entries);
+	PERF_REGION("calibrate fill");
+	ULong64_t entry {0};
+	event_batch* batch;
+	while ((batch = events.next()) != 0) {
+	    calibrated_batch* out = filler.get_free();
+	    for (std::size_t i=0; i<batch->size; ++i) {
+		int channel = batch->channel[i];
+		double energy = batch->energy[i];
+
+		if ((entry + i)%1000000 == 0) {
+		    std::cout << "Processing event " << entry + i << " of "
+			      << num_entries << " ("
+			      << (double)(entry + i)/(double)num_entries*100.0
+			      << "%)" << std::endl;
+		}
+
+		if (channel != channel_num &&
+		    !(pileup_cut == 0 && die_away.observes(channel)))
+		    continue;
+
+		E_calibrated = (channel == channel_num) ?
+		    energy * slope + intercept : energy;
+
+		out->add(batch->time_stamp[i], channel, E_calibrated,
+			 batch->tail[i]/energy, batch->pileup[i]);
+	    }
+	    entry += batch->size;
+	    if (batch->size > 0)
+		time_last = batch->time_stamp[batch->size - 1];
+	    filler.push(out);
+	    events.recycle(batch);
 	}
-	
-	E_calibrated = energy * slope + intercept;
+    }
+    filler.finish();
+    live.publish();
+
+    // The last (partial) ROI rate bin is dropped
+    if (pileup_cut == 0) {
+	rates.flush(time_last);
+	intervals.finish();
+    }
+    account_histograms();
+};
+
+// Histograms calibrated events (runs on the filler thread)
+void process::fill_events(calibrated_batch& batch)
+{
+    for (std::size_t i=0; i<batch.size; ++i) {
+	double E_calibrated = batch.energy[i];
+	double ratio = batch.ratio[i];
+
+	if (pileup_cut == 0)
+	    die_away.observe(batch.time_stamp[i], batch.channel[i]);
 
-	if (channel != channel_num)
+	if (batch.channel[i] != channel_num)
 	    continue;
 
 	if (pileup_cut == 0) {
 	    h_dirty->Fill(E_calibrated);
-	    h_PSD_dirty->Fill(E_calibrated,tail/energy);
+	    h_PSD_dirty->Fill(E_calibrated,ratio);
+	    if (die_away.enabled())
+		die_away.fill(batch.time_stamp[i], E_calibrated);
+	    if (rates.enabled())
+		rates.fill(batch.time_stamp[i], E_calibrated);
+	    if (intervals.enabled())
+		intervals.fill(batch.time_stamp[i], channel_num, E_calibrated);
+	    if (batch.pileup[i])
+		h_wave_pileup->Fill(E_calibrated);
 	}
-	else if (pileup_cut != 0 &&
-		 pileup_cut->IsInside(E_calibrated,tail/energy)) {
-	    
-	    h_clean->Fill(E_calibrated);
-	    h_PSD_clean->Fill(E_calibrated,tail/energy);
+	else {
+	    if (pileup_cut->IsInside(E_calibrated,ratio)) {
+		h_clean->Fill(E_calibrated);
+		h_PSD_clean->Fill(E_calibrated,ratio);
+	    }
+
+	    // Particle tags do not depend on the pileup cut (neutrons are
+	    // outside the dominant band)
+	    if (neutron_cut != 0) {
+		if (neutron_cut->IsInside(E_calibrated,ratio))
+		    h_neutron->Fill(E_calibrated);
+		else if (gamma_cut->IsInside(E_calibrated,ratio))
+		    h_gamma->Fill(E_calibrated);
+	    }
 	}
     }
-};
+    if (batch.size > 0)
+	live.update(batch.time_stamp[batch.size - 1], batch.size);
+}
+
+// Time stamp of one entry (reading only that branch)
+ULong64_t process::time_stamp_at(ULong64_t entry)
+{
+    if (binary != 0)
+	return binary->time_stamp(entry);
+    Long64_t local = tree->LoadTree(entry); // entry in the current segment
+    tree->GetBranch("TimeStamp")->GetEntry(local);
+    return tree->GetLeaf("TimeStamp")->GetValue(0);
+}
 
 // Cleans up pileup for a correction later
-void process::psd_cut(double slope, double intercept, double num_stddevs = 2)
+void process::psd_cut(double slope, double intercept, double num_stddevs = 2,
+		      bool pyramid = false)
 {
     std::cout << "\n\nProcessing Pileup Cut.\n\nProgress:\n\t";
 
@@ -246,58 +447,77 @@ void process::psd_cut(double slope, double intercept, double num_stddevs = 2)
     //        3 --> offset
     double last_par [] {0,0,0.1,0};
 
-    for (int xbin=0; xbin<=h_PSD_dirty->GetNbinsX(); ++xbin) {
-	if (xbin % 100 == 0) {
-	    std::cout << static_cast<double>(xbin)/h_PSD_dirty->GetNbinsX()*100
-		      << "%\n" << std::flush << "\t";
+    if (pyramid) {
+	// Coarse-to-fine fits, interpolated where the band is smooth
+	PERF_REGION("psd_cut pyramid");
+	std::lock_guard<std::mutex> lock(fit_mutex);
+	std::vector<double> center;
+	std::vector<double> sigma;
+	fit_psd_pyramid(h_PSD_dirty, center, sigma);
+
+	for (int xbin=0; xbin<=h_PSD_dirty->GetNbinsX(); ++xbin) {
+	    double std_dev = std::max(sigma.at(xbin), 0.005);
+	    double cut = std_dev*num_stddevs;
+	    double energy = h_PSD_dirty->GetXaxis()->GetBinCenter(xbin);
+	    y_bottom.push_back(center.at(xbin)-cut);
+	    y_top.push_back(center.at(xbin)+cut);
+	    x.push_back(energy);
 	}
+    }
+    else {
+	PERF_REGION("psd_cut fits");
+	std::lock_guard<std::mutex> lock(fit_mutex);
+
+	for (int xbin=0; xbin<=h_PSD_dirty->GetNbinsX(); ++xbin) {
+	    if (xbin % 100 == 0) {
+		std::cout << static_cast<double>(xbin)/h_PSD_dirty->GetNbinsX()*100
+			  << "%\n" << std::flush << "\t";
+	    }
 
-	/** Uncomment for a coarser fit  
-	if (xbin % 5 != 0) {
-	    continue;
-	}
-	**/
-
-	TH1D* proj_p = h_PSD_dirty->ProjectionY("current_proj", xbin, xbin);
-	TH1D proj = *proj_p;
-
-	// Create gaussian fit
-	TF1* gaus_fit = new TF1("fit","gaus(0)+[3]",0,1);
-
-	// Set peak parameters
-	double peak_bin = proj.GetBinCenter(proj.GetMaximumBin());
-	double height {h_PSD_dirty->GetBinContent(peak_bin)};
-	double std_dev = last_par[2];
-	double offset = last_par[3];
-
-	// Perform fit 
-	double par [] {height,peak_bin,std_dev,offset};
-	gaus_fit->SetParameters(par);
-	proj.Fit(gaus_fit,"Q");
-	gaus_fit->GetParameters(par);
-
-	// Check fit
-	int n_entries = proj.Integral(1,proj.GetNbinsX());
-	if (n_entries < 100)
-	    continue; // This number might need to be changed 
-
-	if (par[2] < 0.005)  
-	    par[2] = 0.005;
-
-	// Collect coordinates for the TCutG points
-	double cut = par[2]*num_stddevs;
-	double energy = h_PSD_dirty->GetXaxis()->GetBinCenter(xbin);
-	y_bottom.push_back(par[1]-cut);
-	y_top.push_back(par[1]+cut);
-	x.push_back(energy);
-
-	// Set default fit parameters for the next run
-	for (int i=0; i<4; ++i) {
-	    last_par[i] = par[i];
+	    /** Uncomment for a coarser fit  
+	    if (xbin % 5 != 0) {
+		continue;
+	    }
+	    **/
+
+	    TH1D* proj_p = h_PSD_dirty->ProjectionY("current_proj", xbin, xbin);
+	    TH1D proj = *proj_p;
+	    delete proj_p;
+
+	    // Set peak parameters
+	    double peak_bin = proj.GetBinCenter(proj.GetMaximumBin());
+	    double height {h_PSD_dirty->GetBinContent(peak_bin)};
+	    double std_dev = last_par[2];
+	    double offset = last_par[3];
+
+	    // Perform fit (a fresh function, so no step sizes carry over)
+	    double par [] {height,peak_bin,std_dev,offset};
+	    TF1* gaus_fit = new TF1("fit","gaus(0)+[3]",0,1);
+	    gaus_fit->SetParameters(par);
+	    proj.Fit(gaus_fit,"Q");
+	    gaus_fit->GetParameters(par);
+	    delete gaus_fit;
+
+	    // Check fit
+	    int n_entries = proj.Integral(1,proj.GetNbinsX());
+	    if (n_entries < 100)
+		continue; // This number might need to be changed 
+
+	    if (par[2] < 0.005)  
+		par[2] = 0.005;
+
+	    // Collect coordinates for the TCutG points
+	    double cut = par[2]*num_stddevs;
+	    double energy = h_PSD_dirty->GetXaxis()->GetBinCenter(xbin);
+	    y_bottom.push_back(par[1]-cut);
+	    y_top.push_back(par[1]+cut);
+	    x.push_back(energy);
+
+	    // Set default fit parameters for the next run
+	    for (int i=0; i<4; ++i) {
+		last_par[i] = par[i];
+	    }
 	}
-	
-	// Clean up our object
-        delete proj_p;
     }
 
     // Create TCutG
@@ -365,7 +585,10 @@ void process::psd_cut(double slope, double intercept, double num_stddevs = 2)
 	,scale_factor;
     
     // Get number of clean events (inside the pileup correction)
-    num_clean = pileup_cut->IntegralHist(h_PSD_dirty);
+    {
+	PERF_REGION("IntegralHist");
+	num_clean = pileup_cut->IntegralHist(h_PSD_dirty);
+    }
     
     // Get number of total events
     num_total = h_dirty->Integral(1,h_dirty->GetNbinsX());
@@ -374,6 +597,15 @@ void process::psd_cut(double slope, double intercept, double num_stddevs = 2)
 
     // Pileup correction factor
     scale_factor = ( (1 - TMath::Log(fraction)) / fraction);
+    intervals.compare(scale_factor);
+
+    // Uncertainty of the correction factor
+    if (bootstrap_replicas > 0)
+	run_bootstrap(num_stddevs, pyramid, scale_factor);
+
+    // Neutron and gamma cuts, for tagging in the same pass
+    if (ng_region_width > 0)
+	fit_discrimination();
 
     // Create histograms
     calibrate(slope, intercept);
@@ -381,6 +613,189 @@ void process::psd_cut(double slope, double intercept, double num_stddevs = 2)
     // Apply correction factor
     h_clean->Sumw2();
     h_clean->Scale(scale_factor);
+    account_histograms();
+}
+
+// Sets the number of bootstrap replicas of the pileup correction (0 for
+// none)
+void process::set_bootstrap(int num_replicas)
+{
+    bootstrap_replicas = num_replicas;
+}
+
+// Estimates the uncertainty of the pileup correction factor by resampling
+// the uncut PSD plot
+void process::run_bootstrap(double num_stddevs, bool pyramid, double scale)
+{
+    PERF_REGION("bootstrap");
+    std::cout << "\n\nBootstrapping the pileup correction ("
+	      << bootstrap_replicas << " replicas).\n\n";
+
+    // Slices with too few entries are left out of the cut, as in psd_cut
+    bootstrap B(h_PSD_dirty, num_stddevs, pyramid, true);
+    B.run(bootstrap_replicas);
+    std::cout << "Pileup scale factor: " << scale << " +- " << B.rms()
+	      << " (replica mean " << B.mean() << ")\n";
+
+    // The replicas refit the band without Minuit; how far that refit of
+    // the plot itself is from the fitted factor tells whether it stands in
+    // for it
+    bootstrap_offset = B.nominal() - scale;
+    std::cout << "Bootstrap refit of the uncut plot: " << B.nominal()
+	      << " (offset " << bootstrap_offset << ")\n";
+    if (TMath::Abs(bootstrap_offset) > B.rms()) {
+	std::cout << "Warning: the bootstrap refit is further from the "
+		  << "pileup scale factor than the replica RMS\n";
+    }
+
+    delete h_bootstrap;
+    delete h_band;
+    h_bootstrap = B.make_histogram("Scale_Factor_Bootstrap");
+    h_band = B.make_band("Pileup_Corrected_Rel_Error");
+}
+
+// Enables the neutron/gamma discrimination in energy regions of
+// region_width (MeV)
+void process::set_discrimination(double region_width)
+{
+    ng_region_width = region_width;
+}
+
+// Fits the two bands of the uncut PSD plot region by region and sets up
+// the cuts and spectra filled by the clean pass
+void process::fit_discrimination()
+{
+    PERF_REGION("discrimination");
+    std::cout << "\n\nFitting neutron and gamma bands.\n\n";
+
+    {
+	std::lock_guard<std::mutex> lock(fit_mutex);
+	discrimination D(h_PSD_dirty, ng_region_width);
+	neutron_cut = D.make_neutron_cut("Neutron_Cut");
+	gamma_cut = D.make_gamma_cut("Gamma_Cut");
+	fom_graph = D.make_fom("PSD_FOM");
+	if (D.num_regions() < 2) {
+	    std::cout << "Too few regions for the neutron/gamma cuts\n";
+	    delete neutron_cut;
+	    delete gamma_cut;
+	    neutron_cut = 0;
+	    gamma_cut = 0;
+	    return;
+	}
+    }
+
+    h_neutron = new TH1D("Neutron_Spectrum","Neutrons;Energy [MeV];Counts"
+			 ,h_dirty->GetNbinsX()
+			 ,h_dirty->GetXaxis()->GetXmin()
+			 ,h_dirty->GetXaxis()->GetXmax());
+    h_gamma = new TH1D("Gamma_Spectrum","Gammas;Energy [MeV];Counts"
+		       ,h_dirty->GetNbinsX()
+		       ,h_dirty->GetXaxis()->GetXmin()
+		       ,h_dirty->GetXaxis()->GetXmax());
+}
+
+// Enables recomputing the PSD integrals from the raw samples in branch
+// gate_list is <baseline samples>,<gate start>,<short gate>,<long gate>
+// (in samples), optionally followed by the pulse polarity (+1 or -1)
+void process::set_waveforms(std::string& branch, std::vector<int>& gate_list)
+{
+    waveform_branch = branch;
+    if (gate_list.size() >= 4) {
+	gates.baseline_samples = gate_list.at(0);
+	gates.gate_start = gate_list.at(1);
+	gates.short_gate = gate_list.at(2);
+	gates.long_gate = gate_list.at(3);
+    }
+    if (gate_list.size() >= 5)
+	gates.polarity = gate_list.at(4);
+}
+
+// Enables the die-away histograms, filled during the calibration pass
+// The reference is a beam period (if > 0), a trigger channel (if >= 0) or
+// the beam off gaps in an RBD file (if given), in that order
+void process::set_dieaway(double period_us, int trigger_channel,
+			  std::string& rbd_file, double range_us)
+{
+    if (period_us > 0)
+	die_away.set_period(period_us);
+    else if (trigger_channel >= 0)
+	die_away.set_trigger(trigger_channel);
+    else if (!rbd_file.empty())
+	die_away.set_rbd(rbd_file, 0.1);
+
+    dieaway_range = range_us;
+}
+
+// Bins the counts in energy ROIs (low, high pairs in MeV) in bin_sec
+// seconds; rbd_file (if not empty) gives the beam current to join them with
+void process::set_rate_monitor(std::vector<double>& rois, double bin_sec,
+			       std::string& rbd_file)
+{
+    for (std::size_t i=0; i+1<rois.size(); i+=2)
+	rates.add_roi(rois.at(i), rois.at(i+1));
+    rates.set_bin(bin_sec);
+    if (rates.enabled() && !rbd_file.empty())
+	rates.set_rbd(rbd_file);
+}
+
+// Tags events with a neighbour closer than tau_ns (0: off)
+void process::set_resolving_time(double tau_ns)
+{
+    intervals.set_resolving_time(tau_ns);
+}
+
+// Publishes the spectra in shared memory while they fill (after
+// initialize)
+bool process::set_live(std::string& name)
+{
+    std::vector<TH1*> published {h_dirty, h_PSD_dirty, h_clean};
+    return live.open(name, published);
+}
+
+// Adds a file segment of the same run (after the ones already given)
+void process::add_segment(std::string& name_input)
+{
+    segment_names.push_back(name_input);
+}
+
+// Charges the histograms of the run to the memory budget
+void process::account_histograms()
+{
+    histogram_memory.resize(histogram_bytes(h_dirty)
+			    + histogram_bytes(h_clean)
+			    + histogram_bytes(h_PSD_dirty)
+			    + histogram_bytes(h_PSD_clean)
+			    + histogram_bytes(h_wave_pileup)
+			    + histogram_bytes(h_bootstrap)
+			    + histogram_bytes(h_band)
+			    + histogram_bytes(h_neutron)
+			    + histogram_bytes(h_gamma));
+}
+
+// Read-ahead cache of the input tree: 32 MB, at most 1/16 of the memory
+// budget. Under pressure it is cut to a quarter (down to 1 MB) before the
+// next pass reads the tree.
+void process::size_tree_cache()
+{
+    if (tree == 0)
+	return;
+    const std::size_t mb {1048576};
+    std::size_t bytes = cache_memory.size();
+    if (bytes == 0) {
+	bytes = 32*mb;
+	if (memory().limit() > 0) {
+	    bytes = std::min(bytes, memory().limit()/16);
+	    bytes = std::max(mb, std::min(bytes, memory().headroom()));
+	}
+    }
+    else if (memory().pressure() && bytes > mb) {
+	bytes = std::max(mb, bytes/4);
+	memory().degraded("smaller tree cache");
+    }
+    else
+	return;
+    tree->SetCacheSize(bytes);
+    cache_memory.resize(bytes);
 }
 
 // Computes and applies scaling factor to private member histograms
@@ -388,35 +803,18 @@ void process::psd_cut(double slope, double intercept, double num_stddevs = 2)
 // It assumes a three column, csv input and a sample rate of 50ms
 void process::apply_scaling(std::string& file_name)
 {
-    // Read beam current file 
-    std::ifstream infile;
-    std::string line;
+    PERF_REGION("apply_scaling");
+
+    // Read beam current file
     double integral {0}; // Amperes
-    int counter {1};
-    // The following is the correction for a 50ms sample rate 
-    double sample_rate {0.05};
-    double time {0.00};
+    // The following is the correction for a 50ms sample rate
+    double sample_rate {rbd_sample_rate};
     std::vector<double> charge_measured {0}; // amperes
     std::vector<double> time_measured {0}; // seconds
 
-    infile.open(file_name);
-    
-    while (std::getline(infile, line))
-    {
-	std::stringstream line_stream(line);
-        std::string value;
-	while (std::getline(line_stream, value, ','))
-	{
-	    if (counter % 3 == 0) {
-		integral += (std::stod(value)*sample_rate);
-		charge_measured.push_back(std::stod(value));
-		time_measured.push_back(time);
-		time += sample_rate;
-	    }
-	    ++counter;
-	}
-    }
-    infile.close();
+    read_rbd(file_name, time_measured, charge_measured);
+    for (std::size_t i=1; i<charge_measured.size(); ++i)
+	integral += (charge_measured.at(i)*sample_rate);
 
     // assign value to private member variable 
     scale_factor = 1/integral;
@@ -438,11 +836,21 @@ void process::apply_scaling(std::string& file_name)
     h_PSD_dirty->GetZaxis()->SetTitle("Counts/C");
     h_PSD_clean->GetZaxis()->SetTitle("Counts/C");
 
+    // Tagged spectra (if discriminated)
+    for (TH1D* h : {h_neutron, h_gamma}) {
+	if (h == 0)
+	    continue;
+	h->Sumw2();
+	h->Scale(scale_factor);
+	h->GetYaxis()->SetTitle("Counts/C");
+    }
+
     // Create TGraph of the charge measured by the RBD
     charge_graph = new TGraph(time_measured.size(),
 			      &(time_measured[0]),
 			      &(charge_measured[0]));
     charge_graph->GetXaxis()->SetTitle("Time [s]");
     charge_graph->GetYaxis()->SetTitle("Charge [A]");
+    account_histograms();
 }
 
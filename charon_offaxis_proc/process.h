@@ -6,7 +6,16 @@
 #include "TH1D.h"
 #include "TH2D.h"
 #include "TGraph.h"
+#include "TGraphErrors.h"
 #include "TTree.h"
+#include "dieaway.h"
+#include "interval_tagger.h"
+#include "list_mode.h"
+#include "live_histograms.h"
+#include "memory_budget.h"
+#include "pipeline.h"
+#include "rate_monitor.h"
+#include "waveform.h"
 #include <vector>
 
 class process
@@ -20,9 +29,20 @@ public:
     // Functions
     void initialize();
     bool check_ifile();
-    bool check_ofile_write(bool overwrite_param);
+    bool check_ofile_write(bool overwrite_param, bool interactive = true);
     void calibrate(double slope, double intercept);
-    void psd_cut(double slope, double intercept, double num_stddevs);
+    void psd_cut(double slope, double intercept, double num_stddevs,
+		 bool pyramid);
+    void set_waveforms(std::string& branch, std::vector<int>& gate_list);
+    void set_dieaway(double period_us, int trigger_channel,
+		     std::string& rbd_file, double range_us);
+    void set_rate_monitor(std::vector<double>& rois, double bin_sec,
+			  std::string& rbd_file);
+    void set_resolving_time(double tau_ns);
+    bool set_live(std::string& name);
+    void set_bootstrap(int num_replicas);
+    void set_discrimination(double region_width);
+    void add_segment(std::string& name_input);
     void apply_scaling(std::string& file_name);
     void write_out(bool overwrite_param);
     
@@ -30,8 +50,10 @@ private:
     std::string name_in;
     std::string name_out;
     TFile* f_in;
+    std::vector<std::string> segment_names; // all input files, in order
 
     TTree* tree;
+    list_mode* binary; // list-mode input instead of the tree
     ULong64_t num_entries;
     int channel_num;
     double scale_factor;
@@ -43,6 +65,50 @@ private:
     TH2D* h_PSD_clean;
     TCutG* pileup_cut;
     TGraph* charge_graph;
+
+    // Die-away (time since beam reference) histograms
+    dieaway die_away;
+    double dieaway_range;
+
+    // Count rates in energy ROIs next to the beam current
+    rate_monitor rates;
+
+    // Pileup tagged from the time between events
+    interval_tagger intervals;
+
+    // Histograms published while they fill (off unless set)
+    live_publisher live;
+
+    // Waveform reanalysis (off if the branch is empty)
+    std::string waveform_branch;
+    gate_params gates;
+    TH1D* h_wave_pileup;
+
+    // Bootstrap of the pileup correction
+    int bootstrap_replicas;
+    TH1D* h_bootstrap; // replica scale factors
+    TH1D* h_band;      // relative uncertainty of the corrected spectrum
+    double bootstrap_offset; // of the bootstrap refit from the fit
+    void run_bootstrap(double num_stddevs, bool pyramid, double scale);
+
+    // Neutron/gamma discrimination (off if the region width is 0)
+    double ng_region_width; // MeV
+    TCutG* neutron_cut;
+    TCutG* gamma_cut;
+    TGraphErrors* fom_graph;
+    TH1D* h_neutron;
+    TH1D* h_gamma;
+    void fit_discrimination();
+
+    // Runs on the filler thread of calibrate()
+    void fill_events(calibrated_batch& batch);
+    ULong64_t time_stamp_at(ULong64_t entry);
+
+    // Charges to the memory budget
+    memory_charge histogram_memory;
+    memory_charge cache_memory; // tree cache
+    void account_histograms();
+    void size_tree_cache();
 };
 
 char gather_input();
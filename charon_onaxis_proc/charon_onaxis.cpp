@@ -1,19 +1,29 @@
 #include "process.h"
+#include "memory_budget.h"
+#include "perf_region.h"
+#include "spool.h"
 #include "TFile.h"
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <memory>
 #include <vector>
 #include <string>
+#include <mutex>
 #include <getopt.h>
 
 static void show_usage(std::string name)
 {
     std::cerr << "Takes on-axis data from CHARON and processes it into "
 	      << "useful histograms.\n\n"
-	      << "Usage: " << name << " [OPTION]...\n\n"
+	      << "Usage: " << name << " [OPTION]...\n"
+	      << "       " << name << " --daemon <dir> [workers] [budget]\n\n"
               << "Options:\n"
-	      << "-i, --input <file>   \t ROOT input file name "
-	      <<                            "[default: default_input.root]\n"
+	      << "-i, --input <file>   \t ROOT or list-mode (*.bin) input file "
+	      <<                            "name\n\t\t\t\t[default: "
+	      <<                            "default_input.root]\n"
+	      <<                       "\t\t\t\trepeat for the segments of a "
+	      <<                            "run, in order\n"
 	      << "-o, --output <file>  \t ROOT output file name "
 	      <<                            "[default: default_output.root]\n"
 	      << "-c, --channel <int>  \t digitizer channel "
@@ -22,11 +32,86 @@ static void show_usage(std::string name)
 	      <<                          " [default: 0]\n"
 	      << "-s, --stddevs <dble> \t number of standard deviations for "
 	      <<                          "pileup cut\n\t\t\t\t[default: 2.0]\n"
+	      << "--waveforms <branch> \t recompute the PSD integrals from the "
+	      <<                            "raw samples\n\t\t\t\tin this branch\n"
+	      << "--gates <list>       \t waveform gates in samples: baseline,"
+	      <<                            "start,short,long[,polarity]\n"
+	      <<                       "\t\t\t\t[default: 16,20,12,60,-1]\n"
+	      << "--pyramid            \t fit the pileup band coarse-to-fine "
+	      <<                            "(fewer fits)\n"
+	      << "--bootstrap <int>    \t bootstrap replicas for the pileup "
+	      <<                            "correction\n\t\t\t\terror "
+	      <<                            "(0: off) [default: 200]\n"
+	      << "--unfold <file[:name]> unfold the pileup corrected spectrum "
+	      <<                            "(MLEM) with\n\t\t\t\tthe "
+	      <<                            "response TH2D in <file> "
+	      <<                            "[default name:\n\t\t\t\t"
+	      <<                            "Response]\n"
+	      << "--unfold-iterations <int> most unfolding iterations "
+	      <<                            "[default: 100]\n"
+	      << "--unfold-tolerance <dble> stop once the unfolded spectrum "
+	      <<                            "changes less\n\t\t\t\t(0: run "
+	      <<                            "all iterations) [default: 1e-4]\n"
+	      << "--preview <dble>     \t quick look from sampled time windows,"
+	      <<                            " until the pileup\n\t\t\t\tscale "
+	      <<                            "factor has this relative error\n"
+	      << "--sweep-stddevs <list> sweep comma separated cut widths "
+	      <<                            "(one directory\n\t\t\t\tper variant "
+	      <<                            "in the output)\n"
+	      << "--sweep-bounds <list>\t sweep comma separated peak bound "
+	      <<                            "files\n"
 	      << "-p, --peakfile <file> \t text file with peak bounds for "
 	      <<                             "calibration\n"
 	      <<                       "\t\t\t\t[default: default_bounds.txt]\n"
+	      << "--auto-bounds <file> \t find the peak bounds in the first "
+	      <<                            "windows and\n\t\t\t\twrite them "
+	      <<                            "to <file> (for -p)\n"
+	      << "--dieaway-period <us>\t fill die-away histograms relative to "
+	      <<                            "a beam period\n"
+	      << "--dieaway-trigger <int> fill die-away histograms relative to "
+	      <<                            "a trigger\n\t\t\t\tchannel\n"
+	      << "--dieaway-rbd        \t fill die-away histograms relative to "
+	      <<                            "beam off gaps\n\t\t\t\tin the "
+	      <<                            "scale (RBD) file\n"
+	      << "--dieaway-range <us> \t die-away histogram range "
+	      <<                            "[default: 1000]\n"
+	      << "--roi <lo:hi>        \t count rate in this energy range "
+	      <<                            "[MeV] over time,\n\t\t\t\twith "
+	      <<                            "the beam current of the scale "
+	      <<                            "file\n\t\t\t\t(repeat for more "
+	      <<                            "ROIs)\n"
+	      << "--roi-bin <s>        \t ROI rate time bin [default: 1]\n"
+	      << "--resolving-time <ns>  tag events with a neighbour closer "
+	      <<                            "than <ns>\n\t\t\t\tand compare "
+	      <<                            "with the PSD pileup\n\t\t\t\t"
+	      <<                            "correction [default: 0, off]\n"
+	      << "--checkpoint <int>   \t save the state to <output>.ckpt.root "
+	      <<                            "every <int>\n\t\t\t\twindows and "
+	      <<                            "after each pass (0: passes only)\n"
+	      << "--resume             \t continue from the checkpoint of the "
+	      <<                            "output file\n"
+	      << "--append             \t add the input segments to the "
+	      <<                            "finished run in the\n\t\t\t\t"
+	      <<                            "checkpoint of the output file\n"
+	      << "--cache <dir>        \t reuse the results of earlier runs "
+	      <<                            "with the same\n\t\t\t\tinput "
+	      <<                            "and settings, kept in <dir>\n"
+	      << "--memory-budget <size> memory budget, e.g. 4G (smaller "
+	      <<                            "batches, windows\n\t\t\t\tand "
+	      <<                            "caches past it) [default: none]\n"
+	      << "--memory-report <file> JSON report of the memory use "
+	      <<                            "per subsystem\n"
+	      << "--live <name>        \t publish the spectra and progress in "
+	      <<                            "shared memory\n\t\t\t\t"
+	      <<                            "/dev/shm/charon_<name> (see "
+	      <<                            "charon_monitor)\n"
 	      << "-w, --overwrite      \t enables overwriting the output file "
 	      <<                            "[default: off]\n"
+	      << "--daemon <dir> [int] \t stay resident and run the *.job files"
+	      <<                            " put in <dir>\n\t\t\t\t(must be "
+	      <<                            "the first option), with\n\t\t\t\t"
+	      <<                            "<int> workers and a shared memory "
+	      <<                            "budget\n"
 	      << "-h,  --help           \t show this help message\n"
               << std::endl;
 };
@@ -48,7 +133,65 @@ void read_bounds(std::string& file_name, std::vector<int>& bounds)
     f_stream.close();
 };
 
-int main(int argc, char **argv)
+// Writes bounds as read_bounds reads them
+void write_bounds(std::string& file_name, std::vector<int>& bounds)
+{
+    std::ofstream f_stream(file_name.c_str());
+    if (!f_stream) {
+	std::cerr << "Cannot write peak bounds file, " << file_name << "\n";
+	return;
+    }
+    for (auto bound : bounds)
+	f_stream << bound << "\n";
+};
+
+// Reads a comma separated list of integers (e.g. waveform gates)
+void read_list(std::string list, std::vector<int>& values)
+{
+    std::stringstream list_stream(list);
+    std::string value;
+    while (std::getline(list_stream, value, ',')) {
+	if (!value.empty())
+	    values.push_back(std::stoi(value));
+    }
+};
+
+void read_list(std::string list, std::vector<double>& values)
+{
+    std::stringstream list_stream(list);
+    std::string value;
+    while (std::getline(list_stream, value, ',')) {
+	if (!value.empty())
+	    values.push_back(std::stod(value));
+    }
+};
+
+void read_list(std::string list, std::vector<std::string>& values)
+{
+    std::stringstream list_stream(list);
+    std::string value;
+    while (std::getline(list_stream, value, ',')) {
+	if (!value.empty())
+	    values.push_back(value);
+    }
+};
+
+// Counters and memory use of a run (the charges still in use after the
+// process object is gone were never released)
+static void report(std::string& memory_report_file)
+{
+    perf_report();
+    if (memory().limit() > 0)
+	memory().print();
+    if (!memory_report_file.empty())
+	memory().write_report(memory_report_file);
+};
+
+// getopt keeps its state in globals, so jobs of the daemon parse in turn
+static std::mutex getopt_mutex;
+
+// One run of the tool; interactive runs ask before processing
+int run(int argc, char **argv, bool interactive)
 {
     // Gather commandline input
     std::cout << "########################################"
@@ -56,16 +199,54 @@ int main(int argc, char **argv)
    
     // Set defaults
     std::string name_input {"default_input.root"};
+    std::vector<std::string> segment_names {}; // further input segments
     std::string name_output {"default_output.root"};
     int channel {0};
     std::string scale_file_name; // default is "empty"
     double num_stddevs {2};
+    bool pyramid {false}; // coarse-to-fine pileup band fit
+    double preview_precision {0}; // 0 processes the whole run
+    int bootstrap_replicas {200};
+    std::string waveform_branch; // default is "empty" (use digitizer values)
+    std::string response_file; // default is "empty" (no unfolding)
+    int unfold_iterations {100};
+    double unfold_tolerance {1e-4};
+    std::vector<int> gate_list {};
+    std::string memory_budget_text; // default is "empty" (no budget)
+    std::string memory_report_file; // default is "empty" (no report)
+    std::string live_name; // default is "empty" (not published)
     
     std::vector<int> peak_bounds {};
     std::string peak_bound_file {"default_bounds.txt"};
+    std::string auto_bounds_file; // default is "empty" (no search)
     read_bounds(peak_bound_file, peak_bounds);
     const int num_peaks {3}; // number of peaks to fit
     
+    // Die-away histograms (off unless a reference is chosen)
+    double dieaway_period {0};
+    int dieaway_trigger {-1};
+    bool dieaway_rbd {false};
+    double dieaway_range {1000};
+
+    // ROI rate monitor (off if no ROI is given); low, high pairs
+    std::vector<double> roi_list {};
+    double roi_bin {1};
+
+    // Interval pileup tagging (off if 0)
+    double resolving_time {0}; // ns
+
+    // Parameter sweep (off if both lists are empty)
+    std::vector<double> sweep_stddevs {};
+    std::vector<std::string> sweep_bound_files {};
+
+    // Checkpoints (off unless asked for)
+    int checkpoint_windows {-1};
+    bool resume {false};
+    bool append {false};
+
+    // Stage results of earlier runs (off unless a directory is given)
+    std::string cache_dir;
+
     bool overwrite_param {false}; // enforces overwriting output file if it exists
                                   // WARNING. This can be dangerous.
     
@@ -78,12 +259,39 @@ int main(int argc, char **argv)
 	{"stddevs", required_argument, 0, 's'},
 	{"peakfile", required_argument, 0, 'p'},
 	{"overwrite", no_argument, 0, 'w'},
+	{"dieaway-period", required_argument, 0, 1000},
+	{"dieaway-trigger", required_argument, 0, 1001},
+	{"dieaway-rbd", no_argument, 0, 1002},
+	{"dieaway-range", required_argument, 0, 1003},
+	{"pyramid", no_argument, 0, 1004},
+	{"waveforms", required_argument, 0, 1005},
+	{"gates", required_argument, 0, 1006},
+	{"preview", required_argument, 0, 1007},
+	{"checkpoint", required_argument, 0, 1008},
+	{"resume", no_argument, 0, 1009},
+	{"append", no_argument, 0, 1010},
+	{"sweep-stddevs", required_argument, 0, 1011},
+	{"sweep-bounds", required_argument, 0, 1012},
+	{"bootstrap", required_argument, 0, 1013},
+	{"roi", required_argument, 0, 1014},
+	{"roi-bin", required_argument, 0, 1015},
+	{"unfold", required_argument, 0, 1016},
+	{"unfold-iterations", required_argument, 0, 1017},
+	{"unfold-tolerance", required_argument, 0, 1018},
+	{"memory-budget", required_argument, 0, 1019},
+	{"memory-report", required_argument, 0, 1020},
+	{"resolving-time", required_argument, 0, 1021},
+	{"auto-bounds", required_argument, 0, 1022},
+	{"live", required_argument, 0, 1023},
+	{"cache", required_argument, 0, 1024},
 	{} // deals with unknown parameters
     };
 
     std::string option_string {"i:o:c:l:s:p:wh"};
 
     // Parse input
+    std::unique_lock<std::mutex> getopt_lock(getopt_mutex);
+    optind = 0; // full reinitialization, for repeated runs
     int opt;
     int option_index {0};
     opt = getopt_long(argc, argv, option_string.c_str(), long_options,
@@ -92,7 +300,7 @@ int main(int argc, char **argv)
 	switch (opt)
 	{
 	case 'i':
-	    name_input = optarg;
+	    segment_names.push_back(optarg);
 	    break;
 	case 'o':
 	    name_output = optarg;
@@ -131,6 +339,92 @@ int main(int argc, char **argv)
 	case 'w':
 	    overwrite_param = true;
 	    break;
+	case 1000:
+	    dieaway_period = std::stod(optarg);
+	    break;
+	case 1001:
+	    dieaway_trigger = std::atoi(optarg);
+	    break;
+	case 1002:
+	    dieaway_rbd = true;
+	    break;
+	case 1003:
+	    dieaway_range = std::stod(optarg);
+	    break;
+	case 1004:
+	    pyramid = true;
+	    break;
+	case 1005:
+	    waveform_branch = optarg;
+	    break;
+	case 1006:
+	    gate_list.clear();
+	    read_list(optarg, gate_list);
+	    break;
+	case 1007:
+	    preview_precision = std::stod(optarg);
+	    break;
+	case 1008:
+	    checkpoint_windows = std::atoi(optarg);
+	    break;
+	case 1009:
+	    resume = true;
+	    break;
+	case 1010:
+	    append = true;
+	    break;
+	case 1011:
+	    read_list(optarg, sweep_stddevs);
+	    break;
+	case 1012:
+	    read_list(optarg, sweep_bound_files);
+	    break;
+	case 1013:
+	    bootstrap_replicas = std::atoi(optarg);
+	    break;
+	case 1014:
+	{
+	    std::string roi {optarg};
+	    std::size_t colon = roi.find(':');
+	    if (colon == std::string::npos) {
+		std::cout << "\nWarning! ROI " << roi
+			  << " is not <lo:hi>, skipping it\n\n";
+		break;
+	    }
+	    roi_list.push_back(std::stod(roi.substr(0, colon)));
+	    roi_list.push_back(std::stod(roi.substr(colon + 1)));
+	    break;
+	}
+	case 1015:
+	    roi_bin = std::stod(optarg);
+	    break;
+	case 1016:
+	    response_file = optarg;
+	    break;
+	case 1017:
+	    unfold_iterations = std::atoi(optarg);
+	    break;
+	case 1018:
+	    unfold_tolerance = std::stod(optarg);
+	    break;
+	case 1019:
+	    memory_budget_text = optarg;
+	    break;
+	case 1020:
+	    memory_report_file = optarg;
+	    break;
+	case 1021:
+	    resolving_time = std::stod(optarg);
+	    break;
+	case 1022:
+	    auto_bounds_file = optarg;
+	    break;
+	case 1023:
+	    live_name = optarg;
+	    break;
+	case 1024:
+	    cache_dir = optarg;
+	    break;
 	case 'h':
 	    show_usage(argv[0]);
 	    return 1;
@@ -144,6 +438,20 @@ int main(int argc, char **argv)
 	opt = getopt_long(argc, argv, option_string.c_str(), long_options,
 			  &option_index);
     }
+    getopt_lock.unlock();
+
+    // The budget is per process, so daemon jobs share the daemon's
+    if (!memory_budget_text.empty()) {
+	if (interactive)
+	    memory().set_limit(parse_bytes(memory_budget_text));
+	else
+	    std::cout << "\nJobs use the memory budget of the daemon\n";
+    }
+
+    if (!segment_names.empty()) {
+	name_input = segment_names.front();
+	segment_names.erase(segment_names.begin());
+    }
 
     if (peak_bounds.size() != 2*num_peaks) {
 	std::cout << "\nPeak bound file not loaded properly\n"
@@ -166,13 +474,57 @@ int main(int argc, char **argv)
 	peak_bounds.push_back(l_bound_2p2mev);
     }
 
+    // Sweep variants default to the single run's settings
+    bool sweep = !sweep_stddevs.empty() || !sweep_bound_files.empty();
+    std::vector<std::vector<int>> sweep_bounds {};
+    std::vector<std::string> sweep_bound_names {};
+    if (sweep) {
+	if (sweep_stddevs.empty())
+	    sweep_stddevs.push_back(num_stddevs);
+	for (auto& file : sweep_bound_files) {
+	    std::vector<int> bounds {};
+	    read_bounds(file, bounds);
+	    if (bounds.size() != 2*num_peaks) {
+		std::cout << "\nWarning! " << file
+			  << " was not read properly, skipping it\n\n";
+		continue;
+	    }
+	    sweep_bounds.push_back(bounds);
+	    sweep_bound_names.push_back(file);
+	}
+	if (sweep_bounds.empty()) {
+	    sweep_bounds.push_back(peak_bounds);
+	    sweep_bound_names.push_back(peak_bound_file);
+	}
+    }
+
     // Print out settings for user to see
-    std::cout << "\nInput file:\t\t" << name_input << "\n"
-	      << "\nOutput file:\t\t" << name_output << "\n"
+    std::cout << "\nInput file:\t\t" << name_input << "\n";
+    for (auto& name : segment_names)
+	std::cout << "\t\t\t" << name << "\n";
+    std::cout << "\nOutput file:\t\t" << name_output << "\n"
 	      << "\nChannel number:\t\t" << channel << "\n"
 	      << "\nScaling File:\t\t" << scale_file_name << "\n"
 	      << "\nStandard deviations:\t" << num_stddevs << "\n"
+	      << "\nWaveform branch:\t" << waveform_branch << "\n"
+	      << "\nPyramid band fit:\t" << std::boolalpha << pyramid << "\n"
+	      << "\nBootstrap replicas:\t" << bootstrap_replicas << "\n"
+	      << "\nResponse matrix:\t" << response_file << "\n"
+	      << "\nPreview precision:\t" << preview_precision << "\n"
+	      << "\nMemory budget [MB]:\t" << memory().limit()/1048576.0
+	      << "\n"
+	      << "\nROIs (bin [s]):\t\t" << roi_list.size()/2 << " ("
+	      << roi_bin << ")\n"
+	      << "\nResolving time [ns]:\t" << resolving_time << "\n"
+	      << "\nLive name:\t\t" << live_name << "\n"
+	      << "\nCheckpoint windows:\t" << checkpoint_windows << "\n"
+	      << "\nResume/append:\t\t" << std::boolalpha << resume << "/"
+	      << append << "\n"
+	      << "\nResult cache:\t\t" << cache_dir << "\n"
 	      << "\nPeak bound file:\t" << peak_bound_file << "\n"
+	      << "\nAutomatic bounds:\t" << auto_bounds_file << "\n"
+	      << "\nSweep variants:\t\t"
+	      << sweep_bounds.size()*sweep_stddevs.size() << "\n"
 	      << "\nOverwrite output:\t" << std::boolalpha << overwrite_param << "\n"
 	      << std::endl;
 
@@ -180,17 +532,23 @@ int main(int argc, char **argv)
 	      << "########################################\n";
 
     // Ask if the user wants to continue with the default parameters
-    std::cout << "\nWould you like to continue with these parameters? [y/N]\n";
-    char response = gather_input();
-    if (response == 'n' || response == 'N') {
-	std::cerr << "\nExiting.\n";
-	return 1;
+    if (interactive) {
+	std::cout << "\nWould you like to continue with these parameters? "
+		  << "[y/N]\n";
+	char response = gather_input();
+	if (response == 'n' || response == 'N') {
+	    std::cerr << "\nExiting.\n";
+	    return 1;
+	}
     }
 
     // Perform analysis
     
     // Create object to perform the analysis
-    process* P = new process(name_input, name_output, channel);
+    std::unique_ptr<process> P(new process(name_input, name_output,
+					   channel));
+    for (auto& name : segment_names)
+	P->add_segment(name);
 
     // Check if input file exists (for soft failure)
     bool ifile_exists = P->check_ifile();
@@ -202,20 +560,104 @@ int main(int argc, char **argv)
     }
     
     // Check if the output file exists and if it should be overwritten
-    bool ofile_overwrite = P->check_ofile_write(overwrite_param);
+    bool ofile_overwrite = P->check_ofile_write(overwrite_param,
+						   interactive);
     if (ofile_overwrite == false) {
 	std::cerr << "\n\nExiting.\n\n";
 	return 1;
     }
     
     P->initialize();
-    P->time_cut(peak_bounds);
-    //P->temp_func();
-    P->psd_cut(peak_bounds, num_stddevs);
+    if (!live_name.empty())
+	P->set_live(live_name);
+    P->set_bootstrap(bootstrap_replicas);
+    if (!waveform_branch.empty())
+	P->set_waveforms(waveform_branch, gate_list);
+    P->set_resolving_time(resolving_time);
+
+    // Found bounds replace the bound file (also as the only sweep set)
+    if (!auto_bounds_file.empty() && P->find_bounds(peak_bounds)) {
+	write_bounds(auto_bounds_file, peak_bounds);
+	if (sweep && sweep_bound_files.empty()) {
+	    sweep_bounds.at(0) = peak_bounds;
+	    sweep_bound_names.at(0) = auto_bounds_file;
+	}
+    }
+    if (sweep) {
+	P->sweep(sweep_bounds, sweep_bound_names, sweep_stddevs, pyramid);
+	if (!scale_file_name.empty())
+	    P->apply_scaling(scale_file_name);
+	P->write_sweep(overwrite_param);
+	P.reset();
+	report(memory_report_file);
+	return 0;
+    }
+    else if (preview_precision > 0) {
+	// Die-away and ROI rates need the continuous event stream
+	if (dieaway_period > 0 || dieaway_trigger >= 0 || dieaway_rbd)
+	    std::cout << "\nPreview: die-away histograms are not filled\n";
+	if (!roi_list.empty())
+	    std::cout << "\nPreview: ROI rates are not filled\n";
+	P->preview(peak_bounds, num_stddevs, pyramid, preview_precision);
+    }
+    else {
+	std::string dieaway_file = dieaway_rbd ? scale_file_name : "";
+	P->set_dieaway(dieaway_period, dieaway_trigger, dieaway_file,
+		       dieaway_range);
+	P->set_rate_monitor(roi_list, roi_bin, scale_file_name);
+	P->set_checkpoint(checkpoint_windows);
+	if (!cache_dir.empty() && (resume || append))
+	    std::cout << "\nCheckpoints are not cached, running all "
+		      << "stages\n";
+	else if (!cache_dir.empty())
+	    P->set_cache(cache_dir);
+	if ((resume && !P->resume_checkpoint()) ||
+	    (append && !P->append_checkpoint())) {
+	    std::cerr << "\nExiting.\n\n";
+	    return 1;
+	}
+	P->time_cut(peak_bounds);
+	//P->temp_func();
+	P->psd_cut(peak_bounds, num_stddevs, pyramid);
+    }
+    if (!response_file.empty()) {
+	P->set_unfolding(response_file, unfold_iterations, unfold_tolerance);
+	P->unfold_spectrum();
+    }
     if (!scale_file_name.empty())
 	P->apply_scaling(scale_file_name);
     P->write_out(overwrite_param);
 
-    //delete P;
+    P.reset();
+    report(memory_report_file);
     return 0;
 };
+
+// Runs one job of the daemon, given as long options
+int run_job(std::vector<std::string>& args)
+{
+    std::vector<char*> argv_job {const_cast<char*>("charon_onaxis")};
+    for (auto& arg : args)
+	argv_job.push_back(&arg[0]);
+    argv_job.push_back(0);
+    return run(argv_job.size() - 1, argv_job.data(), false);
+};
+
+int main(int argc, char **argv)
+{
+    if (argc > 2 && std::string(argv[1]) == "--daemon") {
+	std::string spool_dir {argv[2]};
+	int workers = (argc > 3) ? std::atoi(argv[3]) : 0;
+	if (argc > 4)
+	    memory().set_limit(parse_bytes(argv[4]));
+	spool_daemon daemon(spool_dir, workers, run_job);
+	return daemon.run();
+    }
+    try {
+	return run(argc, argv, true);
+    }
+    catch (std::exception& e) {
+	std::cerr << "\nError: " << e.what() << "\nExiting.\n\n";
+	return 1;
+    }
+};
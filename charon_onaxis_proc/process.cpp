@@ -1,16 +1,38 @@
 #include "process.h"
+#include "TBranch.h"
+#include "TChain.h"
 #include "TCutG.h"
 #include "TF1.h"
 #include "TLeaf.h"
 #include "TLinearFitter.h"
+#include "TGraphErrors.h"
 #include "TMath.h"
+#include "TNamed.h"
+#include "TObjString.h"
+#include "TParameter.h"
+#include "TROOT.h"
+#include "bootstrap.h"
+#include "event_reader.h"
+#include "list_mode.h"
+#include "peak_search.h"
+#include "perf_region.h"
+#include "psd_pyramid.h"
+#include "rbd.h"
+#include "unfold.h"
+#include <algorithm>
+#include <cstdio>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <mutex>
 #include <vector>
 ////////////////////////////////////////////////////////////////////////////////
 // Non member functions
 ////////////////////////////////////////////////////////////////////////////////
+// TH1::Fit goes through one global TMinuit, so fits in concurrent daemon
+// jobs take turns
+static std::mutex fit_mutex;
+
 char gather_input()
 {
     // Gets input from user (y,Y,n,N) and returns it as a char
@@ -24,6 +46,27 @@ char gather_input()
     return check_val;
 }
 
+// Indices 0..n-1 in bit reversed (van der Corput) order, so that the first
+// k of them are spread evenly over the whole range for any k
+std::vector<ULong64_t> stratified_order(ULong64_t n)
+{
+    int bits {0};
+    while ((ULong64_t(1) << bits) < n)
+	++bits;
+
+    std::vector<ULong64_t> order;
+    for (ULong64_t i=0; i<(ULong64_t(1) << bits); ++i) {
+	ULong64_t reversed {0};
+	for (int b=0; b<bits; ++b) {
+	    if (i & (ULong64_t(1) << b))
+		reversed |= ULong64_t(1) << (bits-1-b);
+	}
+	if (reversed < n)
+	    order.push_back(reversed);
+    }
+    return order;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Member functions
 ////////////////////////////////////////////////////////////////////////////////
@@ -34,7 +77,9 @@ process::process(std::string& name_input, std::string& name_output,
     :
     name_in {name_input}
     ,name_out {name_output}
+    ,f_in {0}
     ,tree {0}
+    ,binary {0}
     ,num_entries {0}
     ,channel_num {channel}
     ,scale_factor {1}
@@ -44,7 +89,35 @@ process::process(std::string& name_input, std::string& name_output,
     ,h_PSD_clean {0}
     ,pileup_cut {0}
     ,charge_graph {0}
+    ,dieaway_range {1000}
+    ,gates (default_gates())
+    ,h_wave_pileup {0}
+    ,keeping_events {false}
+    ,bootstrap_replicas {200}
+    ,h_bootstrap {0}
+    ,h_band {0}
+    ,bootstrap_offset {0}
+    ,response_name {"Response"}
+    ,unfold_iterations {100}
+    ,unfold_tolerance {1e-4}
+    ,unfold_used {0}
+    ,h_unfolded {0}
+    ,h_unfold_band {0}
+    ,preview_fraction {0}
+    ,preview_scale {1}
+    ,preview_scale_error {0}
+    ,name_checkpoint {name_output + ".ckpt.root"}
+    ,checkpoint_every {-1}
+    ,pass {0}
+    ,resume_entry {0}
+    ,resume_time {0}
+    ,stored_cut {0}
+    ,num_earlier {0}
+    ,histogram_memory(mem_histograms)
+    ,kept_memory(mem_event_buffers)
+    ,cache_memory(mem_io_caches)
 {
+    segment_names.push_back(name_input);
 };
 
 // Destructor
@@ -52,20 +125,50 @@ process::~process()
 {
     delete f_in;
     delete tree;
+    delete binary;
     delete h_dirty;
     delete h_clean;
     delete h_PSD_dirty;
     delete h_PSD_clean;
     delete pileup_cut;
     delete charge_graph;
+    delete h_wave_pileup;
+    delete h_bootstrap;
+    delete h_band;
+    delete h_unfolded;
+    delete h_unfold_band;
+    delete stored_cut;
+    for (auto& set : sweep_sets) {
+	delete set.h_dirty;
+	delete set.h_PSD_dirty;
+    }
+    for (auto& variant : variants) {
+	delete variant.cut;
+	delete variant.h_clean;
+	delete variant.h_PSD_clean;
+    }
 };
 
 // Initial setup (defining some private members)
 void process::initialize()
 {
-    f_in = new TFile(name_in.c_str());
-    tree = (TTree*)f_in->Get("WaveformData");
-    num_entries = tree->GetEntries();
+    // The event loops run on several threads
+    ROOT::EnableThreadSafety();
+
+    // All segments of the run, in order (ROOT files or the digitizer's
+    // list-mode files)
+    if (list_mode::is_list_mode(segment_names.front())) {
+	binary = new list_mode(segment_names);
+	num_entries = binary->entries();
+    }
+    else {
+	TChain* chain = new TChain("WaveformData");
+	for (auto& name : segment_names)
+	    chain->Add(name.c_str());
+	tree = chain;
+	num_entries = tree->GetEntries();
+	size_tree_cache();
+    }
     std::cout << "\n\nTree read with " <<num_entries<< " events\n\n";
 
     // Define histogram parameters
@@ -92,6 +195,7 @@ void process::initialize()
     h_PSD_clean = new TH2D("Clean_PSD","PSD;Energy [MeV];Tail/Total"
 			   ,num_xbin,x_min,x_max
 			   ,num_ybin,y_min,y_max);
+    account_histograms();
 };
 
 // Checks if the designated input file exists
@@ -102,17 +206,18 @@ bool process::check_ifile()
     // true --> input file exists
     // false --> input file does not exist
     
-    std::ifstream stream(name_in.c_str());
-    
-    if (stream.good()) 
-	return true;
-    else
-	return false; 
+    for (auto& name : segment_names) {
+	std::ifstream stream(name.c_str());
+	if (!stream.good())
+	    return false;
+    }
+    return true;
 }
 
 // Checks if the designated output file exists already
 // Want to be careful not to overwrite something by accident 
-bool process::check_ofile_write(bool overwrite_param)
+// (without asking if not interactive, e.g. daemon jobs)
+bool process::check_ofile_write(bool overwrite_param, bool interactive)
 {
     // check if output file already exists
     // Returns boolian to main.
@@ -131,6 +236,8 @@ bool process::check_ofile_write(bool overwrite_param)
 		      << "overwrite it.\n";
 	    return false;
 	}
+	if (!interactive)
+	    return true;
 	std::cout << "\n\nOops!\n\t"
 		  << "The output file '" << name_out.c_str()
 	          << "' already exists.\n\t"
@@ -160,7 +267,9 @@ bool process::check_ofile_write(bool overwrite_param)
 // Does some cleaning up of objects still in memory (prevents duplicated writes)
 void process::write_out(bool overwrite_param)
 {
+    PERF_REGION("write_out");
     std::cout << "\n\nWriting output file.\n\n";
+    live.finish();
     TFile* f_output {0};
     // Need to check if we can overwrite an existing output file
     if (overwrite_param == true)
@@ -176,151 +285,500 @@ void process::write_out(bool overwrite_param)
     pileup_cut->Write();
     if (charge_graph != 0)
 	charge_graph->Write();
+    die_away.write();
+    rates.write();
+    intervals.write();
+    if (h_wave_pileup != 0)
+	h_wave_pileup->Write();
+    if (h_bootstrap != 0) {
+	h_bootstrap->Write();
+	h_band->Write();
+
+	// Corrected spectrum with its bootstrap uncertainty
+	TGraphErrors band(h_clean->GetNbinsX());
+	for (int bin=1; bin<=h_clean->GetNbinsX(); ++bin) {
+	    double counts = h_clean->GetBinContent(bin);
+	    band.SetPoint(bin-1, h_clean->GetBinCenter(bin), counts);
+	    band.SetPointError(bin-1, 0, counts*h_band->GetBinContent(bin));
+	}
+	band.Write("Pileup_Corrected_Band");
+	TParameter<double>("Bootstrap_Offset", bootstrap_offset).Write();
+    }
+    if (h_unfolded != 0) {
+	h_unfolded->Write();
+	TParameter<int>("Unfold_Iterations", unfold_used).Write();
+	if (h_unfold_band != 0) {
+	    h_unfold_band->Write();
+
+	    // Unfolded spectrum with its bootstrap uncertainty
+	    TGraphErrors band(h_unfolded->GetNbinsX());
+	    for (int bin=1; bin<=h_unfolded->GetNbinsX(); ++bin) {
+		double counts = h_unfolded->GetBinContent(bin);
+		band.SetPoint(bin-1, h_unfolded->GetBinCenter(bin), counts);
+		band.SetPointError(bin-1, 0,
+				   counts*h_unfold_band->GetBinContent(bin));
+	    }
+	    band.Write("Unfolded_Band");
+	}
+    }
+    if (preview_fraction > 0) {
+	// Tag quick look output
+	std::stringstream tag;
+	tag << "Preview from " << preview_fraction*100
+	    << "% of the run; pileup scale factor " << preview_scale
+	    << " +- " << preview_scale_error;
+	TNamed("Preview", tag.str().c_str()).Write();
+	TParameter<double>("Preview_Fraction", preview_fraction).Write();
+	TParameter<double>("Scale_Factor", preview_scale).Write();
+	TParameter<double>("Scale_Factor_Error", preview_scale_error).Write();
+    }
+
+    f_output->Write();
+    f_output->Close();
+    delete f_output;
+};
+
+// Writes every sweep variant to its own directory of the output file
+// (scaled by the RBD charge if apply_scaling was called)
+void process::write_sweep(bool overwrite_param)
+{
+    PERF_REGION("write_out");
+    std::cout << "\n\nWriting output file.\n\n";
+    live.finish();
+    TFile* f_output {0};
+    // Need to check if we can overwrite an existing output file
+    if (overwrite_param == true)
+	f_output = new TFile(name_out.c_str(),"RECREATE");
+    else
+	f_output = new TFile(name_out.c_str(),"NEW");
+
+    if (charge_graph != 0) {
+	charge_graph->Write();
+	for (auto& set : sweep_sets) {
+	    set.h_dirty->Sumw2();
+	    set.h_PSD_dirty->Sumw2();
+	    set.h_dirty->Scale(scale_factor);
+	    set.h_PSD_dirty->Scale(scale_factor);
+	    set.h_dirty->GetYaxis()->SetTitle("Counts/C");
+	    set.h_PSD_dirty->GetZaxis()->SetTitle("Counts/C");
+	}
+    }
+
+    for (auto& variant : variants) {
+	sweep_bounds& set = sweep_sets.at(variant.bounds_index);
+	if (charge_graph != 0) {
+	    variant.h_PSD_clean->Sumw2();
+	    variant.h_clean->Scale(scale_factor);
+	    variant.h_PSD_clean->Scale(scale_factor);
+	    variant.h_clean->GetYaxis()->SetTitle("Counts/C");
+	    variant.h_PSD_clean->GetZaxis()->SetTitle("Counts/C");
+	}
+
+	std::stringstream dir_name;
+	dir_name << "bounds" << variant.bounds_index << "_stddevs"
+		 << variant.num_stddevs;
+	TDirectory* dir = f_output->mkdir(dir_name.str().c_str());
+	dir->cd();
+
+	set.h_dirty->Write();
+	set.h_PSD_dirty->Write();
+	variant.h_clean->Write();
+	variant.h_PSD_clean->Write();
+	variant.cut->Write("cut");
+	TNamed("Peak_Bounds", set.name.c_str()).Write();
+	TParameter<double>("Num_Stddevs", variant.num_stddevs).Write();
+	TParameter<double>("Scale_Factor", variant.scale_factor).Write();
+    }
 
     f_output->Write();
     f_output->Close();
+    delete f_output;
 };
 
+// Searches the uncalibrated spectrum of the first time window for the
+// calibration peaks, taking in up to 4 windows if they are not clear.
+// peak_bounds is kept if they are not found.
+bool process::find_bounds(std::vector<int>& peak_bounds)
+{
+    std::cout << "\n\nSearching for the calibration peaks.\n\n";
+
+    // Same histogram and 60 second windows as time_cut
+    TH1D* h_temp = new TH1D("temp","Spectrum;Energy [ADC];Counts"
+			    ,1024,0,35000);
+    const int time_sec {60};
+    ULong64_t time_window = time_sec/4.0e-9;
+    ULong64_t time_initial = time_stamp_at(0);
+
+    event_reader reader(tree, binary, budget_batch_capacity());
+    if (!waveform_branch.empty())
+	reader.set_waveforms(waveform_branch, gates, channel_num);
+
+    std::vector<int> found;
+    bool ok {false};
+    ULong64_t first {0};
+    event_batch batch;
+    for (int num_windows=1; num_windows<=4 && !ok; num_windows*=2) {
+	ULong64_t last
+	    = first_entry_after(time_initial + num_windows*time_window);
+	for (ULong64_t entry=first;
+	     reader.read(entry, last, batch);
+	     entry += batch.size) {
+	    for (std::size_t i=0; i<batch.size; ++i) {
+		if (batch.channel[i] == channel_num)
+		    h_temp->Fill(batch.energy[i]);
+	    }
+	}
+	ok = find_peak_bounds(h_temp, found);
+	if (last == num_entries)
+	    break;
+	first = last;
+    }
+    delete h_temp;
+
+    if (!ok) {
+	std::cout << "No calibration peaks found, keeping the bounds\n";
+	return false;
+    }
+    peak_bounds = found;
+    std::cout << "Peak bounds [ADC]:\n"
+	      << "\t4.44 MeV:\t\t" << found.at(1) << " - " << found.at(0)
+	      << "\n\t4.44 MeV escape:\t" << found.at(3) << " - "
+	      << found.at(2)
+	      << "\n\t2.2 MeV:\t\t" << found.at(5) << " - " << found.at(4)
+	      << "\n";
+    return true;
+}
+
 // Creates a calibrated histogram and PSD plot with 60 second timecut windows
 // to accound for gain drifting
 void process::time_cut(std::vector<int>& peak_bounds)
 {
+    // 0 is the uncut (calibration) pass, 1 the clean pass
+    int this_pass = (pileup_cut == 0) ? 0 : 1;
+    if (pass > this_pass) {
+	std::cout << "\n\nPass " << this_pass << " restored from "
+		  << name_checkpoint << "\n\n";
+	return;
+    }
+
+    // An uncut pass over the same input with the same settings is reused
+    if (this_pass == 0 && result_cache.enabled()) {
+	make_dirty_key(peak_bounds);
+	if (load_dirty()) {
+	    live.publish();
+	    pass = 1;
+	    if (checkpoint_every >= 0)
+		write_checkpoint(0, 0);
+	    return;
+	}
+    }
+
     std::cout << "\n\nProcessing time cuts and calibrating.\n\n";
 
-    // Define histogram parameters
-    const int num_xbin = 1024;
-    const int adc_min = 0;
-    const int adc_max = 35000;
+    // first and last timestamps
+    ULong64_t time_initial = time_stamp_at(0);
+    ULong64_t time_last = time_stamp_at(num_entries-1);
+
+    // Die-away histograms and ROI rates are filled with the uncut
+    // (calibration) pass
+    if (pileup_cut == 0) {
+	die_away.initialize(dieaway_range, time_initial);
+	rates.initialize(time_initial);
+	intervals.initialize();
+    }
+    live.set_pass(this_pass, time_initial, time_last);
+
+    // Entries are decoded on a reader thread (optionally recomputing the
+    // integrals from the raw waveforms), calibrated here once their time
+    // window is complete and histogrammed on a filler thread
+    size_tree_cache();
+    event_reader reader(tree, binary, budget_batch_capacity());
+    if (!waveform_branch.empty()) {
+	reader.set_waveforms(waveform_branch, gates, channel_num);
+	if (h_wave_pileup == 0) {
+	    h_wave_pileup = new TH1D("Waveform_Pileup"
+				     ,"Waveform pileup;Energy [MeV];Counts"
+				     ,1024,0,10);
+	}
+    }
     
+    ULong64_t time_start = time_initial; // start of the first time cut
+    ULong64_t entry_start {0};
+
+    // Continue an interrupted pass from its checkpoint
+    if (resume_entry > 0) {
+	entry_start = resume_entry;
+	time_start = resume_time;
+	resume_entry = 0;
+	std::cout << "Resuming from entry " << entry_start << "\n";
+    }
+
+    filler_stage filler([this](calibrated_batch& b) { fill_events(b); },
+			reader.batch_capacity());
+    time_start = window_loop(reader, filler, entry_start, num_entries,
+			     time_start, true,
+			     [&](TH1D* h_temp, window_events& events,
+				 double window_sec) {
+				 calibrate_window(h_temp, peak_bounds, events,
+						  filler, window_sec);
+			     });
+    filler.finish();
+    live.publish();
+    if (pileup_cut == 0) {
+	rates.flush(time_start);
+	intervals.finish();
+    }
+
+    kept_memory.resize((kept_energy.capacity() + kept_ratio.capacity())
+		       *sizeof(double));
+    account_histograms();
+
+    pass = this_pass + 1;
+    if (checkpoint_every >= 0)
+	write_checkpoint(0, 0);
+    if (this_pass == 0)
+	store_dirty();
+};
+
+// The event loop of every pass, in 60 s calibration windows
+//
+// Reads entries [first, last), the first of them in the window starting
+// at time_start. The events of the channel (and of die-away references in
+// the uncut pass) wait in window_events until their window is complete.
+// window_fn then gets the window's uncalibrated spectrum, its events and
+// its start in seconds, and hands every batch on to the filler (push or
+// recycle). Windows are always the full 60 s.
+//
+// A pass over the whole run (whole_run) reports its progress and writes
+// checkpoints; its last window never sees an event past its end, so (as
+// always) it is not calibrated. Otherwise [first, last) is one sampled
+// window, passed on at the end. Returns the start of the last window.
+ULong64_t process::window_loop(event_reader& reader, filler_stage& filler,
+			       ULong64_t first, ULong64_t last,
+			       ULong64_t time_start, bool whole_run,
+			       window_function window_fn)
+{
     // This histogram temporarily stores uncalibrated data from each timecut
     TH1D* h_temp = new TH1D("temp","Spectrum;Energy [ADC];Counts"
-			    ,num_xbin,adc_min,adc_max);
+			    ,1024,0,35000);
 
-    // Set a 60 second time window
-    const int time_sec {60};
-    ULong64_t time_window = time_sec/4.0e-9;
-    
-    // first timestamp
-    tree->GetEntry(0);
-    ULong64_t time_initial = tree->GetLeaf("TimeStamp")->GetValue(0);
-    
-    // last timestamp
-    tree->GetEntry(num_entries-1);
-    ULong64_t time_last = tree->GetLeaf("TimeStamp")->GetValue(0);
-
-    // Initialize variables for the while loop
-    ULong64_t time_stamp {0};
-    int channel {0};
-    double energy {0};
-    double tail {0};
-    double E_calibrated {0};
-
-    tree->SetBranchAddress("TimeStamp", &time_stamp);
-    tree->SetBranchAddress("ChannelID", &channel);
-    tree->SetBranchAddress("PSDTotalIntegral", &energy);
-    tree->SetBranchAddress("PSDTailIntegral", &tail);
-    
-    ULong64_t time_start = time_initial; // start of time cut (increments in while-loop)
-    ULong64_t time_end = time_start + time_window; // end of time cut (also increments
-    ULong64_t entry_start {0};                    //                  in the loop)
-    ULong64_t last_entry {0};
-    
-    while (time_start < time_last) {
+    ULong64_t time_initial = time_stamp_at(0);
+    ULong64_t time_last = time_stamp_at(num_entries-1);
+    ULong64_t time_end = time_start + window_ticks;
+    int num_windows {0};
+    int num_spilled {0}; // windows larger than the pool
 
-	std::cout << static_cast<double>(time_start) / double(time_last)*100
-		  << "% Complete\n";
-	
-	// Fill a temporary histogram for the time cut calibration
-	for (ULong64_t entry=entry_start; entry<num_entries; ++entry) {
-	    tree->GetEntry(entry);
-	   
-	    if (time_stamp > time_end) {
-		last_entry = entry;
-		break;
-	    }
-	   	   
-	    if (channel == channel_num) {
-		h_temp->Fill(energy);
-	    }
+    // Events of the current window wait here until it is calibrated
+    window_events window(filler);
+
+    calibrated_batch* current = filler.get_free();
+    {
+	reader_stage events(reader, first, last);
+	PERF_REGION("window_loop");
+
+	if (whole_run) {
+	    std::cout << static_cast<double>(time_start) / double(time_last)
+		*100 << "% Complete\n";
 	}
 
-	// Fit peaks
-	// 4.44 Photo peak
-	int u_bound_0 = peak_bounds.at(0);
-	int l_bound_0 = peak_bounds.at(1);
-	int bin_0 {0};
-	double peak_0 {0};
-
-	h_temp->GetXaxis()->SetRangeUser(l_bound_0,u_bound_0);
-	bin_0 = h_temp->GetMaximumBin();
-	h_temp->GetXaxis()->SetRange(bin_0-5,bin_0+5);
-	peak_0 = h_temp->GetMean();
-
-	// Fit 4.44 Single Escape Peak
-	int u_bound_1 = peak_bounds.at(2);
-	int l_bound_1 = peak_bounds.at(3);
-	int bin_1 {0};
-	double peak_1 {0};
-    
-	h_temp->GetXaxis()->SetRangeUser(l_bound_1,u_bound_1);
-	bin_1 = h_temp->GetMaximumBin();
-	h_temp->GetXaxis()->SetRange(bin_1-5,bin_1+5);
-	peak_1 = h_temp->GetMean();
-
-	// Fit 2.2 MeV Photo Peak
-	int u_bound_2 = peak_bounds.at(4);
-	int l_bound_2 = peak_bounds.at(5);
-	int bin_2 {0};
-	double peak_2 {0};
-    
-	h_temp->GetXaxis()->SetRangeUser(l_bound_2,u_bound_2);
-	bin_2 = h_temp->GetMaximumBin();
-	h_temp->GetXaxis()->SetRange(bin_2-5,bin_2+5);
-	peak_2 = h_temp->GetMean();
-	
+	event_batch* batch;
+	while ((batch = events.next()) != 0) {
+	    for (std::size_t i=0; i<batch->size; ++i) {
+		ULong64_t time_stamp = batch->time_stamp[i];
 
+		// A window is complete once an event is past its end
+		while (time_stamp > time_end) {
+		    window.close(current);
+		    if (window.num_spilled() > 0)
+			++num_spilled;
+		    window_fn(h_temp, window,
+			      (time_start - time_initial)*4.0e-9);
+		    current = filler.get_free();
 
-        // Calibrate w/ linear fit
-	TLinearFitter fit1 {TLinearFitter(1,"pol1")};
-	double ax[] = {peak_0,peak_1,peak_2};
-	double ay[] = {4.438,3.927,2.2};
-	fit1.AssignData(3,1,ax,ay);
-	fit1.Eval();
-	double intercept = fit1.GetParameter(0);
-	double slope = fit1.GetParameter(1);
-		
-	// Calibrate 
-	for (ULong64_t entry=entry_start; entry<last_entry; ++entry)
-	{
-	    tree->GetEntry(entry);
-	       	
-	    E_calibrated = slope*energy + intercept;
-      
-	    if (channel == channel_num) {
-		if (pileup_cut == 0) {
-		    h_dirty->Fill(E_calibrated);
-		    h_PSD_dirty->Fill(E_calibrated,tail/energy);
-		}
-		else if (pileup_cut != 0 &&
-		    pileup_cut->IsInside(E_calibrated,tail/energy)) {
-		    h_clean->Fill(E_calibrated);
-		    h_PSD_clean->Fill(E_calibrated,tail/energy);
+		    // Reset temp histogram to reuse
+		    h_temp->Reset();
+
+		    // Increment time boundaries
+		    time_start += window_ticks;
+		    time_end += window_ticks;
+		    if (!whole_run)
+			continue;
+
+		    std::cout << static_cast<double>(time_start)
+			/ double(time_last)*100 << "% Complete\n";
+
+		    // The next window starts with this entry
+		    ++num_windows;
+		    if (checkpoint_every > 0 &&
+			num_windows % checkpoint_every == 0) {
+			filler.drain();
+			if (pileup_cut == 0)
+			    rates.flush(time_start);
+			write_checkpoint(batch->first_entry + i, time_start);
+		    }
 		}
+
+		int channel = batch->channel[i];
+		if (channel != channel_num &&
+		    !(pileup_cut == 0 && die_away.observes(channel)))
+		    continue;
+
+		// Fill a temporary histogram for the time cut calibration
+		if (channel == channel_num)
+		    h_temp->Fill(batch->energy[i]);
+
+		current->add(time_stamp, channel, batch->energy[i],
+			     batch->tail[i]/batch->energy[i],
+			     batch->pileup[i]);
+		if (current->full())
+		    current = window.add(current);
 	    }
+	    events.recycle(batch);
 	}
+    }
 
-	// Reset temp histogram to reuse
-	h_temp->Reset();
+    // The last window of a run never sees an event past its end, so (as
+    // always) it is not calibrated
+    window.close(current);
+    if (window.num_spilled() > 0)
+	++num_spilled;
+    if (whole_run)
+	window.discard();
+    else
+	window_fn(h_temp, window, (time_start - time_initial)*4.0e-9);
 
-	// Increment time boundaries
-	entry_start = last_entry;
-	time_start += time_window;
-	time_end += time_window;
-	// End of while loop
+    if (num_spilled > 0) {
+	std::cout << num_spilled << " windows larger than the "
+		  << filler_stage::max_batches << " batch pool, read back "
+		  << "from a temporary file\n";
     }
 
     delete h_temp;
-};
+    return time_start;
+}
+
+// Finds the calibration peaks in the uncalibrated spectrum of a time window
+// and fits a line through them
+void process::fit_window(TH1D* h_temp, std::vector<int>& peak_bounds,
+			 double& slope, double& intercept)
+{
+    // Fit peaks
+    // 4.44 Photo peak
+    int u_bound_0 = peak_bounds.at(0);
+    int l_bound_0 = peak_bounds.at(1);
+    int bin_0 {0};
+    double peak_0 {0};
+
+    h_temp->GetXaxis()->SetRangeUser(l_bound_0,u_bound_0);
+    bin_0 = h_temp->GetMaximumBin();
+    h_temp->GetXaxis()->SetRange(bin_0-5,bin_0+5);
+    peak_0 = h_temp->GetMean();
+
+    // Fit 4.44 Single Escape Peak
+    int u_bound_1 = peak_bounds.at(2);
+    int l_bound_1 = peak_bounds.at(3);
+    int bin_1 {0};
+    double peak_1 {0};
+
+    h_temp->GetXaxis()->SetRangeUser(l_bound_1,u_bound_1);
+    bin_1 = h_temp->GetMaximumBin();
+    h_temp->GetXaxis()->SetRange(bin_1-5,bin_1+5);
+    peak_1 = h_temp->GetMean();
+
+    // Fit 2.2 MeV Photo Peak
+    int u_bound_2 = peak_bounds.at(4);
+    int l_bound_2 = peak_bounds.at(5);
+    int bin_2 {0};
+    double peak_2 {0};
+
+    h_temp->GetXaxis()->SetRangeUser(l_bound_2,u_bound_2);
+    bin_2 = h_temp->GetMaximumBin();
+    h_temp->GetXaxis()->SetRange(bin_2-5,bin_2+5);
+    peak_2 = h_temp->GetMean();
+
+
+
+    // Calibrate w/ linear fit
+    TLinearFitter fit1 {TLinearFitter(1,"pol1")};
+    double ax[] = {peak_0,peak_1,peak_2};
+    double ay[] = {4.438,3.927,2.2};
+    fit1.AssignData(3,1,ax,ay);
+    fit1.Eval();
+    intercept = fit1.GetParameter(0);
+    slope = fit1.GetParameter(1);
+}
+
+// Calibrates the buffered events of a completed time window and passes
+// them on to the filler
+void process::calibrate_window(TH1D* h_temp, std::vector<int>& peak_bounds,
+			       window_events& events, filler_stage& filler,
+			       double window_sec)
+{
+    double slope {1};
+    double intercept {0};
+    fit_window(h_temp, peak_bounds, slope, intercept);
+
+    // Calibration history (of the uncut pass)
+    live.set_window(window_sec, slope, intercept);
+    if (pileup_cut == 0) {
+	calib_time.push_back(window_sec);
+	calib_slope.push_back(slope);
+	calib_intercept.push_back(intercept);
+    }
+    apply_calibration(events, filler, slope, intercept);
+}
+
+// Calibrates the events of the channel in a window and passes them on to
+// the filler
+void process::apply_calibration(window_events& events, filler_stage& filler,
+				double slope, double intercept)
+{
+    events.take([&](calibrated_batch* batch) {
+	for (std::size_t i=0; i<batch->size; ++i) {
+	    if (batch->channel[i] == channel_num)
+		batch->energy[i] = slope*batch->energy[i] + intercept;
+	}
+	filler.push(batch);
+    });
+}
+
+// Histograms calibrated events (runs on the filler thread)
+void process::fill_events(calibrated_batch& batch)
+{
+    for (std::size_t i=0; i<batch.size; ++i) {
+	double E_calibrated = batch.energy[i];
+	double ratio = batch.ratio[i];
+
+	if (pileup_cut == 0)
+	    die_away.observe(batch.time_stamp[i], batch.channel[i]);
+
+	if (batch.channel[i] != channel_num)
+	    continue;
+
+	if (pileup_cut == 0) {
+	    h_dirty->Fill(E_calibrated);
+	    h_PSD_dirty->Fill(E_calibrated,ratio);
+	    if (keeping_events) {
+		kept_energy.push_back(E_calibrated);
+		kept_ratio.push_back(ratio);
+	    }
+	    if (die_away.enabled())
+		die_away.fill(batch.time_stamp[i], E_calibrated);
+	    if (rates.enabled())
+		rates.fill(batch.time_stamp[i], E_calibrated);
+	    if (intervals.enabled())
+		intervals.fill(batch.time_stamp[i], channel_num, E_calibrated);
+	    if (batch.pileup[i])
+		h_wave_pileup->Fill(E_calibrated);
+	}
+	else if (pileup_cut->IsInside(E_calibrated,ratio)) {
+	    h_clean->Fill(E_calibrated);
+	    h_PSD_clean->Fill(E_calibrated,ratio);
+	}
+    }
+    if (batch.size > 0)
+	live.update(batch.time_stamp[batch.size - 1], batch.size);
+}
 
 // Temporary function to load histograms from another file
 // Useful for debugging or adding functionality
@@ -334,13 +792,120 @@ void process::temp_func()
 }
 
 // Cleans up pileup for a correction later
-void process::psd_cut(std::vector<int>& peak_bounds, double num_stddevs = 2)
+void process::psd_cut(std::vector<int>& peak_bounds, double num_stddevs = 2,
+		      bool pyramid = false)
+{
+    // The cut and the clean pass depend on the uncut pass and the cut
+    // settings only
+    stage_key cut_key = dirty_key;
+    cut_key.add("cut").add(num_stddevs).add(pyramid).add(bootstrap_replicas);
+    TFile* f_cut = result_cache.open("cut", cut_key);
+
+    // A cut restored from a checkpoint (or cached) is reused
+    if (stored_cut != 0) {
+	pileup_cut = stored_cut;
+	stored_cut = 0;
+    }
+    else if (f_cut != 0)
+	pileup_cut = (TCutG*)f_cut->Get("cut")->Clone();
+    else
+	fit_pileup_cut(num_stddevs, pyramid);
+
+    // Now apply the PSD cut
+    std::cout << "\n\nApplying PSD Cut for Pileup Correction.\n\n";
+
+    double fraction
+	,scale_factor;
+    
+    // Fraction of clean events (inside the pileup correction)
+    fraction = clean_fraction(pileup_cut, h_PSD_dirty, h_dirty);
+
+    // Pileup correction factor
+    scale_factor = ( (1 - TMath::Log(fraction)) / fraction);
+    intervals.compare(scale_factor);
+
+    // Uncertainty of the correction factor
+    if (f_cut != 0) {
+	TH1D* stored_bootstrap = (TH1D*)f_cut->Get("Scale_Factor_Bootstrap");
+	TH1D* stored_band = (TH1D*)f_cut->Get("Pileup_Corrected_Rel_Error");
+	TParameter<double>* stored_offset
+	    = (TParameter<double>*)f_cut->Get("Bootstrap_Offset");
+	if (stored_bootstrap != 0 && stored_band != 0) {
+	    h_bootstrap = (TH1D*)stored_bootstrap->Clone();
+	    h_band = (TH1D*)stored_band->Clone();
+	    h_bootstrap->SetDirectory(0);
+	    h_band->SetDirectory(0);
+	}
+	if (stored_offset != 0)
+	    bootstrap_offset = stored_offset->GetVal();
+	f_cut->Close();
+	delete f_cut;
+    }
+    else {
+	if (bootstrap_replicas > 0)
+	    run_bootstrap(num_stddevs, pyramid, scale_factor);
+	TFile* f_result = result_cache.create("cut", cut_key);
+	if (f_result != 0) {
+	    pileup_cut->Write("cut");
+	    if (h_bootstrap != 0) {
+		h_bootstrap->Write();
+		h_band->Write();
+		TParameter<double>("Bootstrap_Offset", bootstrap_offset)
+		    .Write();
+	    }
+	}
+	result_cache.store(f_result);
+    }
+
+    // Create histograms (corrected), unless the clean pass is cached
+    TFile* f_clean = result_cache.open("clean", cut_key);
+    if (f_clean != 0) {
+	h_clean->Add((TH1D*)f_clean->Get("Pileup_Corrected"));
+	h_PSD_clean->Add((TH2D*)f_clean->Get("Clean_PSD"));
+	f_clean->Close();
+	delete f_clean;
+	pass = 2;
+	if (checkpoint_every >= 0)
+	    write_checkpoint(0, 0);
+    }
+    else {
+	time_cut(peak_bounds);
+
+	// Apply correction factor
+	h_clean->Sumw2();
+	h_clean->Scale(scale_factor);
+
+	TFile* f_result = result_cache.create("clean", cut_key);
+	if (f_result != 0) {
+	    h_clean->Write();
+	    h_PSD_clean->Write();
+	}
+	result_cache.store(f_result);
+    }
+    account_histograms();
+}
+
+// Fits the pileup band of the uncut PSD plot and stores it as pileup_cut
+void process::fit_pileup_cut(double num_stddevs, bool pyramid)
+{
+    std::vector<double> x;
+    std::vector<double> band_center;
+    std::vector<double> band_std_dev;
+    fit_psd_band(h_PSD_dirty, pyramid, x, band_center, band_std_dev);
+    pileup_cut = make_cut(x, band_center, band_std_dev, num_stddevs);
+}
+
+// Fits the center and standard deviation of the pileup band in every
+// energy slice of h_psd (the first point is the origin)
+void process::fit_psd_band(TH2D* h_psd, bool pyramid, std::vector<double>& x,
+			   std::vector<double>& band_center,
+			   std::vector<double>& band_std_dev)
 {
     std::cout << "\n\nProcessing Pileup Cut.\n\nProgress:\n\t";
 
-    std::vector<double> y_bottom {0};
-    std::vector<double> y_top {0};
-    std::vector<double> x {0};
+    band_center.assign(1, 0);
+    band_std_dev.assign(1, 0);
+    x.assign(1, 0);
     
     // Initial guess for the gaussian fit
     // Indexes:
@@ -350,69 +915,103 @@ void process::psd_cut(std::vector<int>& peak_bounds, double num_stddevs = 2)
     //        3 --> offset
     double last_par [] {0,0,0.1,0};
 
-    for (int xbin=0; xbin<=h_PSD_dirty->GetNbinsX(); ++xbin) {
-	if (xbin % 100 == 0) {
-	    std::cout << static_cast<double>(xbin)/h_PSD_dirty->GetNbinsX()*100
-		      << "%\n\t";
-	}
+    if (pyramid) {
+	// Coarse-to-fine fits, interpolated where the band is smooth
+	PERF_REGION("psd_cut pyramid");
+	std::lock_guard<std::mutex> lock(fit_mutex);
+	std::vector<double> center;
+	std::vector<double> sigma;
+	fit_psd_pyramid(h_psd, center, sigma);
 
-	/** Uncomment for a coarser fit  
-	if (xbin % 5 != 0) {
-	    continue;
-	}
-	**/
-
-	TH1D* proj_p = h_PSD_dirty->ProjectionY("current_proj", xbin, xbin);
-	TH1D proj = *proj_p;
-
-	// Create gaussian fit
-	TF1* gaus_fit = new TF1("fit","gaus(0)+[3]",0,1);
-
-	// Set peak parameters
-	double peak_bin = proj.GetBinCenter(proj.GetMaximumBin());
-	double height {h_PSD_dirty->GetBinContent(peak_bin)};
-	double std_dev = last_par[2];
-	double offset = last_par[3];
-
-	// Perform fit 
-	double par [] {height,peak_bin,std_dev,offset};
-	gaus_fit->SetParameters(par);
-	proj.Fit(gaus_fit,"Q");
-	gaus_fit->GetParameters(par);
-
-	// Check fit
-	int n_entries = proj.Integral(1,proj.GetNbinsX());
-	if (n_entries < 100) {
-	    par[0] = last_par[0];
-	    par[1] = last_par[1];
-	    par[2] = last_par[2];
-	    par[3] = last_par[3];
+	for (int xbin=0; xbin<=h_psd->GetNbinsX(); ++xbin) {
+	    double std_dev = std::max(sigma.at(xbin), 0.005);
+	    double energy = h_psd->GetXaxis()->GetBinCenter(xbin);
+	    band_center.push_back(center.at(xbin));
+	    band_std_dev.push_back(std_dev);
+	    x.push_back(energy);
 	}
+    }
+    else {
+	PERF_REGION("psd_cut fits");
+	std::lock_guard<std::mutex> lock(fit_mutex);
+
+	for (int xbin=0; xbin<=h_psd->GetNbinsX(); ++xbin) {
+	    if (xbin % 100 == 0) {
+		std::cout << static_cast<double>(xbin)/h_psd->GetNbinsX()*100
+			  << "%\n\t";
+	    }
+
+	    /** Uncomment for a coarser fit  
+	    if (xbin % 5 != 0) {
+		continue;
+	    }
+	    **/
+
+	    TH1D* proj_p = h_psd->ProjectionY("current_proj", xbin, xbin);
+	    TH1D proj = *proj_p;
+
+	    // Set peak parameters
+	    double peak_bin = proj.GetBinCenter(proj.GetMaximumBin());
+	    double height {h_psd->GetBinContent(peak_bin)};
+	    double std_dev = last_par[2];
+	    double offset = last_par[3];
+
+	    // Perform fit (a fresh function, so no step sizes carry over)
+	    double par [] {height,peak_bin,std_dev,offset};
+	    TF1* gaus_fit = new TF1("fit","gaus(0)+[3]",0,1);
+	    gaus_fit->SetParameters(par);
+	    proj.Fit(gaus_fit,"Q");
+	    gaus_fit->GetParameters(par);
+	    delete gaus_fit;
+
+	    // Check fit
+	    int n_entries = proj.Integral(1,proj.GetNbinsX());
+	    if (n_entries < 100) {
+		par[0] = last_par[0];
+		par[1] = last_par[1];
+		par[2] = last_par[2];
+		par[3] = last_par[3];
+	    }
 	
 
-	if (par[2] < 0.005)  
-	    par[2] = 0.005;
+	    if (par[2] < 0.005)  
+		par[2] = 0.005;
 
-	// Collect coordinates for the TCutG points
-	double cut = par[2]*num_stddevs;
-	double energy = h_PSD_dirty->GetXaxis()->GetBinCenter(xbin);
-	y_bottom.push_back(par[1]-cut);
-	y_top.push_back(par[1]+cut);
-	x.push_back(energy);
+	    // Collect coordinates for the TCutG points
+	    double energy = h_psd->GetXaxis()->GetBinCenter(xbin);
+	    band_center.push_back(par[1]);
+	    band_std_dev.push_back(par[2]);
+	    x.push_back(energy);
 
-	// Set default fit parameters for the next run
-	for (int i=0; i<4; ++i) {
-	    last_par[i] = par[i];
-	}
+	    // Set default fit parameters for the next run
+	    for (int i=0; i<4; ++i) {
+		last_par[i] = par[i];
+	    }
 	
-	// Clean up our object
-        delete proj_p;
+	    // Clean up our object
+	    delete proj_p;
+	}
+    }
+}
+
+// Cut num_stddevs standard deviations around the band center, with
+// smoothed edges
+TCutG* process::make_cut(std::vector<double>& x,
+			 std::vector<double>& band_center,
+			 std::vector<double>& band_std_dev, double num_stddevs)
+{
+    std::vector<double> y_bottom;
+    std::vector<double> y_top;
+    for (std::size_t i=0; i<x.size(); ++i) {
+	double cut = band_std_dev.at(i)*num_stddevs;
+	y_bottom.push_back(band_center.at(i)-cut);
+	y_top.push_back(band_center.at(i)+cut);
     }
 
     // Create TCutG
     const int n = 2*x.size()+1;
     std::cout << "Number of points: " << n << "\n\n";
-    pileup_cut = new TCutG("cut",n);
+    TCutG* band_cut = new TCutG("cut",n);
 
     // Apply moving average to top
     std::vector<double> y_top_new {};
@@ -455,41 +1054,488 @@ void process::psd_cut(std::vector<int>& peak_bounds, double num_stddevs = 2)
     // Fill the cut with points
     for (std::size_t i=0; i<x.size(); ++i) {
 	// Start with the top points
-	pileup_cut->SetPoint(i,x.at(i),y_top_new.at(i));
+	band_cut->SetPoint(i,x.at(i),y_top_new.at(i));
     }
     for (std::size_t i=0; i<x.size(); ++i) {
 	// Now get the bottom points
 	// Read from x and y backwards
-	pileup_cut->SetPoint(i+x.size(),x.at(x.size()-1-i)
+	band_cut->SetPoint(i+x.size(),x.at(x.size()-1-i)
 			     ,y_bottom_new.at(x.size()-1-i));
     }
-    pileup_cut->SetPoint(n-1,x.at(0),y_top_new.at(0));
-
-    // Now apply the PSD cut
-    std::cout << "\n\nApplying PSD Cut for Pileup Correction.\n\n";
+    band_cut->SetPoint(n-1,x.at(0),y_top_new.at(0));
+    return band_cut;
+}
 
+// Fraction of the uncut events (h_total) inside cut
+double process::clean_fraction(TCutG* cut, TH2D* h_psd, TH1D* h_total)
+{
     double num_clean
-	,num_total
-	,fraction
-	,scale_factor;
+	,num_total;
     
     // Get number of clean events (inside the pileup correction)
-    num_clean = pileup_cut->IntegralHist(h_PSD_dirty);
+    {
+	PERF_REGION("IntegralHist");
+	num_clean = cut->IntegralHist(h_psd);
+    }
     
     // Get number of total events
-    num_total = h_dirty->Integral(1,h_dirty->GetNbinsX());
+    num_total = h_total->Integral(1,h_total->GetNbinsX());
 
-    fraction = num_clean / num_total;
+    return num_clean / num_total;
+}
 
-    // Pileup correction factor
-    scale_factor = ( (1 - TMath::Log(fraction)) / fraction);
+// Quick look at a run: calibrates and histograms a stratified sample of the
+// time windows, spread across the whole run, until the pileup scale factor
+// is known to the requested relative precision. The histograms are scaled
+// up by the sampled fraction of the run.
+void process::preview(std::vector<int>& peak_bounds, double num_stddevs,
+		      bool pyramid, double precision)
+{
+    std::cout << "\n\nPreview: sampling time windows.\n\n";
+
+    // first and last timestamps
+    ULong64_t time_initial = time_stamp_at(0);
+    ULong64_t time_last = time_stamp_at(num_entries-1);
+
+    // Only complete windows are calibrated (as in the full pass)
+    ULong64_t num_windows {0};
+    if (time_last > time_initial)
+	num_windows = (time_last - time_initial - 1)/window_ticks;
+    if (num_windows == 0) {
+	std::cout << "Run is shorter than one window, processing all of it\n";
+	time_cut(peak_bounds);
+	psd_cut(peak_bounds, num_stddevs, pyramid);
+	return;
+    }
+
+    event_reader reader(tree, binary, budget_batch_capacity());
+    if (!waveform_branch.empty()) {
+	reader.set_waveforms(waveform_branch, gates, channel_num);
+	if (h_wave_pileup == 0) {
+	    h_wave_pileup = new TH1D("Waveform_Pileup"
+				     ,"Waveform pileup;Energy [MeV];Counts"
+				     ,1024,0,10);
+	}
+    }
+
+    // Intervals are only taken within a sampled window
+    intervals.initialize();
+    live.set_pass(0, time_initial, time_last);
+
+    // Windows in an order where every prefix is spread across the run
+    std::vector<ULong64_t> order = stratified_order(num_windows);
+
+    // Entry ranges of the sampled windows, and their calibrations (more
+    // than one per window if it held the whole batch pool)
+    std::vector<ULong64_t> first_entries;
+    std::vector<ULong64_t> last_entries;
+    std::vector<double> window_sec;
+    std::vector<double> slopes;
+    std::vector<double> intercepts;
+
+    double fraction {1};
+    double scale {1};
+    double scale_error {0};
+    std::size_t next_check {2};
+
+    filler_stage filler([this](calibrated_batch& b) { fill_events(b); },
+			reader.batch_capacity());
+    auto calibrate = [&](TH1D* h_temp, window_events& events, double sec) {
+	double slope {1};
+	double intercept {0};
+	fit_window(h_temp, peak_bounds, slope, intercept);
+	live.set_window(sec, slope, intercept);
+	window_sec.push_back(sec);
+	slopes.push_back(slope);
+	intercepts.push_back(intercept);
+	apply_calibration(events, filler, slope, intercept);
+    };
+
+    for (std::size_t k=0; k<order.size(); ++k) {
+	// Entries of window w, as time_cut splits them
+	ULong64_t w = order.at(k);
+	ULong64_t first = (w == 0) ? 0 :
+	    first_entry_after(time_initial + w*window_ticks);
+	ULong64_t last = first_entry_after(time_initial + (w+1)*window_ticks);
+	first_entries.push_back(first);
+	last_entries.push_back(last);
+
+	// Calibrate and fill the window
+	window_loop(reader, filler, first, last,
+		    time_initial + w*window_ticks, false, calibrate);
+	filler.drain();
+	intervals.finish(); // the next window is not adjacent
+
+	// Check the precision each time the sample doubles
+	if (k+1 < next_check && k+1 < order.size())
+	    continue;
+	next_check *= 2;
+
+	fit_pileup_cut(num_stddevs, pyramid);
+	fraction = clean_fraction(pileup_cut, h_PSD_dirty, h_dirty);
+	scale = (1 - TMath::Log(fraction)) / fraction;
+
+	// Binomial error of the clean fraction, propagated to the factor
+	double num_total = h_dirty->Integral(1,h_dirty->GetNbinsX());
+	double fraction_error = TMath::Sqrt(fraction*(1 - fraction)/num_total);
+	scale_error = TMath::Abs(TMath::Log(fraction) - 2)
+	    / (fraction*fraction) * fraction_error;
+
+	std::cout << "\nSampled " << k+1 << " of " << num_windows
+		  << " windows: pileup scale factor " << scale << " +- "
+		  << scale_error << "\n";
+
+	if (scale_error <= precision*scale || k+1 == order.size())
+	    break;
+
+	// Keep sampling uncut events
+	delete pileup_cut;
+	pileup_cut = 0;
+    }
+    intervals.compare(scale);
+
+    // Spread of the calibration over the sampled windows
+    double slope_mean = TMath::Mean(slopes.size(), &slopes[0]);
+    double slope_rms = TMath::RMS(slopes.size(), &slopes[0]);
+    std::cout << "\nCalibration slope " << slope_mean << " +- " << slope_rms
+	      << " MeV/ADC over " << first_entries.size() << " windows\n";
+
+    // Clean pass over the same windows, each part with its calibration
+    std::cout << "\n\nApplying PSD Cut for Pileup Correction.\n\n";
+    live.set_pass(1, time_initial, time_last);
+    auto recalibrate = [&](TH1D*, window_events& events, double sec) {
+	std::size_t nearest {0};
+	for (std::size_t j=1; j<window_sec.size(); ++j) {
+	    if (TMath::Abs(window_sec.at(j) - sec)
+		< TMath::Abs(window_sec.at(nearest) - sec))
+		nearest = j;
+	}
+	apply_calibration(events, filler, slopes.at(nearest),
+			  intercepts.at(nearest));
+    };
+    for (std::size_t k=0; k<first_entries.size(); ++k) {
+	window_loop(reader, filler, first_entries.at(k), last_entries.at(k),
+		    time_initial + order.at(k)*window_ticks, false,
+		    recalibrate);
+    }
+    filler.finish();
 
-    // Create histograms
-    time_cut(peak_bounds);
-    
-    // Apply correction factor
     h_clean->Sumw2();
-    h_clean->Scale(scale_factor);
+    h_clean->Scale(scale);
+
+    // Scale up to the whole run
+    preview_fraction = double(first_entries.size())/double(num_windows);
+    preview_scale = scale;
+    preview_scale_error = scale_error;
+
+    h_dirty->Sumw2();
+    h_PSD_dirty->Sumw2();
+    h_PSD_clean->Sumw2();
+    h_dirty->Scale(1/preview_fraction);
+    h_clean->Scale(1/preview_fraction);
+    h_PSD_dirty->Scale(1/preview_fraction);
+    h_PSD_clean->Scale(1/preview_fraction);
+    if (h_wave_pileup != 0) {
+	h_wave_pileup->Sumw2();
+	h_wave_pileup->Scale(1/preview_fraction);
+    }
+    account_histograms();
+}
+
+// Sweeps the peak bound sets and cut widths in two passes over the events:
+// every bound set is calibrated and its pileup band fitted once, then the
+// clean spectra of all variants are filled together
+void process::sweep(std::vector<std::vector<int>>& bound_sets,
+		    std::vector<std::string>& bound_names,
+		    std::vector<double>& stddev_list, bool pyramid)
+{
+    std::cout << "\n\nSweeping " << bound_sets.size() << " peak bound sets "
+	      << "and " << stddev_list.size() << " cut widths.\n\n";
+
+    for (std::size_t b=0; b<bound_sets.size(); ++b) {
+	sweep_bounds set;
+	set.name = bound_names.at(b);
+	set.bounds = bound_sets.at(b);
+	set.h_dirty = (TH1D*)h_dirty->Clone();
+	set.h_PSD_dirty = (TH2D*)h_PSD_dirty->Clone();
+	set.h_dirty->SetDirectory(0);
+	set.h_PSD_dirty->SetDirectory(0);
+	sweep_sets.push_back(set);
+    }
+    account_histograms();
+    sweep_pass(false);
+
+    // One band fit per bound set, shared by all cut widths
+    for (std::size_t b=0; b<sweep_sets.size(); ++b) {
+	sweep_bounds& set = sweep_sets.at(b);
+	fit_psd_band(set.h_PSD_dirty, pyramid, set.x, set.band_center,
+		     set.band_std_dev);
+
+	for (auto num_stddevs : stddev_list) {
+	    sweep_variant variant;
+	    variant.bounds_index = b;
+	    variant.num_stddevs = num_stddevs;
+	    variant.cut = make_cut(set.x, set.band_center, set.band_std_dev,
+				   num_stddevs);
+	    variant.h_clean = (TH1D*)h_clean->Clone();
+	    variant.h_PSD_clean = (TH2D*)h_PSD_clean->Clone();
+	    variant.h_clean->SetDirectory(0);
+	    variant.h_PSD_clean->SetDirectory(0);
+
+	    double fraction = clean_fraction(variant.cut, set.h_PSD_dirty,
+					     set.h_dirty);
+	    variant.scale_factor = (1 - TMath::Log(fraction)) / fraction;
+	    variants.push_back(variant);
+	}
+    }
+    account_histograms();
+
+    std::cout << "\n\nApplying PSD Cuts for Pileup Correction.\n\n";
+    sweep_pass(true);
+
+    // Apply correction factors
+    for (auto& variant : variants) {
+	variant.h_clean->Sumw2();
+	variant.h_clean->Scale(variant.scale_factor);
+    }
+    account_histograms();
+}
+
+// One pass over the events, calibrating every time window with each bound
+// set: fills the uncut spectra, or (clean) those of all variants
+void process::sweep_pass(bool clean)
+{
+    size_tree_cache();
+    event_reader reader(tree, binary, budget_batch_capacity());
+    if (!waveform_branch.empty())
+	reader.set_waveforms(waveform_branch, gates, channel_num);
+
+    // The variants are filled here, the filler only holds the batch pool
+    filler_stage filler([](calibrated_batch&) {}, reader.batch_capacity());
+    window_loop(reader, filler, 0, num_entries, time_stamp_at(0), true,
+		[&](TH1D* h_temp, window_events& events, double) {
+		    sweep_window(h_temp, events, filler, clean);
+		});
+    filler.finish();
+}
+
+// Calibrates a completed window with every bound set and fills it
+void process::sweep_window(TH1D* h_temp, window_events& events,
+			   filler_stage& filler, bool clean)
+{
+    std::vector<double> slopes(sweep_sets.size(), 1);
+    std::vector<double> intercepts(sweep_sets.size(), 0);
+    for (std::size_t b=0; b<sweep_sets.size(); ++b)
+	fit_window(h_temp, sweep_sets.at(b).bounds, slopes.at(b),
+		   intercepts.at(b));
+
+    // One pass over the events (they may be read back from a file)
+    events.take([&](calibrated_batch* batch) {
+	for (std::size_t i=0; i<batch->size; ++i) {
+	    if (batch->channel[i] != channel_num)
+		continue;
+	    double ratio = batch->ratio[i];
+	    for (std::size_t b=0; b<sweep_sets.size(); ++b) {
+		sweep_bounds& set = sweep_sets.at(b);
+		double E_calibrated = slopes.at(b)*batch->energy[i]
+		    + intercepts.at(b);
+		if (!clean) {
+		    set.h_dirty->Fill(E_calibrated);
+		    set.h_PSD_dirty->Fill(E_calibrated,ratio);
+		    continue;
+		}
+		for (auto& variant : variants) {
+		    if (variant.bounds_index == b &&
+			variant.cut->IsInside(E_calibrated,ratio)) {
+			variant.h_clean->Fill(E_calibrated);
+			variant.h_PSD_clean->Fill(E_calibrated,ratio);
+		    }
+		}
+	    }
+	}
+	filler.recycle(batch);
+    });
+}
+
+// First entry with a time stamp after time_stamp (entries are time sorted)
+ULong64_t process::first_entry_after(ULong64_t time_stamp)
+{
+    ULong64_t low {0};
+    ULong64_t high {num_entries};
+    while (low < high) {
+	ULong64_t mid = low + (high - low)/2;
+	if (time_stamp_at(mid) > time_stamp)
+	    high = mid;
+	else
+	    low = mid + 1;
+    }
+    return low;
+}
+
+// Time stamp of one entry (reading only that branch)
+ULong64_t process::time_stamp_at(ULong64_t entry)
+{
+    if (binary != 0)
+	return binary->time_stamp(entry);
+    Long64_t local = tree->LoadTree(entry); // entry in the current segment
+    tree->GetBranch("TimeStamp")->GetEntry(local);
+    return tree->GetLeaf("TimeStamp")->GetValue(0);
+}
+
+// Sets the number of bootstrap replicas of the pileup correction (0 for
+// none)
+void process::set_bootstrap(int num_replicas)
+{
+    bootstrap_replicas = num_replicas;
+}
+
+// Estimates the uncertainty of the pileup correction factor by resampling
+// the uncut PSD plot
+void process::run_bootstrap(double num_stddevs, bool pyramid, double scale)
+{
+    PERF_REGION("bootstrap");
+    std::cout << "\n\nBootstrapping the pileup correction ("
+	      << bootstrap_replicas << " replicas).\n\n";
+
+    // Slices with too few entries take the previous band, as in psd_cut
+    bootstrap B(h_PSD_dirty, num_stddevs, pyramid, false);
+    B.run(bootstrap_replicas);
+    std::cout << "Pileup scale factor: " << scale << " +- " << B.rms()
+	      << " (replica mean " << B.mean() << ")\n";
+
+    // The replicas refit the band without Minuit; how far that refit of
+    // the plot itself is from the fitted factor tells whether it stands in
+    // for it
+    bootstrap_offset = B.nominal() - scale;
+    std::cout << "Bootstrap refit of the uncut plot: " << B.nominal()
+	      << " (offset " << bootstrap_offset << ")\n";
+    if (TMath::Abs(bootstrap_offset) > B.rms()) {
+	std::cout << "Warning: the bootstrap refit is further from the "
+		  << "pileup scale factor than the replica RMS\n";
+    }
+
+    delete h_bootstrap;
+    delete h_band;
+    h_bootstrap = B.make_histogram("Scale_Factor_Bootstrap");
+    h_band = B.make_band("Pileup_Corrected_Rel_Error");
+}
+
+// Unfolds the pileup corrected spectrum with the response matrix in
+// response ("<file>[:<histogram>]", "Response" by default); a tolerance of
+// 0 always runs max_iterations
+void process::set_unfolding(std::string& response, int max_iterations,
+			    double tolerance)
+{
+    std::size_t colon = response.rfind(':');
+    if (colon != std::string::npos) {
+	response_file = response.substr(0, colon);
+	response_name = response.substr(colon + 1);
+    }
+    else
+	response_file = response;
+    unfold_iterations = max_iterations;
+    unfold_tolerance = tolerance;
+}
+
+// Unfolds h_clean into the incident spectrum, with a bootstrap band of
+// bootstrap_replicas replicas; the response has the true energy on x and
+// the measured energy (binned as h_clean) on y
+void process::unfold_spectrum()
+{
+    if (response_file.empty())
+	return;
+    PERF_REGION("unfold");
+    std::cout << "\n\nUnfolding with " << response_name << " from "
+	      << response_file << ".\n\n";
+
+    TFile* f_response = TFile::Open(response_file.c_str());
+    TH2D* response = (f_response != 0) ?
+	(TH2D*)f_response->Get(response_name.c_str()) : 0;
+    if (response == 0 || response->GetDimension() != 2) {
+	std::cerr << "Cannot read the response matrix " << response_name
+		  << " from " << response_file << ", not unfolding\n";
+	delete f_response;
+	return;
+    }
+    if (response->GetNbinsY() != h_clean->GetNbinsX()) {
+	std::cerr << "The response has " << response->GetNbinsY()
+		  << " measured bins, the spectrum " << h_clean->GetNbinsX()
+		  << ", not unfolding\n";
+	delete f_response;
+	return;
+    }
+
+    unfold U(response);
+    delete f_response;
+    U.set_convergence(unfold_iterations, unfold_tolerance);
+    unfold_used = U.run(h_clean);
+    if (bootstrap_replicas > 1)
+	U.run_bootstrap(bootstrap_replicas);
+
+    delete h_unfolded;
+    delete h_unfold_band;
+    h_unfolded = U.make_spectrum("Unfolded");
+    h_unfold_band = (bootstrap_replicas > 1) ?
+	U.make_band("Unfolded_Rel_Error") : 0;
+    account_histograms();
+}
+
+// Enables recomputing the PSD integrals from the raw samples in branch
+// gate_list is <baseline samples>,<gate start>,<short gate>,<long gate>
+// (in samples), optionally followed by the pulse polarity (+1 or -1)
+void process::set_waveforms(std::string& branch, std::vector<int>& gate_list)
+{
+    waveform_branch = branch;
+    if (gate_list.size() >= 4) {
+	gates.baseline_samples = gate_list.at(0);
+	gates.gate_start = gate_list.at(1);
+	gates.short_gate = gate_list.at(2);
+	gates.long_gate = gate_list.at(3);
+    }
+    if (gate_list.size() >= 5)
+	gates.polarity = gate_list.at(4);
+}
+
+// Enables the die-away histograms, filled during the calibration pass
+// The reference is a beam period (if > 0), a trigger channel (if >= 0) or
+// the beam off gaps in an RBD file (if given), in that order
+void process::set_dieaway(double period_us, int trigger_channel,
+			  std::string& rbd_file, double range_us)
+{
+    if (period_us > 0)
+	die_away.set_period(period_us);
+    else if (trigger_channel >= 0)
+	die_away.set_trigger(trigger_channel);
+    else if (!rbd_file.empty())
+	die_away.set_rbd(rbd_file, 0.1);
+
+    dieaway_range = range_us;
+}
+
+// Bins the counts in energy ROIs (low, high pairs in MeV) in bin_sec
+// seconds; rbd_file (if not empty) gives the beam current to join them with
+void process::set_rate_monitor(std::vector<double>& rois, double bin_sec,
+			       std::string& rbd_file)
+{
+    for (std::size_t i=0; i+1<rois.size(); i+=2)
+	rates.add_roi(rois.at(i), rois.at(i+1));
+    rates.set_bin(bin_sec);
+    if (rates.enabled() && !rbd_file.empty())
+	rates.set_rbd(rbd_file);
+}
+
+// Tags events with a neighbour closer than tau_ns (0: off)
+void process::set_resolving_time(double tau_ns)
+{
+    intervals.set_resolving_time(tau_ns);
+}
+
+// Publishes the spectra in shared memory while they fill (after
+// initialize)
+bool process::set_live(std::string& name)
+{
+    std::vector<TH1*> published {h_dirty, h_PSD_dirty, h_clean};
+    return live.open(name, published);
 }
 
 // Computes and applies scaling factor to private member histograms
@@ -497,35 +1543,18 @@ void process::psd_cut(std::vector<int>& peak_bounds, double num_stddevs = 2)
 // It assumes a three column, csv input and a sample rate of 50ms
 void process::apply_scaling(std::string& file_name)
 {
-    // Read beam current file 
-    std::ifstream infile;
-    std::string line;
+    PERF_REGION("apply_scaling");
+
+    // Read beam current file
     double integral {0}; // Amperes
-    int counter {1};
-    // The following is the correction for a 50ms sample rate 
-    double sample_rate {0.05};
-    double time {0.00};
+    // The following is the correction for a 50ms sample rate
+    double sample_rate {rbd_sample_rate};
     std::vector<double> charge_measured {0}; // amperes
     std::vector<double> time_measured {0}; // seconds
 
-    infile.open(file_name);
-    
-    while (std::getline(infile, line))
-    {
-	std::stringstream line_stream(line);
-        std::string value;
-	while (std::getline(line_stream, value, ','))
-	{
-	    if (counter % 3 == 0) {
-		integral += (std::stod(value)*sample_rate);
-		charge_measured.push_back(std::stod(value));
-		time_measured.push_back(time);
-		time += sample_rate;
-	    }
-	    ++counter;
-	}
-    }
-    infile.close();
+    read_rbd(file_name, time_measured, charge_measured);
+    for (std::size_t i=1; i<charge_measured.size(); ++i)
+	integral += (charge_measured.at(i)*sample_rate);
 
     // assign value to private member variable 
     scale_factor = 1/integral;
@@ -540,6 +1569,10 @@ void process::apply_scaling(std::string& file_name)
     h_clean->Scale(scale_factor);
     h_PSD_dirty->Scale(scale_factor);
     h_PSD_clean->Scale(scale_factor);
+    if (h_unfolded != 0) {
+	h_unfolded->Scale(scale_factor);
+	h_unfolded->GetYaxis()->SetTitle("Counts/C");
+    }
 
     // Re-label y-axis
     h_dirty->GetYaxis()->SetTitle("Counts/C");
@@ -553,4 +1586,349 @@ void process::apply_scaling(std::string& file_name)
 			      &(charge_measured[0]));
     charge_graph->GetXaxis()->SetTitle("Time [s]");
     charge_graph->GetYaxis()->SetTitle("Charge [A]");
+    account_histograms();
+}
+
+// Keeps the calibrated energy and tail/total of every event of the channel
+// seen by the uncut pass (for the Python module)
+void process::keep_events(bool keep)
+{
+    keeping_events = keep;
+}
+
+// Output histogram by name (0 if unknown or not created yet)
+TH1* process::histogram(const std::string& name) const
+{
+    if (name == "Calibrated")
+	return h_dirty;
+    if (name == "Pileup_Corrected")
+	return h_clean;
+    if (name == "Calibrated_PSD")
+	return h_PSD_dirty;
+    if (name == "Clean_PSD")
+	return h_PSD_clean;
+    if (name == "Unfolded")
+	return h_unfolded;
+    return 0;
+}
+
+// Charges the histograms of the run (and of the sweep variants) to the
+// memory budget
+void process::account_histograms()
+{
+    std::size_t bytes = histogram_bytes(h_dirty) + histogram_bytes(h_clean)
+	+ histogram_bytes(h_PSD_dirty) + histogram_bytes(h_PSD_clean)
+	+ histogram_bytes(h_wave_pileup) + histogram_bytes(h_bootstrap)
+	+ histogram_bytes(h_band) + histogram_bytes(h_unfolded)
+	+ histogram_bytes(h_unfold_band);
+    for (auto& set : sweep_sets)
+	bytes += histogram_bytes(set.h_dirty)
+	    + histogram_bytes(set.h_PSD_dirty);
+    for (auto& variant : variants)
+	bytes += histogram_bytes(variant.h_clean)
+	    + histogram_bytes(variant.h_PSD_clean);
+    histogram_memory.resize(bytes);
+}
+
+// Read-ahead cache of the input tree: 32 MB, at most 1/16 of the memory
+// budget. Under pressure it is cut to a quarter (down to 1 MB) before the
+// next pass reads the tree.
+void process::size_tree_cache()
+{
+    if (tree == 0)
+	return;
+    const std::size_t mb {1048576};
+    std::size_t bytes = cache_memory.size();
+    if (bytes == 0) {
+	bytes = 32*mb;
+	if (memory().limit() > 0) {
+	    bytes = std::min(bytes, memory().limit()/16);
+	    bytes = std::max(mb, std::min(bytes, memory().headroom()));
+	}
+    }
+    else if (memory().pressure() && bytes > mb) {
+	bytes = std::max(mb, bytes/4);
+	memory().degraded("smaller tree cache");
+    }
+    else
+	return;
+    tree->SetCacheSize(bytes);
+    cache_memory.resize(bytes);
+}
+
+// Adds a file segment of the same run (after the ones already given)
+void process::add_segment(std::string& name_input)
+{
+    segment_names.push_back(name_input);
+}
+
+// Writes a checkpoint every num_windows time windows, and after each pass
+// (0 only after each pass)
+void process::set_checkpoint(int num_windows)
+{
+    checkpoint_every = num_windows;
+}
+
+// Stores stage results in dir and reuses them in later runs
+// Checkpoints are not cached: a resumed or appended run always runs.
+void process::set_cache(std::string& dir)
+{
+    result_cache.set_dir(dir);
+}
+
+// Key of the uncut pass: the input segments and every setting its
+// histograms depend on (the version changes with what they are)
+void process::make_dirty_key(std::vector<int>& peak_bounds)
+{
+    dirty_key = stage_key();
+    dirty_key.add("charon_onaxis dirty 1");
+    for (auto& name : segment_names) {
+	if (!dirty_key.add_file(name))
+	    std::cerr << "Cannot fingerprint " << name << "\n";
+    }
+    dirty_key.add(channel_num).add(peak_bounds).add(waveform_branch)
+	.add(gates.baseline_samples).add(gates.gate_start)
+	.add(gates.short_gate).add(gates.long_gate).add(gates.polarity)
+	.add(gates.pileup_low).add(gates.pileup_high).add(dieaway_range);
+    die_away.fingerprint(dirty_key);
+    rates.fingerprint(dirty_key);
+    intervals.fingerprint(dirty_key);
+}
+
+// Fills the uncut histograms from a cached pass, false if there is none
+bool process::load_dirty()
+{
+    if (keeping_events)
+	return false; // events are not stored
+    TFile* f_result = result_cache.open("dirty", dirty_key);
+    if (f_result == 0)
+	return false;
+
+    h_dirty->Add((TH1D*)f_result->Get("Calibrated"));
+    h_PSD_dirty->Add((TH2D*)f_result->Get("Calibrated_PSD"));
+    TH1D* wave_pileup = (TH1D*)f_result->Get("Waveform_Pileup");
+    if (wave_pileup != 0) {
+	delete h_wave_pileup;
+	h_wave_pileup = (TH1D*)wave_pileup->Clone();
+	h_wave_pileup->SetDirectory(0);
+    }
+    die_away.restore(f_result);
+    rates.restore(f_result);
+    intervals.restore(f_result);
+
+    TGraph* slope_graph = (TGraph*)f_result->Get("Calibration_Slope");
+    TGraph* intercept_graph = (TGraph*)f_result->Get("Calibration_Intercept");
+    if (slope_graph != 0 && intercept_graph != 0) {
+	for (int i=0; i<slope_graph->GetN(); ++i) {
+	    calib_time.push_back(slope_graph->GetX()[i]);
+	    calib_slope.push_back(slope_graph->GetY()[i]);
+	    calib_intercept.push_back(intercept_graph->GetY()[i]);
+	}
+    }
+
+    f_result->Close();
+    delete f_result;
+    account_histograms();
+    return true;
+}
+
+void process::store_dirty()
+{
+    TFile* f_result = result_cache.create("dirty", dirty_key);
+    if (f_result == 0)
+	return;
+
+    h_dirty->Write();
+    h_PSD_dirty->Write();
+    if (h_wave_pileup != 0)
+	h_wave_pileup->Write();
+    die_away.write();
+    rates.write();
+    intervals.write();
+    if (!calib_time.empty()) {
+	TGraph slope_graph(calib_time.size(), &calib_time[0], &calib_slope[0]);
+	TGraph intercept_graph(calib_time.size(), &calib_time[0],
+			       &calib_intercept[0]);
+	slope_graph.Write("Calibration_Slope");
+	intercept_graph.Write("Calibration_Intercept");
+    }
+    result_cache.store(f_result);
+}
+
+// Saves the processing state so that the run can be resumed or extended
+// next_entry and time_start give the window to continue with (0 if the
+// pass is done). The file is written aside and renamed into place so a
+// kill while writing leaves the last checkpoint intact.
+void process::write_checkpoint(ULong64_t next_entry, ULong64_t time_start)
+{
+    std::string name_temp = name_checkpoint + ".tmp";
+    TFile* f_checkpoint = new TFile(name_temp.c_str(),"RECREATE");
+
+    h_dirty->Write();
+    h_PSD_dirty->Write();
+    h_clean->Write();
+    h_PSD_clean->Write();
+    if (h_wave_pileup != 0)
+	h_wave_pileup->Write();
+    die_away.write();
+    rates.write();
+    intervals.write();
+
+    TCutG* cut = (pileup_cut != 0) ? pileup_cut : stored_cut;
+    if (cut != 0)
+	cut->Write("cut");
+
+    // Calibration of each window of the uncut pass
+    if (!calib_time.empty()) {
+	TGraph slope_graph(calib_time.size(), &calib_time[0], &calib_slope[0]);
+	TGraph intercept_graph(calib_time.size(), &calib_time[0],
+			       &calib_intercept[0]);
+	slope_graph.Write("Calibration_Slope");
+	intercept_graph.Write("Calibration_Intercept");
+    }
+
+    std::string segments;
+    for (auto& name : segment_names)
+	segments += name + "\n";
+    TObjString(segments.c_str()).Write("Segments");
+    TParameter<int>("Earlier_Segments", num_earlier).Write();
+    TParameter<int>("Pass", pass).Write();
+    TParameter<Long64_t>("Next_Entry", next_entry).Write();
+    TParameter<Long64_t>("Window_Start", time_start).Write();
+
+    f_checkpoint->Close();
+    delete f_checkpoint;
+    std::rename(name_temp.c_str(), name_checkpoint.c_str());
+}
+
+// Reads the checkpoint of this output file; segments are set to the
+// ones it lists
+bool process::read_checkpoint(std::vector<std::string>& segments)
+{
+    std::ifstream stream(name_checkpoint.c_str());
+    if (!stream.good()) {
+	std::cerr << "\nNo checkpoint " << name_checkpoint << "\n";
+	return false;
+    }
+
+    TFile* f_checkpoint = new TFile(name_checkpoint.c_str());
+    TParameter<int>* stored_pass
+	= (TParameter<int>*)f_checkpoint->Get("Pass");
+    TParameter<Long64_t>* next_entry
+	= (TParameter<Long64_t>*)f_checkpoint->Get("Next_Entry");
+    TParameter<Long64_t>* window_start
+	= (TParameter<Long64_t>*)f_checkpoint->Get("Window_Start");
+    TObjString* stored_segments = (TObjString*)f_checkpoint->Get("Segments");
+    if (stored_pass == 0 || next_entry == 0 || window_start == 0 ||
+	stored_segments == 0) {
+	std::cerr << "\n" << name_checkpoint << " is not a checkpoint\n";
+	delete f_checkpoint;
+	return false;
+    }
+    pass = stored_pass->GetVal();
+    resume_entry = next_entry->GetVal();
+    resume_time = window_start->GetVal();
+    TParameter<int>* earlier
+	= (TParameter<int>*)f_checkpoint->Get("Earlier_Segments");
+    num_earlier = (earlier != 0) ? earlier->GetVal() : 0;
+
+    segments.clear();
+    std::stringstream segment_stream(stored_segments->GetString().Data());
+    std::string name;
+    while (std::getline(segment_stream, name)) {
+	if (!name.empty())
+	    segments.push_back(name);
+    }
+
+    // Continue filling the stored histograms
+    h_dirty->Add((TH1D*)f_checkpoint->Get("Calibrated"));
+    h_PSD_dirty->Add((TH2D*)f_checkpoint->Get("Calibrated_PSD"));
+    h_clean->Add((TH1D*)f_checkpoint->Get("Pileup_Corrected"));
+    h_PSD_clean->Add((TH2D*)f_checkpoint->Get("Clean_PSD"));
+    TH1D* wave_pileup = (TH1D*)f_checkpoint->Get("Waveform_Pileup");
+    if (wave_pileup != 0) {
+	h_wave_pileup = (TH1D*)wave_pileup->Clone();
+	h_wave_pileup->SetDirectory(0);
+    }
+    die_away.restore(f_checkpoint);
+    rates.restore(f_checkpoint);
+    intervals.restore(f_checkpoint);
+
+    TCutG* cut = (TCutG*)f_checkpoint->Get("cut");
+    if (cut != 0)
+	stored_cut = (TCutG*)cut->Clone();
+
+    TGraph* slope_graph = (TGraph*)f_checkpoint->Get("Calibration_Slope");
+    TGraph* intercept_graph
+	= (TGraph*)f_checkpoint->Get("Calibration_Intercept");
+    if (slope_graph != 0 && intercept_graph != 0) {
+	for (int i=0; i<slope_graph->GetN(); ++i) {
+	    calib_time.push_back(slope_graph->GetX()[i]);
+	    calib_slope.push_back(slope_graph->GetY()[i]);
+	    calib_intercept.push_back(intercept_graph->GetY()[i]);
+	}
+    }
+
+    f_checkpoint->Close();
+    delete f_checkpoint;
+    return true;
+}
+
+// Continues an interrupted run from its last checkpoint
+// The input segments must be the ones the checkpoint was written for (the
+// new ones only, if it was appending)
+bool process::resume_checkpoint()
+{
+    std::vector<std::string> segments;
+    if (!read_checkpoint(segments))
+	return false;
+    if (num_earlier > segments.size() ||
+	!std::equal(segments.begin() + num_earlier, segments.end(),
+		    segment_names.begin(), segment_names.end())) {
+	std::cerr << "\nThe input files differ from the ones in "
+		  << name_checkpoint << "\n";
+	return false;
+    }
+    segment_names = segments;
+
+    if (checkpoint_every < 0)
+	checkpoint_every = 0;
+    std::cout << "\nResuming pass " << pass << " from " << name_checkpoint
+	      << "\n";
+    return true;
+}
+
+// Adds new segments to a finished run: they are calibrated and filled on
+// top of the stored histograms, with the stored pileup cut
+bool process::append_checkpoint()
+{
+    std::vector<std::string> segments;
+    if (!read_checkpoint(segments))
+	return false;
+    if (pass < 2 || stored_cut == 0) {
+	std::cerr << "\nThe run in " << name_checkpoint
+		  << " is not finished, resume it first\n";
+	return false;
+    }
+    for (auto& name : segment_names) {
+	if (std::find(segments.begin(), segments.end(), name)
+	    != segments.end()) {
+	    std::cerr << "\n" << name << " was already processed\n";
+	    return false;
+	}
+    }
+
+    // Process the new segments from the start; they are listed after the
+    // earlier ones in the next checkpoint
+    pass = 0;
+    resume_entry = 0;
+    resume_time = 0;
+    num_earlier = segments.size();
+    segment_names.insert(segment_names.begin(), segments.begin(),
+			 segments.end());
+    if (checkpoint_every < 0)
+	checkpoint_every = 0;
+    std::cout << "\nAppending to the " << segments.size()
+	      << " segments in " << name_checkpoint << "\n";
+    return true;
 }
@@ -7,8 +7,42 @@
 #include "TH2D.h"
 #include "TGraph.h"
 #include "TTree.h"
+#include "dieaway.h"
+#include "interval_tagger.h"
+#include "list_mode.h"
+#include "live_histograms.h"
+#include "memory_budget.h"
+#include "pipeline.h"
+#include "rate_monitor.h"
+#include "stage_cache.h"
+#include "waveform.h"
+#include <functional>
 #include <vector>
 
+// Peak bound set of a parameter sweep, with its calibrated spectra and
+// pileup band fit
+struct sweep_bounds
+{
+    std::string name; // bound file
+    std::vector<int> bounds;
+    TH1D* h_dirty;
+    TH2D* h_PSD_dirty;
+    std::vector<double> x;
+    std::vector<double> band_center;
+    std::vector<double> band_std_dev;
+};
+
+// Variant (bound set and cut width) of a parameter sweep
+struct sweep_variant
+{
+    std::size_t bounds_index;
+    double num_stddevs;
+    TCutG* cut;
+    double scale_factor; // pileup correction
+    TH1D* h_clean;
+    TH2D* h_PSD_clean;
+};
+
 class process
 {
 public:
@@ -20,12 +54,42 @@ public:
     // Functions
     void initialize();
     bool check_ifile();
-    bool check_ofile_write(bool overwrite_param);
+    bool check_ofile_write(bool overwrite_param, bool interactive = true);
+    bool find_bounds(std::vector<int>& peak_bounds);
     void time_cut(std::vector<int>& peak_bounds);
     void temp_func();
-    void psd_cut(std::vector<int>& peak_bounds, double num_stddevs);
+    void psd_cut(std::vector<int>& peak_bounds, double num_stddevs,
+		 bool pyramid);
+    void preview(std::vector<int>& peak_bounds, double num_stddevs,
+		 bool pyramid, double precision);
+    void sweep(std::vector<std::vector<int>>& bound_sets,
+	       std::vector<std::string>& bound_names,
+	       std::vector<double>& stddev_list, bool pyramid);
+    void set_waveforms(std::string& branch, std::vector<int>& gate_list);
+    void set_dieaway(double period_us, int trigger_channel,
+		     std::string& rbd_file, double range_us);
+    void set_rate_monitor(std::vector<double>& rois, double bin_sec,
+			  std::string& rbd_file);
+    void set_resolving_time(double tau_ns);
+    bool set_live(std::string& name);
+    void add_segment(std::string& name_input);
+    void set_checkpoint(int num_windows);
+    bool resume_checkpoint();
+    bool append_checkpoint();
+    void set_cache(std::string& dir);
+    void set_bootstrap(int num_replicas);
+    void set_unfolding(std::string& response, int max_iterations,
+		       double tolerance);
+    void unfold_spectrum();
     void apply_scaling(std::string& file_name);
     void write_out(bool overwrite_param);
+    void write_sweep(bool overwrite_param);
+
+    // Access for the Python module (python_module.cpp)
+    void keep_events(bool keep);
+    const std::vector<double>& event_energy() const { return kept_energy; }
+    const std::vector<double>& event_ratio() const { return kept_ratio; }
+    TH1* histogram(const std::string& name) const;
     
 private:
     std::string name_in;
@@ -33,6 +97,7 @@ private:
     TFile* f_in;
 
     TTree* tree;
+    list_mode* binary; // list-mode input instead of the tree
     ULong64_t num_entries;
     int channel_num;
     double scale_factor;
@@ -45,10 +110,123 @@ private:
     TH2D* h_PSD_clean;
     TCutG* pileup_cut;
     TGraph* charge_graph;
+
+    // Die-away (time since beam reference) histograms
+    dieaway die_away;
+    double dieaway_range;
+
+    // Count rates in energy ROIs next to the beam current
+    rate_monitor rates;
+
+    // Pileup tagged from the time between events
+    interval_tagger intervals;
+
+    // Histograms published while they fill (off unless set)
+    live_publisher live;
+
+    // Waveform reanalysis (off if the branch is empty)
+    std::string waveform_branch;
+    gate_params gates;
+    TH1D* h_wave_pileup;
+
+    // Calibrated events of the channel from the uncut pass (if kept)
+    bool keeping_events;
+    std::vector<double> kept_energy;
+    std::vector<double> kept_ratio;
+
+    // Bootstrap of the pileup correction
+    int bootstrap_replicas;
+    TH1D* h_bootstrap; // replica scale factors
+    TH1D* h_band;      // relative uncertainty of the corrected spectrum
+    double bootstrap_offset; // of the bootstrap refit from the fit
+    void run_bootstrap(double num_stddevs, bool pyramid, double scale);
+
+    // Unfolding of the pileup corrected spectrum (off if no response)
+    std::string response_file;
+    std::string response_name;
+    int unfold_iterations; // at most
+    double unfold_tolerance;
+    int unfold_used;       // iterations of the result
+    TH1D* h_unfolded;
+    TH1D* h_unfold_band;   // relative uncertainty of the unfolded spectrum
+
+    // The event loop of every pass, in 60 s calibration windows: calls a
+    // window_function with each window's uncalibrated spectrum, its events
+    // and its start [s]
+    typedef std::function<void(TH1D*, window_events&, double)>
+	window_function;
+    static constexpr ULong64_t window_ticks = 60/4.0e-9;
+    ULong64_t window_loop(event_reader& reader, filler_stage& filler,
+			  ULong64_t first, ULong64_t last,
+			  ULong64_t time_start, bool whole_run,
+			  window_function window_fn);
+
+    // Stages of the time_cut event loop
+    void fit_window(TH1D* h_temp, std::vector<int>& peak_bounds,
+		    double& slope, double& intercept);
+    void calibrate_window(TH1D* h_temp, std::vector<int>& peak_bounds,
+			  window_events& events, filler_stage& filler,
+			  double window_sec);
+    void apply_calibration(window_events& events, filler_stage& filler,
+			   double slope, double intercept);
+    void fill_events(calibrated_batch& batch);
+
+    // Pileup cut
+    void fit_pileup_cut(double num_stddevs, bool pyramid);
+    void fit_psd_band(TH2D* h_psd, bool pyramid, std::vector<double>& x,
+		      std::vector<double>& band_center,
+		      std::vector<double>& band_std_dev);
+    TCutG* make_cut(std::vector<double>& x, std::vector<double>& band_center,
+		    std::vector<double>& band_std_dev, double num_stddevs);
+    double clean_fraction(TCutG* cut, TH2D* h_psd, TH1D* h_total);
+
+    // Preview (sampled windows)
+    double preview_fraction; // sampled fraction of the run (0 if no preview)
+    double preview_scale;
+    double preview_scale_error;
+    ULong64_t first_entry_after(ULong64_t time_stamp);
+    ULong64_t time_stamp_at(ULong64_t entry);
+
+    // Input segments and checkpoints
+    std::vector<std::string> segment_names;
+    std::string name_checkpoint;
+    int checkpoint_every; // windows between checkpoints (-1 for none)
+    int pass;             // passes done: 0 none, 1 uncut, 2 clean
+    ULong64_t resume_entry; // window to continue with (0 for the start)
+    ULong64_t resume_time;
+    TCutG* stored_cut;    // cut of a restored run
+    std::size_t num_earlier; // segments filled before (not in the tree)
+    std::vector<double> calib_time; // seconds since the start
+    std::vector<double> calib_slope;
+    std::vector<double> calib_intercept;
+    void write_checkpoint(ULong64_t next_entry, ULong64_t time_start);
+    bool read_checkpoint(std::vector<std::string>& segments);
+
+    // Stage results of earlier runs (off unless a directory is set)
+    stage_cache result_cache;
+    stage_key dirty_key;    // everything the uncut pass depends on
+    void make_dirty_key(std::vector<int>& peak_bounds);
+    bool load_dirty();
+    void store_dirty();
+
+    // Parameter sweep
+    std::vector<sweep_bounds> sweep_sets;
+    std::vector<sweep_variant> variants;
+    void sweep_pass(bool clean);
+    void sweep_window(TH1D* h_temp, window_events& events,
+		      filler_stage& filler, bool clean);
+
+    // Charges to the memory budget
+    memory_charge histogram_memory;
+    memory_charge kept_memory;  // kept events
+    memory_charge cache_memory; // tree cache
+    void account_histograms();
+    void size_tree_cache();
 };
 
 // Non member function 
 char gather_input();
+std::vector<ULong64_t> stratified_order(ULong64_t n);
 
 #endif
 
@@ -0,0 +1,551 @@
+// Python module "charon_onaxis": the on-axis processing from Python, with
+// numpy views of the results instead of an output file to read back
+//
+//     import numpy as np
+//     import charon_onaxis
+//
+//     p = charon_onaxis.process(["seg1.root", "seg2.root"], channel=0)
+//     p.calibrate([u0, l0, u1, l1, u2, l2]) # peak bounds, as in bound files
+//     p.cut(stddevs=2.0, pyramid=False)     # pileup cut and correction
+//     p.scale("rbd.csv")                    # optional
+//     energy = np.asarray(p.energy)          # calibrated events (MeV)
+//     ratio = np.asarray(p.ratio)            # tail/total of the events
+//     clean = np.asarray(p.histogram("Pileup_Corrected"))
+//     p.write(overwrite=True)               # optional ROOT output
+//
+// Arrays are read-only views (buffer protocol) of memory owned by the
+// process object, which they keep alive, so nothing is copied. Histogram
+// views leave out the under/overflow bins and 2D views are indexed
+// [xbin, ybin]; binning() gives the axes. The stages release the GIL.
+// A view is only valid until the next stage, which may refill or move
+// the arrays; copy it (np.array) to keep it. No view is given out while
+// a stage runs.
+//
+// Build with "make python".
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "process.h"
+#include "TH1.h"
+#include <exception>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct py_process
+{
+    PyObject_HEAD
+    process* P;
+    std::vector<int> peak_bounds;
+    int stage;   // 0 opened, 1 calibrated, 2 cut
+    bool scaled;
+    bool busy;   // a stage is running (on another Python thread)
+};
+
+// Read-only, strided view of doubles owned by a py_process
+struct py_view
+{
+    PyObject_HEAD
+    PyObject* owner;
+    double* data;
+    int ndim;
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+};
+
+PyTypeObject process_type = { PyVarObject_HEAD_INIT(NULL, 0) };
+PyTypeObject view_type = { PyVarObject_HEAD_INIT(NULL, 0) };
+
+double empty_data {0}; // buffer of empty views
+
+////////////////////////////////////////////////////////////////////////////////
+// view
+////////////////////////////////////////////////////////////////////////////////
+
+PyObject* make_view(PyObject* owner, double* data, int ndim,
+		    const Py_ssize_t* shape, const Py_ssize_t* strides)
+{
+    py_view* v = PyObject_New(py_view, &view_type);
+    if (v == 0)
+	return 0;
+    Py_INCREF(owner);
+    v->owner = owner;
+    v->data = (data != 0) ? data : &empty_data;
+    v->ndim = ndim;
+    for (int i=0; i<ndim; ++i) {
+	v->shape[i] = shape[i];
+	v->strides[i] = strides[i];
+    }
+    return (PyObject*)v;
+}
+
+void view_dealloc(PyObject* self)
+{
+    Py_XDECREF(((py_view*)self)->owner);
+    PyObject_Del(self);
+}
+
+int view_getbuffer(PyObject* self, Py_buffer* buffer, int flags)
+{
+    py_view* v = (py_view*)self;
+    buffer->obj = 0;
+    if ((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE) {
+	PyErr_SetString(PyExc_BufferError, "view is read-only");
+	return -1;
+    }
+    bool contiguous = (v->ndim == 1 && v->strides[0] == sizeof(double));
+    bool with_strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES);
+    if (!contiguous && !with_strides) {
+	PyErr_SetString(PyExc_BufferError, "view is not contiguous");
+	return -1;
+    }
+
+    Py_ssize_t size {1};
+    for (int i=0; i<v->ndim; ++i)
+	size *= v->shape[i];
+
+    buffer->buf = v->data;
+    buffer->obj = self;
+    Py_INCREF(self);
+    buffer->len = size*sizeof(double);
+    buffer->readonly = 1;
+    buffer->itemsize = sizeof(double);
+    buffer->format = (flags & PyBUF_FORMAT) ? const_cast<char*>("d") : 0;
+    buffer->ndim = v->ndim;
+    buffer->shape = ((flags & PyBUF_ND) == PyBUF_ND) ? v->shape : 0;
+    buffer->strides = with_strides ? v->strides : 0;
+    buffer->suboffsets = 0;
+    buffer->internal = 0;
+    return 0;
+}
+
+PyBufferProcs view_buffer = { view_getbuffer, 0 };
+
+////////////////////////////////////////////////////////////////////////////////
+// process
+////////////////////////////////////////////////////////////////////////////////
+
+// False (with "process is busy") while a stage runs, as the data of the
+// views are then being written
+bool check_idle(py_process* self)
+{
+    if (self->busy) {
+	PyErr_SetString(PyExc_RuntimeError, "process is busy");
+	return false;
+    }
+    return true;
+}
+
+// Runs a stage without the GIL; C++ exceptions become RuntimeError
+template<class F>
+bool run_released(py_process* self, F stage)
+{
+    if (!check_idle(self))
+	return false;
+    self->busy = true;
+    bool ok {true};
+    std::string message;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+	stage();
+    }
+    catch (std::exception& e) {
+	ok = false;
+	message = e.what();
+    }
+    Py_END_ALLOW_THREADS
+    self->busy = false;
+    if (!ok)
+	PyErr_SetString(PyExc_RuntimeError, message.c_str());
+    return ok;
+}
+
+bool check_stage(py_process* self, int stage, const char* message)
+{
+    if (self->P == 0) {
+	PyErr_SetString(PyExc_RuntimeError, "process is not opened");
+	return false;
+    }
+    if (self->stage != stage) {
+	PyErr_SetString(PyExc_RuntimeError, message);
+	return false;
+    }
+    return true;
+}
+
+// Reads a str or a sequence of str
+bool read_names(PyObject* input, std::vector<std::string>& names)
+{
+    if (PyUnicode_Check(input)) {
+	const char* name = PyUnicode_AsUTF8(input);
+	if (name == 0)
+	    return false;
+	names.push_back(name);
+	return true;
+    }
+    PyObject* seq = PySequence_Fast(input, "input must be a str or a "
+				    "sequence of str");
+    if (seq == 0)
+	return false;
+    for (Py_ssize_t i=0; i<PySequence_Fast_GET_SIZE(seq); ++i) {
+	PyObject* item = PySequence_Fast_GET_ITEM(seq, i);
+	const char* name = PyUnicode_Check(item) ? PyUnicode_AsUTF8(item) : 0;
+	if (name == 0) {
+	    Py_DECREF(seq);
+	    PyErr_SetString(PyExc_TypeError, "input must be a str or a "
+			    "sequence of str");
+	    return false;
+	}
+	names.push_back(name);
+    }
+    Py_DECREF(seq);
+    return true;
+}
+
+PyObject* process_new(PyTypeObject* type, PyObject*, PyObject*)
+{
+    py_process* self = (py_process*)type->tp_alloc(type, 0);
+    if (self == 0)
+	return 0;
+    self->P = 0;
+    new (&self->peak_bounds) std::vector<int>();
+    self->stage = 0;
+    self->scaled = false;
+    self->busy = false;
+    return (PyObject*)self;
+}
+
+void process_dealloc(PyObject* obj)
+{
+    py_process* self = (py_process*)obj;
+    delete self->P;
+    self->peak_bounds.~vector();
+    Py_TYPE(obj)->tp_free(obj);
+}
+
+int process_init(PyObject* obj, PyObject* args, PyObject* kwds)
+{
+    py_process* self = (py_process*)obj;
+    static const char* keywords[] = {"input", "output", "channel",
+				     "keep_events", 0};
+    PyObject* input {0};
+    const char* output {"default_output.root"};
+    int channel {0};
+    int keep {1};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|sip",
+				     const_cast<char**>(keywords),
+				     &input, &output, &channel, &keep))
+	return -1;
+    if (self->P != 0) {
+	PyErr_SetString(PyExc_RuntimeError, "process is already opened");
+	return -1;
+    }
+
+    std::vector<std::string> names;
+    if (!read_names(input, names))
+	return -1;
+    if (names.empty()) {
+	PyErr_SetString(PyExc_ValueError, "no input file");
+	return -1;
+    }
+
+    std::string name_output {output};
+    process* P = new process(names.front(), name_output, channel);
+    for (std::size_t i=1; i<names.size(); ++i)
+	P->add_segment(names[i]);
+    if (!P->check_ifile()) {
+	delete P;
+	PyErr_SetString(PyExc_FileNotFoundError, "input file does not exist");
+	return -1;
+    }
+    P->keep_events(keep);
+    self->P = P;
+    return run_released(self, [P]() { P->initialize(); }) ? 0 : -1;
+}
+
+// Bounds found in the first windows, None if the peaks are not found
+PyObject* process_find_bounds(PyObject* obj, PyObject*)
+{
+    py_process* self = (py_process*)obj;
+    if (!check_stage(self, 0, "find_bounds must come before calibrate"))
+	return 0;
+
+    process* P = self->P;
+    std::vector<int> bounds;
+    bool found {false};
+    if (!run_released(self, [P, &bounds, &found]() {
+		found = P->find_bounds(bounds); }))
+	return 0;
+    if (!found)
+	Py_RETURN_NONE;
+    PyObject* list = PyList_New(bounds.size());
+    for (std::size_t i=0; i<bounds.size(); ++i)
+	PyList_SET_ITEM(list, i, PyLong_FromLong(bounds[i]));
+    return list;
+}
+
+PyObject* process_calibrate(PyObject* obj, PyObject* args)
+{
+    py_process* self = (py_process*)obj;
+    PyObject* bounds {0};
+    if (!PyArg_ParseTuple(args, "O", &bounds))
+	return 0;
+    if (!check_stage(self, 0, "calibrate must be the first stage"))
+	return 0;
+
+    PyObject* seq = PySequence_Fast(bounds, "bounds must be a sequence");
+    if (seq == 0)
+	return 0;
+    std::vector<int> peak_bounds;
+    for (Py_ssize_t i=0; i<PySequence_Fast_GET_SIZE(seq); ++i)
+	peak_bounds.push_back(PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i)));
+    Py_DECREF(seq);
+    if (PyErr_Occurred())
+	return 0;
+    if (peak_bounds.size() != 6) {
+	PyErr_SetString(PyExc_ValueError, "bounds must hold 6 values (upper "
+			"and lower bound of each of the 3 peaks)");
+	return 0;
+    }
+
+    self->peak_bounds = peak_bounds;
+    process* P = self->P;
+    std::vector<int>& b = self->peak_bounds;
+    if (!run_released(self, [P, &b]() { P->time_cut(b); }))
+	return 0;
+    self->stage = 1;
+    Py_RETURN_NONE;
+}
+
+PyObject* process_cut(PyObject* obj, PyObject* args, PyObject* kwds)
+{
+    py_process* self = (py_process*)obj;
+    static const char* keywords[] = {"stddevs", "pyramid", "bootstrap", 0};
+    double num_stddevs {2};
+    int pyramid {0};
+    int replicas {200};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|dpi",
+				     const_cast<char**>(keywords),
+				     &num_stddevs, &pyramid, &replicas))
+	return 0;
+    if (!check_stage(self, 1, "cut must follow calibrate"))
+	return 0;
+
+    process* P = self->P;
+    std::vector<int>& b = self->peak_bounds;
+    P->set_bootstrap(replicas);
+    if (!run_released(self, [P, &b, num_stddevs, pyramid]() {
+		P->psd_cut(b, num_stddevs, pyramid); }))
+	return 0;
+    self->stage = 2;
+    Py_RETURN_NONE;
+}
+
+PyObject* process_scale(PyObject* obj, PyObject* args)
+{
+    py_process* self = (py_process*)obj;
+    const char* file_name {0};
+    if (!PyArg_ParseTuple(args, "s", &file_name))
+	return 0;
+    if (!check_stage(self, 2, "scale must follow cut"))
+	return 0;
+    if (self->scaled) {
+	PyErr_SetString(PyExc_RuntimeError, "already scaled");
+	return 0;
+    }
+
+    process* P = self->P;
+    std::string name {file_name};
+    if (!run_released(self, [P, &name]() { P->apply_scaling(name); }))
+	return 0;
+    self->scaled = true;
+    Py_RETURN_NONE;
+}
+
+PyObject* process_write(PyObject* obj, PyObject* args, PyObject* kwds)
+{
+    py_process* self = (py_process*)obj;
+    static const char* keywords[] = {"overwrite", 0};
+    int overwrite {0};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|p",
+				     const_cast<char**>(keywords),
+				     &overwrite))
+	return 0;
+    if (!check_stage(self, 2, "write must follow cut"))
+	return 0;
+    if (!self->P->check_ofile_write(overwrite, false)) {
+	PyErr_SetString(PyExc_FileExistsError, "output file exists "
+			"(overwrite=True replaces it)");
+	return 0;
+    }
+
+    process* P = self->P;
+    if (!run_released(self, [P, overwrite]() { P->write_out(overwrite); }))
+	return 0;
+    Py_RETURN_NONE;
+}
+
+// Energy (0) or tail/total (1) column of the kept events
+PyObject* event_view(PyObject* obj, int column)
+{
+    py_process* self = (py_process*)obj;
+    if (!check_idle(self))
+	return 0;
+    if (self->P == 0 || self->stage < 1) {
+	PyErr_SetString(PyExc_RuntimeError, "events are there after "
+			"calibrate");
+	return 0;
+    }
+    const std::vector<double>& values = (column == 0) ?
+	self->P->event_energy() : self->P->event_ratio();
+    Py_ssize_t shape[1] {Py_ssize_t(values.size())};
+    Py_ssize_t strides[1] {sizeof(double)};
+    return make_view(obj, const_cast<double*>(values.data()), 1, shape,
+		     strides);
+}
+
+PyObject* process_energy(PyObject* obj, void*)
+{
+    return event_view(obj, 0);
+}
+
+PyObject* process_ratio(PyObject* obj, void*)
+{
+    return event_view(obj, 1);
+}
+
+TH1* find_histogram(py_process* self, PyObject* args)
+{
+    const char* name {0};
+    if (!PyArg_ParseTuple(args, "s", &name))
+	return 0;
+    if (!check_idle(self))
+	return 0;
+    if (self->P == 0) {
+	PyErr_SetString(PyExc_RuntimeError, "process is not opened");
+	return 0;
+    }
+    TH1* h = self->P->histogram(name);
+    if (h == 0)
+	PyErr_Format(PyExc_KeyError, "no histogram %s", name);
+    return h;
+}
+
+// Bin contents without under/overflow; TH1D and TH2D keep them in one
+// array, x fastest
+PyObject* process_histogram(PyObject* obj, PyObject* args)
+{
+    py_process* self = (py_process*)obj;
+    TH1* h = find_histogram(self, args);
+    if (h == 0)
+	return 0;
+
+    double* content = dynamic_cast<TArrayD*>(h)->GetArray();
+    Py_ssize_t nx = h->GetNbinsX();
+    if (h->GetDimension() == 1) {
+	Py_ssize_t shape[1] {nx};
+	Py_ssize_t strides[1] {sizeof(double)};
+	return make_view(obj, content + 1, 1, shape, strides);
+    }
+    Py_ssize_t shape[2] {nx, h->GetNbinsY()};
+    Py_ssize_t strides[2] {sizeof(double), Py_ssize_t((nx + 2)*sizeof(double))};
+    return make_view(obj, content + (nx + 2) + 1, 2, shape, strides);
+}
+
+// ((nbins, min, max) of every axis)
+PyObject* process_binning(PyObject* obj, PyObject* args)
+{
+    py_process* self = (py_process*)obj;
+    TH1* h = find_histogram(self, args);
+    if (h == 0)
+	return 0;
+
+    TAxis* x = h->GetXaxis();
+    if (h->GetDimension() == 1)
+	return Py_BuildValue("((idd))", x->GetNbins(), x->GetXmin(),
+			     x->GetXmax());
+    TAxis* y = h->GetYaxis();
+    return Py_BuildValue("((idd)(idd))", x->GetNbins(), x->GetXmin(),
+			 x->GetXmax(), y->GetNbins(), y->GetXmin(),
+			 y->GetXmax());
+}
+
+PyMethodDef process_methods[] = {
+    {"find_bounds", process_find_bounds, METH_NOARGS,
+     "find_bounds(): peak bounds for calibrate from the first time windows, "
+     "or None"},
+    {"calibrate", process_calibrate, METH_VARARGS,
+     "calibrate(bounds): calibrates every time window and fills the uncut "
+     "spectra"},
+    {"cut", (PyCFunction)(void(*)(void))process_cut,
+     METH_VARARGS | METH_KEYWORDS,
+     "cut(stddevs=2.0, pyramid=False, bootstrap=200): fits the pileup cut "
+     "and fills the corrected spectra"},
+    {"scale", process_scale, METH_VARARGS,
+     "scale(rbd_file): scales the spectra by the RBD charge"},
+    {"write", (PyCFunction)(void(*)(void))process_write,
+     METH_VARARGS | METH_KEYWORDS,
+     "write(overwrite=False): writes the ROOT output file"},
+    {"histogram", process_histogram, METH_VARARGS,
+     "histogram(name): view of the bin contents of Calibrated, "
+     "Pileup_Corrected, Calibrated_PSD or Clean_PSD"},
+    {"binning", process_binning, METH_VARARGS,
+     "binning(name): (nbins, min, max) of every axis of a histogram"},
+    {0, 0, 0, 0}
+};
+
+PyGetSetDef process_getset[] = {
+    {const_cast<char*>("energy"), process_energy, 0,
+     const_cast<char*>("Calibrated energy of the events (MeV)"), 0},
+    {const_cast<char*>("ratio"), process_ratio, 0,
+     const_cast<char*>("Tail/total of the events"), 0},
+    {0, 0, 0, 0, 0}
+};
+
+PyModuleDef module_def = {
+    PyModuleDef_HEAD_INIT, "charon_onaxis",
+    "On-axis CHARON processing with numpy views of the results", -1,
+    0, 0, 0, 0, 0
+};
+
+} // namespace
+
+PyMODINIT_FUNC PyInit_charon_onaxis()
+{
+    view_type.tp_name = "charon_onaxis.view";
+    view_type.tp_basicsize = sizeof(py_view);
+    view_type.tp_dealloc = view_dealloc;
+    view_type.tp_as_buffer = &view_buffer;
+    view_type.tp_flags = Py_TPFLAGS_DEFAULT;
+    view_type.tp_doc = "Read-only array view (use numpy.asarray)";
+
+    process_type.tp_name = "charon_onaxis.process";
+    process_type.tp_basicsize = sizeof(py_process);
+    process_type.tp_new = process_new;
+    process_type.tp_init = process_init;
+    process_type.tp_dealloc = process_dealloc;
+    process_type.tp_methods = process_methods;
+    process_type.tp_getset = process_getset;
+    process_type.tp_flags = Py_TPFLAGS_DEFAULT;
+    process_type.tp_doc = "process(input, output='default_output.root', "
+	"channel=0, keep_events=True)";
+
+    if (PyType_Ready(&view_type) < 0 || PyType_Ready(&process_type) < 0)
+	return 0;
+
+    // Several process objects may exist at once, with the same histogram
+    // names
+    TH1::AddDirectory(false);
+
+    PyObject* module = PyModule_Create(&module_def);
+    if (module == 0)
+	return 0;
+    Py_INCREF(&process_type);
+    if (PyModule_AddObject(module, "process", (PyObject*)&process_type) < 0) {
+	Py_DECREF(&process_type);
+	Py_DECREF(module);
+	return 0;
+    }
+    return module;
+}
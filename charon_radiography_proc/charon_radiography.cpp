@@ -0,0 +1,173 @@
+#include "radiography.h"
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <getopt.h>
+
+static void show_usage(std::string name)
+{
+    std::cerr << "Assembles transmission radiographs from the outputs of "
+	      << "charon_onaxis for\nevery position of a scan.\n\n"
+	      << "Usage: " << name << " [OPTION]...\n\n"
+	      << "Options:\n"
+	      << "-m, --manifest <file>\t scan manifest, '<x> <y> <run file> "
+	      <<                            "<open beam file>'\n\t\t\t\t"
+	      <<                            "lines [default: scan.txt]\n"
+	      << "-o, --output <file>  \t ROOT output file name\n\t\t\t\t"
+	      <<                        "[default: radiography_output.root]\n"
+	      << "-e, --windows <list> \t comma separated energy windows "
+	      <<                            "<lo:hi> [MeV]\n\t\t\t\t"
+	      <<                            "[default: 1:3,3.5:5]\n"
+	      << "-s, --spectrum <name>\t spectrum in the output files "
+	      <<                            "[default: Pileup_Corrected]\n"
+	      << "-z, --ztable <file>  \t '<Z> <R>' lines, R = ln(T1)/ln(T2) "
+	      <<                            "of the first\n\t\t\t\ttwo windows "
+	      <<                            "[default: none, no effective Z]\n"
+	      << "-j, --threads <int>  \t threads reading the runs "
+	      <<                            "[default: 0, all cores]\n"
+	      << "-w, --overwrite      \t enables overwriting the output file "
+	      <<                            "[default: off]\n"
+	      << "-h,  --help           \t show this help message\n"
+	      << std::endl;
+};
+
+// Reads comma separated <lo:hi> windows as low, high pairs
+void read_windows(std::string list, std::vector<double>& windows)
+{
+    std::stringstream list_stream(list);
+    std::string value;
+    while (std::getline(list_stream, value, ',')) {
+	std::size_t colon = value.find(':');
+	if (colon == std::string::npos) {
+	    std::cout << "\nWarning! Window " << value
+		      << " is not <lo:hi>, skipping it\n\n";
+	    continue;
+	}
+	windows.push_back(std::stod(value.substr(0, colon)));
+	windows.push_back(std::stod(value.substr(colon + 1)));
+    }
+};
+
+int main(int argc, char **argv)
+{
+    std::cout << "########################################"
+	      << "########################################\n";
+
+    // Set defaults
+    std::string manifest_file {"scan.txt"};
+    std::string name_output {"radiography_output.root"};
+    std::string window_string {"1:3,3.5:5"};
+    std::string spectrum {"Pileup_Corrected"};
+    std::string z_table_file; // default is "empty"
+    int num_threads {0};
+    bool overwrite_param {false};
+
+    static const struct option long_options[] = {
+	{"help", no_argument, 0, 'h'},
+	{"manifest", required_argument, 0, 'm'},
+	{"output", required_argument, 0, 'o'},
+	{"windows", required_argument, 0, 'e'},
+	{"spectrum", required_argument, 0, 's'},
+	{"ztable", required_argument, 0, 'z'},
+	{"threads", required_argument, 0, 'j'},
+	{"overwrite", no_argument, 0, 'w'},
+	{} // deals with unknown parameters
+    };
+
+    std::string option_string {"m:o:e:s:z:j:wh"};
+
+    // Parse input
+    int opt;
+    int option_index {0};
+    opt = getopt_long(argc, argv, option_string.c_str(), long_options,
+		      &option_index);
+    while (opt != -1) {
+	switch (opt)
+	{
+	case 'm':
+	    manifest_file = optarg;
+	    break;
+	case 'o':
+	    name_output = optarg;
+	    break;
+	case 'e':
+	    window_string = optarg;
+	    break;
+	case 's':
+	    spectrum = optarg;
+	    break;
+	case 'z':
+	    z_table_file = optarg;
+	    break;
+	case 'j':
+	    num_threads = std::atoi(optarg);
+	    break;
+	case 'w':
+	    overwrite_param = true;
+	    break;
+	case 'h':
+	    show_usage(argv[0]);
+	    return 1;
+	case '?':
+	    show_usage(argv[0]);
+	    return 1;
+	default:
+	    break;
+	}
+
+	opt = getopt_long(argc, argv, option_string.c_str(), long_options,
+			  &option_index);
+    }
+
+    std::vector<double> windows {};
+    read_windows(window_string, windows);
+    if (windows.empty()) {
+	std::cerr << "\nNo energy windows\n";
+	return 1;
+    }
+
+    // Print out settings for user to see
+    std::cout << "\nManifest:\t\t" << manifest_file << "\n"
+	      << "\nOutput file:\t\t" << name_output << "\n"
+	      << "\nEnergy windows [MeV]:\t" << window_string << "\n"
+	      << "\nSpectrum:\t\t" << spectrum << "\n"
+	      << "\nZ table:\t\t" << z_table_file << "\n"
+	      << "\nThreads:\t\t" << num_threads << "\n"
+	      << "\nOverwrite output:\t" << std::boolalpha << overwrite_param
+	      << "\n"
+	      << std::endl;
+
+    std::cout << "########################################"
+	      << "########################################\n";
+
+    // Ask if the user wants to continue with the default parameters
+    std::cout << "\nWould you like to continue with these parameters? [y/N]\n";
+    char response = gather_input();
+    if (response == 'n' || response == 'N') {
+	std::cerr << "\nExiting.\n";
+	return 1;
+    }
+
+    radiography R(name_output, spectrum);
+    R.set_windows(windows);
+
+    if (!R.read_manifest(manifest_file)) {
+	std::cerr << "\nWarning! No scan positions!\n"
+		  << "Exiting.\n\n";
+	return 1;
+    }
+    if (!z_table_file.empty() && !R.read_z_table(z_table_file))
+	std::cerr << "\nNo effective Z without a Z table\n";
+
+    if (!R.check_ofile_write(overwrite_param)) {
+	std::cerr << "\n\nExiting.\n\n";
+	return 1;
+    }
+
+    R.process(num_threads);
+    R.write_out(overwrite_param);
+
+    return 0;
+};
@@ -0,0 +1,429 @@
+#include "radiography.h"
+#include "TH1.h"
+#include "TROOT.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <thread>
+////////////////////////////////////////////////////////////////////////////////
+// Non member functions
+////////////////////////////////////////////////////////////////////////////////
+char gather_input()
+{
+    // Gets input from user (y,Y,n,N) and returns it as a char
+    char check_val;
+    std::cin >> check_val;
+    while (check_val != 'n' && check_val != 'N' &&
+	   check_val != 'y' && check_val != 'Y') {
+	std::cout << "Sorry, I do not understand that response.\n";
+	std::cin >> check_val;
+    }
+    return check_val;
+}
+
+// Calls work(i) for i in [0, n) on num_threads threads
+static void parallel_for(std::size_t n, int num_threads,
+			 std::function<void(std::size_t)> work)
+{
+    std::atomic<std::size_t> next {0};
+    auto worker = [&]() {
+	std::size_t index;
+	while ((index = next++) < n)
+	    work(index);
+    };
+    std::vector<std::thread> threads;
+    for (int t=0; t<num_threads; ++t)
+	threads.emplace_back(worker);
+    for (auto& thread : threads)
+	thread.join();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Member functions
+////////////////////////////////////////////////////////////////////////////////
+
+// Constructor
+radiography::radiography(std::string& name_output, std::string& spectrum)
+    :
+    name_out {name_output}
+    ,spectrum_name {spectrum}
+{
+};
+
+// Destructor
+radiography::~radiography()
+{
+};
+
+// Reads the scan manifest, one position per line:
+//     <x> <y> <run output file> <open beam output file>
+// Empty lines and lines starting with '#' are skipped
+bool radiography::read_manifest(std::string& file_name)
+{
+    std::ifstream f_stream(file_name.c_str());
+    if (!f_stream) {
+	std::cerr << "Cannot open manifest, " << file_name << "\n";
+	return false;
+    }
+
+    std::string line;
+    int line_number {0};
+    while (std::getline(f_stream, line)) {
+	++line_number;
+	std::size_t first = line.find_first_not_of(" \t");
+	if (first == std::string::npos || line[first] == '#')
+	    continue;
+	std::stringstream line_stream(line);
+	scan_point p;
+	if (!(line_stream >> p.x >> p.y >> p.run >> p.reference)) {
+	    std::cerr << file_name << ":" << line_number
+		      << ": expected <x> <y> <run> <reference>\n";
+	    continue;
+	}
+	points.push_back(p);
+    }
+    std::cout << "\n" << points.size() << " scan positions in "
+	      << file_name << "\n";
+    return !points.empty();
+}
+
+// Reads the effective Z table, one '<Z> <R>' line per element, R being
+// ln(T_low)/ln(T_high) of the first two energy windows
+bool radiography::read_z_table(std::string& file_name)
+{
+    std::ifstream f_stream(file_name.c_str());
+    if (!f_stream) {
+	std::cerr << "Cannot open Z table, " << file_name << "\n";
+	return false;
+    }
+
+    std::vector<std::pair<double, double>> table; // (R, Z)
+    double z, r;
+    while (f_stream >> z >> r)
+	table.push_back(std::make_pair(r, z));
+    std::sort(table.begin(), table.end());
+    z_ratio.clear();
+    z_value.clear();
+    for (auto& entry : table) {
+	z_ratio.push_back(entry.first);
+	z_value.push_back(entry.second);
+    }
+    if (z_ratio.size() < 2) {
+	std::cerr << "The Z table needs at least two entries\n";
+	z_ratio.clear();
+	z_value.clear();
+	return false;
+    }
+    return true;
+}
+
+void radiography::set_windows(std::vector<double>& windows)
+{
+    window_low.clear();
+    window_high.clear();
+    for (std::size_t i=0; i+1<windows.size(); i+=2) {
+	window_low.push_back(windows.at(i));
+	window_high.push_back(windows.at(i+1));
+    }
+}
+
+// Checks if the output file exists and if it should be overwritten
+bool radiography::check_ofile_write(bool overwrite_param)
+{
+    char delete_check {'n'};
+    std::ifstream stream(name_out.c_str());
+
+    if (!stream.good())
+	return true; // No file exists, so it may be "overwritten"
+
+    if (overwrite_param == false) {
+	std::cout << "\nThe file '" << name_out.c_str()
+		  << "' already exists and you have chosen not to "
+		  << "overwrite it.\n";
+	return false;
+    }
+    std::cout << "\n\nOops!\n\t"
+	      << "The output file '" << name_out.c_str()
+	      << "' already exists.\n\t"
+	      << "Would you like to overwrite it? [y/N]\n\n";
+    delete_check = gather_input();
+
+    return (delete_check == 'y' || delete_check == 'Y');
+}
+
+// Integral and error of the spectrum in every window (bins with their
+// center inside); not ok if the file or spectrum cannot be read
+window_sums radiography::read_sums(const std::string& file_name) const
+{
+    window_sums sums {false, std::vector<double>(window_low.size(), 0),
+		      std::vector<double>(window_low.size(), 0)};
+    TFile* f = TFile::Open(file_name.c_str());
+    if (f == 0 || f->IsZombie()) {
+	std::cerr << "Cannot open " << file_name << "\n";
+	delete f;
+	return sums;
+    }
+    TH1* h = (TH1*)f->Get(spectrum_name.c_str());
+    if (h == 0) {
+	std::cerr << "No " << spectrum_name << " in " << file_name << "\n";
+	delete f;
+	return sums;
+    }
+    if (std::string(h->GetYaxis()->GetTitle()) != "Counts/C")
+	std::cerr << "Warning! " << spectrum_name << " in " << file_name
+		  << " is not charge normalized\n";
+
+    for (std::size_t w=0; w<window_low.size(); ++w) {
+	double variance {0};
+	for (int bin=1; bin<=h->GetNbinsX(); ++bin) {
+	    double center = h->GetBinCenter(bin);
+	    if (center < window_low[w] || center >= window_high[w])
+		continue;
+	    sums.counts[w] += h->GetBinContent(bin);
+	    variance += h->GetBinError(bin)*h->GetBinError(bin);
+	}
+	sums.errors[w] = std::sqrt(variance);
+    }
+    sums.ok = true;
+    delete f;
+    return sums;
+}
+
+// Reads every reference once, then every position, on num_threads threads
+// (all cores if 0)
+void radiography::process(int num_threads)
+{
+    if (num_threads <= 0)
+	num_threads = std::max(1u, std::thread::hardware_concurrency());
+    ROOT::EnableThreadSafety();
+    TH1::AddDirectory(false);
+
+    std::vector<std::string> names;
+    for (auto& p : points) {
+	if (references.count(p.reference) == 0) {
+	    references[p.reference] = window_sums();
+	    names.push_back(p.reference);
+	}
+    }
+    std::cout << "\nReading " << names.size() << " open beam runs\n";
+    std::vector<window_sums> sums(names.size());
+    parallel_for(names.size(), num_threads, [&](std::size_t i) {
+	    sums[i] = read_sums(names[i]);
+	});
+    for (std::size_t i=0; i<names.size(); ++i)
+	references[names[i]] = sums[i];
+
+    std::size_t n = points.size();
+    valid.assign(n, false);
+    transmission.assign(n, std::vector<double>(window_low.size(), 0));
+    transmission_error.assign(n, std::vector<double>(window_low.size(), 0));
+    z_valid.assign(n, false);
+    z_eff.assign(n, 0);
+    z_eff_error.assign(n, 0);
+
+    std::cout << "Reading " << n << " scan positions\n";
+    parallel_for(n, num_threads, [this](std::size_t i) {
+	    process_point(i);
+	});
+
+    std::size_t num_valid = std::count(valid.begin(), valid.end(), true);
+    std::cout << num_valid << " of " << n << " positions assembled\n";
+}
+
+// Transmission (and effective Z) of one position
+void radiography::process_point(std::size_t index)
+{
+    const scan_point& p = points[index];
+    const window_sums& open = references.at(p.reference);
+    window_sums run = read_sums(p.run);
+    if (!run.ok || !open.ok)
+	return;
+
+    // Every window needs open beam counts, or the position has none
+    for (std::size_t w=0; w<window_low.size(); ++w) {
+	if (open.counts[w] <= 0)
+	    return;
+    }
+
+    // t = c/c_open, with the absolute error (also right for c = 0)
+    for (std::size_t w=0; w<window_low.size(); ++w) {
+	double c_open = open.counts[w];
+	double t = run.counts[w]/c_open;
+	transmission[index][w] = t;
+	transmission_error[index][w]
+	    = std::sqrt(std::pow(run.errors[w], 2)
+			+ std::pow(t*open.errors[w], 2))/c_open;
+    }
+    valid[index] = true;
+
+    if (!z_ratio.empty() && window_low.size() >= 2)
+	z_valid[index] = effective_z(transmission[index][0],
+				     transmission_error[index][0],
+				     transmission[index][1],
+				     transmission_error[index][1],
+				     z_eff[index], z_eff_error[index]);
+}
+
+// Interpolates Z in the table from R = ln(t_low)/ln(t_high); false (and
+// no Z) without attenuation in both windows or outside the table
+bool radiography::effective_z(double t_low, double e_low, double t_high,
+			      double e_high, double& z, double& z_error) const
+{
+    if (t_low <= 0 || t_low >= 1 || t_high <= 0 || t_high >= 1)
+	return false;
+    double l_low = std::log(t_low);
+    double l_high = std::log(t_high);
+    double r = l_low/l_high;
+    double r_error = std::fabs(r)*std::sqrt(std::pow(e_low/(t_low*l_low), 2)
+					    + std::pow(e_high/(t_high*l_high),
+						       2));
+    if (r < z_ratio.front() || r > z_ratio.back())
+	return false;
+
+    std::size_t k = std::upper_bound(z_ratio.begin(), z_ratio.end(), r)
+	- z_ratio.begin();
+    k = std::min(std::max<std::size_t>(k, 1), z_ratio.size() - 1);
+    double slope = (z_value[k] - z_value[k-1])/(z_ratio[k] - z_ratio[k-1]);
+    z = z_value[k-1] + slope*(r - z_ratio[k-1]);
+    z_error = std::fabs(slope)*r_error;
+    return true;
+}
+
+// Bin edges halfway between the distinct positions
+void radiography::make_axis(std::vector<double> positions,
+			    std::vector<double>& edges) const
+{
+    std::sort(positions.begin(), positions.end());
+    positions.erase(std::unique(positions.begin(), positions.end()),
+		    positions.end());
+    edges.clear();
+    if (positions.size() == 1) {
+	edges.push_back(positions[0] - 0.5);
+	edges.push_back(positions[0] + 0.5);
+	return;
+    }
+    edges.push_back(positions[0] - 0.5*(positions[1] - positions[0]));
+    for (std::size_t i=1; i<positions.size(); ++i)
+	edges.push_back(0.5*(positions[i-1] + positions[i]));
+    std::size_t last = positions.size() - 1;
+    edges.push_back(positions[last]
+		    + 0.5*(positions[last] - positions[last-1]));
+}
+
+TH2D* radiography::make_image(const char* name, const char* title,
+			      const std::vector<double>& values,
+			      const std::vector<char>& mask) const
+{
+    std::vector<double> xs;
+    std::vector<double> ys;
+    for (auto& p : points) {
+	xs.push_back(p.x);
+	ys.push_back(p.y);
+    }
+    std::vector<double> x_edges;
+    std::vector<double> y_edges;
+    make_axis(xs, x_edges);
+    make_axis(ys, y_edges);
+
+    TH2D* h = new TH2D(name, title, x_edges.size() - 1, &x_edges[0],
+		       y_edges.size() - 1, &y_edges[0]);
+    h->SetDirectory(0);
+    for (std::size_t i=0; i<points.size(); ++i) {
+	if (mask[i])
+	    h->SetBinContent(h->FindFixBin(points[i].x, points[i].y),
+			     values[i]);
+    }
+    return h;
+}
+
+// Graph along x (for scans with a single y)
+TGraphErrors* radiography::make_profile(const char* name, const char* title,
+					const std::vector<double>& values,
+					const std::vector<double>& errors,
+					const std::vector<char>& mask) const
+{
+    std::vector<std::size_t> order;
+    for (std::size_t i=0; i<points.size(); ++i) {
+	if (mask[i])
+	    order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(), [this](std::size_t a,
+						 std::size_t b) {
+		  return points[a].x < points[b].x;
+	      });
+
+    TGraphErrors* g = new TGraphErrors(order.size());
+    for (std::size_t k=0; k<order.size(); ++k) {
+	g->SetPoint(k, points[order[k]].x, values[order[k]]);
+	g->SetPointError(k, 0, errors[order[k]]);
+    }
+    g->SetName(name);
+    g->SetTitle(title);
+    return g;
+}
+
+// Writes a transmission image (and its errors) per window, the effective
+// Z image and, for scans along one line, profiles
+void radiography::write_out(bool overwrite_param)
+{
+    std::cout << "\n\nWriting output file.\n\n";
+    TFile* f_output {0};
+    if (overwrite_param == true)
+	f_output = new TFile(name_out.c_str(),"RECREATE");
+    else
+	f_output = new TFile(name_out.c_str(),"NEW");
+
+    bool one_line {true};
+    for (auto& p : points)
+	one_line &= (p.y == points.front().y);
+
+    std::vector<TObject*> objects;
+    for (std::size_t w=0; w<window_low.size(); ++w) {
+	std::vector<double> t(points.size());
+	std::vector<double> e(points.size());
+	for (std::size_t i=0; i<points.size(); ++i) {
+	    t[i] = transmission[i][w];
+	    e[i] = transmission_error[i][w];
+	}
+	std::stringstream name;
+	name << "Transmission_" << w;
+	std::stringstream title;
+	title << "Transmission " << window_low[w] << "-" << window_high[w]
+	      << " MeV;x;y";
+	objects.push_back(make_image(name.str().c_str(),
+				     title.str().c_str(), t, valid));
+	objects.push_back(make_image((name.str() + "_Error").c_str(),
+				     title.str().c_str(), e, valid));
+	if (one_line) {
+	    title.str("");
+	    title << "Transmission " << window_low[w] << "-"
+		  << window_high[w] << " MeV;x;Transmission";
+	    objects.push_back(make_profile((name.str() + "_Profile").c_str(),
+					   title.str().c_str(), t, e, valid));
+	}
+    }
+
+    if (!z_ratio.empty() && window_low.size() >= 2) {
+	objects.push_back(make_image("Z_Effective", "Effective Z;x;y",
+				     z_eff, z_valid));
+	objects.push_back(make_image("Z_Effective_Error",
+				     "Effective Z error;x;y", z_eff_error,
+				     z_valid));
+	if (one_line)
+	    objects.push_back(make_profile("Z_Effective_Profile",
+					   "Effective Z;x;Z", z_eff,
+					   z_eff_error, z_valid));
+    }
+
+    for (auto object : objects) {
+	object->Write();
+	delete object;
+    }
+
+    f_output->Close();
+    delete f_output;
+};
@@ -0,0 +1,88 @@
+#ifndef RADIOGRAPHY_H
+#define RADIOGRAPHY_H
+
+#include "TFile.h"
+#include "TH2D.h"
+#include "TGraphErrors.h"
+#include <map>
+#include <string>
+#include <vector>
+
+// A scan position: its processed run and the open beam run to divide by
+struct scan_point
+{
+    double x;
+    double y;
+    std::string run;
+    std::string reference;
+};
+
+// Window sums of a charge normalized spectrum
+struct window_sums
+{
+    bool ok;
+    std::vector<double> counts;
+    std::vector<double> errors;
+};
+
+// Assembles transmission images from the outputs of charon_onaxis
+//
+// Every position of a scan has a charge normalized spectrum (Counts/C).
+// The transmission in an energy window is its integral over the window
+// divided by that of the open beam (reference) run. With a table of the
+// ratio R = ln(T_low)/ln(T_high) of the first two windows against Z, which
+// does not depend on the thickness to first order, an effective Z is
+// interpolated for every position. Positions are read in parallel; every
+// reference run is read once.
+class radiography
+{
+public:
+    radiography(std::string& name_output, std::string& spectrum);
+    ~radiography();
+
+    bool read_manifest(std::string& file_name);
+    bool read_z_table(std::string& file_name);
+    void set_windows(std::vector<double>& windows); // low, high pairs [MeV]
+    bool check_ofile_write(bool overwrite_param);
+    std::size_t num_points() const { return points.size(); }
+
+    void process(int num_threads);
+    void write_out(bool overwrite_param);
+
+private:
+    std::string name_out;
+    std::string spectrum_name;
+    std::vector<scan_point> points;
+    std::vector<double> window_low;
+    std::vector<double> window_high;
+    std::vector<double> z_ratio; // sorted by ratio
+    std::vector<double> z_value;
+
+    // Per position (and window)
+    std::vector<char> valid; // not vector<bool>, set by several threads
+    std::vector<char> z_valid;
+    std::vector<std::vector<double>> transmission;
+    std::vector<std::vector<double>> transmission_error;
+    std::vector<double> z_eff;
+    std::vector<double> z_eff_error;
+    std::map<std::string, window_sums> references;
+
+    window_sums read_sums(const std::string& file_name) const;
+    void process_point(std::size_t index);
+    bool effective_z(double t_low, double e_low, double t_high,
+		     double e_high, double& z, double& z_error) const;
+    void make_axis(std::vector<double> positions,
+		   std::vector<double>& edges) const;
+    TH2D* make_image(const char* name, const char* title,
+		     const std::vector<double>& values,
+		     const std::vector<char>& mask) const;
+    TGraphErrors* make_profile(const char* name, const char* title,
+			       const std::vector<double>& values,
+			       const std::vector<double>& errors,
+			       const std::vector<char>& mask) const;
+};
+
+// Non member function
+char gather_input();
+
+#endif
@@ -0,0 +1,109 @@
+#include "compare.h"
+#include <iostream>
+#include <string>
+#include <getopt.h>
+
+static void show_usage(std::string name)
+{
+    std::cerr << "Compares a processing output file with a reference "
+	      << "(golden) output and\noptionally checks the processing rate "
+	      << "against a baseline.\nExits with a non-zero status if "
+	      << "anything differs.\n\n"
+	      << "Usage: " << name << " [OPTION]...\n\n"
+	      << "Options:\n"
+	      << "-r, --reference <file> \t reference ROOT file\n"
+	      << "-t, --test <file>    \t ROOT file to check\n"
+	      << "-T, --tolerances <file> text file with '<object> "
+	      <<                            "<relative tolerance>' lines\n"
+	      << "-b, --baseline <file> \t text file with '<tool> "
+	      <<                            "<events/s>' lines\n"
+	      << "-n, --tool <name>    \t tool name in the baseline file\n"
+	      << "-e, --rate <dble>    \t measured events/s\n"
+	      << "-m, --margin <dble>  \t allowed fractional slowdown "
+	      <<                            "[default: 0.2]\n"
+	      << "-h,  --help           \t show this help message\n"
+	      << std::endl;
+};
+
+int main(int argc, char **argv)
+{
+    std::string name_reference;
+    std::string name_test;
+    std::string tolerance_file;
+    std::string baseline_file;
+    std::string tool;
+    double rate {0};
+    double margin {0.2};
+
+    static const struct option long_options[] = {
+	{"help", no_argument, 0, 'h'},
+	{"reference", required_argument, 0, 'r'},
+	{"test", required_argument, 0, 't'},
+	{"tolerances", required_argument, 0, 'T'},
+	{"baseline", required_argument, 0, 'b'},
+	{"tool", required_argument, 0, 'n'},
+	{"rate", required_argument, 0, 'e'},
+	{"margin", required_argument, 0, 'm'},
+	{} // deals with unknown parameters
+    };
+
+    std::string option_string {"r:t:T:b:n:e:m:h"};
+
+    // Parse input
+    int opt;
+    int option_index {0};
+    opt = getopt_long(argc, argv, option_string.c_str(), long_options,
+		      &option_index);
+    while (opt != -1) {
+	switch (opt)
+	{
+	case 'r':
+	    name_reference = optarg;
+	    break;
+	case 't':
+	    name_test = optarg;
+	    break;
+	case 'T':
+	    tolerance_file = optarg;
+	    break;
+	case 'b':
+	    baseline_file = optarg;
+	    break;
+	case 'n':
+	    tool = optarg;
+	    break;
+	case 'e':
+	    rate = std::stod(optarg);
+	    break;
+	case 'm':
+	    margin = std::stod(optarg);
+	    break;
+	case 'h':
+	case '?':
+	    show_usage(argv[0]);
+	    return 1;
+	default:
+	    break;
+	}
+
+	opt = getopt_long(argc, argv, option_string.c_str(), long_options,
+			  &option_index);
+    }
+
+    if (name_reference.empty() || name_test.empty()) {
+	show_usage(argv[0]);
+	return 1;
+    }
+
+    compare C(name_reference, name_test);
+    if (!C.check_files())
+	return 1;
+    if (!tolerance_file.empty())
+	C.read_tolerances(tolerance_file);
+
+    bool ok = C.compare_objects();
+    if (!baseline_file.empty() && !tool.empty())
+	ok = C.check_rate(baseline_file, tool, rate, margin) && ok;
+
+    return ok ? 0 : 1;
+};
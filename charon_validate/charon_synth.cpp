@@ -0,0 +1,152 @@
+#include "TFile.h"
+#include "TRandom3.h"
+#include "TTree.h"
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <getopt.h>
+
+// Generates a fixed, time sorted synthetic WaveformData file for validating
+// the processing tools. The on-axis channel has the 4.438 MeV, single escape
+// and 2.2 MeV lines (inside default_bounds.txt) on a falling continuum with a
+// slow gain drift; the off-axis channel has a gamma and a neutron PSD band.
+// Both have a fraction of pileup events off the PSD band.
+
+static void show_usage(std::string name)
+{
+    std::cerr << "Generates a synthetic, time sorted CHARON data file.\n\n"
+	      << "Usage: " << name << " [OPTION]...\n\n"
+	      << "Options:\n"
+	      << "-o, --output <file>  \t ROOT output file name "
+	      <<                            "[default: synthetic_input.root]\n"
+	      << "-n, --events <int>   \t number of events "
+	      <<                            "[default: 2000000]\n"
+	      << "-d, --duration <s>   \t length of the run "
+	      <<                            "[default: 300]\n"
+	      << "-s, --seed <int>     \t random seed [default: 12345]\n"
+	      << "-h,  --help           \t show this help message\n"
+	      << std::endl;
+};
+
+// Energy of an on-axis event [MeV]
+static double onaxis_energy(TRandom3& rng)
+{
+    double u = rng.Uniform();
+    double E {0};
+    if (u < 0.15)
+	E = 4.438;
+    else if (u < 0.23)
+	E = 3.927;
+    else if (u < 0.30)
+	E = 2.2;
+    else
+	return std::min(rng.Exp(1.5) + 0.1, 9.9);
+    return rng.Gaus(E, 0.02*E);
+}
+
+int main(int argc, char **argv)
+{
+    std::string name_output {"synthetic_input.root"};
+    ULong64_t num_events {2000000};
+    double duration {300};
+    unsigned int seed {12345};
+
+    static const struct option long_options[] = {
+	{"help", no_argument, 0, 'h'},
+	{"output", required_argument, 0, 'o'},
+	{"events", required_argument, 0, 'n'},
+	{"duration", required_argument, 0, 'd'},
+	{"seed", required_argument, 0, 's'},
+	{} // deals with unknown parameters
+    };
+
+    std::string option_string {"o:n:d:s:h"};
+
+    // Parse input
+    int opt;
+    int option_index {0};
+    opt = getopt_long(argc, argv, option_string.c_str(), long_options,
+		      &option_index);
+    while (opt != -1) {
+	switch (opt)
+	{
+	case 'o':
+	    name_output = optarg;
+	    break;
+	case 'n':
+	    num_events = std::stoull(optarg);
+	    break;
+	case 'd':
+	    duration = std::stod(optarg);
+	    break;
+	case 's':
+	    seed = std::stoul(optarg);
+	    break;
+	case 'h':
+	case '?':
+	    show_usage(argv[0]);
+	    return 1;
+	default:
+	    break;
+	}
+
+	opt = getopt_long(argc, argv, option_string.c_str(), long_options,
+			  &option_index);
+    }
+
+    TRandom3 rng(seed);
+
+    TFile* f_output = new TFile(name_output.c_str(), "RECREATE");
+    TTree* tree = new TTree("WaveformData", "Synthetic digitizer data");
+
+    ULong64_t time_stamp {0};
+    int channel {0};
+    double energy {0};
+    double tail {0};
+    tree->Branch("TimeStamp", &time_stamp, "TimeStamp/l");
+    tree->Branch("ChannelID", &channel, "ChannelID/I");
+    tree->Branch("PSDTotalIntegral", &energy, "PSDTotalIntegral/D");
+    tree->Branch("PSDTailIntegral", &tail, "PSDTailIntegral/D");
+
+    // Time stamps are in units of 4 ns
+    const double ticks = duration/4.0e-9;
+    const double mean_gap = ticks/num_events;
+    double t {0};
+
+    const double gain {3600}; // ADC per MeV
+    const double drift {0.01}; // fractional gain drift over the run
+    const double pileup {0.08};
+
+    for (ULong64_t i=0; i<num_events; ++i) {
+	t += rng.Exp(mean_gap);
+	time_stamp = static_cast<ULong64_t>(t);
+	channel = (rng.Uniform() < 0.7) ? 0 : 1;
+
+	double E {0};
+	double ratio {0};
+	if (channel == 0) {
+	    E = onaxis_energy(rng);
+	    ratio = rng.Gaus(0.15, 0.015);
+	}
+	else {
+	    E = std::min(rng.Exp(1.0) + 0.05, 9.9);
+	    bool neutron = rng.Uniform() < 0.3;
+	    ratio = neutron ? rng.Gaus(0.30, 0.02) : rng.Gaus(0.15, 0.015);
+	}
+	if (rng.Uniform() < pileup)
+	    ratio = rng.Uniform(0.35, 0.9);
+
+	double g = gain*(1 + drift*std::sin(2*M_PI*t/ticks));
+	energy = E*g;
+	tail = ratio*energy;
+	tree->Fill();
+    }
+
+    f_output->Write();
+    f_output->Close();
+    delete f_output;
+
+    std::cout << "Wrote " << num_events << " events to " << name_output
+	      << "\n";
+    return 0;
+};
@@ -0,0 +1,265 @@
+#include "compare.h"
+#include "TKey.h"
+#include "TList.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+////////////////////////////////////////////////////////////////////////////////
+// Non member functions
+////////////////////////////////////////////////////////////////////////////////
+double rel_diff(double a, double b)
+{
+    double scale = std::max(std::fabs(a), std::fabs(b));
+    if (scale == 0)
+	return 0;
+    return std::fabs(a - b) / scale;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Member functions
+////////////////////////////////////////////////////////////////////////////////
+
+// Constructor
+compare::compare(std::string& name_reference, std::string& name_test_file)
+    :
+    name_ref {name_reference}
+    ,name_test {name_test_file}
+    ,f_ref {0}
+    ,f_test {0}
+{
+    // Histograms filled straight from the data should match exactly,
+    // anything that went through a fit gets some room
+    tolerance["default"] = 1e-9;
+    tolerance["Pileup_Corrected"] = 1e-6;
+    tolerance["Clean_PSD"] = 1e-6;
+    tolerance["cut"] = 1e-6;
+    tolerance["scale_factor"] = 1e-6;
+};
+
+// Destructor
+compare::~compare()
+{
+    delete f_ref;
+    delete f_test;
+};
+
+// Opens both files
+bool compare::check_files()
+{
+    f_ref = new TFile(name_ref.c_str());
+    f_test = new TFile(name_test.c_str());
+    if (f_ref->IsZombie()) {
+	std::cerr << "Cannot open reference file, " << name_ref << "\n";
+	return false;
+    }
+    if (f_test->IsZombie()) {
+	std::cerr << "Cannot open test file, " << name_test << "\n";
+	return false;
+    }
+    return true;
+}
+
+// Reads "<object name> <relative tolerance>" and "<object name> exclude"
+// lines
+void compare::read_tolerances(std::string& file_name)
+{
+    std::ifstream f_stream(file_name.c_str());
+    if (!f_stream) {
+	std::cerr << "Cannot open tolerance file, " << file_name << "\n";
+	return;
+    }
+
+    std::string line;
+    while (std::getline(f_stream, line)) {
+	if (line.empty() || line.at(0) == '#')
+	    continue;
+	std::stringstream line_stream(line);
+	std::string name;
+	std::string value;
+	if (!(line_stream >> name >> value))
+	    continue;
+	if (value == "exclude")
+	    excluded.insert(name);
+	else
+	    tolerance[name] = std::stod(value);
+    }
+}
+
+double compare::get_tolerance(const std::string& name)
+{
+    auto it = tolerance.find(name);
+    if (it == tolerance.end())
+	return tolerance["default"];
+    return it->second;
+}
+
+// Bin by bin (including under/overflow) comparison of any histogram
+bool compare::compare_hist(TH1* h_ref, TH1* h_test, double tol)
+{
+    if (h_ref->GetNcells() != h_test->GetNcells()) {
+	std::cout << "\t\tdifferent number of bins ("
+		  << h_ref->GetNcells() << " vs "
+		  << h_test->GetNcells() << ")\n";
+	return false;
+    }
+
+    double max_diff {0};
+    int worst_bin {0};
+    for (int bin=0; bin<h_ref->GetNcells(); ++bin) {
+	double diff = rel_diff(h_ref->GetBinContent(bin),
+			       h_test->GetBinContent(bin));
+	if (diff > max_diff) {
+	    max_diff = diff;
+	    worst_bin = bin;
+	}
+    }
+
+    std::cout << "\t\tmax relative difference " << max_diff;
+    if (max_diff > 0)
+	std::cout << " (bin " << worst_bin << ": "
+		  << h_ref->GetBinContent(worst_bin) << " vs "
+		  << h_test->GetBinContent(worst_bin) << ")";
+    std::cout << "\n";
+    return max_diff <= tol;
+}
+
+// Point by point comparison of graphs (and cuts)
+bool compare::compare_graph(TGraph* g_ref, TGraph* g_test, double tol)
+{
+    if (g_ref->GetN() != g_test->GetN()) {
+	std::cout << "\t\tdifferent number of points ("
+		  << g_ref->GetN() << " vs " << g_test->GetN() << ")\n";
+	return false;
+    }
+
+    double max_diff {0};
+    for (int i=0; i<g_ref->GetN(); ++i) {
+	max_diff = std::max(max_diff, rel_diff(g_ref->GetX()[i],
+					       g_test->GetX()[i]));
+	max_diff = std::max(max_diff, rel_diff(g_ref->GetY()[i],
+					       g_test->GetY()[i]));
+    }
+    std::cout << "\t\tmax relative difference " << max_diff << "\n";
+    return max_diff <= tol;
+}
+
+// The pileup scale factor is not stored directly, but Pileup_Corrected is
+// the clean spectrum scaled by it (and Clean_PSD is not)
+bool compare::compare_scale_factor(double tol)
+{
+    TH1* c_ref = (TH1*)f_ref->Get("Pileup_Corrected");
+    TH1* p_ref = (TH1*)f_ref->Get("Clean_PSD");
+    TH1* c_test = (TH1*)f_test->Get("Pileup_Corrected");
+    TH1* p_test = (TH1*)f_test->Get("Clean_PSD");
+    if (c_ref == 0 || p_ref == 0 || c_test == 0 || p_test == 0)
+	return true; // nothing to compare
+
+    double sf_ref = c_ref->Integral() / p_ref->Integral();
+    double sf_test = c_test->Integral() / p_test->Integral();
+    double diff = rel_diff(sf_ref, sf_test);
+
+    std::cout << "\tscale_factor\n\t\t" << sf_ref << " vs " << sf_test
+	      << ", relative difference " << diff << "\n";
+    return diff <= tol;
+}
+
+// Compares every object of the reference file with the test file
+bool compare::compare_objects()
+{
+    std::cout << "\n\nComparing " << name_test << " to reference "
+	      << name_ref << "\n\n";
+
+    bool all_ok {true};
+    TIter next(f_ref->GetListOfKeys());
+    TKey* key;
+    while ((key = (TKey*)next())) {
+	std::string name = key->GetName();
+	if (excluded.count(name) > 0) {
+	    std::cout << "\t" << name << " (excluded)\n";
+	    continue;
+	}
+	TObject* obj_ref = key->ReadObj();
+	TObject* obj_test = f_test->Get(name.c_str());
+	double tol = get_tolerance(name);
+
+	std::cout << "\t" << name << " (" << obj_ref->ClassName()
+		  << ", tolerance " << tol << ")\n";
+
+	bool ok {false};
+	if (obj_test == 0) {
+	    std::cout << "\t\tmissing from the test file\n";
+	}
+	else if (obj_ref->InheritsFrom("TH1") &&
+		 obj_test->InheritsFrom("TH1")) {
+	    ok = compare_hist((TH1*)obj_ref, (TH1*)obj_test, tol);
+	}
+	else if (obj_ref->InheritsFrom("TGraph") &&
+		 obj_test->InheritsFrom("TGraph")) {
+	    ok = compare_graph((TGraph*)obj_ref, (TGraph*)obj_test, tol);
+	}
+	else {
+	    std::cout << "\t\tnot compared\n";
+	    ok = true;
+	}
+
+	if (!ok) {
+	    std::cout << "\t\tFAILED\n";
+	    all_ok = false;
+	}
+    }
+
+    // Output added since the reference was made
+    TIter next_test(f_test->GetListOfKeys());
+    while ((key = (TKey*)next_test())) {
+	std::string name = key->GetName();
+	if (f_ref->GetListOfKeys()->FindObject(name.c_str()) != 0 ||
+	    excluded.count(name) > 0)
+	    continue;
+	std::cout << "\t" << name << "\n\t\tnot in the reference (list it "
+		  << "in the tolerance file)\n\t\tFAILED\n";
+	all_ok = false;
+    }
+
+    if (!compare_scale_factor(get_tolerance("scale_factor"))) {
+	std::cout << "\t\tFAILED\n";
+	all_ok = false;
+    }
+
+    std::cout << "\n" << (all_ok ? "All objects agree" : "Outputs differ")
+	      << "\n";
+    return all_ok;
+}
+
+// Checks the processing rate against a stored baseline
+// The baseline file has "<tool> <events per second>" lines
+bool compare::check_rate(std::string& baseline_file, std::string& tool,
+			 double events_per_sec, double margin)
+{
+    std::ifstream f_stream(baseline_file.c_str());
+    if (!f_stream) {
+	std::cerr << "Cannot open baseline file, " << baseline_file << "\n";
+	return false;
+    }
+
+    std::string name;
+    double baseline {0};
+    while (f_stream >> name >> baseline) {
+	if (name == tool)
+	    break;
+	baseline = 0;
+    }
+    if (baseline <= 0) {
+	std::cerr << "No baseline for " << tool << " in "
+		  << baseline_file << "\n";
+	return false;
+    }
+
+    double limit = baseline*(1 - margin);
+    bool ok = events_per_sec >= limit;
+    std::cout << "\nRate for " << tool << ": " << events_per_sec
+	      << " events/s (baseline " << baseline << ", limit " << limit
+	      << ") " << (ok ? "OK" : "FAILED") << "\n";
+    return ok;
+}
@@ -0,0 +1,49 @@
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include "TFile.h"
+#include "TGraph.h"
+#include "TH1.h"
+#include <map>
+#include <set>
+#include <string>
+
+// Compares the objects of a processing output file with a reference
+// (golden) output. Every object of the reference must be present in the
+// test file and agree within its tolerance. Objects only in the test file
+// fail unless they are excluded, so new output is never left unchecked by
+// accident.
+class compare
+{
+public:
+    // Constructor/destructor
+    compare(std::string& name_reference, std::string& name_test);
+    ~compare();
+
+    // Functions
+    bool check_files();
+    void read_tolerances(std::string& file_name);
+    bool compare_objects();
+    bool check_rate(std::string& baseline_file, std::string& tool,
+		    double events_per_sec, double margin);
+
+private:
+    std::string name_ref;
+    std::string name_test;
+    TFile* f_ref;
+    TFile* f_test;
+
+    // Relative tolerance per object name ("default" for the rest)
+    std::map<std::string, double> tolerance;
+    std::set<std::string> excluded; // not compared
+
+    double get_tolerance(const std::string& name);
+    bool compare_hist(TH1* h_ref, TH1* h_test, double tol);
+    bool compare_graph(TGraph* g_ref, TGraph* g_test, double tol);
+    bool compare_scale_factor(double tol);
+};
+
+// Relative difference that is safe around zero
+double rel_diff(double a, double b);
+
+#endif
@@ -0,0 +1,61 @@
+#!/bin/bash
+# Runs both processing tools on the synthetic input and compares the
+# outputs with the golden references (and the rate with the baseline).
+#
+#   ./run_validation.sh          compare against golden/
+#   ./run_validation.sh golden   (re)create golden/ and the baseline
+#
+# ONAXIS and OFFAXIS choose the tools ("make golden" sets them to a build
+# of the baseline commit).
+#
+# Exits with a non-zero status if anything differs or got too slow.
+
+set -u
+cd "$(dirname "$0")"
+
+MODE=${1:-check}
+INPUT=synthetic_input.root
+EVENTS=2000000
+MARGIN=${MARGIN:-0.2}
+ONAXIS=${ONAXIS:-../charon_onaxis_proc/charon_onaxis}
+OFFAXIS=${OFFAXIS:-../charon_offaxis_proc/charon_offaxis}
+OUT=validation_output
+mkdir -p golden $OUT
+
+if [ ! -f $INPUT ]; then
+    ./charon_synth -o $INPUT -n $EVENTS || exit 1
+fi
+
+# Runs a tool non-interactively, prints its rate in events/s
+run_tool() {
+    local output=$1; shift
+    rm -f $output
+    local start=$(date +%s.%N)
+    yes y | "$@" > $output.log 2>&1
+    local stop=$(date +%s.%N)
+    echo "$EVENTS / ($stop - $start)" | bc -l
+}
+
+status=0
+for tool in onaxis offaxis; do
+    if [ $tool = onaxis ]; then
+	cmd="$ONAXIS -i $INPUT -c 0 -p ../charon_onaxis_proc/default_bounds.txt -o"
+    else
+	cmd="$OFFAXIS --input $INPUT --channel 1 --slope 2.7778e-4 --output"
+    fi
+
+    if [ $MODE = golden ]; then
+	rate=$(run_tool golden/$tool.root $cmd golden/$tool.root)
+	grep -v "^$tool " baseline.txt > baseline.tmp 2>/dev/null
+	echo "$tool $rate" >> baseline.tmp
+	mv baseline.tmp baseline.txt
+	echo "$tool: golden output written, $rate events/s"
+    else
+	rate=$(run_tool $OUT/$tool.root $cmd $OUT/$tool.root)
+	./charon_compare -r golden/$tool.root -t $OUT/$tool.root \
+	    -T tolerances.txt -b baseline.txt -n $tool -e $rate -m $MARGIN \
+	    || status=1
+    fi
+done
+
+exit $status